@@ -17,7 +17,11 @@
  *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  *
  */
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
 #include <alsa/asoundlib.h>
+#include "kernels.h"
 // #include "aconfig.h"
 #ifdef HAVE_SAMPLERATE_H
 #define USE_SAMPLERATE
@@ -34,11 +38,16 @@ enum {
 
 #define MAX_ARGS	128
 #define MAX_MIXERS	64
+#define MAX_MIXSINK_INPUTS	16
+#define MAX_SPLITSRC_OUTPUTS	16
 
-#if 0
-#define FILE_PWRITE "/tmp/alsaloop.praw"
-#define FILE_CWRITE "/tmp/alsaloop.craw"
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE	6
 #endif
+#define MAX_ROUTE_CHANNELS	KERNEL_ROUTE_MAX_CHANNELS
+
+/* hot loop state is grouped into lines of this size */
+#define LOOP_CACHELINE	64
 
 #define WORKAROUND_SERIALOPEN	(1<<0)
 
@@ -60,6 +69,41 @@ typedef enum _slave_type {
 	SLAVE_TYPE_LAST = SLAVE_TYPE_OFF
 } slave_type_t;
 
+/* parameters which can be changed while a loop runs */
+typedef enum _loop_cmd_type {
+	LOOP_CMD_LATENCY = 0,		/* latency in us, restarts the streams */
+	LOOP_CMD_SYNC,			/* sync_type_t, restarts the streams */
+	LOOP_CMD_GAIN,			/* linear playback gain */
+	LOOP_CMD_SRC_QUALITY,		/* SRC_* converter, restarts the converter */
+	LOOP_CMD_XRUN,			/* xrun profiling on (1) or off (0) */
+	LOOP_CMD_LAST = LOOP_CMD_XRUN
+} loop_cmd_type_t;
+
+struct loopback_cmd {
+	loop_cmd_type_t type;
+	double value;
+};
+
+/* commands for one loop thread, power of two */
+#define LOOP_CMDQ_SIZE	64
+
+struct loopback_cmdq_slot {
+	unsigned long seq;
+	struct loopback_cmd cmd;
+};
+
+/* many producers, the loop thread is the only consumer */
+struct loopback_cmdq {
+	alignas(LOOP_CACHELINE) unsigned long head;	/* producers */
+	alignas(LOOP_CACHELINE) unsigned long tail;	/* loop thread */
+	int event_fd;			/* readable while commands wait */
+	struct loopback_cmdq_slot slots[LOOP_CMDQ_SIZE];
+};
+
+static_assert(offsetof(struct loopback_cmdq, tail) -
+	      offsetof(struct loopback_cmdq, head) >= LOOP_CACHELINE,
+	      "producers and the consumer must not share a cache line");
+
 struct loopback_control {
 	snd_ctl_elem_id_t *id;
 	snd_ctl_elem_info_t *info;
@@ -73,6 +117,8 @@ struct loopback_mixer {
 	struct loopback_mixer *next;
 };
 
+struct loopback_ctl_index;
+
 struct loopback_ossmixer {
 	unsigned int skip:1;
 	const char *alsa_id;
@@ -81,44 +127,98 @@ struct loopback_ossmixer {
 	struct loopback_ossmixer *next;
 };
 
+struct loopback_mixsink;
+struct loopback_mixin;
+struct loopback_tap;
+struct ctlmux_listener;
+
+/* recording tap counters */
+struct loopback_tap_stats {
+	unsigned long long frames;	/* frames stored in files */
+	unsigned long long bytes;
+	unsigned long long dropped;	/* frames lost, ring full or no file */
+	unsigned long drops;		/* blocks lost on a full ring */
+	unsigned long files;		/* files started, rotations included */
+	unsigned long write_errors;
+};
+struct loopback_splitsrc;
+struct loopback_splitout;
+struct pcmpool_entry;
+
+/*
+ * Channel routing between the capture and the playback buffer. The gain
+ * matrix has one row per playback channel and one column per capture
+ * channel.
+ */
+struct loopback_route {
+	unsigned int in_channels;
+	unsigned int out_channels;
+	float *coef;			/* out x in gains, row major */
+	int map[MAX_ROUTE_CHANNELS];	/* capture channel per output, -1 = silence */
+	unsigned int identity:1;	/* nothing to do, buffers can be shared */
+	unsigned int reorder:1;		/* plain copies described by map */
+	kernel_route_t kernel;
+	float *fin;			/* one block of capture frames */
+	float *fout;			/* one block of routed frames */
+};
+
+/*
+ * The fields the loop thread touches on every wakeup come first, packed
+ * into whole cache lines. Configuration, names and controls follow on
+ * their own lines.
+ */
 struct loopback_handle {
-	struct loopback *loopback;
-	char *device;
-	char *ctldev;
-	char *id;
-	int card_number;
+	/* I/O job, the ring state fills the first line */
+	alignas(LOOP_CACHELINE) struct loopback *loopback;
 	snd_pcm_t *handle;
-	snd_pcm_access_t access;
-	snd_pcm_format_t format;
-	unsigned int rate;
-	unsigned int rate_req;
-	unsigned int channels;
-	unsigned int buffer_size;
-	unsigned int period_size;
-	snd_pcm_uframes_t avail_min;
-	unsigned int buffer_size_req;
-	unsigned int period_size_req;
-	unsigned int frame_size;
-	unsigned int resample:1;	/* do resample */
-	unsigned int nblock:1;		/* do block (period size) transfers */
-	unsigned int xrun_pending:1;
-	unsigned int pollfd_count;
-	/* I/O job */
 	char *buf;			/* I/O buffer */
 	snd_pcm_uframes_t buf_pos;	/* I/O position */
 	snd_pcm_uframes_t buf_count;	/* filled samples */
-	snd_pcm_uframes_t buf_size;	/* buffer size in frames */
+	snd_pcm_uframes_t buf_size;	/* buffer size in frames (power of two) */
+	snd_pcm_uframes_t buf_mask;	/* buf_size - 1 */
 	snd_pcm_uframes_t buf_over;	/* capture buffer overflow */
-	int stall;
-	/* statistics */
+	struct loopback_mixin *mixin;
+	struct loopback_splitout *splitout;
+	struct loopback_tap *tap;	/* recording tap, NULL = off */
+	int tap_busy;			/* loop thread may use tap, see tap_write() */
+	snd_pcm_uframes_t avail_min;
 	snd_pcm_uframes_t max;
 	unsigned long long counter;
-	unsigned long sync_point;	/* in samples */
 	snd_pcm_sframes_t last_delay;
 	double pitch;
 	snd_pcm_uframes_t total_queued;
+	unsigned long sync_point;	/* in samples */
+	unsigned int frame_size;
+	int stall;
+	snd_pcm_format_t format;
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int buffer_size;
+	unsigned int period_size;
+	unsigned int nblock:1;		/* do block (period size) transfers */
+	unsigned int xrun_pending:1;
+	unsigned int buf_mirror:1;	/* buf is mapped twice back-to-back */
+	unsigned int buf_silence_zero:1; /* silence is all zero bytes */
+	/* configuration */
+	alignas(LOOP_CACHELINE) char *device;
+	char *ctldev;
+	char *id;
+	int card_number;
+	snd_pcm_access_t access;
+	unsigned int rate_req;
+	unsigned int buffer_size_req;
+	unsigned int period_size_req;
+	unsigned int pollfd_count;
+	unsigned int resample:1;	/* do resample */
+	unsigned int mix:1;		/* play into a shared mixing sink */
+	unsigned int split:1;		/* capture from a shared split source */
+	float mix_gain;			/* input gain in the mixing sink */
+	size_t buf_bytes;		/* bytes behind one view of buf */
+	char ident[64];			/* card id based name, survives renumbering */
+	struct pcmpool_entry *pool;	/* warm pool record, NULL = not pooled */
 	/* control */
-	snd_ctl_t *ctl;
+	snd_ctl_t *ctl;			/* shared by the handles of a card */
+	struct ctlmux_listener *ctl_events; /* routed events, NULL = none */
 	unsigned int ctl_pollfd_count;
 	snd_ctl_elem_value_t *ctl_notify;
 	snd_ctl_elem_value_t *ctl_rate_shift;
@@ -126,41 +226,213 @@ struct loopback_handle {
 	snd_ctl_elem_value_t *ctl_format;
 	snd_ctl_elem_value_t *ctl_rate;
 	snd_ctl_elem_value_t *ctl_channels;
+	/* recording tap */
+	struct loopback_tap_stats tap_stats; /* of the last stopped tap */
+};
+
+/* the copy path reads the rings of both handles, one line each */
+static_assert(offsetof(struct loopback_handle, buf_over) +
+	      sizeof(snd_pcm_uframes_t) <= LOOP_CACHELINE,
+	      "ring state of a handle must fit its first cache line");
+static_assert(offsetof(struct loopback_handle, device) <= 3 * LOOP_CACHELINE,
+	      "per wakeup fields of a handle must fit three cache lines");
+
+/*
+ * Scheduling of the threads which run a loop. SCHED_DEADLINE takes the
+ * runtime and period from the negotiated period size.
+ */
+struct loopback_sched {
+	int policy;			/* SCHED_*, -1 = leave as is */
+	int priority;			/* FIFO/RR priority, 0 = maximum */
+	unsigned long long affinity;	/* CPU mask, 0 = any CPU */
+	unsigned int mlock:1;		/* lock all memory of the process */
+};
+
+struct loopback_arena;
+struct loopback_dsp;
+
+/* warm device pool counters, the times are what the pool saved in us */
+struct loopback_pool_stats {
+	unsigned long hits;		/* devices taken opened from the pool */
+	unsigned long misses;		/* devices opened cold */
+	unsigned long params_hits;	/* reused with hw params still applied */
+	unsigned long expired;		/* closed at the end of their TTL */
+	unsigned int pooled;		/* idle devices held now */
+	long long saved_time;
+};
+
+/*
+ * Silence bypass counters. The time saved is the bypassed frames at the
+ * measured cost of processing a frame, minus the time of the bypass.
+ */
+struct loopback_silence_stats {
+	unsigned long entries;		/* bypass started */
+	unsigned long long frames;	/* capture frames bypassed */
+	unsigned long long bypass_ns;	/* time spent in the bypass */
+	unsigned long long work_frames;	/* capture frames processed */
+	unsigned long long work_ns;	/* time spent processing them */
+};
+
+/* plugins in the DSP chain of one connection */
+#define LOOP_DSP_MAX	8
+
+/*
+ * A DSP plugin works in place on the interleaved frames between capture
+ * and playback. open() and close() run on the thread which connects and
+ * disconnects, they allocate and free. prepare() and process() run on the
+ * loop thread and must not block or allocate. prepare() is called on
+ * every stream start with the sample format of the spans, one of the
+ * KERNEL_FORMAT_* bits in formats. Float spans are normalized to [-1, 1).
+ * Spans never cross the end of the ring, frames may be any count.
+ */
+struct loopback_dsp_ops {
+	const char *name;
+	unsigned int formats;		/* 1 << KERNEL_FORMAT_* accepted */
+	int (*open)(void **priv, void *arg);
+	int (*prepare)(void *priv, unsigned int rate, unsigned int channels,
+		       int format);
+	void (*process)(void *priv, void *buf, unsigned int frames);
+	void (*close)(void *priv);
+};
+
+/* one requested plugin, arg is passed to open() */
+struct loopback_dsp_entry {
+	const struct loopback_dsp_ops *ops;
+	void *arg;
+};
+
+/* per plugin time on the loop thread, in ns */
+struct loopback_dsp_stats {
+	unsigned long calls;
+	unsigned long long frames;
+	unsigned long long ns;
+	unsigned long long ns_max;	/* longest single call */
+	unsigned long bypassed;		/* starts where prepare() failed */
+};
+
+/* idle parking counters, times in us */
+struct loopback_park_stats {
+	unsigned long parks;		/* client went inactive */
+	unsigned long closes;		/* playback device closed while parked */
+	unsigned long long idle_time;	/* time spent parked */
+	unsigned long idle_wakeups;	/* thread wakeups while parked */
+	long resume_latency;		/* client active to streams running, last */
+	long resume_latency_max;
+};
+
+/* busy polling counters, spin_time / wall_time is the CPU share spent spinning */
+struct loopback_busy_stats {
+	unsigned long long spin_time;	/* time spent spinning, in us */
+	unsigned long long wall_time;	/* time since the streams started, in us */
+	unsigned long misses;		/* spins that ran out of budget */
+	long latency;			/* highest last measured loop latency, in us */
 };
 
 struct loopback {
-	char *id;
-	struct loopback_handle *capt;
+	/* data path and sync, touched on every wakeup */
+	alignas(LOOP_CACHELINE) struct loopback_handle *capt;
 	struct loopback_handle *play;
 	snd_pcm_uframes_t latency;	/* final latency in frames */
-	unsigned int latency_req;	/* in frames */
-	unsigned int latency_reqtime;	/* in us */
-	unsigned long loop_time;	/* ~0 = unlimited (in seconds) */
 	unsigned long long loop_limit;	/* ~0 = unlimited (in frames) */
-	snd_output_t *output;
-	snd_output_t *state;
+	snd_pcm_uframes_t stop_count;
 	int pollfd_count;
 	int active_pollfd_count;
+	sync_type_t sync;		/* type of sync */
+	int wake_fd;			/* timerfd, -1 = none */
 	unsigned int linked:1;		/* linked streams */
 	unsigned int reinit:1;
 	unsigned int running:1;
 	unsigned int stop_pending:1;
-	snd_pcm_uframes_t stop_count;
-	sync_type_t sync;		/* type of sync */
-	slave_type_t slave;
-	int thread;			/* thread number */
-	unsigned int wake;
-	/* statistics */
+	unsigned int xrun:1;		/* xrun profiling */
+	unsigned int wake_timer:1;	/* wake from a timer, not from periods */
+	unsigned int use_samplerate:1;
+	unsigned int silence_bypass:1;	/* captured silence skips the converters */
+	unsigned int gain_active:1;	/* software gain is not unity or ramping */
+	unsigned int gain_warned:1;	/* unsupported format reported */
+	unsigned int dsp_active:1;	/* a prepared plugin is in the chain */
+	unsigned int total_queued_count;
 	double pitch;
 	double pitch_delta;
 	snd_pcm_sframes_t pitch_diff;
 	snd_pcm_sframes_t pitch_diff_min;
 	snd_pcm_sframes_t pitch_diff_max;
-	unsigned int total_queued_count;
+	unsigned int busy_spin;		/* spin budget per wakeup in us, 0 = off */
+	unsigned int busy_lead;		/* stop blocking this early, in us */
+	snd_pcm_uframes_t silence_hold_frames; /* silence before the bypass, 0 = off */
+	snd_pcm_uframes_t silence_run;	/* silent capture frames in a row */
+	double silence_frac;		/* resampled frame fraction not written yet */
+	float gain;			/* software gain of the playback side */
+	float gain_step;		/* gain change per frame while ramping */
+	snd_pcm_uframes_t gain_ramp;	/* frames left in the ramp */
+	int gain_format;		/* KERNEL_FORMAT_* of the playback ring, -1 = none */
+	struct loopback_dsp *dsp;	/* plugin chain, NULL = none */
+#ifdef USE_SAMPLERATE
+	SRC_STATE *src_state;
+	kernel_convert_t src_cvt_in;	/* capture samples to float */
+	kernel_convert_t src_cvt_out;	/* float to playback samples */
+	unsigned int src_out_frames;
+	SRC_DATA src_data;
+#endif
+	/* channel routing */
+	alignas(LOOP_CACHELINE) struct loopback_route route;
+	/* configuration */
+	alignas(LOOP_CACHELINE) char *id;
+	unsigned int latency_req;	/* in frames */
+	unsigned int latency_reqtime;	/* in us */
+	unsigned long loop_time;	/* ~0 = unlimited (in seconds) */
+	snd_output_t *output;
+	snd_output_t *state;
+	slave_type_t slave;
+	int thread;			/* thread number */
+	unsigned int wake;
+	struct loopback_sched sched;
+	unsigned int route_channels;	/* playback channels, 0 = as capture */
+	float *route_coef;		/* requested matrix, NULL = default */
+#ifdef USE_SAMPLERATE
+	unsigned int src_enable:1;
+	int src_converter_type;
+#endif
+	struct loopback_arena *arena;	/* buffers of the thread, NULL = heap */
+	/* idle parking while the loop client is inactive */
+	unsigned int park:1;		/* follow PCM Slave Active without slave mode */
+	unsigned int parked:1;
+	unsigned int park_closed:1;	/* playback device closed while parked */
+	unsigned int park_delay;	/* inactive time before parking in ms, 0 = 3x latency */
+	unsigned int park_resume;	/* resume bound in ms, 0 = keep the device open */
+	snd_pcm_uframes_t park_frames;	/* played inactive frames before parking */
+	long play_open_time;		/* last open of the playback device, in us */
+	unsigned int silence_hold;	/* silence before the bypass in ms, 0 = off */
+	float soft_gain;		/* requested software gain, 1.0 = off */
+	unsigned int gain_ramp_time;	/* gain ramp in ms, 0 = step */
+	/* control mixer */
+	struct loopback_mixer *controls;
+	struct loopback_ctl_index *ctl_index;	/* controls by numid, NULL = scan */
+	unsigned int ctl_index_mask;
+	struct loopback_ossmixer *oss_controls;
+	/* loop card clocked by the playback card */
+	unsigned int timer_lock:1;	/* try to bind the loop card timer */
+	int timer_card;			/* loop card bound by us, -1 = none */
+	unsigned int timer_checks;	/* sync points left to verify the lock */
+	snd_pcm_sframes_t timer_diff;	/* sync diff when the check started */
+	/* statistics */
+	long reconfig_time;		/* last reconfiguration (in us) */
+	unsigned int pitch_updates;	/* sync updates since start */
+	double drift_pitch;		/* learned pitch to save, 0 = none */
+	int drift_sync;			/* sync type drift_pitch belongs to */
 	snd_timestamp_t tstamp_start;
 	snd_timestamp_t tstamp_end;
+	/* busy polling statistics */
+	unsigned long long busy_time;	/* time spent spinning, in us */
+	unsigned long busy_misses;	/* spins that ran out of budget */
+	long busy_latency;		/* last measured loop latency, in us */
+	snd_timestamp_t busy_start;
+	/* silence bypass statistics */
+	struct loopback_silence_stats silence_stats;
+	/* idle parking statistics */
+	struct loopback_park_stats park_stats;
+	snd_timestamp_t park_start;	/* parked since */
+	snd_timestamp_t park_wake;	/* client became active, 0 = not yet */
 	/* xrun profiling */
-	unsigned int xrun:1;		/* xrun profiling */
 	snd_timestamp_t xrun_last_update;
 	snd_timestamp_t xrun_last_wake0;
 	snd_timestamp_t xrun_last_wake;
@@ -173,24 +445,99 @@ struct loopback {
 	unsigned int xrun_out_frames;
 	long xrun_max_proctime;
 	double xrun_max_missing;
-	/* control mixer */
-	struct loopback_mixer *controls;
-	struct loopback_ossmixer *oss_controls;
-	/* sample rate */
-	unsigned int use_samplerate:1;
-#ifdef USE_SAMPLERATE
-	unsigned int src_enable:1;
-	int src_converter_type;
-	SRC_STATE *src_state;
-	SRC_DATA src_data;
-	unsigned int src_out_frames;
-#endif
-#ifdef FILE_CWRITE
-	FILE *cfile;
-#endif
-#ifdef FILE_PWRITE
-	FILE *pfile;
-#endif
+};
+
+/* the SRC state follows and may take more lines, it is not checked */
+static_assert(offsetof(struct loopback, dsp) + sizeof(void *) <=
+	      3 * LOOP_CACHELINE,
+	      "per wakeup fields of a loop must fit three cache lines");
+
+/*
+ * Mixing sink: several loops feed one real playback device. Each loop
+ * writes into its own input FIFO instead of the PCM, the sink thread mixes
+ * one period of all running inputs and writes it to the device.
+ */
+struct loopback_mixin {
+	struct loopback_mixsink *sink;
+	struct loopback_handle *lhandle;
+	char *buf;			/* input FIFO */
+	snd_pcm_uframes_t size;		/* FIFO size in frames (power of two) */
+	snd_pcm_uframes_t avail_min;	/* wake up the loop at this room */
+	snd_pcm_uframes_t appl_ptr;	/* written frames (loop thread) */
+	snd_pcm_uframes_t hw_ptr;	/* mixed frames (sink thread) */
+	int state;			/* snd_pcm_state_t */
+	float gain;
+	int event_fd;			/* poll descriptor for the loop thread */
+	unsigned long underruns;
+};
+
+struct loopback_mixsink {
+	char *device;
+	snd_pcm_t *handle;
+	snd_pcm_format_t format;
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int frame_size;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_sframes_t delay;	/* device delay after the last write */
+	float *acc;			/* one period of mixed samples */
+	char *out;			/* one period in the device format */
+	unsigned int pollfd_count;
+	struct pollfd *pfds;
+	pthread_t thread;
+	int thread_running;
+	int quit;
+	struct loopback_sched sched;	/* taken from the first loop */
+	pthread_mutex_t lock;		/* inputs and input state changes */
+	struct loopback_mixin *inputs[MAX_MIXSINK_INPUTS];
+	int inputs_count;
+	unsigned long xruns;
+	struct loopback_mixsink *next;
+};
+
+/*
+ * Split source: one loop capture device feeds several loops. The source
+ * thread reads the device once into a shared ring, every loop reads the
+ * ring through its own cursor instead of the PCM. A reader which falls
+ * behind gets an overrun, the source and the other readers go on.
+ */
+struct loopback_splitout {
+	struct loopback_splitsrc *src;
+	struct loopback_handle *lhandle;
+	snd_pcm_uframes_t size;		/* readable window in frames */
+	snd_pcm_uframes_t avail_min;	/* wake up the loop at this fill */
+	snd_pcm_uframes_t appl_ptr;	/* read frames (loop thread) */
+	int state;			/* snd_pcm_state_t */
+	int event_fd;			/* poll descriptor for the loop thread */
+	unsigned long overruns;
+	unsigned long long over;	/* frames lost in overruns */
+};
+
+struct loopback_splitsrc {
+	char *device;
+	snd_pcm_t *handle;
+	snd_pcm_format_t format;
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int frame_size;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_sframes_t delay;	/* device delay after the last read */
+	char *buf;			/* shared ring */
+	snd_pcm_uframes_t size;		/* ring size in frames (power of two) */
+	snd_pcm_uframes_t hw_ptr;	/* captured frames (source thread) */
+	unsigned int pollfd_count;
+	struct pollfd *pfds;
+	pthread_t thread;
+	int thread_running;
+	int quit;
+	struct loopback_sched sched;	/* taken from the first loop */
+	pthread_mutex_t lock;		/* outputs and output state changes */
+	struct loopback_splitout *outputs[MAX_SPLITSRC_OUTPUTS];
+	int outputs_count;
+	unsigned long xruns;
+	struct loopback_splitsrc *next;
 };
 
 extern int verbose;
@@ -211,21 +558,153 @@ int pcmjob_stop(struct loopback *loop);
 int pcmjob_pollfds_init(struct loopback *loop, struct pollfd *fds);
 int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds);
 void pcmjob_state(struct loopback *loop);
+long pcmjob_busy_timeout(struct loopback *loop);
+int pcmjob_command(struct loopback *loop, const struct loopback_cmd *cmd);
+void pcmjob_fade_out(struct loopback *loop, unsigned int ms);
+void pcmjob_busy_spin(struct loopback *loop);
+void pcmjob_busy_stats(struct loopback *loop, struct loopback_busy_stats *stats);
+size_t pcmjob_arena_size(struct loopback *loop);
+
+int mixsink_attach(struct loopback_handle *lhandle);
+void mixsink_detach(struct loopback_handle *lhandle);
+int mixin_setup(struct loopback_mixin *in, snd_pcm_uframes_t size,
+		snd_pcm_uframes_t avail_min);
+void mixin_set_avail_min(struct loopback_mixin *in, snd_pcm_uframes_t avail_min);
+void mixin_set_gain(struct loopback_mixin *in, float gain);
+int mixin_prepare(struct loopback_mixin *in);
+int mixin_start(struct loopback_mixin *in);
+int mixin_drop(struct loopback_mixin *in);
+snd_pcm_state_t mixin_state(struct loopback_mixin *in);
+snd_pcm_sframes_t mixin_avail_update(struct loopback_mixin *in);
+int mixin_delay(struct loopback_mixin *in, snd_pcm_sframes_t *delayp);
+snd_pcm_sframes_t mixin_writei(struct loopback_mixin *in, const void *buf,
+			       snd_pcm_uframes_t size);
+int mixin_poll_descriptors(struct loopback_mixin *in, struct pollfd *pfds,
+			   unsigned int space);
+int mixin_poll_revents(struct loopback_mixin *in, struct pollfd *pfds,
+		       unsigned int nfds, unsigned short *revents);
+
+int route_init(struct loopback_route *route, unsigned int in_channels,
+	       unsigned int out_channels, const float *coef);
+void route_done(struct loopback_route *route);
+void route_frames(struct loopback_route *route, snd_pcm_format_t format,
+		  char *out, const char *in, snd_pcm_uframes_t frames,
+		  float scale);
+void route_frames_float(struct loopback_route *route, snd_pcm_format_t format,
+			float *out, const char *in, snd_pcm_uframes_t frames,
+			float scale);
+
+int splitsrc_attach(struct loopback_handle *lhandle);
+void splitsrc_detach(struct loopback_handle *lhandle);
+int splitout_setup(struct loopback_splitout *out, snd_pcm_uframes_t size,
+		   snd_pcm_uframes_t avail_min);
+int splitout_prepare(struct loopback_splitout *out);
+int splitout_start(struct loopback_splitout *out);
+int splitout_drop(struct loopback_splitout *out);
+snd_pcm_state_t splitout_state(struct loopback_splitout *out);
+snd_pcm_sframes_t splitout_avail_update(struct loopback_splitout *out);
+int splitout_delay(struct loopback_splitout *out, snd_pcm_sframes_t *delayp);
+snd_pcm_sframes_t splitout_readi(struct loopback_splitout *out, void *buf,
+				 snd_pcm_uframes_t size);
+int splitout_poll_descriptors(struct loopback_splitout *out, struct pollfd *pfds,
+			      unsigned int space);
+int splitout_poll_revents(struct loopback_splitout *out, struct pollfd *pfds,
+			  unsigned int nfds, unsigned short *revents);
+
+int hwcache_load(const char *file);
+int hwcache_lookup(struct loopback_handle *lhandle, snd_pcm_uframes_t bufsize,
+		   unsigned int *rate, snd_pcm_uframes_t *buffer_size,
+		   snd_pcm_uframes_t *period_size);
+void hwcache_save(void);
+void hwcache_store(struct loopback_handle *lhandle, snd_pcm_uframes_t bufsize,
+		   unsigned int rate, snd_pcm_uframes_t buffer_size,
+		   snd_pcm_uframes_t period_size);
+
+void pcmpool_config(unsigned int ttl_ms, int keep_params);
+void pcmpool_flush(void);
+int pcmpool_take(struct loopback_handle *lhandle, int stream,
+		 int *device, int *subdevice);
+void pcmpool_opened(struct loopback_handle *lhandle, int device, int subdevice,
+		    long open_time);
+int pcmpool_params(struct loopback_handle *lhandle, snd_pcm_uframes_t bufsize);
+void pcmpool_params_store(struct loopback_handle *lhandle,
+			  snd_pcm_uframes_t bufsize, long params_time);
+int pcmpool_keep_params(struct loopback_handle *lhandle);
+int pcmpool_put(struct loopback_handle *lhandle);
+void pcmpool_get_stats(struct loopback_pool_stats *stats);
+
+int dsp_create(struct loopback_dsp **dsp, const struct loopback_dsp_entry *entries,
+	       int count);
+void dsp_destroy(struct loopback_dsp *dsp);
+int dsp_prepare(struct loopback_dsp *dsp, const char *id, unsigned int rate,
+		unsigned int channels, int format);
+void dsp_process(struct loopback_dsp *dsp, void *buf, unsigned int frames);
+int dsp_get_stats(struct loopback_dsp *dsp, int index,
+		  struct loopback_dsp_stats *stats);
+void dsp_state(struct loopback_dsp *dsp, snd_output_t *output);
+
+int ctlmux_open(snd_ctl_t **ctl, const char *name);
+int ctlmux_close(snd_ctl_t *ctl);
+int ctlmux_listen(struct ctlmux_listener **l, snd_ctl_t *ctl, int device,
+		  int subdevice, int all);
+void ctlmux_unlisten(struct ctlmux_listener *l);
+int ctlmux_fd(struct ctlmux_listener *l);
+void ctlmux_clear(struct ctlmux_listener *l);
+int ctlmux_read(struct ctlmux_listener *l, snd_ctl_event_t *ev);
+void ctlmux_state(struct ctlmux_listener *l, const char *id, snd_output_t *output);
+void ctlmux_sched(const struct loopback_sched *sched);
+
+int tap_start(struct loopback_handle *lhandle, const char *path,
+	      size_t ring_bytes, unsigned long long file_bytes,
+	      unsigned int files);
+int tap_stop(struct loopback_handle *lhandle);
+void tap_write(struct loopback_handle *lhandle, const char *buf,
+	       snd_pcm_uframes_t frames);
+int tap_get_stats(struct loopback_handle *lhandle, struct loopback_tap_stats *stats);
+
+int arena_create(struct loopback_arena **arena, size_t size, int lock_memory);
+void arena_destroy(struct loopback_arena *arena);
+void *arena_alloc(struct loopback_arena *arena, size_t bytes);
+char *arena_alloc_mirror(struct loopback_arena *arena, size_t bytes);
+int arena_free(struct loopback_arena *arena, void *ptr);
+void arena_fallback(struct loopback_arena *arena);
+size_t arena_footprint(struct loopback_arena *arena);
+void arena_state(struct loopback_arena *arena, snd_output_t *output);
+
+int cmdq_init(struct loopback_cmdq *q);
+void cmdq_done(struct loopback_cmdq *q);
+int cmdq_post(struct loopback_cmdq *q, const struct loopback_cmd *cmd);
+int cmdq_full(struct loopback_cmdq *q);
+int cmdq_pop(struct loopback_cmdq *q, struct loopback_cmd *cmd);
+void cmdq_clear_event(struct loopback_cmdq *q);
+void cmdq_wake(struct loopback_cmdq *q);
+
+int drift_load(const char *file);
+double drift_lookup(struct loopback *loop);
+void drift_store(struct loopback *loop);
+
+int setScheduler(const struct loopback_sched *sched, unsigned long long period_ns);
 
 int control_parse_id(const char *str, snd_ctl_elem_id_t *id);
 int control_id_match(snd_ctl_elem_id_t *id1, snd_ctl_elem_id_t *id2);
 int control_init(struct loopback *loop);
 int control_done(struct loopback *loop);
 int control_event(struct loopback_handle *lhandle, snd_ctl_event_t *ev);
+int control_resync(struct loopback_handle *lhandle);
+
+class AlsaLoop;
 
 struct loopbackThread 
 {
+	AlsaLoop *alsaLoop;
 	int threaded;
 	pthread_t thread;
 	int exitcode;
 	struct loopback **loopbacks;
 	int loopbacks_count;
 	snd_output_t *output;
+	struct loopback_cmdq cmdq;	/* live parameter changes */
+	struct loopback_arena *arena;	/* buffers of the loops, NULL = heap */
 };
 
 class AlsaLoop
@@ -238,20 +717,54 @@ public:
 	int daemonize = 0;
 	int use_syslog = 0;
 	struct loopback **loopbacks = NULL;
+	int loopbacks_alloc = 0;
 	int loopbacks_count = 0;
 	char **my_argv = NULL;
 	int my_argc = 0;
-	struct loopbackThread *threads;
+	struct loopbackThread *threads = NULL;
 	int threads_count = 0;
 	pthread_t main_job;
+	int arena_lock = 1;
+	unsigned int quit_fade = 0;	/* fade out at quit, in ms */
+	int start_gate = 0;		/* threads wait for openGate() before start */
+	pthread_mutex_t ready_lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+	int ready_opened = 0;		/* threads with opened devices */
+	int ready_started = 0;		/* threads with running streams */
+	int ready_err = 0;		/* first thread failure */
+	pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER;	/* postCommand() */
+	int arg_default_loops = 1;	/* loops the connection will add */
 	int arg_default_xrun = 0;
 	int arg_default_wake = 0;
+	int arg_default_mix = 0;
+	float arg_default_mix_gain = 1.0f;
+	int arg_default_split = 0;
+	unsigned int arg_default_channels = 2;
+	unsigned int arg_default_route_channels = 0;
+	const float *arg_default_route = NULL;
+	const char *arg_default_hwcache = NULL;
+	const char *arg_default_drift = NULL;
+	int arg_default_timer_lock = 0;
+	int arg_default_wake_timer = 0;
+	unsigned int arg_default_busy_spin = 0;
+	unsigned int arg_default_busy_lead = 200;
+	int arg_default_sched_policy = SCHED_RR;
+	int arg_default_sched_priority = 0;
+	unsigned long long arg_default_sched_affinity = 0;
+	int arg_default_sched_mlock = 0;
+	int arg_default_park = 0;
+	unsigned int arg_default_park_delay = 0;
+	unsigned int arg_default_park_resume = 0;
+	unsigned int arg_default_silence_hold = 0;
+	float arg_default_soft_gain = 1.0f;
+	unsigned int arg_default_gain_ramp = 10;
+	struct loopback_dsp_entry arg_default_dsp[LOOP_DSP_MAX];
+	int arg_default_dsp_count = 0;
 
 	AlsaLoop(/* args */);
 	~AlsaLoop();
 
 	void signalHandler(int sig);
-	void sendToAll(int sig);
 	int sortThreads(snd_output_t * output);
 	void threadJob(struct loopbackThread *thread);
 	bool initConnection(char * realDev, char * loopDev, snd_output_t *output);
@@ -261,6 +774,25 @@ public:
 	void joinFromThreads();
 	void runThreads();
 	void addLoop(struct loopback *loop);
+	void createArena();
+	int postCommand(loop_cmd_type_t type, double value);
+	void reportState(int opened, int started, int err);
+	void waitGate();
+	void openGate();
+	int waitThreads(int *count, int timeout);
+	int waitOpened(int timeout);
+	int waitReady(int timeout);
+	size_t memoryFootprint();
+	void configPool(unsigned int ttl_ms, int keep_params);
+	void poolStats(struct loopback_pool_stats *stats);
+	void parkStats(struct loopback_park_stats *stats);
+	void busyStats(struct loopback_busy_stats *stats);
+	void silenceStats(struct loopback_silence_stats *stats);
+	bool dspStats(int index, struct loopback_dsp_stats *stats);
+	int startTap(snd_pcm_stream_t stream, const char *path,
+		     unsigned long long fileBytes, unsigned int files);
+	int stopTap(snd_pcm_stream_t stream);
+	bool tapStats(snd_pcm_stream_t stream, struct loopback_tap_stats *stats);
 	void * threadJob1(void *_data);
 };
 
@@ -0,0 +1,95 @@
+/**
+ * @file kernels.h
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Sample processing kernels used on the loop data path.
+ *        Every kernel has a SSE2 implementation when the compiler
+ *        targets it and a plain C fallback written so that it can be
+ *        auto-vectorized on other targets.
+ * @version 0.1
+ * @date 2026-10-19
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Mixing: samples are accumulated into a float buffer (acc += in * gain)
+ * and stored back into the device format, multiplied by scale, with
+ * saturation.
+ */
+void kernel_mix_s16(float *acc, const int16_t *in, unsigned int samples, float gain);
+void kernel_mix_s32(float *acc, const int32_t *in, unsigned int samples, float gain);
+void kernel_store_s16(int16_t *out, const float *acc, unsigned int samples, float scale);
+void kernel_store_s32(int32_t *out, const float *acc, unsigned int samples, float scale);
+
+/*
+ * Gain: interleaved frames are scaled in place. Frame f is multiplied by
+ * gain + f * step, a step of zero is a constant gain and takes the
+ * vectorized path. Integer samples saturate, float samples do not.
+ */
+void kernel_gain_s16(int16_t *buf, unsigned int frames, unsigned int channels,
+		     float gain, float step);
+void kernel_gain_s32(int32_t *buf, unsigned int frames, unsigned int channels,
+		     float gain, float step);
+void kernel_gain_float(float *buf, unsigned int frames, unsigned int channels,
+		       float gain, float step);
+
+/*
+ * Routing: interleaved frames are converted to float, multiplied through
+ * an out x in gain matrix (row major, one row per output channel) and
+ * stored back with the store kernels above.
+ */
+#define KERNEL_ROUTE_MAX_CHANNELS	32
+
+typedef void (*kernel_route_t)(float *out, const float *in, unsigned int frames,
+			       const float *coef, unsigned int in_channels,
+			       unsigned int out_channels);
+
+void kernel_to_float_s16(float *out, const int16_t *in, unsigned int samples, float scale);
+void kernel_to_float_s32(float *out, const int32_t *in, unsigned int samples, float scale);
+kernel_route_t kernel_route_select(unsigned int in_channels, unsigned int out_channels);
+
+/*
+ * Sample format conversion of interleaved frames. Float samples are
+ * normalized to [-1, 1). A kernel is looked up once per format and
+ * channel pair, 1, 2, 4, 6 and 8 channels have their own instances and
+ * other counts use the generic one. NULL means the pair is unsupported.
+ */
+enum kernel_format {
+	KERNEL_FORMAT_S16 = 0,
+	KERNEL_FORMAT_S32,
+	KERNEL_FORMAT_FLOAT,
+	KERNEL_FORMAT_COUNT
+};
+
+typedef void (*kernel_convert_t)(void *out, const void *in, unsigned int frames,
+				 unsigned int channels);
+
+kernel_convert_t kernel_convert_select(int in_format, int out_format,
+				       unsigned int channels);
+
+/*
+ * Reordering: every output channel is a copy of one input channel
+ * (map[out] = in) or silence (map[out] < 0), no arithmetic involved.
+ */
+void kernel_reorder_16(uint16_t *out, const uint16_t *in, unsigned int frames,
+		       const int *map, unsigned int in_channels,
+		       unsigned int out_channels, uint16_t silence);
+void kernel_reorder_32(uint32_t *out, const uint32_t *in, unsigned int frames,
+		       const int *map, unsigned int in_channels,
+		       unsigned int out_channels, uint32_t silence);
+
+/*
+ * Silence detection: returns 1 when every byte of the block is zero, the
+ * digital silence of the signed formats. Stops at the first block of
+ * 64 bytes which is not.
+ */
+int kernel_is_zero(const void *buf, size_t bytes);
+
+#endif /*KERNELS_H*/
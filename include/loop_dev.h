@@ -15,6 +15,10 @@
 
 #include <string>
 #include <vector>
+#include <future>
+#include <functional>
+#include <memory>
+#include <thread>
 
 #include "alsaloop.h"
 
@@ -29,6 +33,10 @@ struct loopbackDev;
  * 
  *        1 Loop cihazı yalnızca 1 tane gerçek ses cihazına bağlanabilir.
  *        Aynı zamanda 1 gerçek ses cihazı da tek bir loop cihaza bağlanabilir.
+ *        connectMixed ile bağlanan loop cihazları ise aynı gerçek cihazı
+ *        paylaşır, sesleri tek bir mixer üzerinden karıştırılarak yazılır.
+ *        Cihaz listesi alan connect ile 1 loop cihazı birden fazla gerçek
+ *        cihaza aynı anda bağlanabilir.
  * 
  *        Bir Loop cihazı 2 alt cihazdan oluşur. Capture alt cihazı
  *        gerçek cihaz ile bağlantının kurulduğu cihazdır. Playback alt cihazı
@@ -41,10 +49,22 @@ class LoopDev
 private:
 
     loopbackDev * loopDev;
-    AlsaLoop * alsaLoop;
+    std::shared_ptr<AlsaLoop> alsaLoop;
+    std::thread connectWaiter;
     static std::vector<std::string> realDevs;
+    static std::vector<std::string> mixedRealDevs;
     bool isLoopDevConnected;
-    std::string connectedRealDev;
+    bool isMixedConnection;
+    std::vector<std::string> connectedRealDevs;
+    unsigned int loopChannels;
+    unsigned int realChannels;
+    std::vector<float> routeMatrix;
+    long disconnectLatency;
+    std::string hwCacheFile;
+    std::string driftFile;
+
+    int connectDevs(const std::vector<std::string> &realDevList,
+                    bool mixed, float gain);
 
 public:
 
@@ -64,12 +84,383 @@ public:
     int connect(const std::string &realDev);
 
     /**
-     * @brief Gerçek cihaz ile loop cihaz bağlantısı kopartılır
+     * @brief Loop cihazını verilen gerçek cihazların hepsine aynı anda
+     *        bağlar. Loop capture cihazı bir kez okunur, her gerçek cihaz
+     *        kendi thread'inde, kendi drift düzeltmesi ile çalışır.
+     *        Yavaş kalan bir gerçek cihaz diğerlerini bekletmez,
+     *        yalnızca kendisi overrun alır.
+     * 
+     * @param realDevList 
+     * @return int : 0 - başarılı
+     *             : 1 - gerçek cihazlardan biri meşgul ya da listede
+     *                   birden fazla kez var
+     *             : 2 - loop cihaz başka bir gerçek cihaza bağlı
+     *             : -1 - Bağlantı kurulamadı.(Alsa hatası)
+     */
+    int connect(const std::vector<std::string> &realDevList);
+
+    /**
+     * @brief Loop cihazını gerçek cihaza paylaşımlı olarak bağlar.
+     *        Aynı gerçek cihaza connectMixed ile bağlanan tüm loop
+     *        cihazlarının sesi karıştırılarak tek bir playback
+     *        stream'ine yazılır. Her girişin kendi kazancı ve kendi
+     *        drift düzeltmesi vardır.
+     * 
+     * @param realDev 
+     * @param gain : Bu girişin mixer kazancı (1.0 - değiştirmeden)
+     * @return int : 0 - başarılı
+     *             : 1 - gerçek cihaz paylaşımsız olarak meşgul
+     *             : 2 - loop cihaz başka bir gerçek cihaza bağlı
+     *             : -1 - Bağlantı kurulamadı.(Alsa hatası)
+     */
+    int connectMixed(const std::string &realDev, float gain = 1.0f);
+
+    /**
+     * @brief connect ile aynı bağlantıyı kurar, ancak cihazların açılıp
+     *        stream'lerin başlamasını beklemez. Dönen future ve verilen
+     *        callback, loop thread'leri çalışmaya başladığında ya da
+     *        başlayamadığında sonuçlanır. Sonuç -1 ise kaynakları bırakmak
+     *        için disconnect çağrılmalıdır. Future bırakılabilir, bekleme
+     *        nesnenin thread'inde yapılır ve disconnect bu thread'i
+     *        sonlandırır.
+     * 
+     * @param realDevList 
+     * @param callback : Sonuç ile loop thread'i dışındaki bir thread'den
+     *                   çağrılır, boş olabilir.
+     * @return std::future<int> : 0 - başarılı
+     *                          : 1 - gerçek cihazlardan biri meşgul
+     *                          : 2 - loop cihaz başka bir gerçek cihaza bağlı
+     *                          : -1 - Bağlantı kurulamadı.(Alsa hatası)
+     */
+    std::future<int> connectAsync(const std::vector<std::string> &realDevList,
+                                  std::function<void(int)> callback = std::function<void(int)>());
+
+    /**
+     * @brief Verilen loop cihazlarının her birini aynı sıradaki gerçek
+     *        cihaza bağlar. Cihazlar her bağlantının kendi thread'inde
+     *        paralel olarak açılır, stream'ler ancak tüm cihazlar açılınca
+     *        başlatılır. Başarısız olan bağlantılar bırakılır.
+     * 
+     * @param loops : Bağlanacak loop cihazları
+     * @param realDevList : loops ile aynı sayıda gerçek cihaz
+     * @param results : Her bağlantı için connect dönüş değeri
+     * @param bringUpTime : Boş değilse tüm bağlantıların kurulma süresi (us)
+     * @return int : 0 - tüm bağlantılar başarılı
+     *             : -1 - en az bir bağlantı kurulamadı ya da liste hatalı
+     */
+    static int connectMany(const std::vector<LoopDev *> &loops,
+                           const std::vector<std::string> &realDevList,
+                           std::vector<int> &results,
+                           long *bringUpTime = NULL);
+
+    /**
+     * @brief Sonraki bağlantılar için kanal yönlendirmesini ayarlar.
+     *        Matris verilmezse kanal sayılarına göre varsayılan
+     *        upmix/downmix kullanılır. Kanal sayıları eşit ve matris
+     *        birim matris ise veri kopyalanmadan aktarılır.
+     *        Çağrılmazsa yönlendirme yapılmaz, gerçek cihaz loop
+     *        cihazıyla aynı kanal sayısında açılır.
+     * 
+     * @param loopChannels : loop cihazının kanal sayısı
+     * @param realChannels : gerçek cihazın kanal sayısı
+     * @param matrix : realChannels x loopChannels kazanç matrisi.
+     *                 Her satır bir gerçek cihaz kanalıdır.
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     *             : -1 - geçersiz kanal sayısı ya da matris boyutu
+     */
+    int setRouting(unsigned int loopChannels, unsigned int realChannels,
+                   const std::vector<float> &matrix = std::vector<float>());
+
+    /**
+     * @brief Sonraki bağlantıların thread'leri için zamanlama politikası,
+     *        öncelik ve CPU ataması ayarlar. Varsayılan en yüksek öncelikli
+     *        SCHED_RR'dir. SCHED_DEADLINE için runtime ve period, anlaşılan
+     *        period boyutundan hesaplanır.
+     * 
+     * @param policy : SCHED_OTHER, SCHED_FIFO, SCHED_RR, SCHED_DEADLINE
+     *                 ya da -1 (thread'in ayarı değiştirilmez)
+     * @param priority : SCHED_FIFO ve SCHED_RR için 1-99, 0 - en yüksek.
+     *                   Diğer politikalarda 0 olmalıdır.
+     * @param cpuMask : Thread'lerin çalışacağı CPU'ların maskesi, 0 - hepsi.
+     *                  SCHED_DEADLINE ile kullanılamaz.
+     * @param lockMemory : true ise prosesin belleği kilitlenir (mlockall)
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     *             : -1 - geçersiz politika, öncelik ya da CPU maskesi
+     */
+    int setScheduling(int policy, int priority,
+                      unsigned long long cpuMask = 0, bool lockMemory = false);
+
+    /**
+     * @brief Sonraki bağlantılar için meşgul beklemeyi ayarlar. Thread
+     *        sıradaki capture period'undan leadUs önce uyanır ve yeni
+     *        frame'ler gelene kadar en fazla spinUs boyunca donanım
+     *        göstergesini yoklar. Gecikme azalır, karşılığında CPU harcanır.
      * 
+     * @param spinUs : Uyanma başına en uzun yoklama süresi (us),
+     *                 0 - meşgul bekleme kapalı
+     * @param leadUs : Period beklenmeden ne kadar önce uyanılacağı (us)
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     *             : -1 - süreler çok uzun
+     */
+    int setBusyPoll(unsigned int spinUs, unsigned int leadUs = 200);
+
+    /**
+     * @brief Sonraki bağlantılarda thread'lerin period olayları yerine
+     *        bir zamanlayıcı ile uyanmasını ayarlar. Zamanlayıcı tampon
+     *        doluluğuna göre kurulur, büyük tamponlarda uyanma azalır.
+     *        Zamanlayıcı açılamazsa period olaylarıyla devam edilir.
+     * 
+     * @param enable : true ise zamanlayıcı ile uyanma
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     */
+    int setTimerWakeup(bool enable);
+
+    /**
+     * @brief Sonraki bağlantılar için donanım parametre önbelleğinin
+     *        dosyasını ayarlar. Dosyadaki sonuçlarla cihaz açılışında
+     *        parametre araması atlanır. Yeni öğrenilen sonuçlar bağlantı
+     *        kesilirken dosyaya eklenir.
+     * 
+     * @param path : Önbellek dosyası, boş ise dosya kullanılmaz
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     */
+    int setHwParamsCache(const std::string &path);
+
+    /**
+     * @brief Sonraki bağlantılar için saat kayması profilinin dosyasını
+     *        ayarlar. Cihaz çiftinin kayıtlı kayması ile oran denetimi
+     *        baştan doğru değerle başlar. Ölçülen kayma bağlantı
+     *        kesilirken dosyaya yazılır.
+     * 
+     * @param path : Profil dosyası, boş ise dosya kullanılmaz
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     */
+    int setDriftProfile(const std::string &path);
+
+    /**
+     * @brief Meşgul bekleme sayaçlarını döner. Yoklamaya harcanan CPU
+     *        payı spin_time / wall_time ile bulunur.
+     * 
+     * @param stats : Yoklama süresi, geçen süre (us), bütçesi biten
+     *                yoklamalar ve ölçülen en yüksek gecikme (us)
+     * @return true 
+     * @return false loop cihaz bağlı değil
+     */
+    bool getBusyPollStats(struct loopback_busy_stats &stats) const;
+
+    /**
+     * @brief Sonraki bağlantılar için yazılım kazancını ayarlar. Kazanç
+     *        capture'dan playback'e kopyalama sırasında uygulanır,
+     *        ayrıca bir tampon geçişi gerektirmez. 1.0 kazançta hiç
+     *        işlem yapılmaz. Bağlantı sırasında changeParameter ile
+     *        LOOP_CMD_GAIN gönderilerek değiştirilir.
+     * 
+     * @param gain : Doğrusal kazanç (0 - 16.0), 1.0 - değiştirmeden
+     * @param rampMs : Kazanç değişikliğinin yayılacağı süre (ms, en fazla
+     *                 1000), 0 - anında
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     *             : -1 - geçersiz parametre
+     */
+    int setSoftGain(float gain, unsigned int rampMs = 10);
+
+    /**
+     * @brief Sonraki bağlantılar için sessizlik algılamayı ayarlar. Capture
+     *        tarafından holdMs boyunca yalnızca dijital sessizlik gelirse
+     *        format dönüşümü, kanal yönlendirmesi ve resampler atlanır,
+     *        playback tamponuna doğrudan sessizlik yazılır. Ses geldiğinde
+     *        resampler sıfırlanarak normal işlemeye dönülür.
+     * 
+     * @param holdMs : Atlamaya geçmeden önce beklenen sessizlik süresi
+     *                 (ms), 0 - kapalı
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     */
+    int setSilenceBypass(unsigned int holdMs);
+
+    /**
+     * @brief Sessizlik algılama sayaçlarını ve kazanılan işlemci süresini
+     *        döner.
+     * 
+     * @param stats : Atlanan ve işlenen frame sayıları ile süreleri (ns)
+     * @return long long : Atlanan frame'lerin ölçülen işleme maliyetinden
+     *                     atlama süresi çıkarılarak bulunan kazanç (us),
+     *                     bağlantı yoksa 0
+     */
+    long long getSilenceStats(struct loopback_silence_stats &stats) const;
+
+    /**
+     * @brief Sonraki bağlantılar için DSP zincirinin sonuna bir eklenti
+     *        ekler. Eklenti her loop için bağlantı kurulurken açılır,
+     *        capture'dan playback'e kopyalanan tampon parçaları üzerinde
+     *        yerinde çalışır. Zincir boşsa hiç işlem yapılmaz.
+     * 
+     * @param ops : Eklenti fonksiyonları, bağlantı süresince geçerli
+     *              kalmalıdır
+     * @param arg : Eklentinin open fonksiyonuna verilen parametre
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     *             : -1 - geçersiz eklenti ya da zincir dolu (LOOP_DSP_MAX)
+     */
+    int addDspPlugin(const struct loopback_dsp_ops *ops, void *arg = NULL);
+
+    /**
+     * @brief Sonraki bağlantılar için DSP zincirini boşaltır.
+     * 
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     */
+    int clearDspPlugins();
+
+    /**
+     * @brief Zincirdeki bir eklentinin loop thread'inde harcadığı süreyi
+     *        döner.
+     * 
+     * @param index : Eklentinin zincirdeki sırası (0 - ilk eklenen)
+     * @param stats : Çağrı, frame sayıları ve süreler (ns)
+     * @return true : Eklenti bulundu
+     * @return false : Bağlantı ya da eklenti yok
+     */
+    bool getDspStats(unsigned int index, struct loopback_dsp_stats &stats) const;
+
+    /**
+     * @brief Bağlantı sırasında bir yönden geçen sesi WAV dosyasına
+     *        kaydetmeye başlar. Loop thread'i yalnızca bir halkaya kopyalar,
+     *        dosya ayrı bir thread'de yazılır. Halka dolarsa frame'ler
+     *        kaybolur ve sayılır. 4 GiB'ı aşan dosyalar RF64 olarak
+     *        kapatılır.
+     * 
+     * @param stream : SND_PCM_STREAM_CAPTURE - loop cihazdan okunan ses
+     *               : SND_PCM_STREAM_PLAYBACK - gerçek cihaza yazılan ses
+     * @param path : Uzantısız dosya adı, path.wav ya da döngüde
+     *               path.0.wav ... path.(files - 1).wav
+     * @param maxFileBytes : Bir dosyadaki en fazla ses verisi (byte),
+     *                       dolunca sıradaki dosyaya geçilir, 0 - sınırsız
+     * @param files : Döngüdeki dosya sayısı, en eski dosyanın üzerine
+     *                yazılır
+     * @return int : 0 - başarılı
+     *             : 1 - loop cihaz bağlı değil
+     *             : -1 - kayıt zaten açık ya da başlatılamadı
+     */
+    int startRecording(snd_pcm_stream_t stream, const std::string &path,
+                       unsigned long long maxFileBytes = 0,
+                       unsigned int files = 1);
+
+    /**
+     * @brief Kaydı durdurur, halkada kalan ses dosyaya yazılıp dosya
+     *        kapatılır.
+     * 
+     * @param stream : Kaydı durdurulacak yön
+     * @return int : 0 - başarılı
+     *             : 1 - loop cihaz bağlı değil
+     *             : -1 - bu yönde kayıt yok
+     */
+    int stopRecording(snd_pcm_stream_t stream);
+
+    /**
+     * @brief Çalışan ya da en son durdurulan kaydın sayaçlarını döner.
+     * 
+     * @param stream : Kayıt yönü
+     * @param stats : Yazılan ve kaybolan frame sayıları, dosya sayısı
+     * @return true : Kayıt çalışıyor
+     * @return false : Kayıt ya da bağlantı yok
+     */
+    bool getRecordingStats(snd_pcm_stream_t stream,
+                           struct loopback_tap_stats &stats) const;
+
+    /**
+     * @brief Sonraki bağlantılar için boşta bekleme modunu ayarlar. Loop
+     *        cihazının playback tarafında çalan client kalmadığında
+     *        ("PCM Slave Active" kontrolü) stream'ler durdurulur ve thread
+     *        yalnızca kontrol olaylarında uyanır. Client yeniden başladığında
+     *        stream'ler kendiliğinden başlatılır.
+     * 
+     * @param enable : true ise boşta bekleme açık
+     * @param delayMs : Client durduktan sonra beklemeye geçmeden önceki
+     *                  süre (ms), 0 - gecikmenin 3 katı
+     * @param resumeMs : İzin verilen en uzun geri dönüş süresi (ms). Gerçek
+     *                   cihazın açılma süresi bu sürenin altındaysa cihaz
+     *                   beklerken kapatılır. 0 - cihaz açık tutulur.
+     * @return int : 0 - başarılı
+     *             : 2 - loop cihaz zaten bağlı
+     */
+    int setIdleParking(bool enable, unsigned int delayMs = 0,
+                       unsigned int resumeMs = 0);
+
+    /**
+     * @brief Boşta bekleme sayaçlarını döner. Boşta saniye başına uyanma
+     *        idle_wakeups / idle_time ile bulunur.
+     * 
+     * @param stats : Bekleme sayısı, beklerken geçen süre (us), beklerken
+     *                uyanma sayısı ve geri dönüş süreleri (us)
+     * @return true 
+     * @return false loop cihaz bağlı değil
+     */
+    bool getIdleStats(struct loopback_park_stats &stats) const;
+
+    /**
+     * @brief Sıcak cihaz havuzunu ayarlar. Havuz açıkken disconnect ile
+     *        bırakılan cihazlar ttlMs boyunca açık ve hazır tutulur, aynı
+     *        cihaza yeniden bağlanıldığında açma adımları atlanır.
+     *        Havuz tüm loop cihazları için ortaktır, ayar hemen geçerli olur.
+     * 
+     * @param ttlMs : Boşta kalan cihazın açık tutulacağı süre (ms),
+     *                0 - havuz kapalı, bekleyen cihazlar kapatılır
+     * @param keepParams : true ise hw parametreleri de uygulanmış kalır,
+     *                     aynı ayarla bağlanınca yeniden anlaşılmaz
+     * @return int : 0 - başarılı
+     *             : -1 - süre çok uzun (en fazla 1 saat)
+     */
+    int setWarmPool(unsigned int ttlMs, bool keepParams = true);
+
+    /**
+     * @brief Sıcak cihaz havuzunun sayaçlarını ve isabet oranını döner.
+     * 
+     * @param stats : Havuz sayaçları, saved_time bağlantılarda kazanılan
+     *                toplam süredir (us)
+     * @return double : Havuzdan alınan cihazların oranı (0.0 - 1.0),
+     *                  hiç cihaz açılmadıysa 0
+     */
+    double getWarmPoolStats(struct loopback_pool_stats &stats) const;
+
+    /**
+     * @brief Bağlantı kopartılmadan bir parametreyi değiştirir. Değişiklik
+     *        loop thread'lerine komut kuyruğu ile iletilir ve bir sonraki
+     *        period sınırında uygulanır. Gecikme, senkronizasyon tipi ve
+     *        resampler kalitesi değişiklikleri yalnızca stream'leri yeniden
+     *        başlatır.
+     * 
+     * @param type : LOOP_CMD_LATENCY - gecikme (us)
+     *             : LOOP_CMD_SYNC - senkronizasyon tipi (sync_type_t)
+     *             : LOOP_CMD_GAIN - kazanç (0 - 16.0), mixer
+     *               girişinde mixer kazancı, diğer bağlantılarda yazılım
+     *               kazancı rampa ile değişir
+     *             : LOOP_CMD_SRC_QUALITY - resampler kalitesi (SRC_*)
+     *             : LOOP_CMD_XRUN - xrun profili açık (1) / kapalı (0)
+     * @param value : Yeni değer
+     * @return int : 0 - başarılı
+     *             : 1 - loop cihaz bağlı değil
+     *             : -1 - geçersiz parametre ya da komut kuyruğu dolu
+     */
+    int changeParameter(loop_cmd_type_t type, double value);
+
+    /**
+     * @brief Gerçek cihaz ile loop cihaz bağlantısı kopartılır.
+     *        Thread'ler poll içinde beklerken eventfd ile uyandırılır,
+     *        kapanma bir period içinde tamamlanır.
+     * 
+     * @param fadeMs : Kapanmadan önce sesin kısılacağı süre (en fazla
+     *                 100 ms), 0 - kısmadan kapat
      * @return int : 0 - başarılı
      *             : diğer - başarısız
      */
-    int disconnect();
+    int disconnect(unsigned int fadeMs = 0);
 
     /**
      * @brief Loop cihazının capture alt cihazının ismi döner.
@@ -87,6 +478,7 @@ public:
 
     /**
      * @brief Bu Loop cihazının bağlantı kurduğu gerçek cihaz adı döner.
+     *        Birden fazla gerçek cihaza bağlıysa ilki döner.
      *        Bu fonksiyon connection varsa değer döndürür. 
      *        Bu nedenle geri dönüş değeri kontrol edildikten sonra 
      *        string okunmalıdır.
@@ -97,6 +489,22 @@ public:
      */
     bool getRealDevName(std::string &realDevName) const;
 
+    /**
+     * @brief Bağlantının tamponları için ayrılan, kilitli ve sayfaları
+     *        önceden yüklenmiş bellek miktarını döner.
+     * 
+     * @return size_t : byte cinsinden bellek, bağlantı yoksa 0
+     */
+    size_t getMemoryFootprint() const;
+
+    /**
+     * @brief Son disconnect çağrısında thread'lerin kapanması için geçen
+     *        süreyi döner.
+     * 
+     * @return long : mikrosaniye cinsinden süre, disconnect yapılmadıysa 0
+     */
+    long getDisconnectLatency() const;
+
     /**
      * @brief Nesne bağlantılı mı değil mi döner.
      * 
@@ -14,7 +14,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <errno.h>
+#include <limits.h>
 #include <getopt.h>
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
@@ -58,6 +62,17 @@ static void myExit(struct loopbackThread *thread, int exitcode)
 	exit(exitcode);
 }
 
+/* the hot fields of the loop structures start on a cache line */
+static void *callocAligned(size_t size)
+{
+	void *ptr;
+
+	if (posix_memalign(&ptr, LOOP_CACHELINE, size) != 0)
+		return NULL;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
 static int createLoopbackHandle(struct loopback_handle **_handle,
 				  				const char *device,
 				  				const char *ctldev,
@@ -66,7 +81,7 @@ static int createLoopbackHandle(struct loopback_handle **_handle,
 	char idbuf[1024];
 	struct loopback_handle *handle;
 
-	handle = (struct loopback_handle *) calloc(1, sizeof(*handle));
+	handle = (struct loopback_handle *) callocAligned(sizeof(*handle));
 	if (handle == NULL)
 		return -ENOMEM;
 	if (device == NULL)
@@ -100,7 +115,7 @@ static int createLoopback(struct loopback **_handle,
 {
 	struct loopback *handle;
 
-	handle = (struct loopback *) calloc(1, sizeof(*handle));
+	handle = (struct loopback *) callocAligned(sizeof(*handle));
 	if (handle == NULL)
 		return -ENOMEM;
 	handle->play = play;
@@ -113,6 +128,8 @@ static int createLoopback(struct loopback **_handle,
 	handle->loop_limit = ~0ULL;
 	handle->output = output;
 	handle->state = output;
+	handle->timer_card = -1;
+	handle->wake_fd = -1;
 #ifdef USE_SAMPLERATE
 	handle->src_enable = 1;
 	handle->src_converter_type = SRC_SINC_BEST_QUALITY;
@@ -121,28 +138,138 @@ static int createLoopback(struct loopback **_handle,
 	return 0;
 }
 
-static void setScheduler(void)
+/* SCHED_DEADLINE runtime is this part of the period */
+#define SCHED_DEADLINE_SHARE	4
+
+/* struct sched_attr, glibc has no wrapper for sched_setattr() */
+struct loop_sched_attr
+{
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static const char *schedName(int policy)
+{
+	switch (policy) 
+	{
+	case SCHED_OTHER:	return "Other";
+	case SCHED_FIFO:	return "FIFO";
+	case SCHED_RR:		return "Round Robin";
+	case SCHED_DEADLINE:	return "Deadline";
+	default:		return "Unknown";
+	}
+}
+
+static int setDeadline(unsigned long long period_ns)
+{
+#ifdef SYS_sched_setattr
+	struct loop_sched_attr attr;
+
+	if (period_ns == 0)
+		return -EINVAL;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	attr.sched_runtime = period_ns / SCHED_DEADLINE_SHARE;
+	attr.sched_deadline = period_ns;
+	attr.sched_period = period_ns;
+	if (syscall(SYS_sched_setattr, 0, &attr, 0) < 0)
+		return -errno;
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+/*
+ * Apply the scheduling settings to the calling thread. period_ns is the
+ * period of the thread, it is used by SCHED_DEADLINE only.
+ */
+int setScheduler(const struct loopback_sched *sched, unsigned long long period_ns)
 {
 	struct sched_param sched_param;
+	int err = 0, err1;
 
-	if (sched_getparam(0, &sched_param) < 0)
+	if (sched->mlock && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) 
 	{
-		logit(LOG_WARNING, "Scheduler getparam failed.\n");
-		return;
+		err = -errno;
+		logit(LOG_WARNING, "Unable to lock memory: %s\n", strerror(errno));
+	}
+	/* the kernel refuses SCHED_DEADLINE for a thread with a restricted affinity */
+	if (sched->affinity && sched->policy == SCHED_DEADLINE) 
+	{
+		logit(LOG_WARNING, "CPU affinity 0x%llx ignored for Deadline scheduling\n", sched->affinity);
 	}
-	sched_param.sched_priority = sched_get_priority_max(SCHED_RR);
-	if (!sched_setscheduler(0, SCHED_RR, &sched_param)) 
+	else if (sched->affinity) 
 	{
+		cpu_set_t cpus;
+		unsigned int cpu;
+
+		CPU_ZERO(&cpus);
+		for (cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; cpu++)
+			if (sched->affinity & (1ULL << cpu))
+				CPU_SET(cpu, &cpus);
+		err1 = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (err1 != 0) 
+		{
+			err = -err1;
+			logit(LOG_WARNING, "Unable to set CPU affinity 0x%llx: %s\n", sched->affinity, strerror(err1));
+		}
+	}
+	if (sched->policy < 0)
+		return err;
+	if (sched->policy == SCHED_DEADLINE) 
+	{
+		err1 = setDeadline(period_ns);
+		if (err1 < 0) 
+		{
+			logit(LOG_WARNING, "Scheduler set to Deadline with period %lluns failed: %s\n", period_ns, strerror(-err1));
+			return err1;
+		}
 		if (verbose)
-			logit(LOG_WARNING, 
-				"Scheduler set to Round Robin with priority %i\n", 
-				sched_param.sched_priority);
-		return;
+			logit(LOG_INFO, "Scheduler set to Deadline with runtime %lluns, period %lluns\n", period_ns / SCHED_DEADLINE_SHARE, period_ns);
+		return err;
+	}
+	memset(&sched_param, 0, sizeof(sched_param));
+	if (sched->policy == SCHED_FIFO || sched->policy == SCHED_RR)
+		sched_param.sched_priority = sched->priority > 0 ? sched->priority :
+						sched_get_priority_max(sched->policy);
+	if (sched_setscheduler(0, sched->policy, &sched_param) < 0) 
+	{
+		err1 = -errno;
+		logit(LOG_WARNING, "Scheduler set to %s with priority %i failed: %s\n",
+			schedName(sched->policy), sched_param.sched_priority, strerror(errno));
+		return err1;
 	}
 	if (verbose)
-		logit(LOG_INFO, 
-			"!!!Scheduler set to Round Robin with priority %i FAILED!\n", 
-			sched_param.sched_priority);
+		logit(LOG_INFO, "Scheduler set to %s with priority %i\n",
+			schedName(sched->policy), sched_param.sched_priority);
+	return err;
+}
+
+/* the shortest period of the loops in the thread, in ns */
+static unsigned long long threadPeriod(struct loopbackThread *thread)
+{
+	unsigned long long period, min = 0;
+	struct loopback_handle *lhandle;
+	int i;
+
+	for (i = 0; i < thread->loopbacks_count; i++) 
+	{
+		lhandle = thread->loopbacks[i]->play;
+		if (lhandle->rate == 0 || lhandle->period_size == 0)
+			continue;
+		period = (lhandle->period_size * 1000000000ULL) / lhandle->rate;
+		if (min == 0 || period < min)
+			min = period;
+	}
+	return min;
 }
 
 static long timeDiff(struct timeval t1, struct timeval t2)
@@ -160,33 +287,56 @@ static long timeDiff(struct timeval t1, struct timeval t2)
 	return (t1.tv_sec * 1000000) + l;
 }
 
+/* apply the queued parameter changes to all loops of the thread */
+static void threadCommands(struct loopbackThread *thread)
+{
+	struct loopback_cmd cmd;
+	int i, err;
+
+	cmdq_clear_event(&thread->cmdq);
+	while (cmdq_pop(&thread->cmdq, &cmd)) 
+	{
+		for (i = 0; i < thread->loopbacks_count; i++) 
+		{
+			err = pcmjob_command(thread->loopbacks[i], &cmd);
+			if (err < 0)
+				logit(LOG_WARNING, "%s: command %i failed: %s\n", thread->loopbacks[i]->id, cmd.type, strerror(-err));
+		}
+	}
+}
+
 void * AlsaLoop::threadJob1(void *_data)
 {
 	struct loopbackThread *thread = (struct loopbackThread *) _data;
 	snd_output_t *output = thread->output;
 	struct pollfd *pfds = NULL;
 	int pfds_count = 0;
-	int i, j, err, wake = 1000000;
+	int i, j, err, wake = 1000000, timeout;
+	long busy;
 
 	std::cout << "Thread Entered" << std::endl;
 
-	setScheduler();
-
 	for (i = 0; i < thread->loopbacks_count; i++) 
 	{
 		err = pcmjob_init(thread->loopbacks[i]);
 		if (err < 0) 
 		{
 			logit(LOG_CRIT, "Loopback initialization failure.\n");
+			reportState(0, 0, err);
 			myExit(thread, EXIT_FAILURE);
 		}
 	}
+	reportState(1, 0, 0);
+	waitGate();
+	if (quit)
+		myExit(thread, EXIT_SUCCESS);
 	for (i = 0; i < thread->loopbacks_count; i++) 
 	{
 		err = pcmjob_start(thread->loopbacks[i]);
 		if (err < 0) 
 		{
 			logit(LOG_CRIT, "Loopback start failure.\n");
+			reportState(0, 0, err);
 			myExit(thread, EXIT_FAILURE);
 		}
 		pfds_count += thread->loopbacks[i]->pollfd_count;
@@ -194,9 +344,17 @@ void * AlsaLoop::threadJob1(void *_data)
 		if (j > 0 && j < wake)
 			wake = j;
 	}
+	reportState(0, 1, 0);
+	/* the period is known now, the loops of one thread share the settings */
+	err = setScheduler(&thread->loopbacks[0]->sched, threadPeriod(thread));
+	if (err < 0)
+		logit(LOG_CRIT, "%s: thread scheduling not applied: %s\n", thread->loopbacks[0]->id, strerror(-err));
+	/* the ctl events of the loop are routed by the demux thread */
+	ctlmux_sched(&thread->loopbacks[0]->sched);
 	if (wake >= 1000000)
 		wake = -1;
-	pfds = (pollfd *) calloc(pfds_count, sizeof(struct pollfd));
+	/* the last descriptor is the command queue */
+	pfds = (pollfd *) calloc(pfds_count + 1, sizeof(struct pollfd));
 	if (pfds == NULL || pfds_count <= 0) 
 	{
 		logit(LOG_CRIT, "Poll FDs allocation failed.\n");
@@ -215,9 +373,39 @@ void * AlsaLoop::threadJob1(void *_data)
 			}
 			j += err;
 		}
+		pfds[j].fd = thread->cmdq.event_fd;
+		pfds[j].events = POLLIN;
+		pfds[j].revents = 0;
+		busy = -1;
+		for (i = 0; i < thread->loopbacks_count; i++) 
+		{
+			long t = pcmjob_busy_timeout(thread->loopbacks[i]);
+			if (t >= 0 && (busy < 0 || t < busy))
+				busy = t;
+		}
+		if (busy >= 0 && wake >= 0 && busy > wake * 1000L)
+			busy = wake * 1000L;
+		/* parked loops wait for control events only */
+		timeout = -1;
+		for (i = 0; i < thread->loopbacks_count; i++) 
+		{
+			if (!thread->loopbacks[i]->parked)
+			{
+				timeout = wake;
+				break;
+			}
+		}
 		if (verbose > 10)
 			gettimeofday(&tv1, NULL);
-		err = poll(pfds, j, wake);
+		if (busy >= 0) 
+		{
+			struct timespec ts;
+			ts.tv_sec = busy / 1000000;
+			ts.tv_nsec = (busy % 1000000) * 1000;
+			err = ppoll(pfds, j + 1, &ts, NULL);
+		}
+		else
+			err = poll(pfds, j + 1, timeout);
 		if (err < 0)
 			err = -errno;
 		if (verbose > 10) 
@@ -232,9 +420,12 @@ void * AlsaLoop::threadJob1(void *_data)
 			logit(LOG_CRIT, "Poll failed: %s\n", strerror(-err));
 			myExit(thread, EXIT_FAILURE);
 		}
+		if (pfds[j].revents & POLLIN)
+			threadCommands(thread);
 		for (i = j = 0; i < thread->loopbacks_count; i++) 
 		{
 			struct loopback *loop = thread->loopbacks[i];
+			pcmjob_busy_spin(loop);
 			if (j < loop->active_pollfd_count)
 			 {
 				err = pcmjob_pollfds_handle(loop, &pfds[j]);
@@ -248,17 +439,110 @@ void * AlsaLoop::threadJob1(void *_data)
 		}
 	}
 
+	if (quit_fade > 0) 
+	{
+		for (i = 0; i < thread->loopbacks_count; i++)
+			pcmjob_fade_out(thread->loopbacks[i], quit_fade);
+	}
+	free(pfds);
 	myExit(thread, EXIT_SUCCESS);
 }
 
+/* progress of the threads, err < 0 marks a failed thread */
+void AlsaLoop::reportState(int opened, int started, int err)
+{
+	pthread_mutex_lock(&ready_lock);
+	ready_opened += opened;
+	ready_started += started;
+	if (err < 0 && ready_err == 0)
+		ready_err = err;
+	pthread_cond_broadcast(&ready_cond);
+	pthread_mutex_unlock(&ready_lock);
+}
+
+/* hold the opened devices until openGate(), quit releases the threads too */
+void AlsaLoop::waitGate()
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&ready_lock);
+	while (start_gate && !quit) 
+	{
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 100000000;
+		if (ts.tv_nsec >= 1000000000) 
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&ready_cond, &ready_lock, &ts);
+	}
+	pthread_mutex_unlock(&ready_lock);
+}
+
+void AlsaLoop::openGate()
+{
+	pthread_mutex_lock(&ready_lock);
+	start_gate = 0;
+	pthread_cond_broadcast(&ready_cond);
+	pthread_mutex_unlock(&ready_lock);
+}
+
+/*
+ * wait until *count reaches the number of threads or a thread fails,
+ * -ENODEV when the connection is torn down before or while waiting
+ */
+int AlsaLoop::waitThreads(int *count, int timeout)
+{
+	struct timespec ts;
+	int err = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000;
+	ts.tv_nsec += (timeout % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000) 
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&ready_lock);
+	while (*count < threads_count && ready_err == 0 && err == 0 && !quit)
+		err = -pthread_cond_timedwait(&ready_cond, &ready_lock, &ts);
+	if (ready_err < 0)
+		err = ready_err;
+	else if (threads_count == 0 || quit)
+		err = -ENODEV;
+	pthread_mutex_unlock(&ready_lock);
+	return err;
+}
+
+int AlsaLoop::waitOpened(int timeout)
+{
+	return waitThreads(&ready_opened, timeout);
+}
+
+int AlsaLoop::waitReady(int timeout)
+{
+	return waitThreads(&ready_started, timeout);
+}
+
+/* the array is sized for arg_default_loops once, it is kept for reconnects */
 void AlsaLoop::addLoop(struct loopback *loop)
 {
-	loopbacks = (struct loopback **) realloc(loopbacks, (loopbacks_count + 1) *
-						sizeof(struct loopback *));
-	if (loopbacks == NULL) 
+	int count;
+
+	if (loopbacks_count >= loopbacks_alloc) 
 	{
-		logit(LOG_CRIT, "No enough memory\n");
-		exit(EXIT_FAILURE);
+		count = arg_default_loops > loopbacks_count ?
+				arg_default_loops : loopbacks_count * 2;
+		loopbacks = (struct loopback **) realloc(loopbacks, count *
+							sizeof(struct loopback *));
+		if (loopbacks == NULL) 
+		{
+			logit(LOG_CRIT, "No enough memory\n");
+			exit(EXIT_FAILURE);
+		}
+		loopbacks_alloc = count;
 	}
 	loopbacks[loopbacks_count++] = loop;
 }
@@ -274,7 +558,9 @@ bool AlsaLoop::initConnection(char * realDev, char * loopDev, snd_output_t *outp
 	unsigned int arg_latency_req = 0;
 	unsigned int arg_latency_reqtime = 300000;
 	snd_pcm_format_t arg_format = SND_PCM_FORMAT_S16_LE;
-	unsigned int arg_channels = 2;
+	unsigned int arg_channels = arg_default_channels;
+	unsigned int arg_route_channels = arg_default_route_channels;
+	const float *arg_route = arg_default_route;
 	unsigned int arg_rate = 48000;
 	snd_pcm_uframes_t arg_buffer_size = 0;
 	snd_pcm_uframes_t arg_period_size = 0;
@@ -287,7 +573,7 @@ bool AlsaLoop::initConnection(char * realDev, char * loopDev, snd_output_t *outp
 #endif
 	int arg_sync = SYNC_TYPE_AUTO;
 	int arg_slave = SLAVE_TYPE_AUTO;
-	int arg_thread = 0;
+	int arg_thread = arg_default_split ? loopbacks_count : 0;
 	struct loopback *loop = NULL;
 	char *arg_mixers[MAX_MIXERS];
 	int arg_mixers_count = 0;
@@ -295,6 +581,22 @@ bool AlsaLoop::initConnection(char * realDev, char * loopDev, snd_output_t *outp
 	int arg_ossmixers_count = 0;
 	int arg_xrun = arg_default_xrun;
 	int arg_wake = arg_default_wake;
+	int arg_mix = arg_default_mix;
+	float arg_mix_gain = arg_default_mix_gain;
+	int arg_split = arg_default_split;
+	const char *arg_hwcache = arg_default_hwcache;
+	const char *arg_drift = arg_default_drift;
+	int arg_timer_lock = arg_default_timer_lock;
+	int arg_wake_timer = arg_default_wake_timer;
+	unsigned int arg_busy_spin = arg_default_busy_spin;
+	unsigned int arg_busy_lead = arg_default_busy_lead;
+	int arg_park = arg_default_park;
+	unsigned int arg_park_delay = arg_default_park_delay;
+	unsigned int arg_park_resume = arg_default_park_resume;
+	unsigned int arg_silence_hold = arg_default_silence_hold;
+	float arg_soft_gain = arg_default_soft_gain;
+	unsigned int arg_gain_ramp = arg_default_gain_ramp;
+	struct loopback_sched arg_sched;
 
 	struct loopback_handle *play;
 	struct loopback_handle *capt;
@@ -320,11 +622,15 @@ bool AlsaLoop::initConnection(char * realDev, char * loopDev, snd_output_t *outp
 	
 	play->format = capt->format = arg_format;
 	play->rate = play->rate_req = capt->rate = capt->rate_req = arg_rate;
-	play->channels = capt->channels = arg_channels;
+	capt->channels = arg_channels;
+	play->channels = arg_route_channels ? arg_route_channels : arg_channels;
 	play->buffer_size_req = capt->buffer_size_req = arg_buffer_size;
 	play->period_size_req = capt->period_size_req = arg_period_size;
 	play->resample = capt->resample = arg_resample;
 	play->nblock = capt->nblock = arg_nblock ? 1 : 0;
+	play->mix = arg_mix ? 1 : 0;
+	play->mix_gain = arg_mix_gain;
+	capt->split = arg_split ? 1 : 0;
 	loop->latency_req = arg_latency_req;
 	loop->latency_reqtime = arg_latency_reqtime;
 	loop->sync = (sync_type_t) arg_sync;
@@ -332,27 +638,82 @@ bool AlsaLoop::initConnection(char * realDev, char * loopDev, snd_output_t *outp
 	loop->thread = arg_thread;
 	loop->xrun = arg_xrun;
 	loop->wake = arg_wake;
+	loop->timer_lock = arg_timer_lock ? 1 : 0;
+	loop->wake_timer = arg_wake_timer ? 1 : 0;
+	loop->busy_spin = arg_busy_spin;
+	loop->busy_lead = arg_busy_lead;
+	loop->park = arg_park ? 1 : 0;
+	loop->park_delay = arg_park_delay;
+	loop->park_resume = arg_park_resume;
+	loop->silence_hold = arg_silence_hold;
+	loop->soft_gain = arg_soft_gain;
+	loop->gain = arg_soft_gain;
+	loop->gain_ramp_time = arg_gain_ramp;
+	loop->gain_format = -1;
+	arg_sched.policy = arg_default_sched_policy;
+	arg_sched.priority = arg_default_sched_priority;
+	arg_sched.affinity = arg_default_sched_affinity;
+	arg_sched.mlock = arg_default_sched_mlock ? 1 : 0;
+	loop->sched = arg_sched;
+	loop->route_channels = arg_route_channels;
+	if (arg_route) 
+	{
+		size_t size = play->channels * capt->channels * sizeof(float);
+
+		loop->route_coef = (float *) malloc(size);
+		if (loop->route_coef == NULL) 
+		{
+			logit(LOG_CRIT, "No enough memory\n");
+			return false;
+		}
+		memcpy(loop->route_coef, arg_route, size);
+	}
+	/* every loop has its own plugin instances, opened here and not on the loop thread */
+	if (arg_default_dsp_count > 0)
+	{
+		err = dsp_create(&loop->dsp, arg_default_dsp, arg_default_dsp_count);
+		if (err < 0)
+		{
+			logit(LOG_CRIT, "Unable to create the DSP chain: %s\n", strerror(-err));
+			free(loop->route_coef);
+			loop->route_coef = NULL;
+			return false;
+		}
+	}
 
 #ifdef USE_SAMPLERATE
 	loop->src_enable = arg_samplerate > 0;
 	if (loop->src_enable)
 		loop->src_converter_type = arg_samplerate - 1;
 #endif
+	if (arg_hwcache && hwcache_load(arg_hwcache) < 0)
+		logit(LOG_WARNING, "hw params cache %s not used\n", arg_hwcache);
+	if (arg_drift && drift_load(arg_drift) < 0)
+		logit(LOG_WARNING, "drift profile %s not used\n", arg_drift);
 	addLoop(loop);
 	return true;
 }
 
-typedef void * (*THREADFUNCPTR)(void *);
+static void *threadStart(void *_data)
+{
+	struct loopbackThread *thread = (struct loopbackThread *) _data;
+
+	return thread->alsaLoop->threadJob1(thread);
+}
 
 void AlsaLoop::threadJob(struct loopbackThread *thread)
 {
+	int err;
+
 	if (!thread->threaded) 
 	{
 		threadJob1(thread);
 		return;
 	}
 
-	pthread_create(&thread->thread, NULL, (THREADFUNCPTR) &AlsaLoop::threadJob1, thread);
+	err = pthread_create(&thread->thread, NULL, threadStart, thread);
+	if (err != 0)
+		logit(LOG_CRIT, "Unable to create loop thread: %s\n", strerror(err));
 }
 
 int AlsaLoop::sortThreads(snd_output_t * output)
@@ -382,7 +743,7 @@ int AlsaLoop::sortThreads(snd_output_t * output)
 			j = loopbacks[i]->thread;
 	}
 	j += 1;
-	threads = (struct loopbackThread *) calloc(1, sizeof(struct loopbackThread) * j);
+	threads = (struct loopbackThread *) callocAligned(sizeof(struct loopbackThread) * j);
 	if (threads == NULL) 
 	{
 		logit(LOG_CRIT, "No enough memory\n");
@@ -396,42 +757,48 @@ int AlsaLoop::sortThreads(snd_output_t * output)
 				l++;
 		threads[k].loopbacks = (struct loopback **) malloc(l * sizeof(struct loopback *));
 		threads[k].loopbacks_count = l;
+		threads[k].alsaLoop = this;
 		threads[k].output = output;
 		threads[k].threaded = j > 0;
+		if (cmdq_init(&threads[k].cmdq) < 0) 
+		{
+			logit(LOG_CRIT, "Unable to create command queue: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
 		for (i = l = 0; i < loopbacks_count; i++)
 			if (loopbacks[i]->thread == k)
 				threads[k].loopbacks[l++] = loopbacks[i];
 	}
 	threads_count = j;
 	main_job = pthread_self();
+	pthread_mutex_lock(&ready_lock);
+	ready_opened = ready_started = ready_err = 0;
+	pthread_mutex_unlock(&ready_lock);
+	createArena();
 
 	return j;
 }
 
-void AlsaLoop::sendToAll(int sig)
-{
-	struct loopbackThread *thread;
-	int i;
-
-	for (i = 0; i < threads_count; i++) 
-	{
-		thread = &threads[i];
-		if (thread->threaded)
-		{
-			pthread_kill(thread->thread, sig);
-		}
-	}
-}
-
 void AlsaLoop::signalHandler(int sig)
 {
-	quit = 1;
-	sendToAll(SIGUSR2);
+	setQuit();
 }
 
+/*
+ * The threads sleep in poll with the command queue descriptor in their
+ * set, waking them through it needs no signal handler and no mask.
+ */
 void AlsaLoop::setQuit()
 {
-    quit = 1;
+	int i;
+
+	__atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < threads_count; i++)
+		cmdq_wake(&threads[i].cmdq);
+	/* a connect still waiting for the threads gives up */
+	pthread_mutex_lock(&ready_lock);
+	pthread_cond_broadcast(&ready_cond);
+	pthread_mutex_unlock(&ready_lock);
 }
 
 void AlsaLoop::clearQuit()
@@ -455,8 +822,270 @@ void AlsaLoop::joinFromThreads()
 	}
 }
 
+/*
+ * Reserve the buffers of all loops at connect time, so the loop threads
+ * do not fault in fresh pages while the streams run. Every thread gets
+ * its own arena, the allocations need no lock.
+ */
+void AlsaLoop::createArena()
+{
+	struct loopbackThread *thread;
+	size_t size;
+	int i, k, err;
+
+	for (k = 0; k < threads_count; k++) 
+	{
+		thread = &threads[k];
+		if (thread->arena == NULL) 
+		{
+			for (i = 0, size = 0; i < thread->loopbacks_count; i++)
+				size += pcmjob_arena_size(thread->loopbacks[i]);
+			err = arena_create(&thread->arena, size, arena_lock);
+			if (err < 0)
+				logit(LOG_WARNING, "Loop buffer arena not available: %s\n", strerror(-err));
+		}
+		for (i = 0; i < thread->loopbacks_count; i++)
+			thread->loopbacks[i]->arena = thread->arena;
+	}
+}
+
+size_t AlsaLoop::memoryFootprint()
+{
+	size_t size = 0;
+	int k;
+
+	for (k = 0; k < threads_count; k++)
+		if (threads[k].arena)
+			size += arena_footprint(threads[k].arena);
+	return size;
+}
+
+/* the warm device pool is shared by all loops of the process */
+void AlsaLoop::configPool(unsigned int ttl_ms, int keep_params)
+{
+	pcmpool_config(ttl_ms, keep_params);
+}
+
+void AlsaLoop::poolStats(struct loopback_pool_stats *stats)
+{
+	pcmpool_get_stats(stats);
+}
+
+void AlsaLoop::silenceStats(struct loopback_silence_stats *stats)
+{
+	struct loopback_silence_stats *s;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < loopbacks_count; i++) 
+	{
+		s = &loopbacks[i]->silence_stats;
+		stats->entries += s->entries;
+		stats->frames += s->frames;
+		stats->bypass_ns += s->bypass_ns;
+		stats->work_frames += s->work_frames;
+		stats->work_ns += s->work_ns;
+	}
+}
+
+static struct loopback_handle *tapHandle(struct loopback *loop, snd_pcm_stream_t stream)
+{
+	return stream == SND_PCM_STREAM_CAPTURE ? loop->capt : loop->play;
+}
+
+/* one tap per loop, the loops of a connection get their index appended */
+int AlsaLoop::startTap(snd_pcm_stream_t stream, const char *path,
+		       unsigned long long fileBytes, unsigned int files)
+{
+	char name[PATH_MAX];
+	int i, err;
+
+	for (i = 0; i < loopbacks_count; i++) 
+	{
+		if (loopbacks_count > 1)
+			snprintf(name, sizeof(name), "%s-%i", path, i);
+		else
+			snprintf(name, sizeof(name), "%s", path);
+		err = tap_start(tapHandle(loopbacks[i], stream), name, 0, fileBytes, files);
+		if (err < 0) 
+		{
+			logit(LOG_WARNING, "Recording tap %s not started: %s\n", name, strerror(-err));
+			while (--i >= 0)
+				tap_stop(tapHandle(loopbacks[i], stream));
+			return err;
+		}
+	}
+	return 0;
+}
+
+int AlsaLoop::stopTap(snd_pcm_stream_t stream)
+{
+	int i, err = -ENOENT;
+
+	for (i = 0; i < loopbacks_count; i++) 
+	{
+		if (tap_stop(tapHandle(loopbacks[i], stream)) == 0)
+			err = 0;
+	}
+	return err;
+}
+
+/* sum over the loops, true when a tap is running */
+bool AlsaLoop::tapStats(snd_pcm_stream_t stream, struct loopback_tap_stats *stats)
+{
+	struct loopback_tap_stats s;
+	bool running = false;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < loopbacks_count; i++) 
+	{
+		if (tap_get_stats(tapHandle(loopbacks[i], stream), &s) > 0)
+			running = true;
+		stats->frames += s.frames;
+		stats->bytes += s.bytes;
+		stats->dropped += s.dropped;
+		stats->drops += s.drops;
+		stats->files += s.files;
+		stats->write_errors += s.write_errors;
+	}
+	return running;
+}
+
+/* counters of the plugin at index summed over the loops, the longest call is the worst */
+bool AlsaLoop::dspStats(int index, struct loopback_dsp_stats *stats)
+{
+	struct loopback_dsp_stats s;
+	bool found = false;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < loopbacks_count; i++) 
+	{
+		if (dsp_get_stats(loopbacks[i]->dsp, index, &s) < 0)
+			continue;
+		stats->calls += s.calls;
+		stats->frames += s.frames;
+		stats->ns += s.ns;
+		if (s.ns_max > stats->ns_max)
+			stats->ns_max = s.ns_max;
+		stats->bypassed += s.bypassed;
+		found = true;
+	}
+	return found;
+}
+
+/* sum of the parking counters of all loops, the latencies are the worst */
+void AlsaLoop::parkStats(struct loopback_park_stats *stats)
+{
+	struct loopback_park_stats *s;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < loopbacks_count; i++) 
+	{
+		s = &loopbacks[i]->park_stats;
+		stats->parks += s->parks;
+		stats->closes += s->closes;
+		stats->idle_time += s->idle_time;
+		stats->idle_wakeups += s->idle_wakeups;
+		if (s->resume_latency > stats->resume_latency)
+			stats->resume_latency = s->resume_latency;
+		if (s->resume_latency_max > stats->resume_latency_max)
+			stats->resume_latency_max = s->resume_latency_max;
+	}
+}
+
+void AlsaLoop::busyStats(struct loopback_busy_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < loopbacks_count; i++)
+		pcmjob_busy_stats(loopbacks[i], stats);
+}
+
+/*
+ * Hand a parameter change to every loop thread. The threads apply it at
+ * their next wakeup, the caller never touches the loops.
+ */
+int AlsaLoop::postCommand(loop_cmd_type_t type, double value)
+{
+	struct loopback_cmd cmd;
+	int i, err;
+
+	cmd.type = type;
+	cmd.value = value;
+	/*
+	 * All threads or none: with the producers serialized, a queue which
+	 * has room now still has it when the command is posted.
+	 */
+	pthread_mutex_lock(&cmd_lock);
+	err = 0;
+	for (i = 0; i < threads_count; i++) 
+	{
+		if (cmdq_full(&threads[i].cmdq))
+		{
+			err = -EAGAIN;
+			logit(LOG_WARNING, "Command %i not queued: %s\n", type, strerror(-err));
+			goto __out;
+		}
+	}
+	for (i = 0; i < threads_count; i++) 
+	{
+		err = cmdq_post(&threads[i].cmdq, &cmd);
+		if (err < 0)
+			break;
+	}
+      __out:
+	pthread_mutex_unlock(&cmd_lock);
+	return err;
+}
+
+static void freeLoopbackHandle(struct loopback_handle *handle)
+{
+	free(handle->device);
+	free(handle->ctldev);
+	free(handle->id);
+	free(handle);
+}
+
+/* pcmjob_done() has released the devices and buffers already */
+static void freeLoopback(struct loopback *loop)
+{
+	drift_store(loop);
+	tap_stop(loop->play);
+	tap_stop(loop->capt);
+	freeLoopbackHandle(loop->play);
+	freeLoopbackHandle(loop->capt);
+	free(loop->route_coef);
+	dsp_destroy(loop->dsp);
+	free(loop->id);
+	free(loop);
+}
+
 void AlsaLoop::freeThreads()
 {
+	int i;
+
+	for (i = 0; i < threads_count; i++) 
+	{
+		cmdq_done(&threads[i].cmdq);
+		free(threads[i].loopbacks);
+	}
+	if (threads_count > 0)
+		snd_output_close(threads[0].output);
+	for (i = 0; i < loopbacks_count; i++)
+		freeLoopback(loopbacks[i]);
+	/* the loop threads only learn the hw params, persist them here */
+	hwcache_save();
+	for (i = 0; i < threads_count; i++)
+		arena_destroy(threads[i].arena);
 	free(threads);
+	threads = NULL;
+	pthread_mutex_lock(&ready_lock);
+	threads_count = 0;
+	pthread_cond_broadcast(&ready_cond);
+	pthread_mutex_unlock(&ready_lock);
 	loopbacks_count = 0;
 }
\ No newline at end of file
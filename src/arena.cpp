@@ -0,0 +1,301 @@
+/**
+ * @file arena.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Bir loop thread'inin tüm tamponlarının ayrıldığı, bağlantı
+ *        kurulurken kilitlenip sayfaları önceden yüklenen bellek alanı
+ *        modülü. Alan yalnızca sahibi olan thread tarafından kullanılır,
+ *        kilit almaz. Bırakılan tamponlar işletim sistemine geri
+ *        verilmez, sonraki başlatmalarda yeniden kullanılır.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+/* block descriptors, a loop uses at most four blocks */
+#define ARENA_BLOCKS		64
+/* smallest chunk added when the reserved space runs out */
+#define ARENA_CHUNK_MIN		(256 * 1024)
+
+/*
+ * One mapping of the arena. Chunks are backed by a memfd when possible,
+ * so a block can be mapped a second time as a mirrored ring without
+ * taking more memory.
+ */
+struct arena_chunk {
+	char *base;
+	size_t size;
+	size_t top;			/* carved bytes */
+	int fd;				/* -1 = anonymous memory */
+	struct arena_chunk *next;
+};
+
+struct arena_block {
+	struct arena_chunk *chunk;
+	char *ptr;
+	char *mirror;			/* mirrored alias of ptr, NULL = none */
+	size_t size;			/* whole pages */
+	unsigned int used:1;
+};
+
+/* owned by one loop thread, only reserved is read by other threads */
+struct loopback_arena {
+	struct arena_chunk *chunks;
+	struct arena_block blocks[ARENA_BLOCKS];
+	int blocks_count;
+	size_t page;
+	size_t reserved;		/* mapped bytes */
+	size_t used;			/* bytes in used blocks */
+	size_t peak;
+	unsigned long grows;		/* chunks added after the first one */
+	unsigned long fallbacks;	/* buffers the heap had to provide */
+	unsigned int lock_memory:1;
+	unsigned int locked:1;		/* all chunks are locked */
+};
+
+static size_t arena_round(struct loopback_arena *arena, size_t bytes)
+{
+	return (bytes + arena->page - 1) & ~(arena->page - 1);
+}
+
+static struct arena_chunk *arena_chunk_new(struct loopback_arena *arena,
+					   size_t size)
+{
+	struct arena_chunk *chunk;
+	int flags = MAP_SHARED | MAP_POPULATE;
+
+	chunk = (struct arena_chunk *) calloc(1, sizeof(*chunk));
+	if (chunk == NULL)
+		return NULL;
+	chunk->size = arena_round(arena, size);
+	chunk->fd = memfd_create("alsaloop-arena", MFD_CLOEXEC);
+	if (chunk->fd >= 0 && ftruncate(chunk->fd, chunk->size) < 0) {
+		close(chunk->fd);
+		chunk->fd = -1;
+	}
+	if (chunk->fd < 0)
+		flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	chunk->base = (char *) mmap(NULL, chunk->size, PROT_READ | PROT_WRITE,
+				    flags, chunk->fd, 0);
+	if (chunk->base == MAP_FAILED) {
+		if (chunk->fd >= 0)
+			close(chunk->fd);
+		free(chunk);
+		return NULL;
+	}
+	if (arena->lock_memory && mlock(chunk->base, chunk->size) < 0) {
+		if (arena->locked || arena->chunks == NULL)
+			logit(LOG_WARNING, "Unable to lock %zu bytes of loop buffers: %s\n", chunk->size, strerror(errno));
+		arena->locked = 0;
+	}
+	/* MAP_POPULATE is only a hint, touch every page */
+	memset(chunk->base, 0, chunk->size);
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	__atomic_store_n(&arena->reserved, arena->reserved + chunk->size,
+			 __ATOMIC_RELAXED);
+	return chunk;
+}
+
+/*
+ * Reserve size bytes for the loop buffers of one connection. With
+ * lock_memory the pages are locked, in any case they are faulted in now.
+ */
+int arena_create(struct loopback_arena **_arena, size_t size, int lock_memory)
+{
+	struct loopback_arena *arena;
+	long page = sysconf(_SC_PAGESIZE);
+
+	arena = (struct loopback_arena *) calloc(1, sizeof(*arena));
+	if (arena == NULL)
+		return -ENOMEM;
+	arena->page = page > 0 ? page : 4096;
+	arena->lock_memory = lock_memory ? 1 : 0;
+	arena->locked = arena->lock_memory;
+	if (arena_chunk_new(arena, size > 0 ? size : ARENA_CHUNK_MIN) == NULL) {
+		free(arena);
+		return -ENOMEM;
+	}
+	if (verbose)
+		logit(LOG_INFO, "Loop buffer arena: %zu bytes%s\n", arena->reserved, arena->locked ? ", locked" : "");
+	*_arena = arena;
+	return 0;
+}
+
+void arena_destroy(struct loopback_arena *arena)
+{
+	struct arena_chunk *chunk;
+	int i;
+
+	if (arena == NULL)
+		return;
+	for (i = 0; i < arena->blocks_count; i++)
+		if (arena->blocks[i].mirror)
+			munmap(arena->blocks[i].mirror, arena->blocks[i].size * 2);
+	while ((chunk = arena->chunks) != NULL) {
+		arena->chunks = chunk->next;
+		munmap(chunk->base, chunk->size);
+		if (chunk->fd >= 0)
+			close(chunk->fd);
+		free(chunk);
+	}
+	free(arena);
+}
+
+static struct arena_block *arena_carve(struct loopback_arena *arena,
+				       size_t size, int need_fd)
+{
+	struct arena_chunk *chunk;
+	struct arena_block *block;
+
+	if (arena->blocks_count >= ARENA_BLOCKS)
+		return NULL;
+	for (chunk = arena->chunks; chunk; chunk = chunk->next)
+		if (chunk->size - chunk->top >= size &&
+		    (!need_fd || chunk->fd >= 0))
+			break;
+	if (chunk == NULL) {
+		chunk = arena_chunk_new(arena, size > ARENA_CHUNK_MIN ?
+						size : ARENA_CHUNK_MIN);
+		if (chunk == NULL || (need_fd && chunk->fd < 0))
+			return NULL;
+		arena->grows++;
+		if (verbose)
+			logit(LOG_INFO, "Loop buffer arena grown to %zu bytes\n", arena->reserved);
+	}
+	block = &arena->blocks[arena->blocks_count++];
+	block->chunk = chunk;
+	block->ptr = chunk->base + chunk->top;
+	block->mirror = NULL;
+	block->size = size;
+	chunk->top += size;
+	return block;
+}
+
+/* the smallest free block which fits, mirrors need the exact size */
+static struct arena_block *arena_find(struct loopback_arena *arena,
+				      size_t size, int mirror)
+{
+	struct arena_block *block, *best = NULL;
+	int i;
+
+	for (i = 0; i < arena->blocks_count; i++) {
+		block = &arena->blocks[i];
+		if (block->used || block->size < size)
+			continue;
+		if (mirror && (block->size != size || block->chunk->fd < 0))
+			continue;
+		if (best == NULL || block->size < best->size ||
+		    (mirror && block->mirror && best->mirror == NULL))
+			best = block;
+	}
+	if (best == NULL)
+		best = arena_carve(arena, size, mirror);
+	return best;
+}
+
+static void arena_use(struct loopback_arena *arena, struct arena_block *block)
+{
+	block->used = 1;
+	arena->used += block->size;
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+}
+
+/* zeroed block of at least bytes, NULL when the arena cannot provide it */
+void *arena_alloc(struct loopback_arena *arena, size_t bytes)
+{
+	struct arena_block *block;
+
+	block = arena_find(arena, arena_round(arena, bytes), 0);
+	if (block == NULL)
+		return NULL;
+	arena_use(arena, block);
+	memset(block->ptr, 0, bytes);
+	return block->ptr;
+}
+
+/*
+ * Ring of bytes (whole pages) mapped twice back-to-back, see
+ * buf_mirror_map(). The second mapping shares the locked pages of the
+ * chunk, it is kept with the block for the next user.
+ */
+char *arena_alloc_mirror(struct loopback_arena *arena, size_t bytes)
+{
+	struct arena_block *block;
+	char *addr = NULL;
+
+	if (bytes % arena->page)
+		return NULL;
+	block = arena_find(arena, bytes, 1);
+	if (block == NULL)
+		return NULL;
+	if (block->mirror == NULL) {
+		off_t offset = block->ptr - block->chunk->base;
+
+		addr = (char *) mmap(NULL, bytes * 2, PROT_NONE,
+				     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED)
+			return NULL;
+		if (mmap(addr, bytes, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_FIXED | MAP_POPULATE,
+			 block->chunk->fd, offset) == MAP_FAILED ||
+		    mmap(addr + bytes, bytes, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_FIXED | MAP_POPULATE,
+			 block->chunk->fd, offset) == MAP_FAILED) {
+			munmap(addr, bytes * 2);
+			return NULL;
+		}
+		block->mirror = addr;
+	}
+	addr = block->mirror;
+	arena_use(arena, block);
+	memset(addr, 0, bytes);
+	return addr;
+}
+
+/* give the block back to the arena, -ENOENT when ptr is not from it */
+int arena_free(struct loopback_arena *arena, void *ptr)
+{
+	struct arena_block *block;
+	int i;
+
+	for (i = 0; i < arena->blocks_count; i++) {
+		block = &arena->blocks[i];
+		if (block->used && (block->ptr == ptr || block->mirror == ptr)) {
+			block->used = 0;
+			arena->used -= block->size;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+/* the caller took a buffer from the heap because the arena had none */
+void arena_fallback(struct loopback_arena *arena)
+{
+	arena->fallbacks++;
+}
+
+/* any thread */
+size_t arena_footprint(struct loopback_arena *arena)
+{
+	return __atomic_load_n(&arena->reserved, __ATOMIC_RELAXED);
+}
+
+void arena_state(struct loopback_arena *arena, snd_output_t *output)
+{
+	snd_output_printf(output, "  arena = %zu bytes%s, used = %zu, peak = %zu, blocks = %i, grows = %lu, fallbacks = %lu\n", arena->reserved, arena->locked ? " (locked)" : "", arena->used, arena->peak, arena->blocks_count, arena->grows, arena->fallbacks);
+}
@@ -0,0 +1,127 @@
+/**
+ * @file cmdq.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Çalışan loop thread'lerine yeniden başlatma gerektirmeden
+ *        parametre değişikliği iletmek için kullanılan kilitsiz komut
+ *        kuyruğu modülü. Birden fazla thread yazabilir, yalnızca loop
+ *        thread'i okur.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+/*
+ * Every slot carries a sequence number. A slot is free for the producer
+ * which reserved position pos when seq == pos, it holds a command for the
+ * consumer when seq == pos + 1.
+ */
+int cmdq_init(struct loopback_cmdq *q)
+{
+	unsigned long i;
+
+	memset(q, 0, sizeof(*q));
+	for (i = 0; i < LOOP_CMDQ_SIZE; i++)
+		q->slots[i].seq = i;
+	q->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (q->event_fd < 0)
+		return -errno;
+	return 0;
+}
+
+void cmdq_done(struct loopback_cmdq *q)
+{
+	if (q->event_fd >= 0)
+		close(q->event_fd);
+	q->event_fd = -1;
+}
+
+/* any thread, -EAGAIN when the queue is full */
+int cmdq_post(struct loopback_cmdq *q, const struct loopback_cmd *cmd)
+{
+	struct loopback_cmdq_slot *slot;
+	unsigned long pos, seq;
+	long diff;
+
+	pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &q->slots[pos & (LOOP_CMDQ_SIZE - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (long)seq - (long)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 0,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return -EAGAIN;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+	slot->cmd = *cmd;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	cmdq_wake(q);
+	return 0;
+}
+
+/*
+ * Any thread, 1 when cmdq_post() would fail now. Only the consumer frees
+ * slots, so the answer holds while no other producer posts.
+ */
+int cmdq_full(struct loopback_cmdq *q)
+{
+	unsigned long pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	struct loopback_cmdq_slot *slot = &q->slots[pos & (LOOP_CMDQ_SIZE - 1)];
+
+	return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos;
+}
+
+/*
+ * Make the event descriptor readable, the loop thread returns from poll.
+ * Async signal safe. A full counter is still readable, so EAGAIN is fine.
+ */
+void cmdq_wake(struct loopback_cmdq *q)
+{
+	uint64_t one = 1;
+	ssize_t r;
+
+	r = write(q->event_fd, &one, sizeof(one));
+	(void)r;
+}
+
+/* loop thread only, returns 1 when a command was taken */
+int cmdq_pop(struct loopback_cmdq *q, struct loopback_cmd *cmd)
+{
+	struct loopback_cmdq_slot *slot;
+	unsigned long pos = q->tail;
+
+	slot = &q->slots[pos & (LOOP_CMDQ_SIZE - 1)];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return 0;
+	*cmd = slot->cmd;
+	__atomic_store_n(&slot->seq, pos + LOOP_CMDQ_SIZE, __ATOMIC_RELEASE);
+	q->tail = pos + 1;
+	return 1;
+}
+
+/* loop thread only, called before the queue is drained */
+void cmdq_clear_event(struct loopback_cmdq *q)
+{
+	uint64_t count;
+
+	if (read(q->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		logit(LOG_WARNING, "Command queue event read failed: %s\n", strerror(errno));
+}
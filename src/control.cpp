@@ -22,10 +22,18 @@
  */
 
 #include <ctype.h>
+#include <stdlib.h>
 #include <syslog.h>
 #include <alsa/asoundlib.h>
 #include "alsaloop.h"
 
+/* open addressing, numid 0 marks a free slot */
+struct loopback_ctl_index {
+	unsigned int numid;
+	unsigned int capt;		/* numid of the capture card */
+	struct loopback_mixer *mix;
+};
+
 static char *id_str(snd_ctl_elem_id_t *id)
 {
 	static char str[128];
@@ -309,6 +317,67 @@ static int control_init2(struct loopback *loop,
 	return 0;
 }
 
+static inline unsigned int ctl_hash(unsigned int numid, unsigned int capt)
+{
+	return (numid * 2654435761U) ^ capt;
+}
+
+static void ctl_index_add(struct loopback *loop, unsigned int numid,
+			  unsigned int capt, struct loopback_mixer *mix)
+{
+	struct loopback_ctl_index *slot;
+	unsigned int i;
+
+	i = ctl_hash(numid, capt) & loop->ctl_index_mask;
+	while (loop->ctl_index[i].numid)
+		i = (i + 1) & loop->ctl_index_mask;
+	slot = &loop->ctl_index[i];
+	slot->numid = numid;
+	slot->capt = capt;
+	slot->mix = mix;
+}
+
+/*
+ * Index the mirrored controls by the numids the cards gave them, so an
+ * event costs one lookup. Without an index control_event() scans the list.
+ */
+static void ctl_index_init(struct loopback *loop)
+{
+	struct loopback_mixer *mix;
+	unsigned int numid, count = 0, size = 16;
+
+	for (mix = loop->controls; mix; mix = mix->next)
+		if (!mix->skip)
+			count += 2;
+	if (count == 0)
+		return;
+	while (size < count * 2)
+		size <<= 1;
+	loop->ctl_index = (struct loopback_ctl_index *) calloc(size, sizeof(*loop->ctl_index));
+	if (loop->ctl_index == NULL) {
+		logit(LOG_WARNING, "%s: No memory for the control index\n", loop->id);
+		return;
+	}
+	loop->ctl_index_mask = size - 1;
+	for (mix = loop->controls; mix; mix = mix->next) {
+		if (mix->skip)
+			continue;
+		numid = snd_ctl_elem_info_get_numid(mix->src.info);
+		if (numid == 0)
+			goto __scan;
+		ctl_index_add(loop, numid, 0, mix);
+		numid = snd_ctl_elem_info_get_numid(mix->dst.info);
+		if (numid == 0)
+			goto __scan;
+		ctl_index_add(loop, numid, 1, mix);
+	}
+	return;
+      __scan:
+	logit(LOG_WARNING, "%s: No numid for control '%s', using the list\n", loop->id, id_str(mix->src.id));
+	free(loop->ctl_index);
+	loop->ctl_index = NULL;
+}
+
 int control_init(struct loopback *loop)
 {
 	struct loopback_mixer *mix;
@@ -328,6 +397,7 @@ int control_init(struct loopback *loop)
 		if (err < 0)
 			return err;
 	}
+	ctl_index_init(loop);
 	for (ossmix = loop->oss_controls; ossmix; ossmix = ossmix->next) {
 		err = oss_set(loop, ossmix, 1);
 		if (err < 0) {
@@ -344,6 +414,8 @@ int control_done(struct loopback *loop)
 	struct loopback_ossmixer *ossmix;
 	int err;
 
+	free(loop->ctl_index);
+	loop->ctl_index = NULL;
 	if (loop->capt->ctl == NULL)
 		return 0;
 	for (ossmix = loop->oss_controls; ossmix; ossmix = ossmix->next) {
@@ -361,18 +433,13 @@ int control_done(struct loopback *loop)
 	return 0;
 }
 
-static int control_event1(struct loopback *loop,
-			  struct loopback_mixer *mix,
-			  snd_ctl_event_t *ev,
-			  int capture)
+/* copy the value of one mirrored control from the side which changed */
+static int control_copy(struct loopback *loop,
+			struct loopback_mixer *mix,
+			int capture)
 {
-	unsigned int mask = snd_ctl_event_elem_get_mask(ev);
 	int err;
 
-	if (mask == SND_CTL_EVENT_MASK_REMOVE)
-		return 0;
-	if ((mask & SND_CTL_EVENT_MASK_VALUE) == 0)
-		return 0;
 	if (!capture) {
 		snd_ctl_elem_value_set_id(mix->src.value, mix->src.id);
 		err = snd_ctl_elem_read(loop->play->ctl, mix->src.value);
@@ -402,13 +469,60 @@ static int control_event1(struct loopback *loop,
 	return 0;
 }
 
+static int control_event1(struct loopback *loop,
+			  struct loopback_mixer *mix,
+			  snd_ctl_event_t *ev,
+			  int capture)
+{
+	unsigned int mask = snd_ctl_event_elem_get_mask(ev);
+
+	if (mask == SND_CTL_EVENT_MASK_REMOVE)
+		return 0;
+	if ((mask & SND_CTL_EVENT_MASK_VALUE) == 0)
+		return 0;
+	return control_copy(loop, mix, capture);
+}
+
+/* events of lhandle's card were lost, copy every mirrored value from it */
+int control_resync(struct loopback_handle *lhandle)
+{
+	struct loopback_mixer *mix;
+	int capt = lhandle == lhandle->loopback->capt;
+	int err;
+
+	for (mix = lhandle->loopback->controls; mix; mix = mix->next) {
+		if (mix->skip)
+			continue;
+		err = control_copy(lhandle->loopback, mix, capt);
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+
 int control_event(struct loopback_handle *lhandle, snd_ctl_event_t *ev)
 {
+	struct loopback *loop = lhandle->loopback;
+	struct loopback_ctl_index *slot;
 	snd_ctl_elem_id_t *id2;
 	struct loopback_mixer *mix;
+	unsigned int numid, i;
 	int capt = lhandle == lhandle->loopback->capt;
 	int err;
 
+	numid = snd_ctl_event_elem_get_numid(ev);
+	if (loop->ctl_index && numid) {
+		i = ctl_hash(numid, capt) & loop->ctl_index_mask;
+		for (; loop->ctl_index[i].numid; i = (i + 1) & loop->ctl_index_mask) {
+			slot = &loop->ctl_index[i];
+			if (slot->numid != numid || slot->capt != (unsigned int)capt)
+				continue;
+			err = control_event1(loop, slot->mix, ev, capt);
+			if (err < 0)
+				return err;
+		}
+		return 0;
+	}
 	snd_ctl_elem_id_alloca(&id2);
 	snd_ctl_event_elem_get_id(ev, id2);
 	for (mix = lhandle->loopback->controls; mix; mix = mix->next) {
@@ -0,0 +1,464 @@
+/**
+ * @file ctlmux.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Her kart için tek bir ctl handle açan ve kartın olaylarını tek
+ *        bir thread'de okuyup cihaz ve alt cihaza göre ilgili loop'a
+ *        kuyruk ile dağıtan modül. Loop thread'leri yalnızca kendi
+ *        olayları geldiğinde uyanır.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+/* queued events of one listener, power of two */
+#define CTLMUX_SLOTS		64
+/* poll descriptors of all cards together */
+#define CTLMUX_POLLFDS		64
+
+struct ctlmux_card {
+	char *name;
+	snd_ctl_t *ctl;
+	int refs;
+	unsigned int pollfd_count;
+	struct ctlmux_listener *listeners;
+	struct ctlmux_card *next;
+};
+
+/*
+ * The demux thread is the only producer, the owning loop thread the only
+ * consumer. Slots hold raw copies of snd_ctl_event_t.
+ */
+struct ctlmux_listener {
+	struct ctlmux_card *card;
+	int device;
+	int subdevice;
+	unsigned int all:1;		/* every event of the card */
+	int event_fd;
+	char *slots;
+	unsigned long head;		/* demux thread */
+	unsigned long tail;		/* loop thread */
+	int overflow;			/* events were lost since the last read */
+	unsigned long delivered;
+	unsigned long overflows;
+	struct ctlmux_listener *next;
+};
+
+static pthread_mutex_t ctlmux_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct ctlmux_card *ctlmux_cards = NULL;
+static unsigned long ctlmux_gen = 0;	/* bumped on every card list change */
+static int ctlmux_wake_fd = -1;
+static int ctlmux_thread = 0;
+static pthread_t ctlmux_tid;
+static int ctlmux_priority = 0;		/* wanted SCHED_FIFO priority, 0 = none */
+static int ctlmux_applied = 0;		/* priority the thread runs with */
+static size_t ctlmux_event_size = 0;
+
+static void ctlmux_wake(void)
+{
+	uint64_t one = 1;
+	ssize_t r;
+
+	r = write(ctlmux_wake_fd, &one, sizeof(one));
+	(void)r;
+}
+
+/* the caller holds ctlmux_mutex */
+static void ctlmux_changed(void)
+{
+	ctlmux_gen++;
+	if (ctlmux_wake_fd >= 0)
+		ctlmux_wake();
+}
+
+static struct ctlmux_card *ctlmux_find(snd_ctl_t *ctl)
+{
+	struct ctlmux_card *card;
+
+	for (card = ctlmux_cards; card; card = card->next)
+		if (card->ctl == ctl)
+			return card;
+	return NULL;
+}
+
+static int ctlmux_match(struct ctlmux_listener *l, snd_ctl_event_t *ev)
+{
+	if (l->all)
+		return 1;
+	return snd_ctl_event_elem_get_interface(ev) == SND_CTL_ELEM_IFACE_PCM &&
+	       (int)snd_ctl_event_elem_get_device(ev) == l->device &&
+	       (int)snd_ctl_event_elem_get_subdevice(ev) == l->subdevice;
+}
+
+static void ctlmux_deliver(struct ctlmux_listener *l, snd_ctl_event_t *ev)
+{
+	unsigned long tail = __atomic_load_n(&l->tail, __ATOMIC_ACQUIRE);
+
+	if (l->head - tail >= CTLMUX_SLOTS) {
+		__atomic_store_n(&l->overflow, 1, __ATOMIC_RELEASE);
+		l->overflows++;
+		return;
+	}
+	memcpy(l->slots + (l->head & (CTLMUX_SLOTS - 1)) * ctlmux_event_size,
+	       ev, ctlmux_event_size);
+	__atomic_store_n(&l->head, l->head + 1, __ATOMIC_RELEASE);
+	l->delivered++;
+}
+
+/* read every pending event of the card once and route it, ctlmux_mutex is held */
+static void ctlmux_card_read(struct ctlmux_card *card)
+{
+	struct ctlmux_listener *l;
+	snd_ctl_event_t *ev;
+	uint64_t one = 1;
+	ssize_t r;
+	int err;
+
+	snd_ctl_event_alloca(&ev);
+	while ((err = snd_ctl_read(card->ctl, ev)) > 0) {
+		if (snd_ctl_event_get_type(ev) != SND_CTL_EVENT_ELEM)
+			continue;
+		for (l = card->listeners; l; l = l->next) {
+			if (!ctlmux_match(l, ev))
+				continue;
+			ctlmux_deliver(l, ev);
+			r = write(l->event_fd, &one, sizeof(one));
+			(void)r;
+		}
+	}
+	if (err < 0 && err != -EAGAIN && verbose > 1)
+		logit(LOG_WARNING, "ctl %s read error: %s\n", card->name, snd_strerror(err));
+}
+
+static void *ctlmux_demux(void *arg)
+{
+	struct pollfd pfds[CTLMUX_POLLFDS + 1];
+	struct ctlmux_card *cards[CTLMUX_POLLFDS];
+	struct ctlmux_card *card;
+	unsigned int counts[CTLMUX_POLLFDS];
+	unsigned short revents;
+	unsigned long gen;
+	uint64_t val;
+	int i, n, cards_count, err;
+
+	(void)arg;
+	for (;;) {
+		pfds[0].fd = ctlmux_wake_fd;
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		n = 1;
+		cards_count = 0;
+		pthread_mutex_lock(&ctlmux_mutex);
+		gen = ctlmux_gen;
+		for (card = ctlmux_cards; card; card = card->next) {
+			if (card->listeners == NULL || card->pollfd_count == 0)
+				continue;
+			if (n + card->pollfd_count > CTLMUX_POLLFDS + 1) {
+				logit(LOG_WARNING, "ctl %s not watched, too many cards\n", card->name);
+				continue;
+			}
+			err = snd_ctl_poll_descriptors(card->ctl, pfds + n, card->pollfd_count);
+			if (err <= 0)
+				continue;
+			cards[cards_count] = card;
+			counts[cards_count++] = err;
+			n += err;
+		}
+		pthread_mutex_unlock(&ctlmux_mutex);
+		if (poll(pfds, n, -1) < 0) {
+			if (errno != EINTR)
+				logit(LOG_WARNING, "ctl demux poll error: %s\n", strerror(errno));
+			continue;
+		}
+		if (pfds[0].revents & POLLIN) {
+			if (read(ctlmux_wake_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+				logit(LOG_WARNING, "ctl demux wake read failed: %s\n", strerror(errno));
+		}
+		pthread_mutex_lock(&ctlmux_mutex);
+		/* a card may be gone, its descriptors are not trusted then */
+		if (gen == ctlmux_gen) {
+			for (i = 0, n = 1; i < cards_count; n += counts[i], i++) {
+				if (snd_ctl_poll_descriptors_revents(cards[i]->ctl, pfds + n,
+								     counts[i], &revents) < 0)
+					continue;
+				if (revents & POLLIN)
+					ctlmux_card_read(cards[i]);
+			}
+		}
+		pthread_mutex_unlock(&ctlmux_mutex);
+	}
+	return NULL;
+}
+
+/* the caller holds ctlmux_mutex */
+static void ctlmux_set_priority(void)
+{
+	struct sched_param param;
+	int err;
+
+	if (!ctlmux_thread || ctlmux_priority <= ctlmux_applied)
+		return;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = ctlmux_priority;
+	err = pthread_setschedparam(ctlmux_tid, SCHED_FIFO, &param);
+	if (err != 0) {
+		logit(LOG_WARNING, "ctl demux priority %i not set: %s\n", ctlmux_priority, strerror(err));
+		return;
+	}
+	ctlmux_applied = ctlmux_priority;
+	if (verbose)
+		logit(LOG_INFO, "ctl demux thread set to FIFO with priority %i\n", ctlmux_applied);
+}
+
+/* the caller holds ctlmux_mutex */
+static int ctlmux_start(void)
+{
+	pthread_attr_t attr;
+	int err;
+
+	if (ctlmux_thread)
+		return 0;
+	if (ctlmux_wake_fd < 0) {
+		ctlmux_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (ctlmux_wake_fd < 0)
+			return -errno;
+	}
+	ctlmux_event_size = snd_ctl_event_sizeof();
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&ctlmux_tid, &attr, ctlmux_demux, NULL);
+	pthread_attr_destroy(&attr);
+	if (err != 0)
+		return -err;
+	ctlmux_thread = 1;
+	ctlmux_set_priority();
+	return 0;
+}
+
+/*
+ * Rate, format and active changes of every loop pass through the demux
+ * thread, so it runs with the highest real-time priority of the loop
+ * threads. A Deadline loop raises it to the FIFO maximum. It is never
+ * lowered while it runs.
+ */
+void ctlmux_sched(const struct loopback_sched *sched)
+{
+	int prio;
+
+	switch (sched->policy) {
+	case SCHED_FIFO:
+	case SCHED_RR:
+		prio = sched->priority > 0 ? sched->priority :
+			sched_get_priority_max(SCHED_FIFO);
+		break;
+	case SCHED_DEADLINE:
+		prio = sched_get_priority_max(SCHED_FIFO);
+		break;
+	default:
+		return;
+	}
+	pthread_mutex_lock(&ctlmux_mutex);
+	if (prio > ctlmux_priority)
+		ctlmux_priority = prio;
+	ctlmux_set_priority();
+	pthread_mutex_unlock(&ctlmux_mutex);
+}
+
+/* the ctl handle of the card, opened by the first user */
+int ctlmux_open(snd_ctl_t **ctl, const char *name)
+{
+	struct ctlmux_card *card;
+	int err;
+
+	pthread_mutex_lock(&ctlmux_mutex);
+	for (card = ctlmux_cards; card; card = card->next)
+		if (strcmp(card->name, name) == 0)
+			break;
+	if (card) {
+		card->refs++;
+		*ctl = card->ctl;
+		err = 0;
+		goto __unlock;
+	}
+	card = (struct ctlmux_card *) calloc(1, sizeof(*card));
+	if (card == NULL || (card->name = strdup(name)) == NULL) {
+		free(card);
+		err = -ENOMEM;
+		goto __unlock;
+	}
+	err = snd_ctl_open(&card->ctl, name, SND_CTL_NONBLOCK);
+	if (err < 0) {
+		free(card->name);
+		free(card);
+		goto __unlock;
+	}
+	card->refs = 1;
+	card->next = ctlmux_cards;
+	ctlmux_cards = card;
+	*ctl = card->ctl;
+      __unlock:
+	pthread_mutex_unlock(&ctlmux_mutex);
+	return err;
+}
+
+int ctlmux_close(snd_ctl_t *ctl)
+{
+	struct ctlmux_card *card, **prev;
+	int err = 0;
+
+	pthread_mutex_lock(&ctlmux_mutex);
+	card = ctlmux_find(ctl);
+	if (card == NULL) {
+		err = -ENOENT;
+		goto __unlock;
+	}
+	if (--card->refs > 0)
+		goto __unlock;
+	for (prev = &ctlmux_cards; *prev != card; prev = &(*prev)->next)
+		;
+	*prev = card->next;
+	err = snd_ctl_close(card->ctl);
+	free(card->name);
+	free(card);
+	ctlmux_changed();
+      __unlock:
+	pthread_mutex_unlock(&ctlmux_mutex);
+	return err;
+}
+
+/*
+ * Ask for the events of ctl which concern the PCM device and subdevice,
+ * or for all of them. They are queued for the caller and announced on
+ * the descriptor returned by ctlmux_fd().
+ */
+int ctlmux_listen(struct ctlmux_listener **_l, snd_ctl_t *ctl, int device,
+		  int subdevice, int all)
+{
+	struct ctlmux_card *card;
+	struct ctlmux_listener *l;
+	int err;
+
+	l = (struct ctlmux_listener *) calloc(1, sizeof(*l));
+	if (l == NULL)
+		return -ENOMEM;
+	l->device = device;
+	l->subdevice = subdevice;
+	l->all = all ? 1 : 0;
+	l->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (l->event_fd < 0) {
+		free(l);
+		return -errno;
+	}
+	pthread_mutex_lock(&ctlmux_mutex);
+	card = ctlmux_find(ctl);
+	if (card == NULL) {
+		err = -ENOENT;
+		goto __error;
+	}
+	if ((err = ctlmux_start()) < 0)
+		goto __error;
+	l->slots = (char *) calloc(CTLMUX_SLOTS, ctlmux_event_size);
+	if (l->slots == NULL) {
+		err = -ENOMEM;
+		goto __error;
+	}
+	if (card->listeners == NULL) {
+		if ((err = snd_ctl_subscribe_events(ctl, 1)) < 0)
+			goto __error;
+		err = snd_ctl_poll_descriptors_count(ctl);
+		card->pollfd_count = err > 0 ? err : 0;
+	}
+	l->card = card;
+	l->next = card->listeners;
+	card->listeners = l;
+	ctlmux_changed();
+	pthread_mutex_unlock(&ctlmux_mutex);
+	*_l = l;
+	return 0;
+      __error:
+	pthread_mutex_unlock(&ctlmux_mutex);
+	close(l->event_fd);
+	free(l->slots);
+	free(l);
+	return err;
+}
+
+void ctlmux_unlisten(struct ctlmux_listener *l)
+{
+	struct ctlmux_card *card;
+	struct ctlmux_listener **prev;
+
+	if (l == NULL)
+		return;
+	pthread_mutex_lock(&ctlmux_mutex);
+	card = l->card;
+	for (prev = &card->listeners; *prev; prev = &(*prev)->next) {
+		if (*prev == l) {
+			*prev = l->next;
+			break;
+		}
+	}
+	if (card->listeners == NULL)
+		snd_ctl_subscribe_events(card->ctl, 0);
+	ctlmux_changed();
+	pthread_mutex_unlock(&ctlmux_mutex);
+	close(l->event_fd);
+	free(l->slots);
+	free(l);
+}
+
+int ctlmux_fd(struct ctlmux_listener *l)
+{
+	return l->event_fd;
+}
+
+/* loop thread, called before the queue is drained */
+void ctlmux_clear(struct ctlmux_listener *l)
+{
+	uint64_t count;
+
+	if (read(l->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		logit(LOG_WARNING, "ctl event queue read failed: %s\n", strerror(errno));
+}
+
+/*
+ * Loop thread: take the next queued event. Returns 1 with an event, 0 when
+ * the queue is empty and -EOVERFLOW once after events were lost, the
+ * caller reads the state it follows again then.
+ */
+int ctlmux_read(struct ctlmux_listener *l, snd_ctl_event_t *ev)
+{
+	unsigned long head;
+
+	/* taken in one step, a flag set meanwhile is not lost */
+	if (__atomic_exchange_n(&l->overflow, 0, __ATOMIC_ACQ_REL))
+		return -EOVERFLOW;
+	head = __atomic_load_n(&l->head, __ATOMIC_ACQUIRE);
+	if (l->tail == head)
+		return 0;
+	memcpy(ev, l->slots + (l->tail & (CTLMUX_SLOTS - 1)) * ctlmux_event_size,
+	       ctlmux_event_size);
+	__atomic_store_n(&l->tail, l->tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void ctlmux_state(struct ctlmux_listener *l, const char *id, snd_output_t *output)
+{
+	snd_output_printf(output, "    %s: ctl events = %lu, overflows = %lu%s\n", id, l->delivered, l->overflows, l->all ? " (all)" : "");
+}
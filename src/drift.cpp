@@ -0,0 +1,170 @@
+/**
+ * @file drift.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Loop cihazı ile gerçek cihaz çiftleri arasında öğrenilen saat
+ *        farkının (pitch) saklanıp sonraki başlatmalarda başlangıç değeri
+ *        olarak kullanılmasını sağlayan modül.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <math.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+/* a learned pitch further off than this is not trusted (1%) */
+#define DRIFT_MAX_OFFSET	0.01
+
+struct drift_entry {
+	char capt[sizeof(((struct loopback_handle *)0)->ident)];
+	char play[sizeof(((struct loopback_handle *)0)->ident)];
+	int sync;
+	double pitch;
+	struct drift_entry *next;
+};
+
+static pthread_mutex_t drift_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct drift_entry *drift_list = NULL;
+static char *drift_file = NULL;
+
+static struct drift_entry *drift_find(const char *capt, const char *play,
+				      int sync)
+{
+	struct drift_entry *e;
+
+	for (e = drift_list; e; e = e->next)
+		if (e->sync == sync &&
+		    strcmp(e->capt, capt) == 0 &&
+		    strcmp(e->play, play) == 0)
+			return e;
+	return NULL;
+}
+
+static int drift_insert(const char *capt, const char *play, int sync,
+			double pitch)
+{
+	struct drift_entry *e = drift_find(capt, play, sync);
+
+	if (e == NULL) {
+		e = (struct drift_entry *) calloc(1, sizeof(*e));
+		if (e == NULL)
+			return -ENOMEM;
+		snprintf(e->capt, sizeof(e->capt), "%s", capt);
+		snprintf(e->play, sizeof(e->play), "%s", play);
+		e->sync = sync;
+		e->next = drift_list;
+		drift_list = e;
+	}
+	e->pitch = pitch;
+	return 0;
+}
+
+/* the whole list is small, it is written at once and renamed over the old one */
+static void drift_save(void)
+{
+	struct drift_entry *e;
+	char tmp[PATH_MAX];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", drift_file);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		if (verbose > 1)
+			logit(LOG_WARNING, "Unable to write drift profile %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+	for (e = drift_list; e; e = e->next)
+		fprintf(f, "%s %s %i %.12f\n", e->capt, e->play, e->sync, e->pitch);
+	if (fclose(f) != 0 || rename(tmp, drift_file) < 0) {
+		logit(LOG_WARNING, "Unable to write drift profile %s: %s\n", drift_file, strerror(errno));
+		unlink(tmp);
+	}
+}
+
+/*
+ * Use a file to keep the learned pitch across runs. Identifiers have no
+ * whitespace, see openit().
+ */
+int drift_load(const char *file)
+{
+	char capt[sizeof(((struct drift_entry *)0)->capt)];
+	char play[sizeof(((struct drift_entry *)0)->play)];
+	char line[256];
+	double pitch;
+	int sync, err = 0;
+	FILE *f;
+
+	pthread_mutex_lock(&drift_mutex);
+	if (drift_file && strcmp(drift_file, file) == 0)
+		goto __unlock;
+	free(drift_file);
+	drift_file = strdup(file);
+	if (drift_file == NULL) {
+		err = -ENOMEM;
+		goto __unlock;
+	}
+	f = fopen(file, "r");
+	if (f == NULL) {
+		if (errno != ENOENT) {
+			err = -errno;
+			logit(LOG_WARNING, "Unable to read drift profile %s: %s\n", file, strerror(errno));
+		}
+		goto __unlock;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %63s %i %lf", capt, play, &sync, &pitch) != 4)
+			continue;
+		if (fabs(pitch - 1.0) > DRIFT_MAX_OFFSET)
+			continue;
+		if ((err = drift_insert(capt, play, sync, pitch)) < 0)
+			break;
+	}
+	fclose(f);
+      __unlock:
+	pthread_mutex_unlock(&drift_mutex);
+	return err;
+}
+
+/* initial pitch for the loop, 1.0 when the device pair was never seen */
+double drift_lookup(struct loopback *loop)
+{
+	struct drift_entry *e;
+	double pitch = 1.0;
+
+	pthread_mutex_lock(&drift_mutex);
+	e = drift_find(loop->capt->ident, loop->play->ident, loop->sync);
+	if (e)
+		pitch = e->pitch;
+	pthread_mutex_unlock(&drift_mutex);
+	if (e && verbose)
+		snd_output_printf(loop->output, "%s: learned drift %+.1f ppm\n", loop->id, (pitch - 1.0) * 1000000);
+	return pitch;
+}
+
+/*
+ * Save the pitch noted by the loop thread. This does file I/O, call it
+ * only once the loop thread is gone.
+ */
+void drift_store(struct loopback *loop)
+{
+	if (loop->drift_pitch == 0 || fabs(loop->drift_pitch - 1.0) > DRIFT_MAX_OFFSET)
+		return;
+	pthread_mutex_lock(&drift_mutex);
+	if (drift_insert(loop->capt->ident, loop->play->ident,
+			 loop->drift_sync, loop->drift_pitch) == 0 && drift_file)
+		drift_save();
+	pthread_mutex_unlock(&drift_mutex);
+	loop->drift_pitch = 0;
+}
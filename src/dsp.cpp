@@ -0,0 +1,177 @@
+/**
+ * @file dsp.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Capture ile playback arasında, kopyalama sırasında yazılan
+ *        tampon parçaları üzerinde yerinde çalışan DSP eklenti zinciri
+ *        modülü. Eklentiler bağlantı kurulurken açılır, loop thread'i
+ *        yalnızca işleme fonksiyonlarını çağırır ve sürelerini ölçer.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+struct dsp_plugin {
+	const struct loopback_dsp_ops *ops;
+	void *priv;
+	unsigned int prepared:1;	/* takes part in the current start */
+	struct loopback_dsp_stats stats;
+};
+
+struct loopback_dsp {
+	int count;
+	struct dsp_plugin plugins[LOOP_DSP_MAX];
+};
+
+/* indexed by KERNEL_FORMAT_* */
+static const char *dsp_formats[KERNEL_FORMAT_COUNT] = {
+	"S16", "S32", "FLOAT"
+};
+
+static inline unsigned long long dsp_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char *dsp_name(struct dsp_plugin *p)
+{
+	return p->ops->name ? p->ops->name : "unnamed";
+}
+
+/* open every plugin of the chain, nothing is left open on an error */
+int dsp_create(struct loopback_dsp **_dsp, const struct loopback_dsp_entry *entries,
+	       int count)
+{
+	struct loopback_dsp *dsp;
+	struct dsp_plugin *p;
+	int i, err;
+
+	if (count <= 0 || count > LOOP_DSP_MAX)
+		return -EINVAL;
+	dsp = (struct loopback_dsp *) calloc(1, sizeof(*dsp));
+	if (dsp == NULL)
+		return -ENOMEM;
+	for (i = 0; i < count; i++) {
+		p = &dsp->plugins[i];
+		p->ops = entries[i].ops;
+		if (p->ops == NULL || p->ops->process == NULL) {
+			err = -EINVAL;
+			goto __error;
+		}
+		if (p->ops->open && (err = p->ops->open(&p->priv, entries[i].arg)) < 0) {
+			logit(LOG_CRIT, "DSP plugin %s open error: %s\n", dsp_name(p), snd_strerror(err));
+			goto __error;
+		}
+		dsp->count++;
+	}
+	*_dsp = dsp;
+	return 0;
+      __error:
+	dsp_destroy(dsp);
+	return err;
+}
+
+void dsp_destroy(struct loopback_dsp *dsp)
+{
+	struct dsp_plugin *p;
+	int i;
+
+	if (dsp == NULL)
+		return;
+	for (i = dsp->count - 1; i >= 0; i--) {
+		p = &dsp->plugins[i];
+		if (p->ops->close)
+			p->ops->close(p->priv);
+	}
+	free(dsp);
+}
+
+/*
+ * Tell the plugins the stream parameters of a start. A plugin which does
+ * not take the format or fails to prepare is bypassed until the next
+ * start. Returns the number of plugins which process.
+ */
+int dsp_prepare(struct loopback_dsp *dsp, const char *id, unsigned int rate,
+		unsigned int channels, int format)
+{
+	struct dsp_plugin *p;
+	int i, err, prepared = 0;
+
+	for (i = 0; i < dsp->count; i++) {
+		p = &dsp->plugins[i];
+		p->prepared = 0;
+		if (format < 0 || !(p->ops->formats & (1U << format))) {
+			logit(LOG_WARNING, "%s: DSP plugin %s does not take %s samples, bypassed\n", id, dsp_name(p), format < 0 ? "these" : dsp_formats[format]);
+			p->stats.bypassed++;
+			continue;
+		}
+		if (p->ops->prepare &&
+		    (err = p->ops->prepare(p->priv, rate, channels, format)) < 0) {
+			logit(LOG_WARNING, "%s: DSP plugin %s prepare error: %s, bypassed\n", id, dsp_name(p), snd_strerror(err));
+			p->stats.bypassed++;
+			continue;
+		}
+		p->prepared = 1;
+		prepared++;
+	}
+	return prepared;
+}
+
+/* run the chain in place over one contiguous span */
+void dsp_process(struct loopback_dsp *dsp, void *buf, unsigned int frames)
+{
+	struct dsp_plugin *p;
+	unsigned long long t0, t1;
+	int i;
+
+	if (frames == 0)
+		return;
+	t0 = dsp_clock_ns();
+	for (i = 0; i < dsp->count; i++) {
+		p = &dsp->plugins[i];
+		if (!p->prepared)
+			continue;
+		p->ops->process(p->priv, buf, frames);
+		t1 = dsp_clock_ns();
+		p->stats.calls++;
+		p->stats.frames += frames;
+		p->stats.ns += t1 - t0;
+		if (t1 - t0 > p->stats.ns_max)
+			p->stats.ns_max = t1 - t0;
+		t0 = t1;
+	}
+}
+
+int dsp_get_stats(struct loopback_dsp *dsp, int index,
+		  struct loopback_dsp_stats *stats)
+{
+	if (dsp == NULL || index < 0 || index >= dsp->count)
+		return -ENOENT;
+	*stats = dsp->plugins[index].stats;
+	return 0;
+}
+
+void dsp_state(struct loopback_dsp *dsp, snd_output_t *output)
+{
+	struct dsp_plugin *p;
+	int i;
+
+	for (i = 0; i < dsp->count; i++) {
+		p = &dsp->plugins[i];
+		snd_output_printf(output, "  dsp %i %s%s: calls = %lu, frames = %llu, time = %lluus (max %lluus)\n", i, dsp_name(p), p->prepared ? "" : " (bypassed)", p->stats.calls, p->stats.frames, p->stats.ns / 1000, p->stats.ns_max / 1000);
+	}
+}
@@ -0,0 +1,257 @@
+/**
+ * @file hwcache.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Cihaz başına bulunan donanım parametrelerini (rate, buffer ve
+ *        period) saklayarak yeniden başlatmalarda tek seferde kurulmasını
+ *        sağlayan önbellek modülü.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+/*
+ * One negotiated configuration. The key is what the loop asked for, the
+ * values are what the device accepted.
+ */
+struct hwcache_entry {
+	char *device;
+	unsigned int access;
+	unsigned int format;
+	unsigned int channels;
+	unsigned int rate_req;
+	unsigned int resample;
+	snd_pcm_uframes_t buffer_size_req;
+	snd_pcm_uframes_t period_size_req;
+	snd_pcm_uframes_t bufsize;
+	unsigned int rate;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t period_size;
+	unsigned int dirty:1;		/* learned, not in the file yet */
+	struct hwcache_entry *next;
+};
+
+static pthread_mutex_t hwcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* serializes hwcache_save(), the loop threads never take it */
+static pthread_mutex_t hwcache_save_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hwcache_entry *hwcache_list = NULL;
+static char *hwcache_file = NULL;
+
+static void hwcache_key(struct hwcache_entry *key,
+			struct loopback_handle *lhandle,
+			snd_pcm_uframes_t bufsize)
+{
+	memset(key, 0, sizeof(*key));
+	key->device = lhandle->device;
+	key->access = lhandle->access;
+	key->format = lhandle->format;
+	key->channels = lhandle->channels;
+	key->rate_req = lhandle->rate_req;
+	key->resample = lhandle->resample;
+	key->buffer_size_req = lhandle->buffer_size_req;
+	key->period_size_req = lhandle->period_size_req;
+	key->bufsize = bufsize;
+}
+
+static struct hwcache_entry *hwcache_find(const struct hwcache_entry *key)
+{
+	struct hwcache_entry *e;
+
+	for (e = hwcache_list; e; e = e->next) {
+		if (e->access == key->access &&
+		    e->format == key->format &&
+		    e->channels == key->channels &&
+		    e->rate_req == key->rate_req &&
+		    e->resample == key->resample &&
+		    e->buffer_size_req == key->buffer_size_req &&
+		    e->period_size_req == key->period_size_req &&
+		    e->bufsize == key->bufsize &&
+		    strcmp(e->device, key->device) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/* returns 1 when the list changed, 0 when the entry was known already */
+static int hwcache_insert(const struct hwcache_entry *entry)
+{
+	struct hwcache_entry *e = hwcache_find(entry);
+
+	if (e) {
+		if (e->rate == entry->rate &&
+		    e->buffer_size == entry->buffer_size &&
+		    e->period_size == entry->period_size)
+			return 0;
+	} else {
+		e = (struct hwcache_entry *) malloc(sizeof(*e));
+		if (e == NULL)
+			return -ENOMEM;
+		*e = *entry;
+		e->dirty = 0;
+		e->device = strdup(entry->device);
+		if (e->device == NULL) {
+			free(e);
+			return -ENOMEM;
+		}
+		e->next = hwcache_list;
+		hwcache_list = e;
+	}
+	e->rate = entry->rate;
+	e->buffer_size = entry->buffer_size;
+	e->period_size = entry->period_size;
+	return 1;
+}
+
+/*
+ * Use a file to keep the cache across runs. Learned entries are appended
+ * one per line by hwcache_save(), a later line for the same key wins.
+ */
+int hwcache_load(const char *file)
+{
+	struct hwcache_entry e;
+	char device[256], line[512];
+	FILE *f;
+	int err = 0;
+
+	pthread_mutex_lock(&hwcache_mutex);
+	if (hwcache_file && strcmp(hwcache_file, file) == 0)
+		goto __unlock;
+	free(hwcache_file);
+	hwcache_file = strdup(file);
+	if (hwcache_file == NULL) {
+		err = -ENOMEM;
+		goto __unlock;
+	}
+	f = fopen(file, "r");
+	if (f == NULL) {
+		if (errno != ENOENT) {
+			err = -errno;
+			logit(LOG_WARNING, "Unable to read hw params cache %s: %s\n", file, strerror(errno));
+		}
+		goto __unlock;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		memset(&e, 0, sizeof(e));
+		if (sscanf(line, "%255s %u %u %u %u %u %lu %lu %lu %u %lu %lu",
+			   device, &e.access, &e.format, &e.channels,
+			   &e.rate_req, &e.resample, &e.buffer_size_req,
+			   &e.period_size_req, &e.bufsize, &e.rate,
+			   &e.buffer_size, &e.period_size) != 12)
+			continue;
+		e.device = device;
+		if ((err = hwcache_insert(&e)) < 0)
+			break;
+		err = 0;
+	}
+	fclose(f);
+      __unlock:
+	pthread_mutex_unlock(&hwcache_mutex);
+	return err;
+}
+
+int hwcache_lookup(struct loopback_handle *lhandle, snd_pcm_uframes_t bufsize,
+		   unsigned int *rate, snd_pcm_uframes_t *buffer_size,
+		   snd_pcm_uframes_t *period_size)
+{
+	struct hwcache_entry key, *e;
+	int found = 0;
+
+	hwcache_key(&key, lhandle, bufsize);
+	pthread_mutex_lock(&hwcache_mutex);
+	e = hwcache_find(&key);
+	if (e) {
+		*rate = e->rate;
+		*buffer_size = e->buffer_size;
+		*period_size = e->period_size;
+		found = 1;
+	}
+	pthread_mutex_unlock(&hwcache_mutex);
+	return found;
+}
+
+/* loop thread: remember the result in memory, hwcache_save() writes it */
+void hwcache_store(struct loopback_handle *lhandle, snd_pcm_uframes_t bufsize,
+		   unsigned int rate, snd_pcm_uframes_t buffer_size,
+		   snd_pcm_uframes_t period_size)
+{
+	struct hwcache_entry e, *n;
+
+	hwcache_key(&e, lhandle, bufsize);
+	e.rate = rate;
+	e.buffer_size = buffer_size;
+	e.period_size = period_size;
+	pthread_mutex_lock(&hwcache_mutex);
+	if (hwcache_insert(&e) > 0 && (n = hwcache_find(&e)) != NULL)
+		n->dirty = 1;
+	pthread_mutex_unlock(&hwcache_mutex);
+}
+
+/*
+ * Append the entries learned since the last save to the file. This does
+ * file I/O, call it only from the control side. The entries are copied
+ * first, so the loop threads never wait for the file.
+ */
+void hwcache_save(void)
+{
+	struct hwcache_entry *e, *copy = NULL;
+	char *file = NULL;
+	int i, count = 0;
+	FILE *f;
+
+	pthread_mutex_lock(&hwcache_save_mutex);
+	pthread_mutex_lock(&hwcache_mutex);
+	for (e = hwcache_list; e; e = e->next)
+		if (e->dirty)
+			count++;
+	if (count > 0 && hwcache_file) {
+		copy = (struct hwcache_entry *) malloc(count * sizeof(*copy));
+		file = strdup(hwcache_file);
+	}
+	if (copy && file) {
+		for (i = 0, e = hwcache_list; e; e = e->next) {
+			if (!e->dirty)
+				continue;
+			copy[i++] = *e;
+			e->dirty = 0;
+		}
+	} else {
+		count = 0;
+	}
+	pthread_mutex_unlock(&hwcache_mutex);
+	if (count == 0)
+		goto __out;
+	f = fopen(file, "a");
+	if (f == NULL) {
+		if (verbose > 1)
+			logit(LOG_WARNING, "Unable to write hw params cache %s: %s\n", file, strerror(errno));
+		goto __out;
+	}
+	for (i = 0; i < count; i++) {
+		e = &copy[i];
+		/* the file format is whitespace separated */
+		if (strpbrk(e->device, " \t\n"))
+			continue;
+		fprintf(f, "%s %u %u %u %u %u %lu %lu %lu %u %lu %lu\n",
+			e->device, e->access, e->format, e->channels,
+			e->rate_req, e->resample, e->buffer_size_req,
+			e->period_size_req, e->bufsize, e->rate,
+			e->buffer_size, e->period_size);
+	}
+	if (fclose(f) != 0)
+		logit(LOG_WARNING, "Unable to write hw params cache %s: %s\n", file, strerror(errno));
+      __out:
+	pthread_mutex_unlock(&hwcache_save_mutex);
+	free(copy);
+	free(file);
+}
@@ -0,0 +1,572 @@
+/**
+ * @file kernels.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Sample processing kernels used on the loop data path.
+ * @version 0.1
+ * @date 2026-10-19
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kernels.h"
+
+/* largest float below 2^31, anything above overflows the int32 conversion */
+#define S32_FLOAT_MAX	2147483520.0f
+#define S32_FLOAT_MIN	-2147483648.0f
+
+void kernel_mix_s16(float *acc, const int16_t *in, unsigned int samples, float gain)
+{
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	__m128 g = _mm_set1_ps(gain);
+
+	for (; i + 8 <= samples; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		__m128 a0 = _mm_loadu_ps(acc + i);
+		__m128 a1 = _mm_loadu_ps(acc + i + 4);
+		a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_cvtepi32_ps(lo), g));
+		a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_cvtepi32_ps(hi), g));
+		_mm_storeu_ps(acc + i, a0);
+		_mm_storeu_ps(acc + i + 4, a1);
+	}
+#endif
+	for (; i < samples; i++)
+		acc[i] += (float)in[i] * gain;
+}
+
+void kernel_mix_s32(float *acc, const int32_t *in, unsigned int samples, float gain)
+{
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	__m128 g = _mm_set1_ps(gain);
+
+	for (; i + 4 <= samples; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128 a = _mm_loadu_ps(acc + i);
+		a = _mm_add_ps(a, _mm_mul_ps(_mm_cvtepi32_ps(x), g));
+		_mm_storeu_ps(acc + i, a);
+	}
+#endif
+	for (; i < samples; i++)
+		acc[i] += (float)in[i] * gain;
+}
+
+void kernel_store_s16(int16_t *out, const float *acc, unsigned int samples, float scale)
+{
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	__m128 s = _mm_set1_ps(scale);
+	__m128 vmax = _mm_set1_ps(32767.0f);
+	__m128 vmin = _mm_set1_ps(-32768.0f);
+
+	/* clamped first, a large scale may leave the int32 range */
+	for (; i + 8 <= samples; i += 8) {
+		__m128 a = _mm_mul_ps(_mm_loadu_ps(acc + i), s);
+		__m128 b = _mm_mul_ps(_mm_loadu_ps(acc + i + 4), s);
+		__m128i lo = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(a, vmin), vmax));
+		__m128i hi = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(b, vmin), vmax));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(lo, hi));
+	}
+#endif
+	for (; i < samples; i++) {
+		float v = acc[i] * scale;
+		if (v > 32767.0f)
+			v = 32767.0f;
+		else if (v < -32768.0f)
+			v = -32768.0f;
+		out[i] = (int16_t)lrintf(v);
+	}
+}
+
+void kernel_store_s32(int32_t *out, const float *acc, unsigned int samples, float scale)
+{
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	__m128 s = _mm_set1_ps(scale);
+	__m128 vmax = _mm_set1_ps(S32_FLOAT_MAX);
+	__m128 vmin = _mm_set1_ps(S32_FLOAT_MIN);
+
+	for (; i + 4 <= samples; i += 4) {
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(acc + i), s);
+		v = _mm_min_ps(_mm_max_ps(v, vmin), vmax);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_cvtps_epi32(v));
+	}
+#endif
+	for (; i < samples; i++) {
+		float v = acc[i] * scale;
+		if (v > S32_FLOAT_MAX)
+			v = S32_FLOAT_MAX;
+		else if (v < S32_FLOAT_MIN)
+			v = S32_FLOAT_MIN;
+		out[i] = (int32_t)lrintf(v);
+	}
+}
+
+static inline int16_t gain_s16(int16_t in, float gain)
+{
+	float v = (float)in * gain;
+
+	if (v > 32767.0f)
+		v = 32767.0f;
+	else if (v < -32768.0f)
+		v = -32768.0f;
+	return (int16_t)lrintf(v);
+}
+
+static inline int32_t gain_s32(int32_t in, float gain)
+{
+	float v = (float)in * gain;
+
+	if (v > S32_FLOAT_MAX)
+		v = S32_FLOAT_MAX;
+	else if (v < S32_FLOAT_MIN)
+		v = S32_FLOAT_MIN;
+	return (int32_t)lrintf(v);
+}
+
+void kernel_gain_s16(int16_t *buf, unsigned int frames, unsigned int channels,
+		     float gain, float step)
+{
+	unsigned int i = 0, f, ch, samples = frames * channels;
+
+	if (step != 0.0f) {
+		/* ramps are short, one gain per frame */
+		for (f = 0; f < frames; f++, gain += step)
+			for (ch = 0; ch < channels; ch++, i++)
+				buf[i] = gain_s16(buf[i], gain);
+		return;
+	}
+#ifdef __SSE2__
+	__m128 g = _mm_set1_ps(gain);
+
+	for (; i + 8 <= samples; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g));
+		hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g));
+		_mm_storeu_si128((__m128i *)(buf + i), _mm_packs_epi32(lo, hi));
+	}
+#endif
+	for (; i < samples; i++)
+		buf[i] = gain_s16(buf[i], gain);
+}
+
+void kernel_gain_s32(int32_t *buf, unsigned int frames, unsigned int channels,
+		     float gain, float step)
+{
+	unsigned int i = 0, f, ch, samples = frames * channels;
+
+	if (step != 0.0f) {
+		for (f = 0; f < frames; f++, gain += step)
+			for (ch = 0; ch < channels; ch++, i++)
+				buf[i] = gain_s32(buf[i], gain);
+		return;
+	}
+#ifdef __SSE2__
+	__m128 g = _mm_set1_ps(gain);
+	__m128 vmax = _mm_set1_ps(S32_FLOAT_MAX);
+	__m128 vmin = _mm_set1_ps(S32_FLOAT_MIN);
+
+	for (; i + 4 <= samples; i += 4) {
+		__m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(buf + i)));
+		v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, g), vmin), vmax);
+		_mm_storeu_si128((__m128i *)(buf + i), _mm_cvtps_epi32(v));
+	}
+#endif
+	for (; i < samples; i++)
+		buf[i] = gain_s32(buf[i], gain);
+}
+
+void kernel_gain_float(float *buf, unsigned int frames, unsigned int channels,
+		       float gain, float step)
+{
+	unsigned int i = 0, f, ch, samples = frames * channels;
+
+	if (step != 0.0f) {
+		for (f = 0; f < frames; f++, gain += step)
+			for (ch = 0; ch < channels; ch++, i++)
+				buf[i] *= gain;
+		return;
+	}
+#ifdef __SSE2__
+	__m128 g = _mm_set1_ps(gain);
+
+	for (; i + 4 <= samples; i += 4)
+		_mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+#endif
+	for (; i < samples; i++)
+		buf[i] *= gain;
+}
+
+void kernel_to_float_s16(float *out, const int16_t *in, unsigned int samples, float scale)
+{
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	__m128 s = _mm_set1_ps(scale);
+
+	for (; i + 8 <= samples; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+	}
+#endif
+	for (; i < samples; i++)
+		out[i] = (float)in[i] * scale;
+}
+
+void kernel_to_float_s32(float *out, const int32_t *in, unsigned int samples, float scale)
+{
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	__m128 s = _mm_set1_ps(scale);
+
+	for (; i + 4 <= samples; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(x), s));
+	}
+#endif
+	for (; i < samples; i++)
+		out[i] = (float)in[i] * scale;
+}
+
+static void route_generic(float *out, const float *in, unsigned int frames,
+			  const float *coef, unsigned int in_channels,
+			  unsigned int out_channels)
+{
+	unsigned int f, o, i;
+	float acc;
+
+	for (f = 0; f < frames; f++) {
+		for (o = 0; o < out_channels; o++) {
+			acc = 0;
+			for (i = 0; i < in_channels; i++)
+				acc += in[i] * coef[o * in_channels + i];
+			out[o] = acc;
+		}
+		in += in_channels;
+		out += out_channels;
+	}
+}
+
+/* the channel counts are constants here, the compiler unrolls the frame */
+template <unsigned int IC, unsigned int OC>
+static void route_fixed(float *out, const float *in, unsigned int frames,
+			const float *coef, unsigned int, unsigned int)
+{
+	unsigned int f, o, i;
+	float acc;
+
+	for (f = 0; f < frames; f++) {
+		for (o = 0; o < OC; o++) {
+			acc = 0;
+			for (i = 0; i < IC; i++)
+				acc += in[i] * coef[o * IC + i];
+			out[o] = acc;
+		}
+		in += IC;
+		out += OC;
+	}
+}
+
+#ifdef __SSE2__
+#define SHUF(x, a, b, c, d)	_mm_shuffle_ps(x, x, _MM_SHUFFLE(d, c, b, a))
+
+/* stereo to 5.1: two frames are three vectors, L * column0 + R * column1 */
+static void route_2_6_sse2(float *out, const float *in, unsigned int frames,
+			   const float *coef, unsigned int in_channels,
+			   unsigned int out_channels)
+{
+	__m128 l0 = _mm_setr_ps(coef[0], coef[2], coef[4], coef[6]);
+	__m128 r0 = _mm_setr_ps(coef[1], coef[3], coef[5], coef[7]);
+	__m128 l1 = _mm_setr_ps(coef[8], coef[10], coef[0], coef[2]);
+	__m128 r1 = _mm_setr_ps(coef[9], coef[11], coef[1], coef[3]);
+	__m128 l2 = _mm_setr_ps(coef[4], coef[6], coef[8], coef[10]);
+	__m128 r2 = _mm_setr_ps(coef[5], coef[7], coef[9], coef[11]);
+	unsigned int f;
+
+	for (f = 0; f + 2 <= frames; f += 2) {
+		__m128 x = _mm_loadu_ps(in);
+		_mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(SHUF(x, 0, 0, 0, 0), l0),
+					      _mm_mul_ps(SHUF(x, 1, 1, 1, 1), r0)));
+		_mm_storeu_ps(out + 4, _mm_add_ps(_mm_mul_ps(SHUF(x, 0, 0, 2, 2), l1),
+						  _mm_mul_ps(SHUF(x, 1, 1, 3, 3), r1)));
+		_mm_storeu_ps(out + 8, _mm_add_ps(_mm_mul_ps(SHUF(x, 2, 2, 2, 2), l2),
+						  _mm_mul_ps(SHUF(x, 3, 3, 3, 3), r2)));
+		in += 4;
+		out += 12;
+	}
+	route_fixed<2, 6>(out, in, frames - f, coef, in_channels, out_channels);
+}
+
+/* stereo to 7.1: one frame is two vectors, L * column0 + R * column1 */
+static void route_2_8_sse2(float *out, const float *in, unsigned int frames,
+			   const float *coef, unsigned int in_channels,
+			   unsigned int out_channels)
+{
+	__m128 l0 = _mm_setr_ps(coef[0], coef[2], coef[4], coef[6]);
+	__m128 r0 = _mm_setr_ps(coef[1], coef[3], coef[5], coef[7]);
+	__m128 l1 = _mm_setr_ps(coef[8], coef[10], coef[12], coef[14]);
+	__m128 r1 = _mm_setr_ps(coef[9], coef[11], coef[13], coef[15]);
+	unsigned int f;
+
+	for (f = 0; f < frames; f++) {
+		__m128 l = _mm_set1_ps(in[0]);
+		__m128 r = _mm_set1_ps(in[1]);
+		_mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(l, l0), _mm_mul_ps(r, r0)));
+		_mm_storeu_ps(out + 4, _mm_add_ps(_mm_mul_ps(l, l1), _mm_mul_ps(r, r1)));
+		in += 2;
+		out += 8;
+	}
+}
+
+/* 7.1 to stereo: two dot products of eight, summed horizontally */
+static void route_8_2_sse2(float *out, const float *in, unsigned int frames,
+			   const float *coef, unsigned int in_channels,
+			   unsigned int out_channels)
+{
+	__m128 l0 = _mm_loadu_ps(coef);
+	__m128 l1 = _mm_loadu_ps(coef + 4);
+	__m128 r0 = _mm_loadu_ps(coef + 8);
+	__m128 r1 = _mm_loadu_ps(coef + 12);
+	unsigned int f;
+
+	for (f = 0; f < frames; f++) {
+		__m128 lo = _mm_loadu_ps(in);
+		__m128 hi = _mm_loadu_ps(in + 4);
+		__m128 l = _mm_add_ps(_mm_mul_ps(lo, l0), _mm_mul_ps(hi, l1));
+		__m128 r = _mm_add_ps(_mm_mul_ps(lo, r0), _mm_mul_ps(hi, r1));
+		__m128 t = _mm_add_ps(_mm_unpacklo_ps(l, r), _mm_unpackhi_ps(l, r));
+		t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+		_mm_storel_pi((__m64 *)out, t);
+		in += 8;
+		out += 2;
+	}
+}
+#undef SHUF
+#endif
+
+/* one key per (in, out) pair, out is always below the multiplier */
+#define ROUTE_KEY(in, out)	((in) * (KERNEL_ROUTE_MAX_CHANNELS + 1) + (out))
+
+kernel_route_t kernel_route_select(unsigned int in_channels, unsigned int out_channels)
+{
+	if (in_channels > KERNEL_ROUTE_MAX_CHANNELS || out_channels > KERNEL_ROUTE_MAX_CHANNELS)
+		return route_generic;
+	switch (ROUTE_KEY(in_channels, out_channels)) {
+	case ROUTE_KEY(1, 2):
+		return route_fixed<1, 2>;
+	case ROUTE_KEY(2, 1):
+		return route_fixed<2, 1>;
+	case ROUTE_KEY(2, 2):
+		return route_fixed<2, 2>;
+	case ROUTE_KEY(2, 4):
+		return route_fixed<2, 4>;
+#ifdef __SSE2__
+	case ROUTE_KEY(2, 6):
+		return route_2_6_sse2;
+	case ROUTE_KEY(2, 8):
+		return route_2_8_sse2;
+	case ROUTE_KEY(8, 2):
+		return route_8_2_sse2;
+#else
+	case ROUTE_KEY(2, 6):
+		return route_fixed<2, 6>;
+	case ROUTE_KEY(2, 8):
+		return route_fixed<2, 8>;
+	case ROUTE_KEY(8, 2):
+		return route_fixed<8, 2>;
+#endif
+	case ROUTE_KEY(6, 2):
+		return route_fixed<6, 2>;
+	}
+	return route_generic;
+}
+
+void kernel_reorder_16(uint16_t *out, const uint16_t *in, unsigned int frames,
+		       const int *map, unsigned int in_channels,
+		       unsigned int out_channels, uint16_t silence)
+{
+	unsigned int f, o;
+
+	for (f = 0; f < frames; f++) {
+		for (o = 0; o < out_channels; o++)
+			out[o] = map[o] < 0 ? silence : in[map[o]];
+		in += in_channels;
+		out += out_channels;
+	}
+}
+
+void kernel_reorder_32(uint32_t *out, const uint32_t *in, unsigned int frames,
+		       const int *map, unsigned int in_channels,
+		       unsigned int out_channels, uint32_t silence)
+{
+	unsigned int f, o;
+
+	for (f = 0; f < frames; f++) {
+		for (o = 0; o < out_channels; o++)
+			out[o] = map[o] < 0 ? silence : in[map[o]];
+		in += in_channels;
+		out += out_channels;
+	}
+}
+
+int kernel_is_zero(const void *buf, size_t bytes)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+
+	for (; i + 64 <= bytes; i += 64) {
+		__m128i x = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(p + i)),
+				     _mm_loadu_si128((const __m128i *)(p + i + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(p + i + 32)),
+				     _mm_loadu_si128((const __m128i *)(p + i + 48))));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xffff)
+			return 0;
+	}
+#else
+	for (; i + 64 <= bytes; i += 64) {
+		uint64_t x = 0;
+		unsigned int j;
+
+		for (j = 0; j < 64; j += 8) {
+			uint64_t v;
+			memcpy(&v, p + i + j, 8);
+			x |= v;
+		}
+		if (x)
+			return 0;
+	}
+#endif
+	for (; i < bytes; i++)
+		if (p[i])
+			return 0;
+	return 1;
+}
+
+static inline void sample_cvt(int16_t &out, int16_t in)
+{
+	out = in;
+}
+
+static inline void sample_cvt(int32_t &out, int16_t in)
+{
+	out = (int32_t)in * 65536;
+}
+
+static inline void sample_cvt(float &out, int16_t in)
+{
+	out = (float)in * (1.0f / 32768.0f);
+}
+
+static inline void sample_cvt(int16_t &out, int32_t in)
+{
+	out = (int16_t)(in >> 16);
+}
+
+static inline void sample_cvt(int32_t &out, int32_t in)
+{
+	out = in;
+}
+
+static inline void sample_cvt(float &out, int32_t in)
+{
+	out = (float)in * (1.0f / 2147483648.0f);
+}
+
+static inline void sample_cvt(int16_t &out, float in)
+{
+	float v = in * 32768.0f;
+
+	if (v > 32767.0f)
+		v = 32767.0f;
+	else if (v < -32768.0f)
+		v = -32768.0f;
+	out = (int16_t)lrintf(v);
+}
+
+static inline void sample_cvt(int32_t &out, float in)
+{
+	float v = in * 2147483648.0f;
+
+	if (v > S32_FLOAT_MAX)
+		v = S32_FLOAT_MAX;
+	else if (v < S32_FLOAT_MIN)
+		v = S32_FLOAT_MIN;
+	out = (int32_t)lrintf(v);
+}
+
+static inline void sample_cvt(float &out, float in)
+{
+	out = in;
+}
+
+/* CH == 0 takes the channel count at run time */
+template <typename IN, typename OUT, unsigned int CH>
+static void convert_frames(void *out, const void *in, unsigned int frames,
+			   unsigned int channels)
+{
+	const IN *src = (const IN *)in;
+	OUT *dst = (OUT *)out;
+	unsigned int i, samples = frames * (CH ? CH : channels);
+
+	for (i = 0; i < samples; i++)
+		sample_cvt(dst[i], src[i]);
+}
+
+#define CONVERT_ROW(IN, OUT) {			\
+	convert_frames<IN, OUT, 0>,		\
+	convert_frames<IN, OUT, 1>,		\
+	convert_frames<IN, OUT, 2>,		\
+	convert_frames<IN, OUT, 4>,		\
+	convert_frames<IN, OUT, 6>,		\
+	convert_frames<IN, OUT, 8>		\
+}
+
+static const kernel_convert_t convert_table[KERNEL_FORMAT_COUNT][KERNEL_FORMAT_COUNT][6] = {
+	{ CONVERT_ROW(int16_t, int16_t), CONVERT_ROW(int16_t, int32_t), CONVERT_ROW(int16_t, float) },
+	{ CONVERT_ROW(int32_t, int16_t), CONVERT_ROW(int32_t, int32_t), CONVERT_ROW(int32_t, float) },
+	{ CONVERT_ROW(float, int16_t), CONVERT_ROW(float, int32_t), CONVERT_ROW(float, float) },
+};
+#undef CONVERT_ROW
+
+kernel_convert_t kernel_convert_select(int in_format, int out_format,
+				       unsigned int channels)
+{
+	int idx;
+
+	if (in_format < 0 || in_format >= KERNEL_FORMAT_COUNT ||
+	    out_format < 0 || out_format >= KERNEL_FORMAT_COUNT)
+		return NULL;
+	switch (channels) {
+	case 1: idx = 1; break;
+	case 2: idx = 2; break;
+	case 4: idx = 3; break;
+	case 6: idx = 4; break;
+	case 8: idx = 5; break;
+	default: idx = 0; break;
+	}
+	return convert_table[in_format][out_format][idx];
+}
@@ -25,6 +25,7 @@
 #include <exception>
 #include <syslog.h>
 #include <iostream>
+#include <chrono>
 
 #include <loop_dev.h>
 
@@ -36,6 +37,7 @@ struct loopbackDev
 };
 
 std::vector<std::string> LoopDev::realDevs;
+std::vector<std::string> LoopDev::mixedRealDevs;
 
 loopbackDev devTable[8] = {
 	{.captureDevName = "hw:0,0,0", .playbackDevName = "hw:0,1,0", .isUsed = false},
@@ -63,12 +65,27 @@ static loopbackDev *getLoopDev()
 	return ret;
 }
 
+//Cihazların açılıp stream'lerin başlaması için beklenen en uzun süre (ms)
+static const int CONNECT_TIMEOUT = 5000;
+
+//Sıcak havuzda boşta kalan bir cihazın açık tutulabileceği en uzun süre (ms)
+static const unsigned int WARM_POOL_TTL_MAX = 3600000;
+
+//Yazılım kazancının üst sınırı (+24 dB) ve en uzun rampa süresi (ms)
+static const float SOFT_GAIN_MAX = 16.0f;
+static const unsigned int SOFT_GAIN_RAMP_MAX = 1000;
+
+//Meşgul beklemede uyanma başına en uzun yoklama ve en erken uyanma (us)
+static const unsigned int BUSY_SPIN_MAX = 2000;
+static const unsigned int BUSY_LEAD_MAX = 10000;
+
 static void freeLoopDev(loopbackDev *dev)
 {
 	dev->isUsed = false;
 }
 
-LoopDev::LoopDev() : isLoopDevConnected(false)
+LoopDev::LoopDev() : isLoopDevConnected(false), isMixedConnection(false),
+					 loopChannels(2), realChannels(0), disconnectLatency(0)
 {
 	loopDev = getLoopDev();
 	if (NULL == loopDev)
@@ -76,7 +93,7 @@ LoopDev::LoopDev() : isLoopDevConnected(false)
 		throw std::runtime_error("No loop device has been found!");
 	}
 
-	alsaLoop = new AlsaLoop();
+	alsaLoop = std::make_shared<AlsaLoop>();
 }
 
 LoopDev::~LoopDev()
@@ -86,10 +103,143 @@ LoopDev::~LoopDev()
 		freeLoopDev(loopDev);
 	}
 
-	delete alsaLoop;
+	if (connectWaiter.joinable())
+	{
+		connectWaiter.join();
+	}
 }
 
 int LoopDev::connect(const std::string &realDev)
+{
+	return connectDevs(std::vector<std::string>(1, realDev), false, 1.0f);
+}
+
+int LoopDev::connect(const std::vector<std::string> &realDevList)
+{
+	return connectDevs(realDevList, false, 1.0f);
+}
+
+int LoopDev::connectMixed(const std::string &realDev, float gain)
+{
+	return connectDevs(std::vector<std::string>(1, realDev), true, gain);
+}
+
+std::future<int> LoopDev::connectAsync(const std::vector<std::string> &realDevList,
+									   std::function<void(int)> callback)
+{
+	int ret;
+
+	//Bağlantı bilgileri bu thread'de güncellenir, yalnızca bekleme ayrı
+	//thread'de yapılır.
+	ret = connectDevs(realDevList, false, 1.0f);
+	if (0 != ret)
+	{
+		std::promise<int> result;
+
+		if (callback)
+		{
+			callback(ret);
+		}
+		result.set_value(ret);
+		return result.get_future();
+	}
+
+	//Bekleme thread'i nesneye aittir ve disconnect'te sonlandırılır,
+	//future bırakılsa da çağıran bloklanmaz.
+	std::shared_ptr<AlsaLoop> loop = alsaLoop;
+	std::shared_ptr<std::promise<int> > result = std::make_shared<std::promise<int> >();
+
+	connectWaiter = std::thread([loop, result, callback]() {
+		int err = loop->waitReady(CONNECT_TIMEOUT) < 0 ? -1 : 0;
+
+		if (callback)
+		{
+			callback(err);
+		}
+		result->set_value(err);
+	});
+
+	return result->get_future();
+}
+
+int LoopDev::connectMany(const std::vector<LoopDev *> &loops,
+						 const std::vector<std::string> &realDevList,
+						 std::vector<int> &results, long *bringUpTime)
+{
+	std::chrono::steady_clock::time_point start;
+	int ret = 0;
+
+	if (loops.size() != realDevList.size())
+	{
+		std::cout << "Loop and real device counts differ ";
+		return -1;
+	}
+
+	start = std::chrono::steady_clock::now();
+	results.assign(loops.size(), 0);
+	std::vector<bool> connected(loops.size(), false);
+
+	//connectDevs yalnızca ayarları hazırlayıp thread'leri başlatır,
+	//cihazlar her bağlantının kendi thread'inde paralel açılır.
+	//Cihazlar açıldıktan sonra thread'ler kapıda bekler.
+	for (size_t cnt = 0; cnt < loops.size(); cnt++)
+	{
+		loops[cnt]->alsaLoop->start_gate = 1;
+		results[cnt] = loops[cnt]->connectDevs(
+							std::vector<std::string>(1, realDevList[cnt]),
+							false, 1.0f);
+		if (0 != results[cnt])
+		{
+			loops[cnt]->alsaLoop->start_gate = 0;
+		}
+		connected[cnt] = 0 == results[cnt];
+	}
+
+	for (size_t cnt = 0; cnt < loops.size(); cnt++)
+	{
+		if (0 == results[cnt] &&
+			loops[cnt]->alsaLoop->waitOpened(CONNECT_TIMEOUT) < 0)
+		{
+			results[cnt] = -1;
+		}
+	}
+
+	//Tüm cihazlar açıldı, stream'ler başlatılır.
+	for (size_t cnt = 0; cnt < loops.size(); cnt++)
+	{
+		loops[cnt]->alsaLoop->openGate();
+	}
+
+	for (size_t cnt = 0; cnt < loops.size(); cnt++)
+	{
+		if (0 == results[cnt] &&
+			loops[cnt]->alsaLoop->waitReady(CONNECT_TIMEOUT) < 0)
+		{
+			results[cnt] = -1;
+		}
+
+		if (0 != results[cnt])
+		{
+			ret = -1;
+			//Açılamayan bağlantının kaynakları bırakılır.
+			if (true == connected[cnt])
+			{
+				loops[cnt]->disconnect();
+			}
+		}
+	}
+
+	if (NULL != bringUpTime)
+	{
+		*bringUpTime = std::chrono::duration_cast<std::chrono::microseconds>(
+						std::chrono::steady_clock::now() - start).count();
+	}
+
+	return ret;
+}
+
+int LoopDev::connectDevs(const std::vector<std::string> &realDevList,
+						 bool mixed, float gain)
 {
 	snd_output_t *output;
 	int err;
@@ -102,19 +252,53 @@ int LoopDev::connect(const std::string &realDev)
 		return 2;
 	}
 
-	//Realdev başka bir nesnede bağlantı kurmuş mu?
-	for (int cnt = 0;
-		 cnt < realDevs.size();
-		 cnt++)
+	if (true == realDevList.empty())
 	{
-		if (realDevs.at(cnt) == realDev)
+		std::cout << "No real device to connect ";
+		return -1;
+	}
+
+	for (size_t idx = 0; idx < realDevList.size(); idx++)
+	{
+		const std::string &realDev = realDevList.at(idx);
+
+		//Aynı cihaz listede iki kez verilmiş mi?
+		for (size_t cnt = 0; cnt < idx; cnt++)
 		{
-			std::cout << "Real device already connected to a loop device. ";
-			return 1;
+			if (realDevList.at(cnt) == realDev)
+			{
+				std::cout << "Real device is listed more than once. ";
+				return 1;
+			}
+		}
+
+		//Realdev başka bir nesnede bağlantı kurmuş mu?
+		for (size_t cnt = 0;
+			 cnt < realDevs.size();
+			 cnt++)
+		{
+			if (realDevs.at(cnt) == realDev)
+			{
+				std::cout << "Real device already connected to a loop device. ";
+				return 1;
+			}
 		}
-	}
 
-	std::cout << "Connecting Device : " << realDev ;
+		//Paylaşımsız bağlantı, mixer üzerinden kullanılan cihaza kurulamaz.
+		if (false == mixed)
+		{
+			for (size_t cnt = 0;
+				 cnt < mixedRealDevs.size();
+				 cnt++)
+			{
+				if (mixedRealDevs.at(cnt) == realDev)
+				{
+					std::cout << "Real device is shared by mixed loop devices. ";
+					return 1;
+				}
+			}
+		}
+	}
 
 	alsaLoop->clearQuit();
 
@@ -125,32 +309,458 @@ int LoopDev::connect(const std::string &realDev)
 		return -1;
 	}
 
-	tmpRealDevName = realDev;
-	char *realDevStr = &tmpRealDevName[0];
 	char *loopDevStr = &loopDev->captureDevName[0];
 
-	if (false == alsaLoop->initConnection(realDevStr,
-											loopDevStr,
-											output))
+	alsaLoop->arg_default_channels = loopChannels;
+	alsaLoop->arg_default_route_channels = realChannels;
+	alsaLoop->arg_default_route = routeMatrix.empty() ? NULL : &routeMatrix[0];
+	alsaLoop->arg_default_mix = mixed ? 1 : 0;
+	alsaLoop->arg_default_mix_gain = gain;
+	//Her gerçek cihaz için bir loop eklenir, dizi bir kez ayrılır.
+	alsaLoop->arg_default_loops = realDevList.size();
+	//Birden fazla gerçek cihaz varsa loop capture paylaşılır.
+	alsaLoop->arg_default_split = realDevList.size() > 1 ? 1 : 0;
+	//Loop kartının zamanlayıcısı tek bir gerçek karta bağlanabilir,
+	//bu yüzden yalnızca başka bağlantı yokken denenir.
+	alsaLoop->arg_default_timer_lock = (false == mixed &&
+										1 == realDevList.size() &&
+										true == realDevs.empty() &&
+										true == mixedRealDevs.empty()) ? 1 : 0;
+
+	for (size_t cnt = 0;
+		 cnt < realDevList.size();
+		 cnt++)
 	{
-		std::cerr << "Init Failed!";
-		return -1;
+		std::cout << "Connecting Device : " << realDevList.at(cnt) ;
+
+		tmpRealDevName = realDevList.at(cnt);
+		char *realDevStr = &tmpRealDevName[0];
+
+		if (false == alsaLoop->initConnection(realDevStr,
+												loopDevStr,
+												output))
+		{
+			std::cerr << "Init Failed!";
+			//Önceki cihazlar için oluşturulan loop'lar bırakılır.
+			if (cnt > 0)
+			{
+				alsaLoop->freeThreads();
+			}
+			return -1;
+		}
 	}
 
 	alsaLoop->sortThreads(output);
 
 	alsaLoop->runThreads();
 	
-	realDevs.push_back(realDev);
+	std::vector<std::string> &devs = mixed ? mixedRealDevs : realDevs;
+
+	devs.insert(devs.end(), realDevList.begin(), realDevList.end());
 
-	connectedRealDev = realDev;
+	connectedRealDevs = realDevList;
 	isLoopDevConnected = true;
+	isMixedConnection = mixed;
 
 	return 0;
 }
 
-int LoopDev::disconnect()
+int LoopDev::setRouting(unsigned int loopChannels, unsigned int realChannels,
+						const std::vector<float> &matrix)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	if (loopChannels < 1 || loopChannels > MAX_ROUTE_CHANNELS ||
+		realChannels < 1 || realChannels > MAX_ROUTE_CHANNELS)
+	{
+		std::cout << "Invalid channel count ";
+		return -1;
+	}
+
+	if (false == matrix.empty() &&
+		matrix.size() != loopChannels * realChannels)
+	{
+		std::cout << "Routing matrix size does not match channel counts ";
+		return -1;
+	}
+
+	this->loopChannels = loopChannels;
+	this->realChannels = realChannels;
+	routeMatrix = matrix;
+
+	return 0;
+}
+
+int LoopDev::setScheduling(int policy, int priority,
+						   unsigned long long cpuMask, bool lockMemory)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	if (policy != -1 && policy != SCHED_OTHER && policy != SCHED_FIFO &&
+		policy != SCHED_RR && policy != SCHED_DEADLINE)
+	{
+		std::cout << "Invalid scheduling policy ";
+		return -1;
+	}
+
+	//Öncelik yalnızca FIFO ve RR için anlamlıdır.
+	if ((policy == SCHED_FIFO || policy == SCHED_RR) ?
+		(priority < 0 || priority > 99) : (priority != 0))
+	{
+		std::cout << "Invalid scheduling priority ";
+		return -1;
+	}
+
+	//Çekirdek, CPU ataması kısıtlı thread'ler için SCHED_DEADLINE'ı reddeder.
+	if (policy == SCHED_DEADLINE && cpuMask != 0)
+	{
+		std::cout << "CPU affinity cannot be used with SCHED_DEADLINE ";
+		return -1;
+	}
+
+	alsaLoop->arg_default_sched_policy = policy;
+	alsaLoop->arg_default_sched_priority = priority;
+	alsaLoop->arg_default_sched_affinity = cpuMask;
+	alsaLoop->arg_default_sched_mlock = lockMemory ? 1 : 0;
+
+	return 0;
+}
+
+int LoopDev::setBusyPoll(unsigned int spinUs, unsigned int leadUs)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	if (spinUs > BUSY_SPIN_MAX || leadUs > BUSY_LEAD_MAX)
+	{
+		std::cout << "Invalid busy poll time ";
+		return -1;
+	}
+
+	alsaLoop->arg_default_busy_spin = spinUs;
+	alsaLoop->arg_default_busy_lead = leadUs;
+
+	return 0;
+}
+
+int LoopDev::setTimerWakeup(bool enable)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	alsaLoop->arg_default_wake_timer = enable ? 1 : 0;
+
+	return 0;
+}
+
+int LoopDev::setHwParamsCache(const std::string &path)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	// AlsaLoop sadece göstericiyi saklar, metin bu nesnede yaşar
+	hwCacheFile = path;
+	alsaLoop->arg_default_hwcache = hwCacheFile.empty() ? NULL : hwCacheFile.c_str();
+
+	return 0;
+}
+
+int LoopDev::setDriftProfile(const std::string &path)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	driftFile = path;
+	alsaLoop->arg_default_drift = driftFile.empty() ? NULL : driftFile.c_str();
+
+	return 0;
+}
+
+bool LoopDev::getBusyPollStats(struct loopback_busy_stats &stats) const
 {
+	if (false == isLoopDevConnected)
+	{
+		return false;
+	}
+
+	alsaLoop->busyStats(&stats);
+
+	return true;
+}
+
+int LoopDev::setSoftGain(float gain, unsigned int rampMs)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	if (gain < 0 || gain > SOFT_GAIN_MAX || rampMs > SOFT_GAIN_RAMP_MAX)
+	{
+		std::cout << "Invalid software gain ";
+		return -1;
+	}
+
+	alsaLoop->arg_default_soft_gain = gain;
+	alsaLoop->arg_default_gain_ramp = rampMs;
+
+	return 0;
+}
+
+int LoopDev::addDspPlugin(const struct loopback_dsp_ops *ops, void *arg)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	if (NULL == ops || NULL == ops->process ||
+		alsaLoop->arg_default_dsp_count >= LOOP_DSP_MAX)
+	{
+		std::cout << "Invalid DSP plugin ";
+		return -1;
+	}
+
+	alsaLoop->arg_default_dsp[alsaLoop->arg_default_dsp_count].ops = ops;
+	alsaLoop->arg_default_dsp[alsaLoop->arg_default_dsp_count].arg = arg;
+	alsaLoop->arg_default_dsp_count++;
+
+	return 0;
+}
+
+int LoopDev::clearDspPlugins()
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	alsaLoop->arg_default_dsp_count = 0;
+
+	return 0;
+}
+
+bool LoopDev::getDspStats(unsigned int index, struct loopback_dsp_stats &stats) const
+{
+	if (false == isLoopDevConnected)
+	{
+		return false;
+	}
+
+	return alsaLoop->dspStats(index, &stats);
+}
+
+int LoopDev::startRecording(snd_pcm_stream_t stream, const std::string &path,
+							unsigned long long maxFileBytes, unsigned int files)
+{
+	if (false == isLoopDevConnected)
+	{
+		std::cout << "Loop device not connected any device" ;
+		return 1;
+	}
+
+	if (true == path.empty() ||
+		alsaLoop->startTap(stream, path.c_str(), maxFileBytes, files) < 0)
+	{
+		std::cerr << "Recording could not be started ";
+		return -1;
+	}
+
+	return 0;
+}
+
+int LoopDev::stopRecording(snd_pcm_stream_t stream)
+{
+	if (false == isLoopDevConnected)
+	{
+		std::cout << "Loop device not connected any device" ;
+		return 1;
+	}
+
+	if (alsaLoop->stopTap(stream) < 0)
+	{
+		std::cout << "No recording ";
+		return -1;
+	}
+
+	return 0;
+}
+
+bool LoopDev::getRecordingStats(snd_pcm_stream_t stream,
+								struct loopback_tap_stats &stats) const
+{
+	if (false == isLoopDevConnected)
+	{
+		return false;
+	}
+
+	return alsaLoop->tapStats(stream, &stats);
+}
+
+int LoopDev::setSilenceBypass(unsigned int holdMs)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	alsaLoop->arg_default_silence_hold = holdMs;
+
+	return 0;
+}
+
+long long LoopDev::getSilenceStats(struct loopback_silence_stats &stats) const
+{
+	double frameCost;
+
+	if (false == isLoopDevConnected)
+	{
+		return 0;
+	}
+
+	alsaLoop->silenceStats(&stats);
+
+	if (0 == stats.work_frames)
+	{
+		return 0;
+	}
+
+	//Atlanan frame'ler normal işlemenin frame başına maliyeti ile hesaplanır.
+	frameCost = (double)stats.work_ns / stats.work_frames;
+
+	return ((long long)(stats.frames * frameCost) - (long long)stats.bypass_ns) / 1000;
+}
+
+int LoopDev::setIdleParking(bool enable, unsigned int delayMs,
+							unsigned int resumeMs)
+{
+	if (true == isLoopDevConnected)
+	{
+		std::cout << "Loop device is already connected to a real device ";
+		return 2;
+	}
+
+	alsaLoop->arg_default_park = enable ? 1 : 0;
+	alsaLoop->arg_default_park_delay = delayMs;
+	alsaLoop->arg_default_park_resume = resumeMs;
+
+	return 0;
+}
+
+bool LoopDev::getIdleStats(struct loopback_park_stats &stats) const
+{
+	if (false == isLoopDevConnected)
+	{
+		return false;
+	}
+
+	alsaLoop->parkStats(&stats);
+
+	return true;
+}
+
+int LoopDev::setWarmPool(unsigned int ttlMs, bool keepParams)
+{
+	if (ttlMs > WARM_POOL_TTL_MAX)
+	{
+		std::cout << "Warm pool TTL is too long ";
+		return -1;
+	}
+
+	alsaLoop->configPool(ttlMs, keepParams ? 1 : 0);
+
+	return 0;
+}
+
+double LoopDev::getWarmPoolStats(struct loopback_pool_stats &stats) const
+{
+	unsigned long opened;
+
+	alsaLoop->poolStats(&stats);
+
+	opened = stats.hits + stats.misses;
+	if (0 == opened)
+	{
+		return 0;
+	}
+
+	return (double)stats.hits / opened;
+}
+
+int LoopDev::changeParameter(loop_cmd_type_t type, double value)
+{
+	bool valid = false;
+
+	if (false == isLoopDevConnected)
+	{
+		std::cout << "Loop device not connected any device" ;
+		return 1;
+	}
+
+	switch (type)
+	{
+	case LOOP_CMD_LATENCY:
+		valid = value > 0;
+		break;
+	case LOOP_CMD_SYNC:
+		valid = value >= SYNC_TYPE_NONE && value <= SYNC_TYPE_LAST;
+		break;
+	case LOOP_CMD_GAIN:
+		//Mixer girişlerinde mixer kazancı, diğerlerinde yazılım kazancı
+		//değişir.
+		valid = value >= 0 && value <= SOFT_GAIN_MAX;
+		break;
+	case LOOP_CMD_SRC_QUALITY:
+		valid = value >= SRC_SINC_BEST_QUALITY && value <= SRC_LINEAR;
+		break;
+	case LOOP_CMD_XRUN:
+		valid = value == 0 || value == 1;
+		break;
+	}
+
+	if (false == valid)
+	{
+		std::cout << "Invalid parameter value ";
+		return -1;
+	}
+
+	if (alsaLoop->postCommand(type, value) < 0)
+	{
+		std::cerr << "Command could not be queued ";
+		return -1;
+	}
+
+	return 0;
+}
+
+int LoopDev::disconnect(unsigned int fadeMs)
+{
+	std::chrono::steady_clock::time_point start;
+
 	if (false == isLoopDevConnected)
 	{
 		std::cout << "Loop device not connected any device" ;
@@ -159,28 +769,46 @@ int LoopDev::disconnect()
 
 	std::cout << "Disconnecting device" ;
 
-	//threade kapanma sinyali gönderiliyor
+	start = std::chrono::steady_clock::now();
+
+	//thread'ler poll içindeki eventfd ile uyandırılır, sinyal kullanılmaz.
+	alsaLoop->quit_fade = fadeMs;
 	alsaLoop->setQuit();
-	alsaLoop->sendToAll(SIGUSR2);
 
 	//thread kapanana kadar bekleniyor.
 	alsaLoop->joinFromThreads();
 
+	disconnectLatency = std::chrono::duration_cast<std::chrono::microseconds>(
+							std::chrono::steady_clock::now() - start).count();
+
 	std::cout << "Thread Closed" ;
 
 	alsaLoop->freeThreads();
 
+	//Bekleyen connectAsync varsa freeThreads ile uyanır.
+	if (connectWaiter.joinable())
+	{
+		connectWaiter.join();
+	}
+
 	isLoopDevConnected = false;
+
+	std::vector<std::string> &devs = isMixedConnection ? mixedRealDevs : realDevs;
 	
-    for (auto it = realDevs.begin(); it != realDevs.end(); ++it) 
+	for (const std::string &realDev : connectedRealDevs)
 	{
-		if (connectedRealDev == *it)
+		for (auto it = devs.begin(); it != devs.end(); ++it) 
 		{
-			realDevs.erase(it);
-			break;
+			if (realDev == *it)
+			{
+				devs.erase(it);
+				break;
+			}
 		}
 	}
-	realDevs.shrink_to_fit();
+	devs.shrink_to_fit();
+	connectedRealDevs.clear();
+	isMixedConnection = false;
 
 	return 0;
 }
@@ -202,11 +830,26 @@ bool LoopDev::getRealDevName(std::string &realDevName) const
 		return false;
 	}
 
-	realDevName = connectedRealDev;
+	realDevName = connectedRealDevs.front();
 
 	return true;
 }
 
+size_t LoopDev::getMemoryFootprint() const
+{
+	if (false == isLoopDevConnected)
+	{
+		return 0;
+	}
+
+	return alsaLoop->memoryFootprint();
+}
+
+long LoopDev::getDisconnectLatency() const
+{
+	return disconnectLatency;
+}
+
 bool LoopDev::isLoopConnected() const
 {
 	return isLoopDevConnected;
@@ -214,7 +857,7 @@ bool LoopDev::isLoopConnected() const
 
 bool LoopDev::isRealConnected(const std::string &realDev) const
 {
-	for (int cnt = 0;
+	for (size_t cnt = 0;
 		 cnt < realDevs.size();
 		 cnt++)
 	{
@@ -226,5 +869,17 @@ bool LoopDev::isRealConnected(const std::string &realDev) const
 		}
 	}
 
+	for (size_t cnt = 0;
+		 cnt < mixedRealDevs.size();
+		 cnt++)
+	{
+		if (mixedRealDevs.at(cnt) == realDev)
+		{
+			std::cout
+				<< "Device already connected to mixed loop devices. ";
+			return true;
+		}
+	}
+
 	return false;
 }
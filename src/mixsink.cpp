@@ -0,0 +1,603 @@
+/**
+ * @file mixsink.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Birden fazla loop cihazının tek bir gerçek playback cihazına
+ *        karıştırılarak yazılmasını sağlayan mixing sink modülü.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+#include "kernels.h"
+
+/* queued device periods, this is the latency added by the sink */
+#define MIXSINK_PERIODS		2
+
+static pthread_mutex_t mixsink_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct loopback_mixsink *mixsink_list = NULL;
+
+static inline snd_pcm_uframes_t mixin_fill(struct loopback_mixin *in)
+{
+	return __atomic_load_n(&in->appl_ptr, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&in->hw_ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline int mixin_get_state(struct loopback_mixin *in)
+{
+	return __atomic_load_n(&in->state, __ATOMIC_ACQUIRE);
+}
+
+static inline void mixin_set_state(struct loopback_mixin *in, int state)
+{
+	__atomic_store_n(&in->state, state, __ATOMIC_RELEASE);
+}
+
+static void mixin_wake(struct loopback_mixin *in)
+{
+	uint64_t one = 1;
+
+	/* EAGAIN means the counter is saturated, the loop wakes up anyway */
+	if (write(in->event_fd, &one, sizeof(one)) < 0 && verbose > 8)
+		logit(LOG_DEBUG, "mixer input wake failed: %s\n", strerror(errno));
+}
+
+static int mixsink_setparams(struct loopback_mixsink *sink,
+			     unsigned int period_time)
+{
+	snd_pcm_t *handle = sink->handle;
+	snd_pcm_hw_params_t *params;
+	snd_pcm_sw_params_t *swparams;
+	snd_pcm_uframes_t period, buffer;
+	unsigned int rate = sink->rate;
+	int err;
+
+	snd_pcm_hw_params_alloca(&params);
+	snd_pcm_sw_params_alloca(&swparams);
+	err = snd_pcm_hw_params_any(handle, params);
+	if (err < 0) {
+		logit(LOG_CRIT, "Broken configuration for mixer %s: %s\n", sink->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+	if (err < 0) {
+		logit(LOG_CRIT, "Access type not available for mixer %s: %s\n", sink->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_set_format(handle, params, sink->format);
+	if (err < 0) {
+		logit(LOG_CRIT, "Sample format not available for mixer %s: %s\n", sink->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_set_channels(handle, params, sink->channels);
+	if (err < 0) {
+		logit(LOG_CRIT, "Channels count (%u) not available for mixer %s: %s\n", sink->channels, sink->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_set_rate_near(handle, params, &rate, 0);
+	if (err < 0) {
+		logit(LOG_CRIT, "Rate %uHz not available for mixer %s: %s\n", sink->rate, sink->device, snd_strerror(err));
+		return err;
+	}
+	sink->rate = rate;
+	period = ((unsigned long long)period_time * rate) / 1000000ULL;
+	err = snd_pcm_hw_params_set_period_size_near(handle, params, &period, 0);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set period size %li for mixer %s: %s\n", period, sink->device, snd_strerror(err));
+		return err;
+	}
+	buffer = period * MIXSINK_PERIODS * 2;
+	err = snd_pcm_hw_params_set_buffer_size_near(handle, params, &buffer);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set buffer size %li for mixer %s: %s\n", buffer, sink->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params(handle, params);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set hw params for mixer %s: %s\n", sink->device, snd_strerror(err));
+		return err;
+	}
+	snd_pcm_hw_params_get_period_size(params, &sink->period_size, NULL);
+	snd_pcm_hw_params_get_buffer_size(params, &sink->buffer_size);
+	if (sink->period_size * MIXSINK_PERIODS > sink->buffer_size) {
+		logit(LOG_CRIT, "Mixer %s buffer too small (%li/%li)\n", sink->device, sink->period_size, sink->buffer_size);
+		return -EINVAL;
+	}
+	err = snd_pcm_sw_params_current(handle, swparams);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to determine current swparams for mixer %s: %s\n", sink->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_sw_params_set_start_threshold(handle, swparams, 0x7fffffff);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set start threshold for mixer %s: %s\n", sink->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_sw_params_set_avail_min(handle, swparams, sink->period_size);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set avail min for mixer %s: %s\n", sink->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_sw_params(handle, swparams);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set sw params for mixer %s: %s\n", sink->device, snd_strerror(err));
+		return err;
+	}
+	return 0;
+}
+
+/* queue silence in front of the first mixed period and start the device */
+static int mixsink_prefill(struct loopback_mixsink *sink)
+{
+	snd_pcm_sframes_t r;
+	int i, err;
+
+	if ((err = snd_pcm_prepare(sink->handle)) < 0)
+		return err;
+	err = snd_pcm_format_set_silence(sink->format, sink->out,
+					 sink->period_size * sink->channels);
+	if (err < 0)
+		return err;
+	for (i = 0; i < MIXSINK_PERIODS; i++) {
+		r = snd_pcm_writei(sink->handle, sink->out, sink->period_size);
+		if (r < 0)
+			return r;
+	}
+	return snd_pcm_start(sink->handle);
+}
+
+static void mixsink_accumulate(struct loopback_mixsink *sink, float *acc,
+			       const char *buf, unsigned int samples,
+			       float gain)
+{
+	if (sink->format == SND_PCM_FORMAT_S32)
+		kernel_mix_s32(acc, (const int32_t *)buf, samples, gain);
+	else
+		kernel_mix_s16(acc, (const int16_t *)buf, samples, gain);
+}
+
+/* mix one period of every running input into sink->out */
+static void mixsink_mix(struct loopback_mixsink *sink)
+{
+	snd_pcm_uframes_t period = sink->period_size;
+	snd_pcm_uframes_t count, done, pos, count1;
+	unsigned int channels = sink->channels;
+	struct loopback_mixin *in;
+	float gain;
+	int i;
+
+	memset(sink->acc, 0, period * channels * sizeof(float));
+	pthread_mutex_lock(&sink->lock);
+	for (i = 0; i < sink->inputs_count; i++) {
+		in = sink->inputs[i];
+		if (mixin_get_state(in) != SND_PCM_STATE_RUNNING)
+			continue;
+		__atomic_load(&in->gain, &gain, __ATOMIC_RELAXED);
+		count = mixin_fill(in);
+		if (count > period)
+			count = period;
+		pos = in->hw_ptr & (in->size - 1);
+		for (done = 0; done < count; done += count1) {
+			count1 = count - done;
+			if (pos + count1 > in->size)
+				count1 = in->size - pos;
+			mixsink_accumulate(sink, sink->acc + done * channels,
+					   in->buf + pos * sink->frame_size,
+					   count1 * channels, gain);
+			pos = (pos + count1) & (in->size - 1);
+		}
+		__atomic_store_n(&in->hw_ptr, in->hw_ptr + count, __ATOMIC_RELEASE);
+		if (count < period) {
+			/* the loop did not keep up, report underrun to it */
+			mixin_set_state(in, SND_PCM_STATE_XRUN);
+			in->underruns++;
+			mixin_wake(in);
+		} else if (in->size - mixin_fill(in) >=
+			   __atomic_load_n(&in->avail_min, __ATOMIC_RELAXED)) {
+			mixin_wake(in);
+		}
+	}
+	pthread_mutex_unlock(&sink->lock);
+	if (sink->format == SND_PCM_FORMAT_S32)
+		kernel_store_s32((int32_t *)sink->out, sink->acc, period * channels, 1.0f);
+	else
+		kernel_store_s16((int16_t *)sink->out, sink->acc, period * channels, 1.0f);
+}
+
+static int mixsink_xrun(struct loopback_mixsink *sink, int err)
+{
+	sink->xruns++;
+	if (verbose)
+		logit(LOG_DEBUG, "underrun for mixer %s\n", sink->device);
+	if (err == -ESTRPIPE) {
+		while ((err = snd_pcm_resume(sink->handle)) == -EAGAIN)
+			usleep(1);
+		if (err >= 0)
+			return 0;
+	}
+	return mixsink_prefill(sink);
+}
+
+static void *mixsink_thread(void *_data)
+{
+	struct loopback_mixsink *sink = (struct loopback_mixsink *) _data;
+	snd_pcm_sframes_t avail, r, delay;
+	unsigned short revents;
+	int err, timeout;
+
+	setScheduler(&sink->sched, (sink->period_size * 1000000000ULL) / sink->rate);
+	/* wake up at least every two periods to notice the quit request */
+	timeout = (sink->period_size * 2 * 1000) / sink->rate + 1;
+	while (!__atomic_load_n(&sink->quit, __ATOMIC_ACQUIRE)) {
+		snd_pcm_poll_descriptors(sink->handle, sink->pfds, sink->pollfd_count);
+		err = poll(sink->pfds, sink->pollfd_count, timeout);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			logit(LOG_CRIT, "Mixer %s poll failed: %s\n", sink->device, strerror(errno));
+			break;
+		}
+		if (err > 0)
+			snd_pcm_poll_descriptors_revents(sink->handle, sink->pfds,
+							 sink->pollfd_count, &revents);
+		avail = snd_pcm_avail_update(sink->handle);
+		if (avail == -EPIPE || avail == -ESTRPIPE) {
+			if ((err = mixsink_xrun(sink, avail)) < 0) {
+				logit(LOG_CRIT, "Mixer %s restart failed: %s\n", sink->device, snd_strerror(err));
+				break;
+			}
+			continue;
+		}
+		while (avail >= (snd_pcm_sframes_t)sink->period_size) {
+			mixsink_mix(sink);
+			r = snd_pcm_writei(sink->handle, sink->out, sink->period_size);
+			if (r == -EPIPE || r == -ESTRPIPE) {
+				mixsink_xrun(sink, r);
+				break;
+			}
+			if (r < 0)
+				break;
+			avail -= r;
+		}
+		if (snd_pcm_delay(sink->handle, &delay) >= 0)
+			__atomic_store_n(&sink->delay, delay, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void mixsink_free(struct loopback_mixsink *sink)
+{
+	if (sink->thread_running) {
+		__atomic_store_n(&sink->quit, 1, __ATOMIC_RELEASE);
+		pthread_join(sink->thread, NULL);
+	}
+	if (sink->handle) {
+		snd_pcm_drop(sink->handle);
+		snd_pcm_close(sink->handle);
+	}
+	pthread_mutex_destroy(&sink->lock);
+	free(sink->pfds);
+	free(sink->acc);
+	free(sink->out);
+	free(sink->device);
+	free(sink);
+}
+
+static int mixsink_open(struct loopback_handle *lhandle,
+			struct loopback_mixsink **_sink)
+{
+	struct loopback_mixsink *sink;
+	unsigned int period_time;
+	int err;
+
+	sink = (struct loopback_mixsink *) calloc(1, sizeof(*sink));
+	if (sink == NULL)
+		return -ENOMEM;
+	pthread_mutex_init(&sink->lock, NULL);
+	sink->sched = lhandle->loopback->sched;
+	sink->device = strdup(lhandle->device);
+	if (sink->device == NULL) {
+		err = -ENOMEM;
+		goto __error;
+	}
+	/* the mixing kernels work on 16 or 32 bit samples */
+	sink->format = snd_pcm_format_width(lhandle->format) > 16 ?
+				SND_PCM_FORMAT_S32 : SND_PCM_FORMAT_S16;
+	sink->rate = lhandle->rate_req;
+	sink->channels = lhandle->channels;
+	sink->frame_size = (snd_pcm_format_physical_width(sink->format) / 8) *
+				sink->channels;
+	err = snd_pcm_open(&sink->handle, sink->device, SND_PCM_STREAM_PLAYBACK,
+			   SND_PCM_NONBLOCK);
+	if (err < 0) {
+		logit(LOG_CRIT, "mixer %s open error: %s\n", sink->device, snd_strerror(err));
+		sink->handle = NULL;
+		goto __error;
+	}
+	period_time = lhandle->loopback->latency_reqtime / 8;
+	if (period_time < 1000)
+		period_time = 1000;
+	if ((err = mixsink_setparams(sink, period_time)) < 0)
+		goto __error;
+	sink->acc = (float *) calloc(1, sink->period_size * sink->channels * sizeof(float));
+	sink->out = (char *) calloc(1, sink->period_size * sink->frame_size);
+	err = snd_pcm_poll_descriptors_count(sink->handle);
+	if (err <= 0) {
+		err = err < 0 ? err : -EIO;
+		goto __error;
+	}
+	sink->pollfd_count = err;
+	sink->pfds = (struct pollfd *) calloc(sink->pollfd_count, sizeof(struct pollfd));
+	if (sink->acc == NULL || sink->out == NULL || sink->pfds == NULL) {
+		err = -ENOMEM;
+		goto __error;
+	}
+	if ((err = mixsink_prefill(sink)) < 0) {
+		logit(LOG_CRIT, "mixer %s start error: %s\n", sink->device, snd_strerror(err));
+		goto __error;
+	}
+	err = pthread_create(&sink->thread, NULL, mixsink_thread, sink);
+	if (err != 0) {
+		err = -err;
+		goto __error;
+	}
+	sink->thread_running = 1;
+	if (verbose)
+		logit(LOG_INFO, "Mixer %s: %s, %uHz, %u channels, period %li, buffer %li\n", sink->device, snd_pcm_format_name(sink->format), sink->rate, sink->channels, sink->period_size, sink->buffer_size);
+	*_sink = sink;
+	return 0;
+      __error:
+	mixsink_free(sink);
+	return err;
+}
+
+int mixsink_attach(struct loopback_handle *lhandle)
+{
+	struct loopback_mixsink *sink;
+	struct loopback_mixin *in;
+	int err = 0;
+
+	in = (struct loopback_mixin *) calloc(1, sizeof(*in));
+	if (in == NULL)
+		return -ENOMEM;
+	in->lhandle = lhandle;
+	in->state = SND_PCM_STATE_OPEN;
+	in->gain = lhandle->mix_gain;
+	in->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (in->event_fd < 0) {
+		free(in);
+		return -errno;
+	}
+	pthread_mutex_lock(&mixsink_list_mutex);
+	for (sink = mixsink_list; sink; sink = sink->next)
+		if (strcmp(sink->device, lhandle->device) == 0)
+			break;
+	if (sink == NULL) {
+		if ((err = mixsink_open(lhandle, &sink)) < 0)
+			goto __unlock;
+		sink->next = mixsink_list;
+		mixsink_list = sink;
+	}
+	pthread_mutex_lock(&sink->lock);
+	if (sink->inputs_count >= MAX_MIXSINK_INPUTS) {
+		err = -EBUSY;
+	} else {
+		in->sink = sink;
+		sink->inputs[sink->inputs_count++] = in;
+	}
+	pthread_mutex_unlock(&sink->lock);
+      __unlock:
+	pthread_mutex_unlock(&mixsink_list_mutex);
+	if (err < 0) {
+		logit(LOG_CRIT, "%s: unable to attach to mixer: %s\n", lhandle->id, snd_strerror(err));
+		close(in->event_fd);
+		free(in);
+		return err;
+	}
+	lhandle->mixin = in;
+	return 0;
+}
+
+void mixsink_detach(struct loopback_handle *lhandle)
+{
+	struct loopback_mixin *in = lhandle->mixin;
+	struct loopback_mixsink *sink, **prev;
+	int i, last;
+
+	if (in == NULL)
+		return;
+	sink = in->sink;
+	pthread_mutex_lock(&mixsink_list_mutex);
+	pthread_mutex_lock(&sink->lock);
+	for (i = 0; i < sink->inputs_count; i++) {
+		if (sink->inputs[i] == in) {
+			sink->inputs[i] = sink->inputs[--sink->inputs_count];
+			break;
+		}
+	}
+	last = sink->inputs_count == 0;
+	pthread_mutex_unlock(&sink->lock);
+	if (last) {
+		for (prev = &mixsink_list; *prev; prev = &(*prev)->next) {
+			if (*prev == sink) {
+				*prev = sink->next;
+				break;
+			}
+		}
+		mixsink_free(sink);
+	}
+	pthread_mutex_unlock(&mixsink_list_mutex);
+	if (verbose && in->underruns)
+		logit(LOG_INFO, "%s: %lu mixer underruns\n", lhandle->id, in->underruns);
+	close(in->event_fd);
+	free(in->buf);
+	free(in);
+	lhandle->mixin = NULL;
+}
+
+int mixin_setup(struct loopback_mixin *in, snd_pcm_uframes_t size,
+		snd_pcm_uframes_t avail_min)
+{
+	struct loopback_mixsink *sink = in->sink;
+	char *buf = NULL;
+
+	if (size & (size - 1))
+		return -EINVAL;
+	if (size != in->size) {
+		buf = (char *) calloc(1, size * sink->frame_size);
+		if (buf == NULL)
+			return -ENOMEM;
+	}
+	pthread_mutex_lock(&sink->lock);
+	mixin_set_state(in, SND_PCM_STATE_SETUP);
+	if (buf) {
+		free(in->buf);
+		in->buf = buf;
+		in->size = size;
+	}
+	in->avail_min = avail_min;
+	in->appl_ptr = in->hw_ptr = 0;
+	pthread_mutex_unlock(&sink->lock);
+	return 0;
+}
+
+void mixin_set_avail_min(struct loopback_mixin *in, snd_pcm_uframes_t avail_min)
+{
+	__atomic_store_n(&in->avail_min, avail_min, __ATOMIC_RELAXED);
+}
+
+void mixin_set_gain(struct loopback_mixin *in, float gain)
+{
+	__atomic_store(&in->gain, &gain, __ATOMIC_RELAXED);
+}
+
+int mixin_prepare(struct loopback_mixin *in)
+{
+	pthread_mutex_lock(&in->sink->lock);
+	if (in->buf == NULL) {
+		pthread_mutex_unlock(&in->sink->lock);
+		return -EBADFD;
+	}
+	mixin_set_state(in, SND_PCM_STATE_PREPARED);
+	in->appl_ptr = in->hw_ptr = 0;
+	pthread_mutex_unlock(&in->sink->lock);
+	return 0;
+}
+
+int mixin_start(struct loopback_mixin *in)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&in->sink->lock);
+	if (mixin_get_state(in) == SND_PCM_STATE_PREPARED)
+		mixin_set_state(in, SND_PCM_STATE_RUNNING);
+	else
+		err = -EBADFD;
+	pthread_mutex_unlock(&in->sink->lock);
+	return err;
+}
+
+int mixin_drop(struct loopback_mixin *in)
+{
+	pthread_mutex_lock(&in->sink->lock);
+	mixin_set_state(in, SND_PCM_STATE_SETUP);
+	in->appl_ptr = in->hw_ptr = 0;
+	pthread_mutex_unlock(&in->sink->lock);
+	return 0;
+}
+
+snd_pcm_state_t mixin_state(struct loopback_mixin *in)
+{
+	return (snd_pcm_state_t) mixin_get_state(in);
+}
+
+snd_pcm_sframes_t mixin_avail_update(struct loopback_mixin *in)
+{
+	if (mixin_get_state(in) == SND_PCM_STATE_XRUN)
+		return -EPIPE;
+	return in->size - mixin_fill(in);
+}
+
+int mixin_delay(struct loopback_mixin *in, snd_pcm_sframes_t *delayp)
+{
+	int state = mixin_get_state(in);
+
+	if (state == SND_PCM_STATE_XRUN)
+		return -EPIPE;
+	if (state != SND_PCM_STATE_PREPARED && state != SND_PCM_STATE_RUNNING)
+		return -EBADFD;
+	*delayp = mixin_fill(in) +
+		  __atomic_load_n(&in->sink->delay, __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+snd_pcm_sframes_t mixin_writei(struct loopback_mixin *in, const void *buf,
+			       snd_pcm_uframes_t size)
+{
+	unsigned int frame_size = in->sink->frame_size;
+	snd_pcm_uframes_t avail, pos, count1;
+	int state = mixin_get_state(in);
+
+	if (state == SND_PCM_STATE_XRUN)
+		return -EPIPE;
+	if (state != SND_PCM_STATE_PREPARED && state != SND_PCM_STATE_RUNNING)
+		return -EBADFD;
+	avail = in->size - mixin_fill(in);
+	if (size > avail)
+		size = avail;
+	if (size == 0)
+		return -EAGAIN;
+	pos = in->appl_ptr & (in->size - 1);
+	count1 = size;
+	if (pos + count1 > in->size)
+		count1 = in->size - pos;
+	memcpy(in->buf + pos * frame_size, buf, count1 * frame_size);
+	if (count1 < size)
+		memcpy(in->buf, (const char *)buf + count1 * frame_size,
+		       (size - count1) * frame_size);
+	__atomic_store_n(&in->appl_ptr, in->appl_ptr + size, __ATOMIC_RELEASE);
+	return size;
+}
+
+int mixin_poll_descriptors(struct loopback_mixin *in, struct pollfd *pfds,
+			   unsigned int space)
+{
+	if (space < 1)
+		return -EINVAL;
+	pfds[0].fd = in->event_fd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	return 1;
+}
+
+int mixin_poll_revents(struct loopback_mixin *in, struct pollfd *pfds,
+		       unsigned int nfds, unsigned short *revents)
+{
+	uint64_t val;
+
+	if (nfds < 1)
+		return -EINVAL;
+	*revents = 0;
+	if (pfds[0].revents & POLLIN) {
+		if (read(in->event_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+			return -errno;
+		*revents = POLLOUT;
+	}
+	if (pfds[0].revents & (POLLERR | POLLNVAL))
+		*revents |= POLLERR;
+	return 0;
+}
@@ -24,20 +24,43 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <sched.h>
 #include <errno.h>
 #include <getopt.h>
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <math.h>
 #include <syslog.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
 #include "alsaloop.h"
 
 #define XRUN_PROFILE_UNKNOWN (-10000000)
 
+/* sync updates between two notes of the learned pitch */
+#define DRIFT_STORE_UPDATES 4
+
+/* shortest timer wakeup interval, in us */
+#define WAKE_TIMER_MIN 500
+
+/* longest fade at disconnect, in ms */
+#define FADE_OUT_MAX 100
+
+/* sync points watched before the loop card timer counts as locked */
+#define TIMER_LOCK_CHECKS 4
+/* drift left over on a locked timer, in ppm */
+#define TIMER_LOCK_MAX_PPM 2.0
+
 static int set_rate_shift(struct loopback_handle *lhandle, double pitch);
 static int get_rate(struct loopback_handle *lhandle);
+static void wake_timer_arm(struct loopback *loop);
 
 #define SYNCTYPE(v) [SYNC_TYPE_##v] = #v
 
@@ -106,6 +129,153 @@ static inline snd_pcm_uframes_t time_to_frames(unsigned int rate,
 	return (time * rate) / 1000000ULL;
 }
 
+/*
+ * PCM access for the loop handles. A playback handle attached to a mixing
+ * sink has no PCM of its own, the calls go to its mixer input instead.
+ * A capture handle attached to a split source reads the shared ring.
+ */
+static inline int pcm_prepare(struct loopback_handle *lhandle)
+{
+	if (lhandle->mixin)
+		return mixin_prepare(lhandle->mixin);
+	if (lhandle->splitout)
+		return splitout_prepare(lhandle->splitout);
+	return snd_pcm_prepare(lhandle->handle);
+}
+
+static inline int pcm_start(struct loopback_handle *lhandle)
+{
+	if (lhandle->mixin)
+		return mixin_start(lhandle->mixin);
+	if (lhandle->splitout)
+		return splitout_start(lhandle->splitout);
+	return snd_pcm_start(lhandle->handle);
+}
+
+static inline int pcm_drop(struct loopback_handle *lhandle)
+{
+	if (lhandle->mixin)
+		return mixin_drop(lhandle->mixin);
+	if (lhandle->splitout)
+		return splitout_drop(lhandle->splitout);
+	return snd_pcm_drop(lhandle->handle);
+}
+
+static inline int pcm_hw_free(struct loopback_handle *lhandle)
+{
+	if (lhandle->mixin || lhandle->splitout)
+		return 0;
+	if (pcmpool_keep_params(lhandle))
+		return 0;
+	return snd_pcm_hw_free(lhandle->handle);
+}
+
+static inline int pcm_resume(struct loopback_handle *lhandle)
+{
+	if (lhandle->mixin || lhandle->splitout)
+		return 0;
+	return snd_pcm_resume(lhandle->handle);
+}
+
+static inline snd_pcm_state_t pcm_state(struct loopback_handle *lhandle)
+{
+	if (lhandle->mixin)
+		return mixin_state(lhandle->mixin);
+	if (lhandle->splitout)
+		return splitout_state(lhandle->splitout);
+	return snd_pcm_state(lhandle->handle);
+}
+
+static inline int pcm_delay(struct loopback_handle *lhandle,
+			    snd_pcm_sframes_t *delayp)
+{
+	if (lhandle->mixin)
+		return mixin_delay(lhandle->mixin, delayp);
+	if (lhandle->splitout)
+		return splitout_delay(lhandle->splitout, delayp);
+	return snd_pcm_delay(lhandle->handle, delayp);
+}
+
+static inline snd_pcm_sframes_t pcm_avail_update(struct loopback_handle *lhandle)
+{
+	if (lhandle->mixin)
+		return mixin_avail_update(lhandle->mixin);
+	if (lhandle->splitout)
+		return splitout_avail_update(lhandle->splitout);
+	return snd_pcm_avail_update(lhandle->handle);
+}
+
+static inline snd_pcm_sframes_t pcm_writei(struct loopback_handle *lhandle,
+					   const void *buf,
+					   snd_pcm_uframes_t size)
+{
+	if (lhandle->mixin)
+		return mixin_writei(lhandle->mixin, buf, size);
+	return snd_pcm_writei(lhandle->handle, buf, size);
+}
+
+static inline snd_pcm_sframes_t pcm_readi(struct loopback_handle *lhandle,
+					  void *buf,
+					  snd_pcm_uframes_t size)
+{
+	if (lhandle->splitout)
+		return splitout_readi(lhandle->splitout, buf, size);
+	return snd_pcm_readi(lhandle->handle, buf, size);
+}
+
+static inline int pcm_poll_descriptors_count(struct loopback_handle *lhandle)
+{
+	if (lhandle->mixin || lhandle->splitout)
+		return 1;
+	return snd_pcm_poll_descriptors_count(lhandle->handle);
+}
+
+static inline int pcm_poll_descriptors(struct loopback_handle *lhandle,
+				       struct pollfd *pfds,
+				       unsigned int space)
+{
+	if (lhandle->mixin)
+		return mixin_poll_descriptors(lhandle->mixin, pfds, space);
+	if (lhandle->splitout)
+		return splitout_poll_descriptors(lhandle->splitout, pfds, space);
+	return snd_pcm_poll_descriptors(lhandle->handle, pfds, space);
+}
+
+static inline int pcm_poll_descriptors_revents(struct loopback_handle *lhandle,
+					       struct pollfd *pfds,
+					       unsigned int nfds,
+					       unsigned short *revents)
+{
+	if (lhandle->mixin)
+		return mixin_poll_revents(lhandle->mixin, pfds, nfds, revents);
+	if (lhandle->splitout)
+		return splitout_poll_revents(lhandle->splitout, pfds, nfds, revents);
+	return snd_pcm_poll_descriptors_revents(lhandle->handle, pfds, nfds, revents);
+}
+
+static long timediff(snd_timestamp_t t1, snd_timestamp_t t2)
+{
+	signed long l;
+
+	t1.tv_sec -= t2.tv_sec;
+	if (t1.tv_usec < t2.tv_usec) {
+		l = ((t1.tv_usec + 1000000) - t2.tv_usec) % 1000000;
+		t1.tv_sec--;
+	} else {
+		l = t1.tv_usec - t2.tv_usec;
+	}
+	return (t1.tv_sec * 1000000) + l;
+}
+
+static int getcurtimestamp(snd_timestamp_t *ts)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	ts->tv_sec = tv.tv_sec;
+	ts->tv_usec = tv.tv_usec;
+	return 0;
+}
+
 static int setparams_stream(struct loopback_handle *lhandle,
 			    snd_pcm_hw_params_t *params)
 {
@@ -159,10 +329,10 @@ static int setparams_stream(struct loopback_handle *lhandle,
 	return 0;
 }
 
-static int setparams_bufsize(struct loopback_handle *lhandle,
-			     snd_pcm_hw_params_t *params,
-			     snd_pcm_hw_params_t *tparams,
-			     snd_pcm_uframes_t bufsize)
+static int setparams_bufsize_search(struct loopback_handle *lhandle,
+				    snd_pcm_hw_params_t *params,
+				    snd_pcm_hw_params_t *tparams,
+				    snd_pcm_uframes_t bufsize)
 {
 	snd_pcm_t *handle = lhandle->handle;
 	int err;
@@ -220,32 +390,104 @@ static int setparams_bufsize(struct loopback_handle *lhandle,
 	return 0;
 }
 
-static int setparams_set(struct loopback_handle *lhandle,
-			 snd_pcm_hw_params_t *params,
-			 snd_pcm_sw_params_t *swparams,
-			 snd_pcm_uframes_t bufsize)
+/*
+ * Pick the buffer and period sizes from the limits the device reports,
+ * so the common case needs a single try.
+ */
+static int setparams_bufsize_query(struct loopback_handle *lhandle,
+				   snd_pcm_hw_params_t *params,
+				   snd_pcm_hw_params_t *tparams,
+				   snd_pcm_uframes_t bufsize)
 {
 	snd_pcm_t *handle = lhandle->handle;
+	snd_pcm_uframes_t min, max, periodsize, buffersize;
 	int err;
-	snd_pcm_uframes_t val, period_size, buffer_size;
 
-	err = snd_pcm_hw_params(handle, params);
-	if (err < 0) {
-		logit(LOG_CRIT, "Unable to set hw params for %s: %s\n", lhandle->id, snd_strerror(err));
+	snd_pcm_hw_params_copy(params, tparams);
+	if ((err = snd_pcm_hw_params_get_buffer_size_min(params, &min)) < 0 ||
+	    (err = snd_pcm_hw_params_get_buffer_size_max(params, &max)) < 0)
 		return err;
-	}
-	err = snd_pcm_sw_params_current(handle, swparams);
-	if (err < 0) {
-		logit(LOG_CRIT, "Unable to determine current swparams for %s: %s\n", lhandle->id, snd_strerror(err));
+	buffersize = bufsize * 8;
+	if (buffersize < min)
+		buffersize = min;
+	if (buffersize > max)
+		buffersize = max;
+	if ((err = snd_pcm_hw_params_set_buffer_size_near(handle, params, &buffersize)) < 0)
 		return err;
-	}
-	err = snd_pcm_sw_params_set_start_threshold(handle, swparams, 0x7fffffff);
-	if (err < 0) {
-		logit(LOG_CRIT, "Unable to set start threshold mode for %s: %s\n", lhandle->id, snd_strerror(err));
+	snd_pcm_hw_params_get_buffer_size(params, &buffersize);
+	if ((err = snd_pcm_hw_params_get_period_size_min(params, &min, NULL)) < 0 ||
+	    (err = snd_pcm_hw_params_get_period_size_max(params, &max, NULL)) < 0)
+		return err;
+	if (lhandle->period_size_req > 0)
+		periodsize = lhandle->period_size_req;
+	else
+		periodsize = buffersize / 8;
+	if (periodsize > buffersize / 2)
+		periodsize = buffersize / 2;
+	if (periodsize < min)
+		periodsize = min;
+	if (periodsize > max)
+		periodsize = max;
+	if ((err = snd_pcm_hw_params_set_period_size_near(handle, params, &periodsize, 0)) < 0)
 		return err;
+	snd_pcm_hw_params_get_period_size(params, &periodsize, NULL);
+	if (periodsize * 2 > buffersize)
+		return -EINVAL;
+	if (verbose > 6)
+		snd_output_printf(lhandle->loopback->output, "%s: buffer_size=%li, period_size=%li\n", lhandle->id, buffersize, periodsize);
+	lhandle->period_size = periodsize;
+	lhandle->buffer_size = buffersize;
+	return 0;
+}
+
+/*
+ * Buffer and period sizes come from the cache when this device already
+ * accepted them for the same request, from the device limits otherwise,
+ * and only as the last resort from the stepwise search.
+ */
+static int setparams_bufsize(struct loopback_handle *lhandle,
+			     snd_pcm_hw_params_t *params,
+			     snd_pcm_hw_params_t *tparams,
+			     snd_pcm_uframes_t bufsize)
+{
+	snd_pcm_t *handle = lhandle->handle;
+	snd_pcm_uframes_t periodsize, buffersize;
+	unsigned int rate;
+	int err;
+
+	if (hwcache_lookup(lhandle, bufsize, &rate, &buffersize, &periodsize) &&
+	    rate == (unsigned int)lhandle->rate) {
+		snd_pcm_hw_params_copy(params, tparams);
+		if (snd_pcm_hw_params_set_buffer_size(handle, params, buffersize) >= 0 &&
+		    snd_pcm_hw_params_set_period_size(handle, params, periodsize, 0) >= 0) {
+			if (verbose > 6)
+				snd_output_printf(lhandle->loopback->output, "%s: cached buffer_size=%li, period_size=%li\n", lhandle->id, buffersize, periodsize);
+			lhandle->period_size = periodsize;
+			lhandle->buffer_size = buffersize;
+			return 0;
+		}
+		if (verbose > 1)
+			snd_output_printf(lhandle->loopback->output, "%s: cached hw params rejected\n", lhandle->id);
 	}
-	snd_pcm_hw_params_get_period_size(params, &period_size, NULL);
-	snd_pcm_hw_params_get_buffer_size(params, &buffer_size);
+	err = -EINVAL;
+	if (lhandle->buffer_size_req == 0)
+		err = setparams_bufsize_query(lhandle, params, tparams, bufsize);
+	if (err < 0)
+		err = setparams_bufsize_search(lhandle, params, tparams, bufsize);
+	if (err < 0)
+		return err;
+	hwcache_store(lhandle, bufsize, lhandle->rate,
+		      lhandle->buffer_size, lhandle->period_size);
+	return 0;
+}
+
+static snd_pcm_uframes_t setparams_avail_min(struct loopback_handle *lhandle,
+					     snd_pcm_uframes_t period_size,
+					     snd_pcm_uframes_t buffer_size,
+					     snd_pcm_uframes_t bufsize)
+{
+	snd_pcm_uframes_t val;
+
 	if (lhandle->nblock) {
 		if (lhandle == lhandle->loopback->play) {
 			val = buffer_size - (2 * period_size - 4);
@@ -268,6 +510,114 @@ static int setparams_set(struct loopback_handle *lhandle,
 		if (verbose > 6)
 			snd_output_printf(lhandle->loopback->output, "%s: avail_min2=%li\n", lhandle->id, val);
 	}
+	return val;
+}
+
+/*
+ * Parameters of a playback handle feeding a mixing sink: rate, format and
+ * channels are given by the sink, the input FIFO plays the hardware buffer.
+ */
+static int setparams_mixin_stream(struct loopback_handle *lhandle)
+{
+	struct loopback_mixsink *sink = lhandle->mixin->sink;
+
+	if (lhandle->format != sink->format) {
+		logit(LOG_CRIT, "Sample format %s not available for %s (mixer uses %s)\n", snd_pcm_format_name(lhandle->format), lhandle->id, snd_pcm_format_name(sink->format));
+		return -EINVAL;
+	}
+	if (lhandle->channels != sink->channels) {
+		logit(LOG_CRIT, "Channels count (%u) not available for %s (mixer uses %u)\n", lhandle->channels, lhandle->id, sink->channels);
+		return -EINVAL;
+	}
+	lhandle->rate = sink->rate;
+	lhandle->pitch = (double)lhandle->rate_req / (double)lhandle->rate;
+	return 0;
+}
+
+static int setparams_mixin(struct loopback_handle *lhandle,
+			   snd_pcm_uframes_t bufsize)
+{
+	struct loopback_mixin *in = lhandle->mixin;
+	snd_pcm_uframes_t size = 1;
+
+	while (size < bufsize * 8 || size < in->sink->period_size * 4)
+		size <<= 1;
+	lhandle->buffer_size = size;
+	lhandle->period_size = in->sink->period_size;
+	lhandle->avail_min = setparams_avail_min(lhandle, lhandle->period_size,
+						 lhandle->buffer_size, bufsize);
+	return mixin_setup(in, size, lhandle->avail_min);
+}
+
+/*
+ * Parameters of a capture handle reading a split source: rate, format and
+ * channels are given by the source, the reader window plays the hardware
+ * buffer and must fit into the shared ring.
+ */
+static int setparams_splitout_stream(struct loopback_handle *lhandle)
+{
+	struct loopback_splitsrc *src = lhandle->splitout->src;
+
+	if (lhandle->format != src->format) {
+		logit(LOG_CRIT, "Sample format %s not available for %s (split source uses %s)\n", snd_pcm_format_name(lhandle->format), lhandle->id, snd_pcm_format_name(src->format));
+		return -EINVAL;
+	}
+	if (lhandle->channels != src->channels) {
+		logit(LOG_CRIT, "Channels count (%u) not available for %s (split source uses %u)\n", lhandle->channels, lhandle->id, src->channels);
+		return -EINVAL;
+	}
+	lhandle->rate = src->rate;
+	lhandle->pitch = (double)lhandle->rate_req / (double)lhandle->rate;
+	return 0;
+}
+
+static int setparams_splitout(struct loopback_handle *lhandle,
+			      snd_pcm_uframes_t bufsize)
+{
+	struct loopback_splitout *out = lhandle->splitout;
+	snd_pcm_uframes_t size = 1;
+
+	while (size < bufsize * 8 || size < out->src->period_size * 4)
+		size <<= 1;
+	if (size > out->src->size)
+		size = out->src->size;
+	lhandle->buffer_size = size;
+	lhandle->period_size = out->src->period_size;
+	lhandle->avail_min = setparams_avail_min(lhandle, lhandle->period_size,
+						 lhandle->buffer_size, bufsize);
+	return splitout_setup(out, size, lhandle->avail_min);
+}
+
+static int setparams_sw(struct loopback_handle *lhandle,
+			snd_pcm_sw_params_t *swparams,
+			snd_pcm_uframes_t period_size,
+			snd_pcm_uframes_t buffer_size,
+			snd_pcm_uframes_t bufsize)
+{
+	snd_pcm_t *handle = lhandle->handle;
+	int err;
+	snd_pcm_uframes_t val;
+
+	err = snd_pcm_sw_params_current(handle, swparams);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to determine current swparams for %s: %s\n", lhandle->id, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_sw_params_set_start_threshold(handle, swparams, 0x7fffffff);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set start threshold mode for %s: %s\n", lhandle->id, snd_strerror(err));
+		return err;
+	}
+	val = setparams_avail_min(lhandle, period_size, buffer_size, bufsize);
+	if (lhandle->loopback->wake_timer) {
+		/* the timer drives the loop, the PCM only reports trouble */
+		err = snd_pcm_sw_params_set_period_event(handle, swparams, 0);
+		if (err < 0) {
+			logit(LOG_CRIT, "Unable to disable period events for %s: %s\n", lhandle->id, snd_strerror(err));
+			return err;
+		}
+		val = buffer_size;
+	}
 	err = snd_pcm_sw_params_set_avail_min(handle, swparams, val);
 	if (err < 0) {
 		logit(LOG_CRIT, "Unable to set avail min for %s: %s\n", lhandle->id, snd_strerror(err));
@@ -282,6 +632,24 @@ static int setparams_set(struct loopback_handle *lhandle,
 	return 0;
 }
 
+static int setparams_set(struct loopback_handle *lhandle,
+			 snd_pcm_hw_params_t *params,
+			 snd_pcm_sw_params_t *swparams,
+			 snd_pcm_uframes_t bufsize)
+{
+	int err;
+	snd_pcm_uframes_t period_size, buffer_size;
+
+	err = snd_pcm_hw_params(lhandle->handle, params);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set hw params for %s: %s\n", lhandle->id, snd_strerror(err));
+		return err;
+	}
+	snd_pcm_hw_params_get_period_size(params, &period_size, NULL);
+	snd_pcm_hw_params_get_buffer_size(params, &buffer_size);
+	return setparams_sw(lhandle, swparams, period_size, buffer_size, bufsize);
+}
+
 static int increase_playback_avail_min(struct loopback_handle *lhandle)
 {
 	snd_pcm_t *handle = lhandle->handle;
@@ -296,6 +664,11 @@ static int increase_playback_avail_min(struct loopback_handle *lhandle)
 		nanosleep(&ts, NULL);
 		return 0;
 	}
+	if (lhandle->mixin) {
+		lhandle->avail_min += 4;
+		mixin_set_avail_min(lhandle->mixin, lhandle->avail_min);
+		return 0;
+	}
 	snd_pcm_sw_params_alloca(&swparams);
 	err = snd_pcm_sw_params_current(handle, swparams);
 	if (err < 0) {
@@ -318,63 +691,89 @@ static int increase_playback_avail_min(struct loopback_handle *lhandle)
 	return 0;
 }
 
-static int setparams(struct loopback *loop, snd_pcm_uframes_t bufsize)
+/* negotiate one stream, bufsize is given in frames at the requested rate */
+static int setparams_handle(struct loopback_handle *lhandle,
+			    snd_pcm_uframes_t bufsize)
 {
+	snd_pcm_uframes_t bufsize_req = bufsize;
 	int err;
-	snd_pcm_hw_params_t *pt_params, *ct_params;	/* templates with rate, format and channels */
-	snd_pcm_hw_params_t *p_params, *c_params;
-	snd_pcm_sw_params_t *p_swparams, *c_swparams;
-
-	snd_pcm_hw_params_alloca(&p_params);
-	snd_pcm_hw_params_alloca(&c_params);
-	snd_pcm_hw_params_alloca(&pt_params);
-	snd_pcm_hw_params_alloca(&ct_params);
-	snd_pcm_sw_params_alloca(&p_swparams);
-	snd_pcm_sw_params_alloca(&c_swparams);
-	if ((err = setparams_stream(loop->play, pt_params)) < 0) {
-		logit(LOG_CRIT, "Unable to set parameters for %s stream: %s\n", loop->play->id, snd_strerror(err));
-		return err;
+	snd_pcm_hw_params_t *t_params;	/* template with rate, format and channels */
+	snd_pcm_hw_params_t *params;
+	snd_pcm_sw_params_t *swparams;
+	snd_timestamp_t t1, t2;
+
+	snd_pcm_hw_params_alloca(&params);
+	snd_pcm_hw_params_alloca(&t_params);
+	snd_pcm_sw_params_alloca(&swparams);
+	/* a warm device from the pool may still have these hw params */
+	if (!lhandle->mixin && !lhandle->splitout &&
+	    pcmpool_params(lhandle, bufsize_req)) {
+		err = setparams_sw(lhandle, swparams, lhandle->period_size,
+				   lhandle->buffer_size, bufsize / lhandle->pitch);
+		if (err >= 0)
+			return 0;
 	}
-	if ((err = setparams_stream(loop->capt, ct_params)) < 0) {
-		logit(LOG_CRIT, "Unable to set parameters for %s stream: %s\n", loop->capt->id, snd_strerror(err));
+	getcurtimestamp(&t1);
+	if (lhandle->mixin)
+		err = setparams_mixin_stream(lhandle);
+	else if (lhandle->splitout)
+		err = setparams_splitout_stream(lhandle);
+	else
+		err = setparams_stream(lhandle, t_params);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set parameters for %s stream: %s\n", lhandle->id, snd_strerror(err));
 		return err;
 	}
-
-	if ((err = setparams_bufsize(loop->play, p_params, pt_params, bufsize / loop->play->pitch)) < 0) {
-		logit(LOG_CRIT, "Unable to set buffer parameters for %s stream: %s\n", loop->play->id, snd_strerror(err));
+	bufsize = bufsize / lhandle->pitch;
+	if (lhandle->mixin)
+		err = setparams_mixin(lhandle, bufsize);
+	else if (lhandle->splitout)
+		err = setparams_splitout(lhandle, bufsize);
+	else
+		err = setparams_bufsize(lhandle, params, t_params, bufsize);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set buffer parameters for %s stream: %s\n", lhandle->id, snd_strerror(err));
 		return err;
 	}
-	if ((err = setparams_bufsize(loop->capt, c_params, ct_params, bufsize / loop->capt->pitch)) < 0) {
-		logit(LOG_CRIT, "Unable to set buffer parameters for %s stream: %s\n", loop->capt->id, snd_strerror(err));
-		return err;
+	if (!lhandle->mixin && !lhandle->splitout) {
+		if ((err = setparams_set(lhandle, params, swparams, bufsize)) < 0) {
+			logit(LOG_CRIT, "Unable to set sw parameters for %s stream: %s\n", lhandle->id, snd_strerror(err));
+			return err;
+		}
+		getcurtimestamp(&t2);
+		pcmpool_params_store(lhandle, bufsize_req, timediff(t2, t1));
 	}
+	return 0;
+}
 
-	if ((err = setparams_set(loop->play, p_params, p_swparams, bufsize / loop->play->pitch)) < 0) {
-		logit(LOG_CRIT, "Unable to set sw parameters for %s stream: %s\n", loop->play->id, snd_strerror(err));
+static int setparams(struct loopback *loop, snd_pcm_uframes_t bufsize)
+{
+	int err;
+
+	if ((err = setparams_handle(loop->play, bufsize)) < 0)
 		return err;
-	}
-	if ((err = setparams_set(loop->capt, c_params, c_swparams, bufsize / loop->capt->pitch)) < 0) {
-		logit(LOG_CRIT, "Unable to set sw parameters for %s stream: %s\n", loop->capt->id, snd_strerror(err));
+	if ((err = setparams_handle(loop->capt, bufsize)) < 0)
 		return err;
-	}
 
 #if 0
 	if (!loop->linked)
 		if (snd_pcm_link(loop->capt->handle, loop->play->handle) >= 0)
 			loop->linked = 1;
 #endif
-	if ((err = snd_pcm_prepare(loop->play->handle)) < 0) {
+	if ((err = pcm_prepare(loop->play)) < 0) {
 		logit(LOG_CRIT, "Prepare %s error: %s\n", loop->play->id, snd_strerror(err));
 		return err;
 	}
-	if (!loop->linked && (err = snd_pcm_prepare(loop->capt->handle)) < 0) {
+	if (!loop->linked && (err = pcm_prepare(loop->capt)) < 0) {
 		logit(LOG_CRIT, "Prepare %s error: %s\n", loop->capt->id, snd_strerror(err));
 		return err;
 	}
 
 	if (verbose) {
-		snd_pcm_dump(loop->play->handle, loop->output);
-		snd_pcm_dump(loop->capt->handle, loop->output);
+		if (loop->play->handle)
+			snd_pcm_dump(loop->play->handle, loop->output);
+		if (loop->capt->handle)
+			snd_pcm_dump(loop->capt->handle, loop->output);
 	}
 	return 0;
 }
@@ -387,35 +786,12 @@ static void showlatency(snd_output_t *out, size_t latency, unsigned int rate,
 	snd_output_printf(out, "%s %li frames, %.3fus, %.6fms (%.4fHz)\n", prefix, (long)latency, d * 1000000, d * 1000, (double)1 / d);
 }
 
-static long timediff(snd_timestamp_t t1, snd_timestamp_t t2)
-{
-	signed long l;
-
-	t1.tv_sec -= t2.tv_sec;
-	if (t1.tv_usec < t2.tv_usec) {
-		l = ((t1.tv_usec + 1000000) - t2.tv_usec) % 1000000;
-		t1.tv_sec--;
-	} else {
-		l = t1.tv_usec - t2.tv_usec;
-	}
-	return (t1.tv_sec * 1000000) + l;
-}
-
-static int getcurtimestamp(snd_timestamp_t *ts)
-{
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	ts->tv_sec = tv.tv_sec;
-	ts->tv_usec = tv.tv_usec;
-	return 0;
-}
-
 static void xrun_profile0(struct loopback *loop)
 {
 	snd_pcm_sframes_t pdelay, cdelay;
 
-	if (snd_pcm_delay(loop->play->handle, &pdelay) >= 0 &&
-	    snd_pcm_delay(loop->capt->handle, &cdelay) >= 0) {
+	if (pcm_delay(loop->play, &pdelay) >= 0 &&
+	    pcm_delay(loop->capt, &cdelay) >= 0) {
 		getcurtimestamp(&loop->xrun_last_update);
 		loop->xrun_last_pdelay = pdelay;
 		loop->xrun_last_cdelay = cdelay;
@@ -488,6 +864,44 @@ static inline snd_pcm_uframes_t buf_avail(struct loopback_handle *lhandle)
 	return lhandle->buf_size - lhandle->buf_count;
 }
 
+/*
+ * Number of frames which can be accessed linearly from pos.
+ * A mirrored ring is contiguous across the wrap point.
+ */
+static inline snd_pcm_uframes_t buf_span(struct loopback_handle *lhandle,
+					 snd_pcm_uframes_t pos,
+					 snd_pcm_uframes_t count)
+{
+	if (!lhandle->buf_mirror && count + pos > lhandle->buf_size)
+		count = lhandle->buf_size - pos;
+	return count;
+}
+
+static int buf_set_silence(struct loopback_handle *lhandle,
+			   snd_pcm_uframes_t pos,
+			   snd_pcm_uframes_t count)
+{
+	snd_pcm_uframes_t count1;
+	int err;
+
+	while (count > 0) {
+		count1 = buf_span(lhandle, pos, count);
+		if (lhandle->buf_silence_zero) {
+			memset(lhandle->buf + pos * lhandle->frame_size, 0,
+			       count1 * lhandle->frame_size);
+		} else {
+			err = snd_pcm_format_set_silence(lhandle->format,
+							 lhandle->buf + pos * lhandle->frame_size,
+							 count1 * lhandle->channels);
+			if (err < 0)
+				return err;
+		}
+		count -= count1;
+		pos = (pos + count1) & lhandle->buf_mask;
+	}
+	return 0;
+}
+
 static void buf_remove(struct loopback *loop, snd_pcm_uframes_t count)
 {
 	/* remove samples from the capture buffer */
@@ -537,6 +951,92 @@ static void buf_add_copy(struct loopback *loop)
 }
 #endif
 
+/*
+ * Software gain of frames just written by the copy path, they are still
+ * in the cache. A ramp is cut into its own kernel call, the gain is exact
+ * at the end of it.
+ */
+static void gain_apply(struct loopback *loop, void *buf, int format,
+		       unsigned int frames, unsigned int channels)
+{
+	unsigned int count;
+	float step;
+
+	while (frames > 0) {
+		count = frames;
+		step = 0;
+		if (loop->gain_ramp) {
+			if (count > loop->gain_ramp)
+				count = loop->gain_ramp;
+			step = loop->gain_step;
+		}
+		switch (format) {
+		case KERNEL_FORMAT_S16:
+			kernel_gain_s16((int16_t *)buf, count, channels, loop->gain, step);
+			buf = (int16_t *)buf + count * channels;
+			break;
+		case KERNEL_FORMAT_S32:
+			kernel_gain_s32((int32_t *)buf, count, channels, loop->gain, step);
+			buf = (int32_t *)buf + count * channels;
+			break;
+		default:
+			kernel_gain_float((float *)buf, count, channels, loop->gain, step);
+			buf = (float *)buf + count * channels;
+			break;
+		}
+		frames -= count;
+		if (loop->gain_ramp) {
+			loop->gain_ramp -= count;
+			if (loop->gain_ramp)
+				loop->gain += count * step;
+			else
+				loop->gain = loop->soft_gain;
+		}
+	}
+	if (loop->gain_ramp == 0 && loop->gain == 1.0f)
+		loop->gain_active = 0;
+}
+
+/*
+ * A steady gain rides on a conversion the samples take anyway, a ramp
+ * keeps the separate pass, it changes per frame.
+ */
+static inline int gain_folds(struct loopback *loop)
+{
+	return loop->gain_active && !loop->gain_ramp;
+}
+
+/*
+ * Processing of a span the copy path has just written: the gain first,
+ * so a limiter in the DSP chain sees the final level. With folded set
+ * the conversion applied the gain already.
+ */
+static inline void buf_process(struct loopback *loop, void *buf, int format,
+			       unsigned int frames, unsigned int channels,
+			       int folded)
+{
+	if (loop->gain_active && !folded)
+		gain_apply(loop, buf, format, frames, channels);
+	if (loop->dsp_active)
+		dsp_process(loop->dsp, buf, frames);
+}
+
+/* process count frames at pos of the playback ring in place */
+static void buf_process_ring(struct loopback *loop, snd_pcm_uframes_t pos,
+			     snd_pcm_uframes_t count)
+{
+	struct loopback_handle *play = loop->play;
+	snd_pcm_uframes_t count1;
+
+	while (count > 0) {
+		count1 = buf_span(play, pos, count);
+		buf_process(loop, play->buf + pos * play->frame_size,
+			    loop->gain_format, count1, play->channels, 0);
+		count -= count1;
+		pos = (pos + count1) & play->buf_mask;
+	}
+}
+
 #ifdef USE_SAMPLERATE
 static void buf_add_src(struct loopback *loop)
 {
@@ -544,31 +1044,29 @@ static void buf_add_src(struct loopback *loop)
 	struct loopback_handle *play = loop->play;
 	float *old_data_out;
 	snd_pcm_uframes_t count, pos, count1, pos1;
+	int fold;
 	count = capt->buf_count;
 	pos = 0;
-	pos1 = capt->buf_pos - count;
-	if (pos1 > capt->buf_size)
-		pos1 += capt->buf_size;
+	pos1 = (capt->buf_pos - count) & capt->buf_mask;
 	while (count > 0) {
-		count1 = count;
-		if (count1 + pos1 > capt->buf_size)
-			count1 = capt->buf_size - pos1;
-		if (capt->format == SND_PCM_FORMAT_S32)
-			src_int_to_float_array((int *)(capt->buf +
-						pos1 * capt->frame_size),
-					 (void *)loop->src_data.data_in +
-					   pos * capt->channels,
-					 count1 * capt->channels);
+		count1 = buf_span(capt, pos1, count);
+		if (!loop->route.identity)
+			route_frames_float(&loop->route, capt->format,
+					 (float *)loop->src_data.data_in +
+					   pos * play->channels,
+					 capt->buf + pos1 * capt->frame_size,
+					 count1,
+					 capt->format == SND_PCM_FORMAT_S32 ?
+					   1.0f / 2147483648.0f : 1.0f / 32768.0f);
 		else
-			src_short_to_float_array((short *)(capt->buf +
-						pos1 * capt->frame_size),
-					 (void *)loop->src_data.data_in +
+			loop->src_cvt_in((float *)loop->src_data.data_in +
 					   pos * capt->channels,
-					 count1 * capt->channels);
+					 capt->buf + pos1 * capt->frame_size,
+					 count1, capt->channels);
 		count -= count1;
 		pos += count1;
 		pos1 += count1;
-		pos1 %= capt->buf_size;
+		pos1 &= capt->buf_mask;
 	}
 	loop->src_data.input_frames = pos;
 	loop->src_data.output_frames = play->buf_size -
@@ -582,32 +1080,40 @@ static void buf_add_src(struct loopback *loop)
 	count = loop->src_data.output_frames_gen +
 		loop->src_out_frames;
 	pos = 0;
-	pos1 = (play->buf_pos + play->buf_count) % play->buf_size;
+	pos1 = (play->buf_pos + play->buf_count) & play->buf_mask;
+	/* the chain must see the gain, so it is folded only without one */
+	fold = gain_folds(loop) && !loop->dsp_active;
 	while (count > 0) {
-		count1 = count;
-		if (count1 + pos1 > play->buf_size)
-			count1 = play->buf_size - pos1;
+		count1 = buf_span(play, pos1, count);
 		if (count1 > buf_avail(play))
 			count1 = buf_avail(play);
 		if (count1 == 0)
 			break;
-		if (capt->format == SND_PCM_FORMAT_S32)
-			src_float_to_int_array(loop->src_data.data_out +
-					   pos * play->channels,
-					 (int *)(play->buf +
-					   pos1 * play->frame_size),
-					 count1 * play->channels);
-		else
-			src_float_to_short_array(loop->src_data.data_out +
-					   pos * play->channels,
-					 (short *)(play->buf +
-					   pos1 * play->frame_size),
-					 count1 * play->channels);
+		/* float domain, the converter to the device format saturates */
+		if (fold) {
+			if (loop->gain_format == KERNEL_FORMAT_S32)
+				kernel_store_s32((int32_t *)(play->buf + pos1 * play->frame_size),
+						 loop->src_data.data_out + pos * play->channels,
+						 count1 * play->channels,
+						 loop->gain * 2147483648.0f);
+			else
+				kernel_store_s16((int16_t *)(play->buf + pos1 * play->frame_size),
+						 loop->src_data.data_out + pos * play->channels,
+						 count1 * play->channels,
+						 loop->gain * 32768.0f);
+		} else {
+			if (loop->gain_active || loop->dsp_active)
+				buf_process(loop, loop->src_data.data_out + pos * play->channels,
+					    KERNEL_FORMAT_FLOAT, count1, play->channels, 0);
+			loop->src_cvt_out(play->buf + pos1 * play->frame_size,
+					  loop->src_data.data_out + pos * play->channels,
+					  count1, play->channels);
+		}
 		play->buf_count += count1;
 		count -= count1;
 		pos += count1;
 		pos1 += count1;
-		pos1 %= play->buf_size;
+		pos1 &= play->buf_mask;
 	}
 #if 0
 	printf("src: pos = %li, gen = %li, out = %li, count = %li\n",
@@ -628,15 +1134,182 @@ static void buf_add_src(struct loopback *loop)
 }
 #endif
 
+/* copy samples through the channel routing, rates are equal here */
+static void buf_add_route(struct loopback *loop)
+{
+	struct loopback_handle *capt = loop->capt;
+	struct loopback_handle *play = loop->play;
+	snd_pcm_uframes_t count, count1, cpos, ppos;
+	int fold;
+
+	count = capt->buf_count;
+	if (count > buf_avail(play))
+		count = buf_avail(play);
+	cpos = (capt->buf_pos - capt->buf_count) & capt->buf_mask;
+	ppos = (play->buf_pos + play->buf_count) & play->buf_mask;
+	/* a matrix goes through float, a reorder only copies */
+	fold = gain_folds(loop) && !loop->route.reorder;
+	while (count > 0) {
+		count1 = buf_span(capt, cpos, count);
+		count1 = buf_span(play, ppos, count1);
+		route_frames(&loop->route, capt->format,
+			     play->buf + ppos * play->frame_size,
+			     capt->buf + cpos * capt->frame_size, count1,
+			     fold ? loop->gain : 1.0f);
+		if ((loop->gain_active && !fold) || loop->dsp_active)
+			buf_process(loop, play->buf + ppos * play->frame_size,
+				    loop->gain_format, count1, play->channels, fold);
+		play->buf_count += count1;
+		capt->buf_count -= count1;
+		cpos = (cpos + count1) & capt->buf_mask;
+		ppos = (ppos + count1) & play->buf_mask;
+		count -= count1;
+	}
+}
+
+static void silence_leave(struct loopback *loop)
+{
+	loop->silence_bypass = 0;
+#ifdef USE_SAMPLERATE
+	/* the converter saw no input during the bypass, start it from zero */
+	if (loop->use_samplerate && loop->src_state)
+		src_reset(loop->src_state);
+#endif
+	if (verbose > 1)
+		snd_output_printf(loop->output, "%s: signal, silence bypass left\n", loop->id);
+}
+
+/*
+ * Follow runs of digital silence in the count new capture frames. After
+ * silence_hold_frames of them the converters have no history left and
+ * the frames are replaced by silence, returns 1 then.
+ */
+static int silence_detect(struct loopback *loop, snd_pcm_uframes_t count)
+{
+	struct loopback_handle *capt = loop->capt;
+	snd_pcm_uframes_t pos, count1, left = count;
+
+	if (!capt->buf_silence_zero)
+		return 0;
+	pos = (capt->buf_pos - count) & capt->buf_mask;
+	while (left > 0) {
+		count1 = buf_span(capt, pos, left);
+		if (!kernel_is_zero(capt->buf + pos * capt->frame_size,
+				    count1 * capt->frame_size)) {
+			loop->silence_run = 0;
+			if (loop->silence_bypass)
+				silence_leave(loop);
+			return 0;
+		}
+		left -= count1;
+		pos = (pos + count1) & capt->buf_mask;
+	}
+	if (loop->silence_run < loop->silence_hold_frames + capt->buf_size)
+		loop->silence_run += count;
+	if (loop->silence_bypass)
+		return 1;
+	/* the older frames still queued must be silent too */
+	if (loop->silence_run < loop->silence_hold_frames ||
+	    loop->silence_run < capt->buf_count)
+		return 0;
+#ifdef USE_SAMPLERATE
+	if (loop->use_samplerate && loop->src_out_frames > 0)
+		return 0;
+#endif
+	loop->silence_bypass = 1;
+	loop->silence_frac = 0;
+	loop->silence_stats.entries++;
+	if (verbose > 1)
+		snd_output_printf(loop->output, "%s: silence, converters bypassed\n", loop->id);
+	return 1;
+}
+
+/*
+ * Silence in, silence out: write the playback side's silence pattern for
+ * the captured frames. With the converter the frame count follows the
+ * current ratio, the fraction is carried so the latency stays exact.
+ */
+static void buf_add_silence(struct loopback *loop)
+{
+	struct loopback_handle *capt = loop->capt;
+	struct loopback_handle *play = loop->play;
+	snd_pcm_uframes_t in = capt->buf_count, out, avail = buf_avail(play);
+
+	if (avail == 0)
+		return;
+#ifdef USE_SAMPLERATE
+	if (loop->use_samplerate) {
+		double ratio = loop->src_data.src_ratio, frames;
+
+		if (in * ratio + loop->silence_frac > avail)
+			in = (avail - loop->silence_frac) / ratio;
+		frames = in * ratio + loop->silence_frac;
+		out = frames;
+		if (out > avail)
+			out = avail;
+		loop->silence_frac = frames - out;
+	} else
+#endif
+	{
+		if (in > avail)
+			in = avail;
+		out = in;
+	}
+	buf_set_silence(play, (play->buf_pos + play->buf_count) & play->buf_mask, out);
+	/* silence stays silence, a ramp in progress just ends */
+	if (loop->gain_ramp) {
+		loop->gain_ramp = 0;
+		loop->gain = loop->soft_gain;
+		loop->gain_active = loop->gain != 1.0f;
+	}
+	play->buf_count += out;
+	capt->buf_count -= in;
+	loop->silence_stats.frames += in;
+}
+
+static inline unsigned long long buf_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static void buf_add(struct loopback *loop, snd_pcm_uframes_t count)
 {
+	unsigned long long t = 0;
+	int bypass = 0;
+
 	/* copy samples from capture to playback buffer */
 	if (count <= 0)
 		return;
 	if (loop->play->buf == loop->capt->buf) {
+		/* shared ring, processed in place */
+		if (loop->gain_active || loop->dsp_active)
+			buf_process_ring(loop, (loop->play->buf_pos +
+						loop->play->buf_count) &
+					       loop->play->buf_mask, count);
 		loop->play->buf_count += count;
-	} else {
+		return;
+	}
+	if (loop->silence_hold_frames) {
+		t = buf_clock_ns();
+		bypass = silence_detect(loop, count);
+	}
+	if (bypass)
+		buf_add_silence(loop);
+	else if (loop->use_samplerate)
 		buf_add_src(loop);
+	else
+		buf_add_route(loop);
+	if (loop->silence_hold_frames) {
+		t = buf_clock_ns() - t;
+		if (bypass) {
+			loop->silence_stats.bypass_ns += t;
+		} else {
+			loop->silence_stats.work_ns += t;
+			loop->silence_stats.work_frames += count;
+		}
 	}
 }
 
@@ -647,13 +1320,13 @@ static int xrun(struct loopback_handle *lhandle)
 	if (lhandle == lhandle->loopback->play) {
 		logit(LOG_DEBUG, "underrun for %s\n", lhandle->id);
 		xrun_stats(lhandle->loopback);
-		if ((err = snd_pcm_prepare(lhandle->handle)) < 0)
+		if ((err = pcm_prepare(lhandle)) < 0)
 			return err;
 		lhandle->xrun_pending = 1;
 	} else {
 		logit(LOG_DEBUG, "overrun for %s\n", lhandle->id);
 		xrun_stats(lhandle->loopback);
-		if ((err = snd_pcm_prepare(lhandle->handle)) < 0)
+		if ((err = pcm_prepare(lhandle)) < 0)
 			return err;
 		lhandle->xrun_pending = 1;
 	}
@@ -664,7 +1337,7 @@ static int suspend(struct loopback_handle *lhandle)
 {
 	int err;
 
-	while ((err = snd_pcm_resume(lhandle->handle)) == -EAGAIN)
+	while ((err = pcm_resume(lhandle)) == -EAGAIN)
 		usleep(1);
 	if (err < 0)
 		return xrun(lhandle);
@@ -677,7 +1350,7 @@ static int readit(struct loopback_handle *lhandle)
 	snd_pcm_sframes_t avail;
 	int err;
 
-	avail = snd_pcm_avail_update(lhandle->handle);
+	avail = pcm_avail_update(lhandle);
 	if (avail == -EPIPE) {
 		return xrun(lhandle);
 	} else if (avail == -ESTRPIPE) {
@@ -688,18 +1361,16 @@ static int readit(struct loopback_handle *lhandle)
 		lhandle->buf_over += avail - buf_avail(lhandle);
 		avail = buf_avail(lhandle);
 	} else if (avail == 0) {
-		if (snd_pcm_state(lhandle->handle) == SND_PCM_STATE_DRAINING) {
+		if (pcm_state(lhandle) == SND_PCM_STATE_DRAINING) {
 			lhandle->loopback->reinit = 1;
 			return 0;
 		}
 	}
 	while (avail > 0) {
-		r = buf_avail(lhandle);
-		if (r + lhandle->buf_pos > lhandle->buf_size)
-			r = lhandle->buf_size - lhandle->buf_pos;
+		r = buf_span(lhandle, lhandle->buf_pos, buf_avail(lhandle));
 		if (r > avail)
 			r = avail;
-		r = snd_pcm_readi(lhandle->handle,
+		r = pcm_readi(lhandle,
 				  lhandle->buf +
 				  lhandle->buf_pos *
 				  lhandle->frame_size, r);
@@ -717,18 +1388,16 @@ static int readit(struct loopback_handle *lhandle)
 				return res > 0 ? res : r;
 			}
 		}
-#ifdef FILE_CWRITE
-		if (lhandle->loopback->cfile)
-			fwrite(lhandle->buf + lhandle->buf_pos * lhandle->frame_size,
-			       r, lhandle->frame_size, lhandle->loopback->cfile);
-#endif
+		if (lhandle->tap)
+			tap_write(lhandle, lhandle->buf + lhandle->buf_pos *
+					   lhandle->frame_size, r);
 		res += r;
 		if (lhandle->max < res)
 			lhandle->max = res;
 		lhandle->counter += r;
 		lhandle->buf_count += r;
 		lhandle->buf_pos += r;
-		lhandle->buf_pos %= lhandle->buf_size;
+		lhandle->buf_pos &= lhandle->buf_mask;
 		avail -= r;
 	}
 	return res;
@@ -741,7 +1410,7 @@ static int writeit(struct loopback_handle *lhandle)
 	int err;
 
       __again:
-	avail = snd_pcm_avail_update(lhandle->handle);
+	avail = pcm_avail_update(lhandle);
 	if (avail == -EPIPE) {
 		if ((err = xrun(lhandle)) < 0)
 			return err;
@@ -752,12 +1421,10 @@ static int writeit(struct loopback_handle *lhandle)
 		goto __again;
 	}
 	while (avail > 0 && lhandle->buf_count > 0) {
-		r = lhandle->buf_count;
-		if (r + lhandle->buf_pos > lhandle->buf_size)
-			r = lhandle->buf_size - lhandle->buf_pos;
+		r = buf_span(lhandle, lhandle->buf_pos, lhandle->buf_count);
 		if (r > avail)
 			r = avail;
-		r = snd_pcm_writei(lhandle->handle,
+		r = pcm_writei(lhandle,
 				   lhandle->buf +
 				   lhandle->buf_pos *
 				   lhandle->frame_size, r);
@@ -770,21 +1437,19 @@ static int writeit(struct loopback_handle *lhandle)
 			}
 			return res > 0 ? res : r;
 		}
-#ifdef FILE_PWRITE
-		if (lhandle->loopback->pfile)
-			fwrite(lhandle->buf + lhandle->buf_pos * lhandle->frame_size,
-			       r, lhandle->frame_size, lhandle->loopback->pfile);
-#endif
+		if (lhandle->tap)
+			tap_write(lhandle, lhandle->buf + lhandle->buf_pos *
+					   lhandle->frame_size, r);
 		res += r;
 		lhandle->counter += r;
 		lhandle->buf_count -= r;
 		lhandle->buf_pos += r;
-		lhandle->buf_pos %= lhandle->buf_size;
+		lhandle->buf_pos &= lhandle->buf_mask;
 		xrun_profile(lhandle->loopback);
 		if (lhandle->loopback->stop_pending) {
 			lhandle->loopback->stop_count += r;
 			if (lhandle->loopback->stop_count * lhandle->pitch >
-			    lhandle->loopback->latency * 3) {
+			    lhandle->loopback->park_frames) {
 				lhandle->loopback->stop_pending = 0;
 				lhandle->loopback->reinit = 1;
 				break;
@@ -808,7 +1473,7 @@ static snd_pcm_sframes_t remove_samples(struct loopback *loop,
 			count = loop->capt->buf_count;
 		capt->buf_count -= count;
 		play->buf_pos += count;
-		play->buf_pos %= play->buf_size;
+		play->buf_pos &= play->buf_mask;
 		play->buf_count -= count;
 		return count;
 	}
@@ -838,11 +1503,11 @@ static int xrun_sync(struct loopback *loop)
 	if (capt->xrun_pending) {
 	      __pagain:
 		capt->xrun_pending = 0;
-		if ((err = snd_pcm_prepare(capt->handle)) < 0) {
+		if ((err = pcm_prepare(capt)) < 0) {
 			logit(LOG_CRIT, "%s prepare failed: %s\n", capt->id, snd_strerror(err));
 			return err;
 		}
-		if ((err = snd_pcm_start(capt->handle)) < 0) {
+		if ((err = pcm_start(capt)) < 0) {
 			logit(LOG_CRIT, "%s start failed: %s\n", capt->id, snd_strerror(err));
 			return err;
 		}
@@ -853,7 +1518,7 @@ static int xrun_sync(struct loopback *loop)
 			goto __pagain;
 	}
 	/* skip additional playback samples */
-	if ((err = snd_pcm_delay(capt->handle, &cdelay)) < 0) {
+	if ((err = pcm_delay(capt, &cdelay)) < 0) {
 		if (err == -EPIPE) {
 			capt->xrun_pending = 1;
 			goto __again;
@@ -867,7 +1532,7 @@ static int xrun_sync(struct loopback *loop)
 		logit(LOG_CRIT, "%s capture delay failed: %s\n", capt->id, snd_strerror(err));
 		return err;
 	}
-	if ((err = snd_pcm_delay(play->handle, &pdelay)) < 0) {
+	if ((err = pcm_delay(play, &pdelay)) < 0) {
 		if (err == -EPIPE) {
 			pdelay = 0;
 			play->xrun_pending = 1;
@@ -914,11 +1579,11 @@ static int xrun_sync(struct loopback *loop)
 			(long)capt->buf_count, (long)play->buf_count);
 	}
 	if (delay1 > fill && capt->counter > 0) {
-		if ((err = snd_pcm_drop(capt->handle)) < 0)
+		if ((err = pcm_drop(capt)) < 0)
 			return err;
-		if ((err = snd_pcm_prepare(capt->handle)) < 0)
+		if ((err = pcm_prepare(capt)) < 0)
 			return err;
-		if ((err = snd_pcm_start(capt->handle)) < 0)
+		if ((err = pcm_start(capt)) < 0)
 			return err;
 		diff = remove_samples(loop, 1, (delay1 - fill) / capt->pitch);
 		if (verbose > 6)
@@ -962,18 +1627,20 @@ static int xrun_sync(struct loopback *loop)
 		if (verbose > 6)
 			snd_output_printf(loop->output,
 				"sync: xrun_pending, silence filling %li / buf_count=%li\n", (long)diff, play->buf_count);
-		if (fill > delay1 && play->buf_count < diff) {
+		if ((snd_pcm_sframes_t)fill > delay1 &&
+		    (snd_pcm_sframes_t)play->buf_count < diff) {
 			diff = diff - play->buf_count;
+			if (diff > (snd_pcm_sframes_t)buf_avail(play))
+				diff = buf_avail(play);
 			if (verbose > 6)
 				snd_output_printf(loop->output,
 					"sync: playback silence added %li samples\n", (long)diff);
-			play->buf_pos -= diff;
-			play->buf_pos %= play->buf_size;
-			if ((err = snd_pcm_format_set_silence(play->format, play->buf + play->buf_pos * play->channels, diff)) < 0)
+			play->buf_pos = (play->buf_pos - diff) & play->buf_mask;
+			if ((err = buf_set_silence(play, play->buf_pos, diff)) < 0)
 				return err;
 			play->buf_count += diff;
 		}
-		if ((err = snd_pcm_prepare(play->handle)) < 0) {
+		if ((err = pcm_prepare(play)) < 0) {
 			logit(LOG_CRIT, "%s prepare failed: %s\n", play->id, snd_strerror(err));
 
 			return err;
@@ -988,34 +1655,30 @@ static int xrun_sync(struct loopback *loop)
 				snd_output_printf(loop->output,
 					"sync: playback buf_remove %li samples\n", (long)(delay1 - diff));
 		}
-		if ((err = snd_pcm_start(play->handle)) < 0) {
+		if ((err = pcm_start(play)) < 0) {
 			logit(LOG_CRIT, "%s start failed: %s\n", play->id, snd_strerror(err));
 			return err;
 		}
-	} else if (delay1 < fill) {
+	} else if (delay1 < (snd_pcm_sframes_t)fill) {
 		diff = (fill - delay1) / play->pitch;
-		while (diff > 0) {
-			delay1 = play->buf_size - play->buf_pos;
-			if (verbose > 6)
-				snd_output_printf(loop->output,
-					"sync: playback short, silence filling %li / buf_count=%li\n", (long)delay1, play->buf_count);
-			if (delay1 > diff)
-				delay1 = diff;
-			if ((err = snd_pcm_format_set_silence(play->format, play->buf + play->buf_pos * play->channels, delay1)) < 0)
-				return err;
-			play->buf_pos += delay1;
-			play->buf_pos %= play->buf_size;
-			play->buf_count += delay1;
-			diff -= delay1;
-		}
+		if (diff > (snd_pcm_sframes_t)buf_avail(play))
+			diff = buf_avail(play);
+		if (verbose > 6)
+			snd_output_printf(loop->output,
+				"sync: playback short, silence filling %li / buf_count=%li\n", (long)diff, play->buf_count);
+		/* queue the silence in front of the pending samples */
+		play->buf_pos = (play->buf_pos - diff) & play->buf_mask;
+		if ((err = buf_set_silence(play, play->buf_pos, diff)) < 0)
+			return err;
+		play->buf_count += diff;
 		writeit(play);
 	}
 	if (verbose > 5) {
 		snd_output_printf(loop->output, "%s: xrun sync ok\n", loop->id);
 		if (verbose > 6) {
-			if (snd_pcm_delay(capt->handle, &cdelay) < 0)
+			if (pcm_delay(capt, &cdelay) < 0)
 				cdelay = -1;
-			if (snd_pcm_delay(play->handle, &pdelay) < 0)
+			if (pcm_delay(play, &pdelay) < 0)
 				pdelay = -1;
 			if (play->buf != capt->buf)
 				cdelay += capt->buf_count;
@@ -1214,14 +1877,20 @@ static int openctl(struct loopback_handle *lhandle, int device, int subdevice)
 	     lhandle->ctl_format &&
 	     lhandle->ctl_rate &&
 	     lhandle->ctl_channels) ||
+	    (lhandle->ctl_active && lhandle->loopback->park) ||
 	    lhandle->loopback->controls) {
 	      __events:
-		if ((err = snd_ctl_poll_descriptors_count(lhandle->ctl)) < 0)
-			lhandle->ctl_pollfd_count = 0;
-		else
-			lhandle->ctl_pollfd_count = err;
-		if (snd_ctl_subscribe_events(lhandle->ctl, 1) < 0)
-			lhandle->ctl_pollfd_count = 0;
+		/* the card's events are read once and routed, see ctlmux.cpp */
+		lhandle->ctl_pollfd_count = 0;
+		err = ctlmux_listen(&lhandle->ctl_events, lhandle->ctl,
+				    device, subdevice,
+				    lhandle->loopback->controls != NULL);
+		if (err < 0) {
+			logit(LOG_WARNING, "%s: no ctl events: %s\n", lhandle->id, snd_strerror(err));
+			lhandle->ctl_events = NULL;
+		} else {
+			lhandle->ctl_pollfd_count = 1;
+		}
 	}
 	return 0;
 }
@@ -1229,10 +1898,34 @@ static int openctl(struct loopback_handle *lhandle, int device, int subdevice)
 static int openit(struct loopback_handle *lhandle)
 {
 	snd_pcm_info_t *info;
+	snd_timestamp_t t1, t2;
 	int stream = lhandle == lhandle->loopback->play ?
 				SND_PCM_STREAM_PLAYBACK :
 				SND_PCM_STREAM_CAPTURE;
 	int err, card, device, subdevice;
+	char *p;
+
+	snprintf(lhandle->ident, sizeof(lhandle->ident), "%s", lhandle->device);
+	for (p = lhandle->ident; *p; p++)
+		if (isspace((unsigned char)*p))
+			*p = '_';
+	if (lhandle->mix && lhandle == lhandle->loopback->play) {
+		lhandle->card_number = -1;
+		lhandle->ctl = NULL;
+		return mixsink_attach(lhandle);
+	}
+	if (lhandle->split && lhandle == lhandle->loopback->capt) {
+		lhandle->card_number = -1;
+		lhandle->ctl = NULL;
+		return splitsrc_attach(lhandle);
+	}
+	// havuzda açık bekleyen cihaz varsa yalnızca kontroller yeniden okunur
+	if (pcmpool_take(lhandle, stream, &device, &subdevice) > 0) {
+		if (lhandle->ctl)
+			openctl(lhandle, device, subdevice);
+		return 0;
+	}
+	getcurtimestamp(&t1);
 	pcm_open_lock();
 	err = snd_pcm_open(&lhandle->handle, lhandle->device, (snd_pcm_stream_t) stream, SND_PCM_NONBLOCK);
 	pcm_open_unlock();
@@ -1259,7 +1952,7 @@ static int openit(struct loopback_handle *lhandle)
 			dev = name;
 		}
 		pcm_open_lock();
-		err = snd_ctl_open(&lhandle->ctl, dev, SND_CTL_NONBLOCK);
+		err = ctlmux_open(&lhandle->ctl, dev);
 		pcm_open_unlock();
 		if (err < 0) {
 			logit(LOG_CRIT, "%s [%s] ctl open error: %s\n", lhandle->id, dev, snd_strerror(err));
@@ -1268,16 +1961,134 @@ static int openit(struct loopback_handle *lhandle)
 		if (lhandle->ctl)
 			openctl(lhandle, device, subdevice);
 	}
+	if (lhandle->ctl && lhandle->ctldev == NULL) {
+		snd_ctl_card_info_t *cinfo;
+		snd_ctl_card_info_alloca(&cinfo);
+		if (snd_ctl_card_info(lhandle->ctl, cinfo) >= 0)
+			snprintf(lhandle->ident, sizeof(lhandle->ident), "%s,%i,%i",
+				 snd_ctl_card_info_get_id(cinfo), device, subdevice);
+	}
+	getcurtimestamp(&t2);
+	pcmpool_opened(lhandle, device, subdevice, timediff(t2, t1));
+	return 0;
+}
+
+/*
+ * Round the ring up to a power of two frames, so positions wrap with
+ * a mask, and to a whole number of pages, so the ring can be mirrored.
+ */
+static snd_pcm_uframes_t buf_ring_size(snd_pcm_uframes_t frames,
+				       unsigned int frame_size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	snd_pcm_uframes_t size = 1;
+
+	if (page <= 0)
+		page = 4096;
+	while (size < frames || (size * frame_size) % page)
+		size <<= 1;
+	return size;
+}
+
+/*
+ * Map the same pages twice back-to-back, so a transfer starting near
+ * the end of the ring continues linearly into its beginning.
+ */
+static char *buf_mirror_map(size_t bytes)
+{
+	char *addr;
+	int fd;
+
+	fd = memfd_create("alsaloop", MFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, bytes) < 0) {
+		close(fd);
+		return NULL;
+	}
+	addr = (char *) mmap(NULL, bytes * 2, PROT_NONE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	if (mmap(addr, bytes, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	    mmap(addr + bytes, bytes, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(addr, bytes * 2);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	return addr;
+}
+
+static int buf_alloc(struct loopback_handle *lhandle)
+{
+	struct loopback_arena *arena = lhandle->loopback->arena;
+
+	lhandle->buf_bytes = lhandle->buf_size * lhandle->frame_size;
+	if (arena) {
+		lhandle->buf = arena_alloc_mirror(arena, lhandle->buf_bytes);
+		lhandle->buf_mirror = lhandle->buf != NULL;
+		if (lhandle->buf == NULL)
+			lhandle->buf = (char *) arena_alloc(arena, lhandle->buf_bytes);
+		if (lhandle->buf)
+			return 0;
+		arena_fallback(arena);
+		logit(LOG_WARNING, "%s: buffer arena exhausted, using heap\n", lhandle->id);
+	}
+	lhandle->buf = buf_mirror_map(lhandle->buf_bytes);
+	if (lhandle->buf) {
+		lhandle->buf_mirror = 1;
+		return 0;
+	}
+	if (verbose > 1)
+		snd_output_printf(lhandle->loopback->output, "%s: mirrored buffer not available, using linear buffer\n", lhandle->id);
+	lhandle->buf_mirror = 0;
+	lhandle->buf = (char *) calloc(1, lhandle->buf_bytes);
+	if (lhandle->buf == NULL)
+		return -ENOMEM;
 	return 0;
 }
 
 static int freeit(struct loopback_handle *lhandle)
 {
-	free(lhandle->buf);
+	struct loopback_arena *arena = lhandle->loopback->arena;
+
+	if (lhandle->buf && (arena == NULL || arena_free(arena, lhandle->buf) < 0)) {
+		if (lhandle->buf_mirror)
+			munmap(lhandle->buf, lhandle->buf_bytes * 2);
+		else
+			free(lhandle->buf);
+	}
 	lhandle->buf = NULL;
+	lhandle->buf_mirror = 0;
 	return 0;
 }
 
+/* scratch buffers come from the arena too, the heap is the fallback */
+static void *loop_calloc(struct loopback *loop, size_t bytes)
+{
+	void *ptr;
+
+	if (loop->arena == NULL)
+		return calloc(1, bytes);
+	ptr = arena_alloc(loop->arena, bytes);
+	if (ptr)
+		return ptr;
+	arena_fallback(loop->arena);
+	logit(LOG_WARNING, "%s: scratch arena exhausted, using heap\n", loop->id);
+	return calloc(1, bytes);
+}
+
+static void loop_free(struct loopback *loop, void *ptr)
+{
+	if (ptr && (loop->arena == NULL || arena_free(loop->arena, ptr) < 0))
+		free(ptr);
+}
+
 static int closeit(struct loopback_handle *lhandle)
 {
 	int err = 0;
@@ -1286,61 +2097,234 @@ static int closeit(struct loopback_handle *lhandle)
 	if (lhandle->ctl_rate_shift)
 		snd_ctl_elem_value_free(lhandle->ctl_rate_shift);
 	lhandle->ctl_rate_shift = NULL;
+	ctlmux_unlisten(lhandle->ctl_events);
+	lhandle->ctl_events = NULL;
+	lhandle->ctl_pollfd_count = 0;
+	if (lhandle->pool && pcmpool_put(lhandle) == 0)
+		goto __virtual;
 	if (lhandle->ctl)
-		err = snd_ctl_close(lhandle->ctl);
+		err = ctlmux_close(lhandle->ctl);
 	lhandle->ctl = NULL;
 	if (lhandle->handle)
 		err = snd_pcm_close(lhandle->handle);
 	lhandle->handle = NULL;
+      __virtual:
+	if (lhandle->mixin)
+		mixsink_detach(lhandle);
+	if (lhandle->splitout)
+		splitsrc_detach(lhandle);
 	return err;
 }
 
+/*
+ * Keep the current ring when it still holds a power of two of the new
+ * frames and is large enough, a mirrored ring stays mirrored that way.
+ */
+static int buf_reuse(struct loopback_handle *lhandle)
+{
+	snd_pcm_uframes_t size;
+
+	if (lhandle->buf == NULL || lhandle->buf_bytes % lhandle->frame_size)
+		return 0;
+	size = lhandle->buf_bytes / lhandle->frame_size;
+	if (size < lhandle->buf_size || (size & (size - 1)))
+		return 0;
+	lhandle->buf_size = size;
+	lhandle->buf_mask = size - 1;
+	return 1;
+}
+
 static int init_handle(struct loopback_handle *lhandle, int alloc)
 {
 	snd_pcm_uframes_t lat;
 	lhandle->frame_size = (snd_pcm_format_physical_width(lhandle->format) 
 						/ 8) * lhandle->channels;
+	lhandle->buf_silence_zero = snd_pcm_format_silence_64(lhandle->format) == 0;
 	lhandle->sync_point = lhandle->rate * 15;	/* every 15 seconds */
 	lat = lhandle->loopback->latency;
 	if (lhandle->buffer_size > lat)
 		lat = lhandle->buffer_size;
-	lhandle->buf_size = lat * 2;
+	lhandle->buf_size = buf_ring_size(lat * 2, lhandle->frame_size);
+	lhandle->buf_mask = lhandle->buf_size - 1;
 	if (alloc) {
-		lhandle->buf = (char *) calloc(1, lhandle->buf_size * lhandle->frame_size);
-		if (lhandle->buf == NULL)
-			return -ENOMEM;
+		if (buf_reuse(lhandle))
+			return 0;
+		freeit(lhandle);
+		return buf_alloc(lhandle);
 	}
 	return 0;
 }
 
+/*
+ * Buffer memory the loop will take from the arena, from the requested
+ * configuration. Devices may still settle on larger buffers, the arena
+ * grows for those.
+ */
+size_t pcmjob_arena_size(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play, *capt = loop->capt;
+	snd_pcm_uframes_t lat, pring, cring;
+	unsigned int pframe, cframe;
+	size_t size;
+
+	if (loop->latency_req)
+		lat = loop->latency_req;
+	else
+		lat = time_to_frames(play->rate_req, loop->latency_reqtime);
+	if (play->buffer_size_req > lat)
+		lat = play->buffer_size_req;
+	if (capt->buffer_size_req > lat)
+		lat = capt->buffer_size_req;
+	pframe = (snd_pcm_format_physical_width(play->format) / 8) * play->channels;
+	cframe = (snd_pcm_format_physical_width(capt->format) / 8) * capt->channels;
+	pring = buf_ring_size(lat * 2, pframe);
+	cring = buf_ring_size(lat * 2, cframe);
+	size = pring * pframe + cring * cframe;
+#ifdef USE_SAMPLERATE
+	if (loop->src_enable)
+		size += sizeof(float) * play->channels * (pring + cring);
+#endif
+	return size;
+}
+
+static int timer_source_write(int card, const char *source)
+{
+	char path[64];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/asound/card%i/timer_source", card);
+	f = fopen(path, "w");
+	if (f == NULL)
+		return -errno;
+	fprintf(f, "%s\n", source);
+	if (fclose(f) != 0)
+		return -errno;
+	return 0;
+}
+
+/*
+ * snd-aloop can run its cables from the timer of another card. With the
+ * loop card clocked by the playback device both ends share one clock and
+ * nothing drifts. A cable picks its timer up when it is opened, so this
+ * runs before the capture side is opened.
+ */
+static void timer_lock(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	snd_pcm_info_t *info;
+	char name[32], source[48];
+	int card, err;
+
+	if (!loop->timer_lock || play->handle == NULL ||
+	    play->card_number < 0 || loop->capt->split)
+		return;
+	if (sscanf(loop->capt->device, "hw:%31[^,]", name) != 1 ||
+	    (card = snd_card_get_index(name)) < 0)
+		return;
+	if (snd_pcm_info_malloc(&info) < 0)
+		return;
+	if (snd_pcm_info(play->handle, info) < 0) {
+		snd_pcm_info_free(info);
+		return;
+	}
+	snprintf(source, sizeof(source), "%i,%i,%i", play->card_number,
+		 snd_pcm_info_get_device(info),
+		 snd_pcm_info_get_subdevice(info));
+	snd_pcm_info_free(info);
+	err = timer_source_write(card, source);
+	if (err < 0) {
+		if (verbose > 1)
+			snd_output_printf(loop->output, "%s: no timer source for loop card %i: %s\n", play->id, card, snd_strerror(err));
+		return;
+	}
+	loop->timer_card = card;
+	loop->timer_checks = TIMER_LOCK_CHECKS;
+	if (verbose)
+		snd_output_printf(loop->output, "%s: loop card %i clocked by %s\n", play->id, card, source);
+}
+
+static void timer_unlock(struct loopback *loop)
+{
+	if (loop->timer_card < 0)
+		return;
+	/* an empty source goes back to the system timer */
+	timer_source_write(loop->timer_card, "");
+	loop->timer_card = -1;
+	loop->timer_checks = 0;
+}
+
+/*
+ * Watch the sync diff for a few sync points with the pitch left alone. On
+ * a shared clock it does not move, the sync is turned off then and the
+ * restart can share one buffer between both sides.
+ */
+static void timer_verify(struct loopback *loop, snd_pcm_sframes_t diff)
+{
+	unsigned int checks;
+	double ppm;
+
+	if (loop->timer_checks-- == TIMER_LOCK_CHECKS) {
+		loop->timer_diff = diff;
+		return;
+	}
+	checks = TIMER_LOCK_CHECKS - 1 - loop->timer_checks;
+	ppm = fabs((double)(diff - loop->timer_diff)) * 1000000 /
+	      ((double)checks * loop->play->sync_point);
+	if (ppm > TIMER_LOCK_MAX_PPM) {
+		if (verbose)
+			snd_output_printf(loop->output, "%s: loop timer not locked (%.2f ppm)\n", loop->id, ppm);
+		loop->timer_checks = 0;
+		return;
+	}
+	if (loop->timer_checks > 0)
+		return;
+	if (verbose)
+		snd_output_printf(loop->output, "%s: loop timer locked (%.2f ppm), sync disabled\n", loop->id, ppm);
+	loop->pitch = 1.0;
+	update_pitch(loop);
+	loop->sync = SYNC_TYPE_NONE;
+	loop->reinit = 1;
+}
+
+static void sync_resolve(struct loopback *loop)
+{
+	if (loop->sync == SYNC_TYPE_AUTO && loop->capt->ctl_rate_shift)
+		loop->sync = SYNC_TYPE_CAPTRATESHIFT;
+	if (loop->sync == SYNC_TYPE_AUTO && loop->play->ctl_rate_shift)
+		loop->sync = SYNC_TYPE_PLAYRATESHIFT;
+#ifdef USE_SAMPLERATE
+	if (loop->sync == SYNC_TYPE_AUTO && loop->src_enable)
+		loop->sync = SYNC_TYPE_SAMPLERATE;
+#endif
+	if (loop->sync == SYNC_TYPE_AUTO)
+		loop->sync = SYNC_TYPE_SIMPLE;
+}
+
 int pcmjob_init(struct loopback *loop)
 {
 	int err;
 	char id[128];
+	snd_timestamp_t t1, t2;
 
-#ifdef FILE_CWRITE
-	loop->cfile = fopen(FILE_CWRITE, "w+");
-#endif
-#ifdef FILE_PWRITE
-	loop->pfile = fopen(FILE_PWRITE, "w+");
-#endif
+	getcurtimestamp(&t1);
 	if ((err = openit(loop->play)) < 0)
 		goto __error;
+	getcurtimestamp(&t2);
+	loop->play_open_time = timediff(t2, t1);
+	timer_lock(loop);
 	if ((err = openit(loop->capt)) < 0)
 		goto __error;
+	if (loop->wake_timer) {
+		loop->wake_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (loop->wake_fd < 0) {
+			logit(LOG_WARNING, "%s: no wake timer, using period wakeups: %s\n", loop->play->id, strerror(errno));
+			loop->wake_timer = 0;
+		}
+	}
 	snprintf(id, sizeof(id), "%s/%s", loop->play->id, loop->capt->id);
 	id[sizeof(id)-1] = '\0';
 	loop->id = strdup(id);
-	if (loop->sync == SYNC_TYPE_AUTO && loop->capt->ctl_rate_shift)
-		loop->sync = SYNC_TYPE_CAPTRATESHIFT;
-	if (loop->sync == SYNC_TYPE_AUTO && loop->play->ctl_rate_shift)
-		loop->sync = SYNC_TYPE_PLAYRATESHIFT;
-#ifdef USE_SAMPLERATE
-	if (loop->sync == SYNC_TYPE_AUTO && loop->src_enable)
-		loop->sync = SYNC_TYPE_SAMPLERATE;
-#endif
-	if (loop->sync == SYNC_TYPE_AUTO)
-		loop->sync = SYNC_TYPE_SIMPLE;
+	sync_resolve(loop);
 	if (loop->slave == SLAVE_TYPE_AUTO &&
 	    loop->capt->ctl_notify &&
 	    loop->capt->ctl_active &&
@@ -1348,6 +2332,10 @@ int pcmjob_init(struct loopback *loop)
 	    loop->capt->ctl_rate &&
 	    loop->capt->ctl_channels)
 		loop->slave = SLAVE_TYPE_ON;
+	if (loop->park && loop->capt->ctl_active == NULL) {
+		logit(LOG_WARNING, "%s: no PCM Slave Active control, idle parking disabled\n", loop->id);
+		loop->park = 0;
+	}
 	if (loop->slave == SLAVE_TYPE_ON) {
 		err = set_notify(loop->capt, 1);
 		if (err < 0)
@@ -1375,16 +2363,19 @@ static void freeloop(struct loopback *loop)
 		if (loop->src_state)
 			src_delete(loop->src_state);
 		loop->src_state = NULL;
-		free((void *)loop->src_data.data_in);
+		loop_free(loop, (void *)loop->src_data.data_in);
 		loop->src_data.data_in = NULL;
-		free(loop->src_data.data_out);
+		loop_free(loop, loop->src_data.data_out);
 		loop->src_data.data_out = NULL;
 	}
 #endif
-	if (loop->play->buf == loop->capt->buf)
+	if (loop->play->buf == loop->capt->buf) {
 		loop->play->buf = NULL;
+		loop->play->buf_mirror = 0;
+	}
 	freeit(loop->play);
 	freeit(loop->capt);
+	route_done(&loop->route);
 }
 
 int pcmjob_done(struct loopback *loop)
@@ -1392,21 +2383,13 @@ int pcmjob_done(struct loopback *loop)
 	control_done(loop);
 	closeit(loop->play);
 	closeit(loop->capt);
+	timer_unlock(loop);
+	if (loop->wake_fd >= 0)
+		close(loop->wake_fd);
+	loop->wake_fd = -1;
 	freeloop(loop);
 	free(loop->id);
 	loop->id = NULL;
-#ifdef FILE_PWRITE
-	if (loop->pfile) {
-		fclose(loop->pfile);
-		loop->pfile = NULL;
-	}
-#endif
-#ifdef FILE_CWRITE
-	if (loop->cfile) {
-		fclose(loop->cfile);
-		loop->cfile = NULL;
-	}
-#endif
 	return 0;
 }
 
@@ -1418,6 +2401,65 @@ static void lhandle_start(struct loopback_handle *lhandle)
 	lhandle->total_queued = 0;
 }
 
+static inline int kernel_format(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16:
+		return KERNEL_FORMAT_S16;
+	case SND_PCM_FORMAT_S32:
+		return KERNEL_FORMAT_S32;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * New software gain. A running loop ramps to it over gain_ramp_time,
+ * mixer inputs are scaled by the mixing sink instead.
+ */
+static void gain_set(struct loopback *loop, float gain, int ramp)
+{
+	snd_pcm_uframes_t frames = 0;
+
+	loop->soft_gain = gain;
+	if (!loop->play->mix && loop->gain_format < 0 && gain != 1.0f &&
+	    !loop->gain_warned) {
+		logit(LOG_WARNING, "%s: software gain needs S16 or S32 samples, not applied\n", loop->id);
+		loop->gain_warned = 1;
+	}
+	if (loop->play->mix || loop->gain_format < 0) {
+		loop->gain = gain;
+		loop->gain_ramp = 0;
+		loop->gain_active = 0;
+		return;
+	}
+	if (ramp && loop->running && loop->gain != gain)
+		frames = time_to_frames(loop->play->rate,
+					loop->gain_ramp_time * 1000);
+	if (frames > 0) {
+		loop->gain_step = (gain - loop->gain) / frames;
+		loop->gain_ramp = frames;
+	} else {
+		loop->gain = gain;
+		loop->gain_ramp = 0;
+	}
+	loop->gain_active = loop->gain_ramp || loop->gain != 1.0f;
+}
+
+/* the chain gets the converter's float spans or the playback ring samples */
+static void dsp_start(struct loopback *loop)
+{
+	int format = loop->use_samplerate ? KERNEL_FORMAT_FLOAT :
+					    kernel_format(loop->play->format);
+
+	loop->dsp_active = 0;
+	if (loop->dsp)
+		loop->dsp_active = dsp_prepare(loop->dsp, loop->id,
+					       loop->play->rate,
+					       loop->play->channels,
+					       format) > 0;
+}
+
 static void fix_format(struct loopback *loop, int force)
 {
 	snd_pcm_format_t format = loop->capt->format;
@@ -1435,32 +2477,102 @@ static void fix_format(struct loopback *loop, int force)
 	loop->play->format = format;
 }
 
+/*
+ * The loop client went inactive and the streams are stopped. The thread
+ * polls only the control events now. The playback device is closed too
+ * when opening it again fits into the resume bound.
+ */
+static int park(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+
+	if (!loop->parked) {
+		loop->parked = 1;
+		loop->park_stats.parks++;
+		getcurtimestamp(&loop->park_start);
+		loop->park_wake.tv_sec = loop->park_wake.tv_usec = 0;
+	}
+	if (!loop->park || loop->park_closed || loop->park_resume == 0 ||
+	    play->handle == NULL || play->mix || loop->controls ||
+	    loop->timer_card >= 0 ||
+	    loop->play_open_time >= (long)loop->park_resume * 1000)
+		return 0;
+	closeit(play);
+	loop->park_closed = 1;
+	loop->park_stats.closes++;
+	if (verbose)
+		snd_output_printf(loop->output, "%s: parked, %s closed\n", loop->id, play->id);
+	return 0;
+}
+
+static int park_reopen(struct loopback *loop)
+{
+	snd_timestamp_t t1, t2;
+	int err;
+
+	getcurtimestamp(&t1);
+	if ((err = openit(loop->play)) < 0)
+		return err;
+	getcurtimestamp(&t2);
+	loop->play_open_time = timediff(t2, t1);
+	loop->park_closed = 0;
+	return 0;
+}
+
+static void unpark(struct loopback *loop)
+{
+	struct loopback_park_stats *stats = &loop->park_stats;
+	snd_timestamp_t now;
+
+	getcurtimestamp(&now);
+	stats->idle_time += timediff(now, loop->park_start);
+	if (loop->park_wake.tv_sec || loop->park_wake.tv_usec) {
+		stats->resume_latency = timediff(now, loop->park_wake);
+		if (stats->resume_latency > stats->resume_latency_max)
+			stats->resume_latency_max = stats->resume_latency;
+		if (verbose)
+			snd_output_printf(loop->output, "%s: resumed in %lius\n", loop->id, stats->resume_latency);
+	}
+	loop->parked = 0;
+}
+
 int pcmjob_start(struct loopback *loop)
 {
 	snd_pcm_uframes_t count;
 	int err;
 
+	if (loop->park_closed) {
+		err = get_active(loop->capt);
+		if (err <= 0)
+			return err;
+		if ((err = park_reopen(loop)) < 0)
+			goto __error;
+	}
 	loop->pollfd_count = loop->play->ctl_pollfd_count +
 			     loop->capt->ctl_pollfd_count;
-	if ((err = snd_pcm_poll_descriptors_count(loop->play->handle)) < 0)
+	if (loop->wake_fd >= 0)
+		loop->pollfd_count++;
+	if ((err = pcm_poll_descriptors_count(loop->play)) < 0)
 		goto __error;
 	loop->play->pollfd_count = err;
 	loop->pollfd_count += err;
-	if ((err = snd_pcm_poll_descriptors_count(loop->capt->handle)) < 0)
+	if ((err = pcm_poll_descriptors_count(loop->capt)) < 0)
 		goto __error;
 	loop->capt->pollfd_count = err;
 	loop->pollfd_count += err;
-	if (loop->slave == SLAVE_TYPE_ON) {
+	if (loop->slave == SLAVE_TYPE_ON || loop->park) {
 		err = get_active(loop->capt);
 		if (err < 0)
 			goto __error;
 		if (err == 0)		/* stream is not active */
-			return 0;
+			return park(loop);
+	}
+	if (loop->slave == SLAVE_TYPE_ON) {
 		err = get_format(loop->capt);
 		if (err < 0)
 			goto __error;
 		loop->play->format = loop->capt->format = (snd_pcm_format_t) err;
-		fix_format(loop, 0);
+		fix_format(loop, loop->play->mixin != NULL);
 		err = get_rate(loop->capt);
 		if (err < 0)
 			goto __error;
@@ -1468,54 +2580,70 @@ int pcmjob_start(struct loopback *loop)
 		err = get_channels(loop->capt);
 		if (err < 0)
 			goto __error;
-		loop->play->channels = loop->capt->channels = err;
+		if (loop->route_coef && (unsigned int)err != loop->capt->channels) {
+			logit(LOG_CRIT, "%s: routing matrix expects %u channels, loop uses %i\n", loop->id, loop->capt->channels, err);
+			err = -EINVAL;
+			goto __error;
+		}
+		loop->capt->channels = err;
+		loop->play->channels = loop->route_channels ?
+					loop->route_channels : (unsigned int)err;
 	}
 	loop->reinit = 0;
 	loop->use_samplerate = 0;
 __again:
+	err = route_init(&loop->route, loop->capt->channels,
+			 loop->play->channels, loop->route_coef);
+	if (err < 0) {
+		logit(LOG_CRIT, "%s: unable to route %u to %u channels: %s\n", loop->id, loop->capt->channels, loop->play->channels, snd_strerror(err));
+		goto __error;
+	}
+	/* a real matrix is computed on S16 or S32 samples */
+	if (!loop->route.reorder)
+		fix_format(loop, 1);
 	if (loop->latency_req) {
 		loop->latency_reqtime = frames_to_time(loop->play->rate_req,
 						       loop->latency_req);
 		loop->latency_req = 0;
 	}
 	loop->latency = time_to_frames(loop->play->rate_req, loop->latency_reqtime);
+	/* plugins keep state (delay lines, filters), they must see the silence */
+	loop->silence_hold_frames = loop->silence_hold && loop->dsp == NULL ?
+		time_to_frames(loop->capt->rate_req, loop->silence_hold * 1000) : 0;
+	loop->silence_run = 0;
+	loop->silence_bypass = 0;
+	loop->park_frames = loop->park_delay ?
+		time_to_frames(loop->play->rate_req, loop->park_delay * 1000) :
+		loop->latency * 3;
 	if ((err = setparams(loop, loop->latency/2)) < 0)
 		goto __error;
 	if (verbose)
 		showlatency(loop->output, loop->latency, loop->play->rate_req, "Latency");
+	/* a restart does not ramp, the streams start from silence */
+	loop->gain_format = kernel_format(loop->play->format);
+	gain_set(loop, loop->soft_gain, 0);
 	if (loop->play->access == loop->capt->access &&
 	    loop->play->format == loop->capt->format &&
 	    loop->play->rate == loop->capt->rate &&
 	    loop->play->channels == loop->capt->channels &&
+	    loop->route.identity &&
 	    loop->sync != SYNC_TYPE_SAMPLERATE) {
 		if (verbose > 1)
 			snd_output_printf(loop->output, "shared buffer!!!\n");
-		if ((err = init_handle(loop->play, 1)) < 0)
+		if ((err = init_handle(loop->play, 0)) < 0)
 			goto __error;
 		if ((err = init_handle(loop->capt, 0)) < 0)
 			goto __error;
-		if (loop->play->buf_size < loop->capt->buf_size) {
-			char *nbuf = (char *) realloc(loop->play->buf,
-					     loop->capt->buf_size *
-					       loop->capt->frame_size);
-			if (nbuf == NULL) {
-				err = -ENOMEM;
-				goto __error;
-			}
-			loop->play->buf = nbuf;
+		if (loop->play->buf_size < loop->capt->buf_size)
 			loop->play->buf_size = loop->capt->buf_size;
-		} else if (loop->capt->buf_size < loop->play->buf_size) {
-			char *nbuf = (char *) realloc(loop->capt->buf,
-					     loop->play->buf_size *
-					       loop->play->frame_size);
-			if (nbuf == NULL) {
-				err = -ENOMEM;
-				goto __error;
-			}
-			loop->capt->buf = nbuf;
+		else
 			loop->capt->buf_size = loop->play->buf_size;
-		}
+		loop->play->buf_mask = loop->capt->buf_mask = loop->play->buf_size - 1;
+		if ((err = buf_alloc(loop->play)) < 0)
+			goto __error;
 		loop->capt->buf = loop->play->buf;
+		loop->capt->buf_bytes = loop->play->buf_bytes;
+		loop->capt->buf_mirror = loop->play->buf_mirror;
 	} else {
 		if ((err = init_handle(loop->play, 1)) < 0)
 			goto __error;
@@ -1556,16 +2684,23 @@ __again:
 		}
 		loop->src_state = src_new(loop->src_converter_type,
 					  loop->play->channels, &err);
-		loop->src_data.data_in = calloc(1, sizeof(float)*loop->capt->channels*loop->capt->buf_size);
+		/* routing happens on the way into the converter */
+		loop->src_data.data_in = (float *) loop_calloc(loop, sizeof(float)*loop->play->channels*loop->capt->buf_size);
 		if (loop->src_data.data_in == NULL) {
 			err = -ENOMEM;
 			goto __error;
 		}
-		loop->src_data.data_out =  calloc(1, sizeof(float)*loop->play->channels*loop->play->buf_size);
+		loop->src_data.data_out = (float *) loop_calloc(loop, sizeof(float)*loop->play->channels*loop->play->buf_size);
 		if (loop->src_data.data_out == NULL) {
 			err = -ENOMEM;
 			goto __error;
 		}
+		loop->src_cvt_in = kernel_convert_select(kernel_format(loop->capt->format),
+							 KERNEL_FORMAT_FLOAT,
+							 loop->capt->channels);
+		loop->src_cvt_out = kernel_convert_select(KERNEL_FORMAT_FLOAT,
+							  kernel_format(loop->play->format),
+							  loop->play->channels);
 		loop->src_data.src_ratio = (double)loop->play->rate /
 					   (double)loop->capt->rate;
 		loop->src_data.end_of_input = 0;
@@ -1580,6 +2715,7 @@ __again:
 		goto __error;
 	}
 #endif
+	dsp_start(loop);
 	if (verbose) {
 		snd_output_printf(loop->output, "%s sync type: %s", loop->id, sync_types[loop->sync]);
 #ifdef USE_SAMPLERATE
@@ -1587,6 +2723,8 @@ __again:
 			snd_output_printf(loop->output, " (%s)", src_types[loop->src_converter_type]);
 #endif
 		snd_output_printf(loop->output, "\n");
+		if (!loop->route.identity)
+			snd_output_printf(loop->output, "%s routing: %u -> %u channels%s\n", loop->id, loop->capt->channels, loop->play->channels, loop->route.reorder ? " (reorder)" : "");
 	}
 	lhandle_start(loop->play);
 	lhandle_start(loop->capt);
@@ -1598,7 +2736,8 @@ __again:
 	}
 	if (verbose > 4)
 		snd_output_printf(loop->output, "%s: capt->buffer_size = %li, play->buffer_size = %li\n", loop->id, loop->capt->buf_size, loop->play->buf_size);
-	loop->pitch = 1.0;
+	loop->pitch = drift_lookup(loop);
+	loop->pitch_updates = 0;
 	update_pitch(loop);
 	loop->pitch_delta = 1.0 / ((double)loop->capt->rate * 4);
 	loop->total_queued_count = 0;
@@ -1612,7 +2751,7 @@ __again:
 		snd_output_printf(loop->output, "%s: silence queued %i samples\n", loop->id, err);
 	if (count > loop->play->buffer_size)
 		count = loop->play->buffer_size;
-	if (err != count) {
+	if (err < 0 || (snd_pcm_uframes_t)err != count) {
 		logit(LOG_CRIT, "%s: initial playback fill error (%i/%i/%u)\n", loop->id, err, (int)count, loop->play->buffer_size);
 		err = -EIO;
 		goto __error;
@@ -1625,34 +2764,50 @@ __again:
 		loop->xrun_last_cdelay = XRUN_PROFILE_UNKNOWN;
 		loop->xrun_max_proctime = 0;
 	}
-	if ((err = snd_pcm_start(loop->capt->handle)) < 0) {
+	if ((err = pcm_start(loop->capt)) < 0) {
 		logit(LOG_CRIT, "pcm start %s error: %s\n", loop->capt->id, snd_strerror(err));
 		goto __error;
 	}
 	if (!loop->linked) {
-		if ((err = snd_pcm_start(loop->play->handle)) < 0) {
+		if ((err = pcm_start(loop->play)) < 0) {
 			logit(LOG_CRIT, "pcm start %s error: %s\n", loop->play->id, snd_strerror(err));
 			goto __error;
 		}
 	}
+	if (loop->wake_fd >= 0)
+		wake_timer_arm(loop);
+	getcurtimestamp(&loop->busy_start);
+	loop->busy_time = 0;
+	loop->busy_misses = 0;
+	if (loop->parked)
+		unpark(loop);
 	return 0;
       __error:
 	pcmjob_stop(loop);
 	return err;
 }
 
+/* keep the learned pitch in memory, drift_store() saves it after the thread */
+static inline void drift_note(struct loopback *loop)
+{
+	loop->drift_pitch = loop->pitch;
+	loop->drift_sync = loop->sync;
+}
+
 int pcmjob_stop(struct loopback *loop)
 {
 	int err;
 
 	if (loop->running) {
-		if ((err = snd_pcm_drop(loop->capt->handle)) < 0)
+		if (loop->pitch_updates >= DRIFT_STORE_UPDATES)
+			drift_note(loop);
+		if ((err = pcm_drop(loop->capt)) < 0)
 			logit(LOG_WARNING, "pcm drop %s error: %s\n", loop->capt->id, snd_strerror(err));
-		if ((err = snd_pcm_drop(loop->play->handle)) < 0)
+		if ((err = pcm_drop(loop->play)) < 0)
 			logit(LOG_WARNING, "pcm drop %s error: %s\n", loop->play->id, snd_strerror(err));
-		if ((err = snd_pcm_hw_free(loop->capt->handle)) < 0)
+		if ((err = pcm_hw_free(loop->capt)) < 0)
 			logit(LOG_WARNING, "pcm hw_free %s error: %s\n", loop->capt->id, snd_strerror(err));
-		if ((err = snd_pcm_hw_free(loop->play->handle)) < 0)
+		if ((err = pcm_hw_free(loop->play)) < 0)
 			logit(LOG_WARNING, "pcm hw_free %s error: %s\n", loop->play->id, snd_strerror(err));
 		loop->running = 0;
 	}
@@ -1660,32 +2815,452 @@ int pcmjob_stop(struct loopback *loop)
 	return 0;
 }
 
+/*
+ * Set up the capture stream again for a new loop configuration while the
+ * playback stream keeps running. The playback side keeps its format and
+ * channels, the routing and the rate converter bridge the rest. Returns 1
+ * when done, 0 when the playback side must change too.
+ */
+static int reconfigure_capture(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	struct loopback_handle *capt = loop->capt;
+	snd_pcm_format_t format;
+	unsigned int rate, channels;
+	snd_pcm_uframes_t old_size;
+	int err;
+
+	if (loop->slave != SLAVE_TYPE_ON || loop->linked || capt->splitout)
+		return 0;
+	if (get_active(capt) <= 0)
+		return 0;
+	if ((err = get_format(capt)) < 0)
+		return 0;
+	format = (snd_pcm_format_t) err;
+	if ((err = get_rate(capt)) < 0)
+		return 0;
+	rate = err;
+	if ((err = get_channels(capt)) < 0)
+		return 0;
+	channels = err;
+	if (format != play->format ||
+	    (loop->route_channels ? loop->route_channels : channels) != play->channels)
+		return 0;
+	if (loop->route_coef && channels != capt->channels)
+		return 0;
+	if (rate != play->rate) {
+#ifdef USE_SAMPLERATE
+		if (!loop->src_enable || kernel_format(format) < 0)
+			return 0;
+#else
+		return 0;
+#endif
+	}
+	if (route_init(&loop->route, channels, play->channels, loop->route_coef) < 0)
+		return 0;
+	if (!loop->route.reorder && kernel_format(format) < 0)
+		return 0;
+
+	/* from here on only the capture stream is touched */
+	if ((err = pcm_drop(capt)) < 0)
+		return err;
+	capt->format = format;
+	capt->channels = channels;
+	capt->rate_req = play->rate_req = rate;
+	play->pitch = (double)play->rate_req / (double)play->rate;
+	loop->latency = time_to_frames(play->rate_req, loop->latency_reqtime);
+	if ((err = setparams_handle(capt, loop->latency / 2)) < 0)
+		return err;
+	if ((err = pcm_prepare(capt)) < 0) {
+		logit(LOG_CRIT, "Prepare %s error: %s\n", capt->id, snd_strerror(err));
+		return err;
+	}
+	if (verbose)
+		snd_pcm_dump(capt->handle, loop->output);
+	/* the queued playback samples stay in the playback ring */
+	if (capt->buf == play->buf) {
+		capt->buf = NULL;
+		capt->buf_mirror = 0;
+	}
+	old_size = capt->buf_size;
+	if ((err = init_handle(capt, 1)) < 0)
+		return err;
+#ifdef USE_SAMPLERATE
+	if (loop->use_samplerate || capt->rate != play->rate) {
+		if (!loop->use_samplerate)
+			old_size = 0;
+		loop->use_samplerate = 1;
+		if (loop->src_state == NULL) {
+			loop->src_state = src_new(loop->src_converter_type,
+						  play->channels, &err);
+			if (loop->src_state == NULL)
+				return -EIO;
+			loop->src_out_frames = 0;
+		}
+		if (capt->buf_size > old_size) {
+			loop_free(loop, (void *)loop->src_data.data_in);
+			loop->src_data.data_in = (float *) loop_calloc(loop, sizeof(float)*play->channels*capt->buf_size);
+			if (loop->src_data.data_in == NULL)
+				return -ENOMEM;
+		}
+		if (loop->src_data.data_out == NULL) {
+			loop->src_data.data_out = (float *) loop_calloc(loop, sizeof(float)*play->channels*play->buf_size);
+			if (loop->src_data.data_out == NULL)
+				return -ENOMEM;
+		}
+		loop->src_cvt_in = kernel_convert_select(kernel_format(capt->format),
+							 KERNEL_FORMAT_FLOAT,
+							 capt->channels);
+		loop->src_cvt_out = kernel_convert_select(KERNEL_FORMAT_FLOAT,
+							  kernel_format(play->format),
+							  play->channels);
+		loop->src_data.src_ratio = (double)play->rate /
+					   (double)capt->rate;
+		loop->src_data.end_of_input = 0;
+		/* the spans may have become float */
+		dsp_start(loop);
+	}
+#endif
+	if (verbose > 4)
+		snd_output_printf(loop->output, "%s: capt->buffer_size = %li (%s)\n", loop->id, capt->buf_size, capt->buf_size == old_size ? "reused" : "new");
+	lhandle_start(capt);
+	loop->pitch_delta = 1.0 / ((double)capt->rate * 4);
+	update_pitch(loop);
+	/* let the sync code start the capture and restore the latency */
+	capt->xrun_pending = 1;
+	if ((err = xrun_sync(loop)) < 0)
+		return err;
+	return 1;
+}
+
+/*
+ * Follow a loop configuration change. The capture side alone is set up
+ * again when possible, otherwise both streams are restarted. The learned
+ * pitch is kept, the clocks of both devices did not change.
+ */
+static int pcmjob_reconfigure(struct loopback *loop)
+{
+	snd_timestamp_t t1, t2;
+	double pitch = loop->pitch;
+	const char *how = "capture";
+	int err;
+
+	getcurtimestamp(&t1);
+	err = reconfigure_capture(loop);
+	if (err < 0)
+		logit(LOG_WARNING, "%s: capture reconfiguration failed, restarting: %s\n", loop->id, snd_strerror(err));
+	if (err <= 0) {
+		how = "full";
+		pcmjob_stop(loop);
+		err = pcmjob_start(loop);
+		if (err < 0)
+			return err;
+		if (!loop->running)
+			return 0;
+		loop->pitch = pitch;
+		update_pitch(loop);
+	}
+	getcurtimestamp(&t2);
+	loop->reconfig_time = timediff(t2, t1);
+	if (verbose)
+		snd_output_printf(loop->output, "%s: %s reconfiguration took %lius\n", loop->id, how, loop->reconfig_time);
+	return 0;
+}
+
+/*
+ * Arm the wakeup timer for the next turn: before the playback queue drops
+ * to a quarter of the latency and before the capture buffer is half full,
+ * at most after half of the latency.
+ */
+static void wake_timer_arm(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	struct loopback_handle *capt = loop->capt;
+	snd_pcm_sframes_t delay, avail, mark;
+	struct itimerspec its;
+	unsigned long long usec, t;
+
+	usec = frames_to_time(play->rate_req, loop->latency / 2);
+	mark = loop->latency / 4;
+	if (pcm_delay(play, &delay) >= 0) {
+		t = delay > mark ? frames_to_time(play->rate, delay - mark) : 0;
+		if (t < usec)
+			usec = t;
+	}
+	mark = capt->buffer_size / 2;
+	if ((avail = pcm_avail_update(capt)) >= 0) {
+		t = avail < mark ? frames_to_time(capt->rate, mark - avail) : 0;
+		if (t < usec)
+			usec = t;
+	}
+	if (usec < WAKE_TIMER_MIN)
+		usec = WAKE_TIMER_MIN;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = usec / 1000000;
+	its.it_value.tv_nsec = (usec % 1000000) * 1000;
+	if (timerfd_settime(loop->wake_fd, 0, &its, NULL) < 0)
+		logit(LOG_WARNING, "%s: wake timer failed: %s\n", loop->id, strerror(errno));
+	if (verbose > 9)
+		snd_output_printf(loop->output, "%s: next wake in %lluus\n", loop->id, usec);
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static inline unsigned long long monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* the sync types which need something the loop does not have */
+static int sync_usable(struct loopback *loop, int sync)
+{
+	switch (sync) {
+	case SYNC_TYPE_CAPTRATESHIFT:
+		return loop->capt->ctl_rate_shift != NULL;
+	case SYNC_TYPE_PLAYRATESHIFT:
+		return loop->play->ctl_rate_shift != NULL;
+	case SYNC_TYPE_SAMPLERATE:
+#ifdef USE_SAMPLERATE
+		return loop->src_enable;
+#else
+		return 0;
+#endif
+	default:
+		return sync >= SYNC_TYPE_NONE && sync <= SYNC_TYPE_LAST;
+	}
+}
+
+/*
+ * Apply a parameter change from the command queue. The loop thread calls
+ * this at the top of a wakeup, so it is always between two transfers.
+ * Changes which need new hardware parameters restart the streams from
+ * pcmjob_pollfds_handle().
+ */
+int pcmjob_command(struct loopback *loop, const struct loopback_cmd *cmd)
+{
+	int value = (int)cmd->value;
+
+	switch (cmd->type) {
+	case LOOP_CMD_LATENCY:
+		if (cmd->value <= 0)
+			return -EINVAL;
+		loop->latency_req = 0;
+		loop->latency_reqtime = value;
+		break;
+	case LOOP_CMD_SYNC:
+		if (!sync_usable(loop, value))
+			return -EINVAL;
+		/* a rate shift control left behind would keep the old pitch */
+		if (loop->sync == SYNC_TYPE_CAPTRATESHIFT)
+			set_rate_shift(loop->capt, 1);
+		if (loop->sync == SYNC_TYPE_PLAYRATESHIFT)
+			set_rate_shift(loop->play, 1);
+		loop->sync = (sync_type_t) value;
+		sync_resolve(loop);
+		break;
+	case LOOP_CMD_GAIN:
+		if (cmd->value < 0)
+			return -EINVAL;
+		loop->play->mix_gain = cmd->value;
+		if (loop->play->mixin)
+			mixin_set_gain(loop->play->mixin, cmd->value);
+		else
+			gain_set(loop, cmd->value, 1);
+		return 0;
+	case LOOP_CMD_SRC_QUALITY:
+#ifdef USE_SAMPLERATE
+		if (value < SRC_SINC_BEST_QUALITY || value > SRC_LINEAR)
+			return -EINVAL;
+		loop->src_converter_type = value;
+		if (!loop->use_samplerate)
+			return 0;
+		break;
+#else
+		return -ENOSYS;
+#endif
+	case LOOP_CMD_XRUN:
+		loop->xrun = value ? 1 : 0;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+	if (verbose)
+		snd_output_printf(loop->output, "%s: command %i (%g), restarting streams\n", loop->id, cmd->type, cmd->value);
+	if (loop->running)
+		loop->reinit = 1;
+	return 0;
+}
+
+static void buf_scale_frame(struct loopback_handle *lhandle,
+			    snd_pcm_uframes_t pos, float gain)
+{
+	char *frame = lhandle->buf + pos * lhandle->frame_size;
+	unsigned int ch;
+
+	switch (lhandle->format) {
+	case SND_PCM_FORMAT_S16:
+		for (ch = 0; ch < lhandle->channels; ch++)
+			((int16_t *)frame)[ch] = ((int16_t *)frame)[ch] * gain;
+		break;
+	case SND_PCM_FORMAT_S32:
+		for (ch = 0; ch < lhandle->channels; ch++)
+			((int32_t *)frame)[ch] = ((int32_t *)frame)[ch] * (double)gain;
+		break;
+	default:
+		/* no ramp for packed or foreign endian formats */
+		snd_pcm_format_set_silence(lhandle->format, frame, lhandle->channels);
+		break;
+	}
+}
+
+/*
+ * Replace what the playback device has queued by a short fade to
+ * silence, so a disconnect does not end with a click. The queued frames
+ * are rewound and written again from the ring with a falling gain, then
+ * the thread waits until they are played. Mixer inputs have no PCM to
+ * rewind, they are cut.
+ */
+void pcmjob_fade_out(struct loopback *loop, unsigned int ms)
+{
+	struct loopback_handle *play = loop->play;
+	snd_pcm_sframes_t rewind, frames, i;
+
+	if (!loop->running || play->handle == NULL || ms == 0)
+		return;
+	if (ms > FADE_OUT_MAX)
+		ms = FADE_OUT_MAX;
+	rewind = snd_pcm_rewindable(play->handle);
+	/* the frames behind buf_pos stay in the ring until capture wraps */
+	if (rewind > (snd_pcm_sframes_t)(play->buf_size - play->buf_count))
+		rewind = play->buf_size - play->buf_count;
+	if (rewind > 0)
+		rewind = snd_pcm_rewind(play->handle, rewind);
+	if (rewind > 0) {
+		play->buf_pos = (play->buf_pos - rewind) & play->buf_mask;
+		play->buf_count += rewind;
+	}
+	frames = time_to_frames(play->rate, ms * 1000ULL);
+	if (frames > (snd_pcm_sframes_t)play->buf_count)
+		frames = play->buf_count;
+	for (i = 0; i < frames; i++)
+		buf_scale_frame(play, (play->buf_pos + i) & play->buf_mask,
+				1.0f - (float)(i + 1) / frames);
+	play->buf_count = frames;
+	if (writeit(play) > 0)
+		usleep(frames_to_time(play->rate, frames));
+	if (verbose > 1)
+		snd_output_printf(loop->output, "%s: faded out over %li frames (%li rewound)\n", loop->id, frames, rewind);
+}
+
+/*
+ * Busy polling: the thread blocks only until shortly before the next
+ * capture period is expected, then spins on the hardware pointer and
+ * transfers as soon as new frames show up. Returns how long the thread
+ * may block for this loop in us, -1 when the loop does not spin.
+ */
+long pcmjob_busy_timeout(struct loopback *loop)
+{
+	struct loopback_handle *capt = loop->capt;
+	snd_pcm_sframes_t avail;
+	unsigned long long t;
+
+	if (!loop->busy_spin || !loop->running)
+		return -1;
+	avail = pcm_avail_update(capt);
+	if (avail < 0 || avail >= (snd_pcm_sframes_t)capt->period_size)
+		return 0;
+	t = frames_to_time(capt->rate, capt->period_size - avail);
+	return t > loop->busy_lead ? t - loop->busy_lead : 0;
+}
+
+void pcmjob_busy_spin(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	struct loopback_handle *capt = loop->capt;
+	snd_pcm_sframes_t avail, pdelay, cdelay;
+	unsigned long long start, now;
+
+	if (!loop->busy_spin || !loop->running)
+		return;
+	start = now = monotonic_us();
+	while ((avail = pcm_avail_update(capt)) == 0) {
+		now = monotonic_us();
+		if (now - start >= loop->busy_spin) {
+			loop->busy_misses++;
+			break;
+		}
+		cpu_relax();
+	}
+	loop->busy_time += now - start;
+	if (pcm_delay(play, &pdelay) >= 0 && pcm_delay(capt, &cdelay) >= 0)
+		loop->busy_latency = frames_to_time(play->rate, pdelay + play->buf_count) +
+				     frames_to_time(capt->rate, cdelay + capt->buf_count);
+}
+
+/* add the busy polling counters of a spinning loop to stats */
+void pcmjob_busy_stats(struct loopback *loop, struct loopback_busy_stats *stats)
+{
+	snd_timestamp_t now;
+	long wall;
+
+	if (!loop->busy_spin || !loop->running)
+		return;
+	getcurtimestamp(&now);
+	wall = timediff(now, loop->busy_start);
+	stats->spin_time += loop->busy_time;
+	if (wall > 0 && (unsigned long long)wall > stats->wall_time)
+		stats->wall_time = wall;
+	stats->misses += loop->busy_misses;
+	if (loop->busy_latency > stats->latency)
+		stats->latency = loop->busy_latency;
+}
+
+/* control events matter for the slave mode, mirrored mixers and parking */
+static inline int ctl_polled(struct loopback *loop)
+{
+	return loop->slave == SLAVE_TYPE_ON || loop->controls || loop->park;
+}
+
 int pcmjob_pollfds_init(struct loopback *loop, struct pollfd *fds)
 {
 	int err, idx = 0;
 
 	if (loop->running) {
-		err = snd_pcm_poll_descriptors(loop->play->handle, fds + idx, loop->play->pollfd_count);
+		err = pcm_poll_descriptors(loop->play, fds + idx, loop->play->pollfd_count);
 		if (err < 0)
 			return err;
 		idx += loop->play->pollfd_count;
-		err = snd_pcm_poll_descriptors(loop->capt->handle, fds + idx, loop->capt->pollfd_count);
+		err = pcm_poll_descriptors(loop->capt, fds + idx, loop->capt->pollfd_count);
 		if (err < 0)
 			return err;
 		idx += loop->capt->pollfd_count;
+		if (loop->wake_fd >= 0) {
+			fds[idx].fd = loop->wake_fd;
+			fds[idx].events = POLLIN;
+			fds[idx].revents = 0;
+			idx++;
+		}
 	}
-	if (loop->play->ctl_pollfd_count > 0 &&
-	    (loop->slave == SLAVE_TYPE_ON || loop->controls)) {
-		err = snd_ctl_poll_descriptors(loop->play->ctl, fds + idx, loop->play->ctl_pollfd_count);
-		if (err < 0)
-			return err;
+	if (loop->play->ctl_pollfd_count > 0 && ctl_polled(loop)) {
+		fds[idx].fd = ctlmux_fd(loop->play->ctl_events);
+		fds[idx].events = POLLIN;
+		fds[idx].revents = 0;
 		idx += loop->play->ctl_pollfd_count;
 	}
-	if (loop->capt->ctl_pollfd_count > 0 &&
-	    (loop->slave == SLAVE_TYPE_ON || loop->controls)) {
-		err = snd_ctl_poll_descriptors(loop->capt->ctl, fds + idx, loop->capt->ctl_pollfd_count);
-		if (err < 0)
-			return err;
+	if (loop->capt->ctl_pollfd_count > 0 && ctl_polled(loop)) {
+		fds[idx].fd = ctlmux_fd(loop->capt->ctl_events);
+		fds[idx].events = POLLIN;
+		fds[idx].revents = 0;
 		idx += loop->capt->ctl_pollfd_count;
 	}
 	loop->active_pollfd_count = idx;
@@ -1697,7 +3272,7 @@ static snd_pcm_sframes_t get_queued_playback_samples(struct loopback *loop)
 	snd_pcm_sframes_t delay;
 	int err;
 
-	if ((err = snd_pcm_delay(loop->play->handle, &delay)) < 0)
+	if ((err = pcm_delay(loop->play, &delay)) < 0)
 		return 0;
 	loop->play->last_delay = delay;
 	delay += loop->play->buf_count;
@@ -1712,25 +3287,23 @@ static snd_pcm_sframes_t get_queued_capture_samples(struct loopback *loop)
 	snd_pcm_sframes_t delay;
 	int err;
 
-	if ((err = snd_pcm_delay(loop->capt->handle, &delay)) < 0)
+	if ((err = pcm_delay(loop->capt, &delay)) < 0)
 		return 0;
 	loop->capt->last_delay = delay;
 	delay += loop->capt->buf_count;
 	return delay;
 }
 
+/* the slave elements were read at open, so their values carry the numid */
 static int ctl_event_check(snd_ctl_elem_value_t *val, snd_ctl_event_t *ev)
 {
-	snd_ctl_elem_id_t *id1, *id2;
-	snd_ctl_elem_id_alloca(&id1);
-	snd_ctl_elem_id_alloca(&id2);
-	snd_ctl_elem_value_get_id(val, id1);
-	snd_ctl_event_elem_get_id(ev, id2);
+	if (val == NULL)
+		return 0;
 	if (snd_ctl_event_elem_get_mask(ev) == SND_CTL_EVENT_MASK_REMOVE)
 		return 0;
 	if ((snd_ctl_event_elem_get_mask(ev) & SND_CTL_EVENT_MASK_VALUE) == 0)
 		return 0;
-	return control_id_match(id1, id2);
+	return snd_ctl_elem_value_get_numid(val) == snd_ctl_event_elem_get_numid(ev);
 }
 
 static int handle_ctl_events(struct loopback_handle *lhandle,
@@ -1741,11 +3314,20 @@ static int handle_ctl_events(struct loopback_handle *lhandle,
 	int err, restart = 0;
 
 	snd_ctl_event_alloca(&ev);
-	while ((err = snd_ctl_read(lhandle->ctl, ev)) != 0 && err != -EAGAIN) {
-		if (err < 0)
-			break;
-		if (snd_ctl_event_get_type(ev) != SND_CTL_EVENT_ELEM)
+	ctlmux_clear(lhandle->ctl_events);
+	while ((err = ctlmux_read(lhandle->ctl_events, ev)) != 0) {
+		if (err == -EOVERFLOW) {
+			/* events were lost, compare with what the card says now */
+			if (verbose > 1)
+				snd_output_printf(loop->output, "%s: ctl events lost\n", lhandle->id);
+			control_resync(lhandle);
+			if (lhandle == loop->capt &&
+			    ((lhandle->ctl_format && lhandle->format != get_format(lhandle)) ||
+			     (lhandle->ctl_rate && (int)lhandle->rate != get_rate(lhandle)) ||
+			     (lhandle->ctl_channels && (int)lhandle->channels != get_channels(lhandle))))
+				restart = 1;
 			continue;
+		}
 		if (lhandle == loop->play)
 			goto __ctl_check;
 		if (verbose > 6)
@@ -1759,12 +3341,12 @@ static int handle_ctl_events(struct loopback_handle *lhandle,
 			continue;
 		} else if (ctl_event_check(lhandle->ctl_rate, ev)) {
 			err = get_rate(lhandle);
-			if (lhandle->rate != err)
+			if ((int)lhandle->rate != err)
 				restart = 1;
 			continue;
 		} else if (ctl_event_check(lhandle->ctl_channels, ev)) {
 			err = get_channels(lhandle);
-			if (lhandle->channels != err)
+			if ((int)lhandle->channels != err)
 				restart = 1;
 			continue;
 		}
@@ -1783,10 +3365,16 @@ static int handle_ctl_events(struct loopback_handle *lhandle,
 		loop->stop_pending = 0;
 		if (loop->running == 0)
 			restart = 1;
+		if (loop->parked && !loop->park_wake.tv_sec && !loop->park_wake.tv_usec)
+			getcurtimestamp(&loop->park_wake);
 	}
 	if (restart) {
-		pcmjob_stop(loop);
-		err = pcmjob_start(loop);
+		if (loop->running) {
+			err = pcmjob_reconfigure(loop);
+		} else {
+			pcmjob_stop(loop);
+			err = pcmjob_start(loop);
+		}
 		if (err < 0)
 			return err;
 	}
@@ -1803,33 +3391,43 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 
 	if (verbose > 11)
 		snd_output_printf(loop->output, "%s: pollfds handle\n", loop->id);
+	if (loop->parked)
+		loop->park_stats.idle_wakeups++;
 	if (verbose > 13 || loop->xrun)
 		getcurtimestamp(&loop->tstamp_start);
 	if (verbose > 12) {
 		snd_pcm_sframes_t pdelay, cdelay;
-		if ((err = snd_pcm_delay(play->handle, &pdelay)) < 0)
+		if ((err = pcm_delay(play, &pdelay)) < 0)
 			snd_output_printf(loop->output, "%s: delay error: %s / %li / %li\n", play->id, snd_strerror(err), play->buf_size, play->buf_count);
 		else
 			snd_output_printf(loop->output, "%s: delay %li / %li / %li\n", play->id, pdelay, play->buf_size, play->buf_count);
-		if ((err = snd_pcm_delay(capt->handle, &cdelay)) < 0)
+		if ((err = pcm_delay(capt, &cdelay)) < 0)
 			snd_output_printf(loop->output, "%s: delay error: %s / %li / %li\n", capt->id, snd_strerror(err), capt->buf_size, capt->buf_count);
 		else
 			snd_output_printf(loop->output, "%s: delay %li / %li / %li\n", capt->id, cdelay, capt->buf_size, capt->buf_count);
 	}
 	idx = 0;
 	if (loop->running) {
-		err = snd_pcm_poll_descriptors_revents(play->handle, fds,
+		err = pcm_poll_descriptors_revents(play, fds,
 						       play->pollfd_count,
 						       &prevents);
 		if (err < 0)
 			return err;
 		idx += play->pollfd_count;
-		err = snd_pcm_poll_descriptors_revents(capt->handle, fds + idx,
+		err = pcm_poll_descriptors_revents(capt, fds + idx,
 						       capt->pollfd_count,
 						       &crevents);
 		if (err < 0)
 			return err;
 		idx += capt->pollfd_count;
+		if (loop->wake_fd >= 0) {
+			uint64_t expirations;
+			if ((fds[idx].revents & POLLIN) &&
+			    read(loop->wake_fd, &expirations, sizeof(expirations)) < 0 &&
+			    errno != EAGAIN)
+				logit(LOG_WARNING, "%s: wake timer read failed: %s\n", loop->id, strerror(errno));
+			idx++;
+		}
 		if (loop->xrun) {
 			if (prevents || crevents) {
 				loop->xrun_last_wake = loop->xrun_last_wake0;
@@ -1841,33 +3439,23 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 	} else {
 		prevents = crevents = 0;
 	}
-	if (play->ctl_pollfd_count > 0 &&
-	    (loop->slave == SLAVE_TYPE_ON || loop->controls)) {
-		err = snd_ctl_poll_descriptors_revents(play->ctl, fds + idx,
-						       play->ctl_pollfd_count,
-						       &events);
-		if (err < 0)
-			return err;
+	if (play->ctl_pollfd_count > 0 && ctl_polled(loop)) {
+		events = fds[idx].revents;
 		if (events) {
 			err = handle_ctl_events(play, events);
 			if (err == 1)
-				return 0;
+				goto __rearm;
 			if (err < 0)
 				return err;
 		}
 		idx += play->ctl_pollfd_count;
 	}
-	if (capt->ctl_pollfd_count > 0 &&
-	    (loop->slave == SLAVE_TYPE_ON || loop->controls)) {
-		err = snd_ctl_poll_descriptors_revents(capt->ctl, fds + idx,
-						       capt->ctl_pollfd_count,
-						       &events);
-		if (err < 0)
-			return err;
+	if (capt->ctl_pollfd_count > 0 && ctl_polled(loop)) {
+		events = fds[idx].revents;
 		if (events) {
 			err = handle_ctl_events(capt, events);
 			if (err == 1)
-				return 0;
+				goto __rearm;
 			if (err < 0)
 				return err;
 		}
@@ -1926,7 +3514,9 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		/* FIXME: this algorithm may be slightly better */
 		if (verbose > 3)
 			snd_output_printf(loop->output, "%s: sync diff %li old diff %li\n", loop->id, diff, loop->pitch_diff);
-		if (diff > 0) {
+		if (loop->timer_checks > 0) {
+			timer_verify(loop, diff);
+		} else if (diff > 0) {
 			if (diff == loop->pitch_diff)
 				loop->pitch += loop->pitch_delta;
 			else if (diff > loop->pitch_diff)
@@ -1943,6 +3533,8 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		if (loop->pitch_diff_max < diff)
 			loop->pitch_diff_max = diff;
 		update_pitch(loop);
+		if (++loop->pitch_updates % DRIFT_STORE_UPDATES == 0)
+			drift_note(loop);
 		play->counter -= play->sync_point;
 		capt->counter -= play->sync_point;
 		play->total_queued = 0;
@@ -1964,11 +3556,11 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 	}
 	if (verbose > 12) {
 		snd_pcm_sframes_t pdelay, cdelay;
-		if ((err = snd_pcm_delay(play->handle, &pdelay)) < 0)
+		if ((err = pcm_delay(play, &pdelay)) < 0)
 			snd_output_printf(loop->output, "%s: end delay error: %s / %li / %li\n", play->id, snd_strerror(err), play->buf_size, play->buf_count);
 		else
 			snd_output_printf(loop->output, "%s: end delay %li / %li / %li\n", play->id, pdelay, play->buf_size, play->buf_count);
-		if ((err = snd_pcm_delay(capt->handle, &cdelay)) < 0)
+		if ((err = pcm_delay(capt, &cdelay)) < 0)
 			snd_output_printf(loop->output, "%s: end delay error: %s / %li / %li\n", capt->id, snd_strerror(err), capt->buf_size, capt->buf_count);
 		else
 			snd_output_printf(loop->output, "%s: end delay %li / %li / %li\n", capt->id, cdelay, capt->buf_size, capt->buf_count);
@@ -1983,6 +3575,9 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		if (loop->xrun && loop->xrun_max_proctime < diff)
 			loop->xrun_max_proctime = diff;
 	}
+      __rearm:
+	if (loop->wake_fd >= 0 && loop->running)
+		wake_timer_arm(loop);
 	return 0;
 }
 
@@ -1998,6 +3593,8 @@ static void show_handle(struct loopback_handle *lhandle, const char *id)
 	OUT("  %s: %s:\n", id, lhandle->id);
 	OUT("    device = '%s', ctldev '%s'\n", lhandle->device, lhandle->ctldev);
 	OUT("    card_number = %i\n", lhandle->card_number);
+	if (lhandle->ctl_events)
+		ctlmux_state(lhandle->ctl_events, lhandle->id, loop->state);
 	if (!loop->running)
 		return;
 	OUT("    access = %s, format = %s, rate = %u, channels = %u\n", snd_pcm_access_name(lhandle->access), snd_pcm_format_name(lhandle->format), lhandle->rate, lhandle->channels);
@@ -2015,12 +3612,35 @@ void pcmjob_state(struct loopback *loop)
 	OUT("  running = %i\n", loop->running);
 	OUT("  sync = %i\n", loop->sync);
 	OUT("  slave = %i\n", loop->slave);
+	if (loop->silence_hold) {
+		struct loopback_silence_stats *st = &loop->silence_stats;
+		long long saved = 0;
+		if (st->work_frames)
+			saved = (long long)((double)st->frames * st->work_ns / st->work_frames) - (long long)st->bypass_ns;
+		OUT("  silence bypass = %i, entries = %lu, frames = %llu, cpu saved = %llius\n", loop->silence_bypass, st->entries, st->frames, saved / 1000);
+	}
+	if (loop->dsp)
+		dsp_state(loop->dsp, loop->state);
+	if (loop->gain_active || loop->soft_gain != 1.0f)
+		OUT("  gain = %.4f, target = %.4f, ramp = %li\n", loop->gain, loop->soft_gain, (long)loop->gain_ramp);
+	if (loop->park || loop->park_stats.parks)
+		OUT("  parked = %i%s, parks = %lu, idle wakeups = %lu, resume = %lius (max %lius)\n", loop->parked, loop->park_closed ? " (closed)" : "", loop->park_stats.parks, loop->park_stats.idle_wakeups, loop->park_stats.resume_latency, loop->park_stats.resume_latency_max);
 	if (!loop->running)
 		goto __skip;
 	OUT("  pollfd_count = %i\n", loop->pollfd_count);
 	OUT("  pitch = %.8f, delta = %.8f, diff = %li, min = %li, max = %li\n", loop->pitch, loop->pitch_delta, loop->pitch_diff, loop->pitch_diff_min, loop->pitch_diff_max);
 	OUT("  use_samplerate = %i\n", loop->use_samplerate);
+	OUT("  reconfig_time = %lius\n", loop->reconfig_time);
+	if (loop->busy_spin) {
+		snd_timestamp_t now;
+		long wall;
+		getcurtimestamp(&now);
+		wall = timediff(now, loop->busy_start);
+		OUT("  busy spin = %lluus (%.1f%% cpu), misses = %lu, latency = %lius\n", loop->busy_time, wall > 0 ? (double)loop->busy_time * 100 / wall : 0.0, loop->busy_misses, loop->busy_latency);
+	}
       __skip:
+	if (loop->arena)
+		arena_state(loop->arena, loop->state);
 	show_handle(loop->play, "playback");
 	show_handle(loop->capt, "capture");
 	pthread_mutex_unlock(&state_mutex);
@@ -0,0 +1,443 @@
+/**
+ * @file pcmpool.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Bağlantı kopartıldıktan sonra PCM ve ctl handle'larını belirli bir
+ *        süre açık ve hazır tutan, aynı cihaza yeniden bağlanıldığında
+ *        açma ve parametre anlaşmasını atlatan sıcak cihaz havuzu modülü.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+/*
+ * One opened device. The record travels with the handle: the loop owns
+ * it while connected, the pool owns it while the device is idle.
+ */
+struct pcmpool_entry {
+	char *device;
+	char *ctldev;			/* NULL = card of the PCM */
+	int stream;
+	snd_pcm_t *handle;
+	snd_ctl_t *ctl;
+	int card_number;
+	int pcm_device;
+	int pcm_subdevice;
+	char ident[sizeof(((struct loopback_handle *)0)->ident)];
+	long open_time;			/* cold open, in us */
+	/* hw params still applied to handle, key as in hwcache.cpp */
+	unsigned int params:1;
+	snd_pcm_access_t access;
+	snd_pcm_format_t format;
+	unsigned int channels;
+	unsigned int rate_req;
+	unsigned int resample;
+	unsigned int buffer_size_req;
+	unsigned int period_size_req;
+	snd_pcm_uframes_t bufsize;
+	unsigned int rate;
+	double pitch;
+	unsigned int buffer_size;
+	unsigned int period_size;
+	long params_time;		/* cold negotiation, in us */
+	struct timespec expire;
+	struct pcmpool_entry *next;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static struct pcmpool_entry *pool_list = NULL;
+static unsigned int pool_ttl = 0;	/* in ms, 0 = pool off */
+static int pool_keep_params = 0;
+static int pool_reaper = 0;		/* reaper thread running */
+static struct loopback_pool_stats pool_stats;
+
+static void pcmpool_init_cond(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pool_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static int devname_equal(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static void pcmpool_free(struct pcmpool_entry *e)
+{
+	if (e == NULL)
+		return;
+	if (e->ctl)
+		ctlmux_close(e->ctl);
+	if (e->handle)
+		snd_pcm_close(e->handle);
+	free(e->device);
+	free(e->ctldev);
+	free(e);
+}
+
+/* close a list of entries taken out of the pool, never under pool_mutex */
+static void pcmpool_free_list(struct pcmpool_entry *list)
+{
+	struct pcmpool_entry *e;
+
+	while ((e = list) != NULL) {
+		list = e->next;
+		if (verbose > 1)
+			logit(LOG_INFO, "Warm pool: closing %s\n", e->device);
+		pcmpool_free(e);
+	}
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+	       (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* unlink the entries which expired at now, or all of them */
+static struct pcmpool_entry *pcmpool_expire(const struct timespec *now)
+{
+	struct pcmpool_entry *e, **pe = &pool_list, *expired = NULL;
+
+	while ((e = *pe) != NULL) {
+		if (now && timespec_before(now, &e->expire)) {
+			pe = &e->next;
+			continue;
+		}
+		*pe = e->next;
+		e->next = expired;
+		expired = e;
+		pool_stats.pooled--;
+		if (now)
+			pool_stats.expired++;
+	}
+	return expired;
+}
+
+/* closes idle devices at their TTL, lives as long as the pool is not empty */
+static void *pcmpool_reaper(void *arg)
+{
+	struct pcmpool_entry *e, *expired;
+	struct timespec now, next;
+
+	(void)arg;
+	pthread_mutex_lock(&pool_mutex);
+	while (pool_list) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		expired = pcmpool_expire(&now);
+		if (expired) {
+			pthread_mutex_unlock(&pool_mutex);
+			pcmpool_free_list(expired);
+			pthread_mutex_lock(&pool_mutex);
+			continue;
+		}
+		next = pool_list->expire;
+		for (e = pool_list->next; e; e = e->next)
+			if (timespec_before(&e->expire, &next))
+				next = e->expire;
+		pthread_cond_timedwait(&pool_cond, &pool_mutex, &next);
+	}
+	pool_reaper = 0;
+	pthread_mutex_unlock(&pool_mutex);
+	return NULL;
+}
+
+/*
+ * Keep closed devices open for ttl_ms. With keep_params the hw params stay
+ * applied too, a reconnect with the same configuration skips the whole
+ * negotiation. A ttl_ms of 0 disables the pool and closes idle devices.
+ */
+void pcmpool_config(unsigned int ttl_ms, int keep_params)
+{
+	struct pcmpool_entry *expired = NULL;
+
+	pthread_once(&pool_once, pcmpool_init_cond);
+	pthread_mutex_lock(&pool_mutex);
+	pool_ttl = ttl_ms;
+	pool_keep_params = keep_params ? 1 : 0;
+	if (pool_ttl == 0)
+		expired = pcmpool_expire(NULL);
+	pthread_cond_signal(&pool_cond);
+	pthread_mutex_unlock(&pool_mutex);
+	pcmpool_free_list(expired);
+}
+
+void pcmpool_flush(void)
+{
+	struct pcmpool_entry *expired;
+
+	pthread_mutex_lock(&pool_mutex);
+	expired = pcmpool_expire(NULL);
+	pthread_mutex_unlock(&pool_mutex);
+	pcmpool_free_list(expired);
+}
+
+/*
+ * Hand an idle device of the pool to lhandle. Returns 1 with the handle,
+ * the ctl and the card identity restored, 0 when the caller has to open
+ * the device. The handle gets its own record either way while the pool
+ * is enabled.
+ */
+int pcmpool_take(struct loopback_handle *lhandle, int stream,
+		 int *device, int *subdevice)
+{
+	struct pcmpool_entry *e, **pe;
+
+	lhandle->pool = NULL;
+	pthread_mutex_lock(&pool_mutex);
+	if (pool_ttl == 0) {
+		pthread_mutex_unlock(&pool_mutex);
+		return 0;
+	}
+	for (pe = &pool_list; (e = *pe) != NULL; pe = &e->next)
+		if (e->stream == stream &&
+		    strcmp(e->device, lhandle->device) == 0 &&
+		    devname_equal(e->ctldev, lhandle->ctldev))
+			break;
+	if (e) {
+		*pe = e->next;
+		e->next = NULL;
+		pool_stats.pooled--;
+		pool_stats.hits++;
+		pool_stats.saved_time += e->open_time;
+	} else {
+		pool_stats.misses++;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+	if (e == NULL) {
+		e = (struct pcmpool_entry *) calloc(1, sizeof(*e));
+		if (e == NULL)
+			return 0;
+		e->device = strdup(lhandle->device);
+		e->ctldev = lhandle->ctldev ? strdup(lhandle->ctldev) : NULL;
+		if (e->device == NULL || (lhandle->ctldev && e->ctldev == NULL)) {
+			pcmpool_free(e);
+			return 0;
+		}
+		e->stream = stream;
+		lhandle->pool = e;
+		return 0;
+	}
+	lhandle->handle = e->handle;
+	lhandle->ctl = e->ctl;
+	lhandle->card_number = e->card_number;
+	snprintf(lhandle->ident, sizeof(lhandle->ident), "%s", e->ident);
+	*device = e->pcm_device;
+	*subdevice = e->pcm_subdevice;
+	e->handle = NULL;
+	e->ctl = NULL;
+	lhandle->pool = e;
+	if (verbose > 1)
+		snd_output_printf(lhandle->loopback->output, "%s: warm device from pool%s\n", lhandle->id, e->params ? ", hw params applied" : "");
+	return 1;
+}
+
+/* remember how the device was found and what opening it cost */
+void pcmpool_opened(struct loopback_handle *lhandle, int device, int subdevice,
+		    long open_time)
+{
+	struct pcmpool_entry *e = lhandle->pool;
+
+	if (e == NULL)
+		return;
+	e->card_number = lhandle->card_number;
+	e->pcm_device = device;
+	e->pcm_subdevice = subdevice;
+	snprintf(e->ident, sizeof(e->ident), "%s", lhandle->ident);
+	e->open_time = open_time;
+	e->params = 0;
+}
+
+static int pcmpool_params_match(struct pcmpool_entry *e,
+				struct loopback_handle *lhandle,
+				snd_pcm_uframes_t bufsize)
+{
+	return e->access == lhandle->access &&
+	       e->format == lhandle->format &&
+	       e->channels == lhandle->channels &&
+	       e->rate_req == lhandle->rate_req &&
+	       e->resample == lhandle->resample &&
+	       e->buffer_size_req == lhandle->buffer_size_req &&
+	       e->period_size_req == lhandle->period_size_req &&
+	       e->bufsize == bufsize;
+}
+
+/*
+ * Returns 1 when the hw params the stream needs are still applied to the
+ * reused handle, the negotiated values are restored then. Only the sw
+ * params are left to the caller.
+ */
+int pcmpool_params(struct loopback_handle *lhandle, snd_pcm_uframes_t bufsize)
+{
+	struct pcmpool_entry *e = lhandle->pool;
+
+	if (e == NULL || !e->params)
+		return 0;
+	if (!pcmpool_params_match(e, lhandle, bufsize)) {
+		e->params = 0;
+		return 0;
+	}
+	lhandle->rate = e->rate;
+	lhandle->pitch = e->pitch;
+	lhandle->buffer_size = e->buffer_size;
+	lhandle->period_size = e->period_size;
+	pthread_mutex_lock(&pool_mutex);
+	pool_stats.params_hits++;
+	pool_stats.saved_time += e->params_time;
+	pthread_mutex_unlock(&pool_mutex);
+	return 1;
+}
+
+void pcmpool_params_store(struct loopback_handle *lhandle,
+			  snd_pcm_uframes_t bufsize, long params_time)
+{
+	struct pcmpool_entry *e = lhandle->pool;
+
+	if (e == NULL)
+		return;
+	e->access = lhandle->access;
+	e->format = lhandle->format;
+	e->channels = lhandle->channels;
+	e->rate_req = lhandle->rate_req;
+	e->resample = lhandle->resample;
+	e->buffer_size_req = lhandle->buffer_size_req;
+	e->period_size_req = lhandle->period_size_req;
+	e->bufsize = bufsize;
+	e->rate = lhandle->rate;
+	e->pitch = lhandle->pitch;
+	e->buffer_size = lhandle->buffer_size;
+	e->period_size = lhandle->period_size;
+	e->params_time = params_time;
+	e->params = 1;
+}
+
+/*
+ * Called instead of snd_pcm_hw_free() when a stream stops. Returns 1 when
+ * the hw params are kept for the pool, the record forgets them otherwise.
+ */
+int pcmpool_keep_params(struct loopback_handle *lhandle)
+{
+	struct pcmpool_entry *e = lhandle->pool;
+	int keep;
+
+	if (e == NULL)
+		return 0;
+	pthread_mutex_lock(&pool_mutex);
+	keep = pool_keep_params && pool_ttl > 0;
+	pthread_mutex_unlock(&pool_mutex);
+	if (!keep)
+		e->params = 0;
+	return keep && e->params;
+}
+
+/*
+ * Give the device of lhandle back to the pool. Returns 0 when the pool
+ * took the handle and the ctl, a negative error when the caller has to
+ * close them. The record is released in both cases.
+ */
+int pcmpool_put(struct loopback_handle *lhandle)
+{
+	struct pcmpool_entry *e = lhandle->pool;
+	pthread_t thread;
+	pthread_attr_t attr;
+	snd_pcm_state_t state;
+	int err = 0;
+
+	lhandle->pool = NULL;
+	if (e == NULL)
+		return -ENOENT;
+	if (lhandle->handle == NULL) {
+		pcmpool_free(e);
+		return -ENOENT;
+	}
+	state = snd_pcm_state(lhandle->handle);
+	if (state == SND_PCM_STATE_DISCONNECTED) {
+		pcmpool_free(e);
+		return -ENODEV;
+	}
+	snd_pcm_drop(lhandle->handle);
+	pthread_mutex_lock(&pool_mutex);
+	if (pool_ttl == 0) {
+		pthread_mutex_unlock(&pool_mutex);
+		pcmpool_free(e);
+		return -ENOENT;
+	}
+	if (!pool_keep_params)
+		e->params = 0;
+	pthread_mutex_unlock(&pool_mutex);
+	/* the next user finds the device prepared, or without hw params */
+	if (e->params && snd_pcm_prepare(lhandle->handle) < 0)
+		e->params = 0;
+	if (!e->params)
+		snd_pcm_hw_free(lhandle->handle);
+	e->handle = lhandle->handle;
+	e->ctl = lhandle->ctl;
+	lhandle->handle = NULL;
+	lhandle->ctl = NULL;
+	pthread_mutex_lock(&pool_mutex);
+	clock_gettime(CLOCK_MONOTONIC, &e->expire);
+	e->expire.tv_sec += pool_ttl / 1000;
+	e->expire.tv_nsec += (pool_ttl % 1000) * 1000000L;
+	if (e->expire.tv_nsec >= 1000000000L) {
+		e->expire.tv_sec++;
+		e->expire.tv_nsec -= 1000000000L;
+	}
+	e->next = pool_list;
+	pool_list = e;
+	pool_stats.pooled++;
+	if (!pool_reaper) {
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, pcmpool_reaper, NULL) == 0)
+			pool_reaper = 1;
+		else
+			err = -EAGAIN;
+		pthread_attr_destroy(&attr);
+	}
+	if (err < 0) {
+		/* nobody would close it at the TTL */
+		pool_list = e->next;
+		pool_stats.pooled--;
+		e->next = NULL;
+	}
+	pthread_cond_signal(&pool_cond);
+	pthread_mutex_unlock(&pool_mutex);
+	if (err < 0) {
+		lhandle->handle = e->handle;
+		lhandle->ctl = e->ctl;
+		e->handle = NULL;
+		e->ctl = NULL;
+		pcmpool_free(e);
+		return err;
+	}
+	if (verbose > 1)
+		logit(LOG_INFO, "Warm pool: keeping %s for %ums\n", e->device, pool_ttl);
+	return 0;
+}
+
+void pcmpool_get_stats(struct loopback_pool_stats *stats)
+{
+	pthread_mutex_lock(&pool_mutex);
+	*stats = pool_stats;
+	pthread_mutex_unlock(&pool_mutex);
+}
@@ -0,0 +1,251 @@
+/**
+ * @file route.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Loop cihazı ile gerçek cihaz arasında kanal yönlendirme
+ *        (upmix, downmix, kanal seçimi ve sıralaması) modülü.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <syslog.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+#include "kernels.h"
+
+/* frames converted at once, the float scratch buffers hold one block */
+#define ROUTE_BLOCK	256
+
+/* ALSA default channel positions */
+#define CH_FL	0
+#define CH_FR	1
+#define CH_RL	2
+#define CH_RR	3
+#define CH_FC	4
+#define CH_LFE	5
+#define CH_SL	6
+#define CH_SR	7
+
+/*
+ * Default matrix when no gains are given: mono goes to the front pair,
+ * stereo is spread to the rear, center and side speakers, surround is
+ * folded down to stereo and other shapes copy the common channels.
+ */
+static void route_default(float *coef, unsigned int ic, unsigned int oc)
+{
+	unsigned int o, i;
+	float sum;
+
+#define C(o, i)	coef[(o) * ic + (i)]
+	memset(coef, 0, ic * oc * sizeof(float));
+	if (ic == oc) {
+		for (o = 0; o < oc; o++)
+			C(o, o) = 1.0f;
+	} else if (ic == 1) {
+		C(CH_FL, 0) = 1.0f;
+		C(CH_FR, 0) = 1.0f;
+	} else if (oc == 1) {
+		for (i = 0; i < ic; i++)
+			C(0, i) = 1.0f / ic;
+	} else if (ic == 2) {
+		C(CH_FL, 0) = 1.0f;
+		C(CH_FR, 1) = 1.0f;
+		if (oc > CH_RR) {
+			C(CH_RL, 0) = 1.0f;
+			C(CH_RR, 1) = 1.0f;
+		}
+		if (oc > CH_FC) {
+			C(CH_FC, 0) = 0.5f;
+			C(CH_FC, 1) = 0.5f;
+		}
+		if (oc > CH_SR) {
+			C(CH_SL, 0) = 1.0f;
+			C(CH_SR, 1) = 1.0f;
+		}
+	} else if (oc == 2) {
+		C(0, CH_FL) = 1.0f;
+		C(1, CH_FR) = 1.0f;
+		if (ic > CH_RR) {
+			C(0, CH_RL) = M_SQRT1_2;
+			C(1, CH_RR) = M_SQRT1_2;
+		}
+		if (ic > CH_FC) {
+			C(0, CH_FC) = M_SQRT1_2;
+			C(1, CH_FC) = M_SQRT1_2;
+		}
+		if (ic > CH_SR) {
+			C(0, CH_SL) = M_SQRT1_2;
+			C(1, CH_SR) = M_SQRT1_2;
+		}
+		/* keep the fold-down from clipping */
+		for (o = 0; o < 2; o++) {
+			for (i = 0, sum = 0; i < ic; i++)
+				sum += C(o, i);
+			for (i = 0; i < ic; i++)
+				C(o, i) /= sum;
+		}
+	} else {
+		for (o = 0; o < oc && o < ic; o++)
+			C(o, o) = 1.0f;
+	}
+#undef C
+}
+
+/* find out if the matrix only copies channels around */
+static void route_classify(struct loopback_route *route)
+{
+	unsigned int ic = route->in_channels, oc = route->out_channels;
+	unsigned int o, i;
+	float c;
+
+	route->reorder = 1;
+	for (o = 0; o < oc; o++) {
+		route->map[o] = -1;
+		for (i = 0; i < ic; i++) {
+			c = route->coef[o * ic + i];
+			if (c == 0.0f)
+				continue;
+			if (c != 1.0f || route->map[o] >= 0)
+				route->reorder = 0;
+			route->map[o] = i;
+		}
+	}
+	route->identity = route->reorder && ic == oc;
+	for (o = 0; route->identity && o < oc; o++)
+		if (route->map[o] != (int)o)
+			route->identity = 0;
+}
+
+void route_done(struct loopback_route *route)
+{
+	free(route->coef);
+	free(route->fin);
+	free(route->fout);
+	memset(route, 0, sizeof(*route));
+}
+
+int route_init(struct loopback_route *route, unsigned int in_channels,
+	       unsigned int out_channels, const float *coef)
+{
+	route_done(route);
+	if (in_channels < 1 || in_channels > MAX_ROUTE_CHANNELS ||
+	    out_channels < 1 || out_channels > MAX_ROUTE_CHANNELS)
+		return -EINVAL;
+	route->in_channels = in_channels;
+	route->out_channels = out_channels;
+	route->coef = (float *) malloc(in_channels * out_channels * sizeof(float));
+	if (route->coef == NULL)
+		return -ENOMEM;
+	if (coef)
+		memcpy(route->coef, coef, in_channels * out_channels * sizeof(float));
+	else
+		route_default(route->coef, in_channels, out_channels);
+	route_classify(route);
+	if (route->identity)
+		return 0;
+	route->kernel = kernel_route_select(in_channels, out_channels);
+	route->fin = (float *) malloc(ROUTE_BLOCK * in_channels * sizeof(float));
+	route->fout = (float *) malloc(ROUTE_BLOCK * out_channels * sizeof(float));
+	if (route->fin == NULL || route->fout == NULL) {
+		route_done(route);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void route_reorder(struct loopback_route *route, snd_pcm_format_t format,
+			  char *out, const char *in, snd_pcm_uframes_t frames)
+{
+	unsigned int width = snd_pcm_format_physical_width(format) / 8;
+	uint64_t silence = snd_pcm_format_silence_64(format);
+	unsigned int ic = route->in_channels, oc = route->out_channels;
+	snd_pcm_uframes_t f;
+	unsigned int o;
+
+	if (width == 2) {
+		kernel_reorder_16((uint16_t *)out, (const uint16_t *)in, frames,
+				  route->map, ic, oc, (uint16_t)silence);
+		return;
+	}
+	if (width == 4) {
+		kernel_reorder_32((uint32_t *)out, (const uint32_t *)in, frames,
+				  route->map, ic, oc, (uint32_t)silence);
+		return;
+	}
+	for (f = 0; f < frames; f++) {
+		for (o = 0; o < oc; o++) {
+			if (route->map[o] < 0)
+				memcpy(out + o * width, &silence, width);
+			else
+				memcpy(out + o * width, in + route->map[o] * width, width);
+		}
+		in += ic * width;
+		out += oc * width;
+	}
+}
+
+static void route_to_float(snd_pcm_format_t format, float *out,
+			   const char *in, unsigned int samples, float scale)
+{
+	if (format == SND_PCM_FORMAT_S32)
+		kernel_to_float_s32(out, (const int32_t *)in, samples, scale);
+	else
+		kernel_to_float_s16(out, (const int16_t *)in, samples, scale);
+}
+
+/*
+ * Route frames between two buffers in the same sample format. Reorders
+ * work on any format, a real matrix needs S16 or S32. A matrix multiplies
+ * the samples by scale too, reorders copy them unchanged.
+ */
+void route_frames(struct loopback_route *route, snd_pcm_format_t format,
+		  char *out, const char *in, snd_pcm_uframes_t frames,
+		  float scale)
+{
+	unsigned int ic = route->in_channels, oc = route->out_channels;
+	unsigned int width, count;
+
+	if (route->reorder) {
+		route_reorder(route, format, out, in, frames);
+		return;
+	}
+	width = snd_pcm_format_physical_width(format) / 8;
+	while (frames > 0) {
+		count = frames > ROUTE_BLOCK ? ROUTE_BLOCK : frames;
+		route_to_float(format, route->fin, in, count * ic, scale);
+		route->kernel(route->fout, route->fin, count, route->coef, ic, oc);
+		if (format == SND_PCM_FORMAT_S32)
+			kernel_store_s32((int32_t *)out, route->fout, count * oc, 1.0f);
+		else
+			kernel_store_s16((int16_t *)out, route->fout, count * oc, 1.0f);
+		in += count * ic * width;
+		out += count * oc * width;
+		frames -= count;
+	}
+}
+
+/* route S16 or S32 frames into a float buffer, samples are multiplied by scale */
+void route_frames_float(struct loopback_route *route, snd_pcm_format_t format,
+			float *out, const char *in, snd_pcm_uframes_t frames,
+			float scale)
+{
+	unsigned int ic = route->in_channels, oc = route->out_channels;
+	unsigned int width = snd_pcm_format_physical_width(format) / 8;
+	unsigned int count;
+
+	while (frames > 0) {
+		count = frames > ROUTE_BLOCK ? ROUTE_BLOCK : frames;
+		route_to_float(format, route->fin, in, count * ic, scale);
+		route->kernel(out, route->fin, count, route->coef, ic, oc);
+		in += count * ic * width;
+		out += count * oc;
+		frames -= count;
+	}
+}
@@ -0,0 +1,580 @@
+/**
+ * @file splitsrc.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Bir loop capture cihazının birden fazla gerçek cihaza aynı anda
+ *        yönlendirilmesini sağlayan split source modülü.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+/* device periods in the capture buffer of the source */
+#define SPLITSRC_PERIODS	4
+
+static pthread_mutex_t splitsrc_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct loopback_splitsrc *splitsrc_list = NULL;
+
+static inline snd_pcm_uframes_t splitout_fill(struct loopback_splitout *out)
+{
+	return __atomic_load_n(&out->src->hw_ptr, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&out->appl_ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline int splitout_get_state(struct loopback_splitout *out)
+{
+	return __atomic_load_n(&out->state, __ATOMIC_ACQUIRE);
+}
+
+static inline void splitout_set_state(struct loopback_splitout *out, int state)
+{
+	__atomic_store_n(&out->state, state, __ATOMIC_RELEASE);
+}
+
+static void splitout_wake(struct loopback_splitout *out)
+{
+	uint64_t one = 1;
+
+	/* EAGAIN means the counter is saturated, the loop wakes up anyway */
+	if (write(out->event_fd, &one, sizeof(one)) < 0 && verbose > 8)
+		logit(LOG_DEBUG, "split output wake failed: %s\n", strerror(errno));
+}
+
+static int splitsrc_setparams(struct loopback_splitsrc *src,
+			      unsigned int period_time)
+{
+	snd_pcm_t *handle = src->handle;
+	snd_pcm_hw_params_t *params;
+	snd_pcm_sw_params_t *swparams;
+	snd_pcm_uframes_t period, buffer;
+	unsigned int rate = src->rate;
+	int err;
+
+	snd_pcm_hw_params_alloca(&params);
+	snd_pcm_sw_params_alloca(&swparams);
+	err = snd_pcm_hw_params_any(handle, params);
+	if (err < 0) {
+		logit(LOG_CRIT, "Broken configuration for split source %s: %s\n", src->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+	if (err < 0) {
+		logit(LOG_CRIT, "Access type not available for split source %s: %s\n", src->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_set_format(handle, params, src->format);
+	if (err < 0) {
+		logit(LOG_CRIT, "Sample format not available for split source %s: %s\n", src->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_set_channels(handle, params, src->channels);
+	if (err < 0) {
+		logit(LOG_CRIT, "Channels count (%u) not available for split source %s: %s\n", src->channels, src->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_set_rate_near(handle, params, &rate, 0);
+	if (err < 0) {
+		logit(LOG_CRIT, "Rate %uHz not available for split source %s: %s\n", src->rate, src->device, snd_strerror(err));
+		return err;
+	}
+	src->rate = rate;
+	period = ((unsigned long long)period_time * rate) / 1000000ULL;
+	err = snd_pcm_hw_params_set_period_size_near(handle, params, &period, 0);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set period size %li for split source %s: %s\n", period, src->device, snd_strerror(err));
+		return err;
+	}
+	buffer = period * SPLITSRC_PERIODS;
+	err = snd_pcm_hw_params_set_buffer_size_near(handle, params, &buffer);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set buffer size %li for split source %s: %s\n", buffer, src->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params(handle, params);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set hw params for split source %s: %s\n", src->device, snd_strerror(err));
+		return err;
+	}
+	snd_pcm_hw_params_get_period_size(params, &src->period_size, NULL);
+	snd_pcm_hw_params_get_buffer_size(params, &src->buffer_size);
+	err = snd_pcm_sw_params_current(handle, swparams);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to determine current swparams for split source %s: %s\n", src->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_sw_params_set_start_threshold(handle, swparams, 0x7fffffff);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set start threshold for split source %s: %s\n", src->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_sw_params_set_avail_min(handle, swparams, src->period_size);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set avail min for split source %s: %s\n", src->device, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_sw_params(handle, swparams);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to set sw params for split source %s: %s\n", src->device, snd_strerror(err));
+		return err;
+	}
+	return 0;
+}
+
+static int splitsrc_restart(struct loopback_splitsrc *src)
+{
+	int err;
+
+	if ((err = snd_pcm_prepare(src->handle)) < 0)
+		return err;
+	return snd_pcm_start(src->handle);
+}
+
+/*
+ * The next count frames overwrite the ring at hw_ptr. Readers which have
+ * not consumed that part of their window yet lose it, they get an overrun
+ * instead of stalling the source.
+ */
+static void splitsrc_protect(struct loopback_splitsrc *src,
+			     snd_pcm_uframes_t count)
+{
+	struct loopback_splitout *out;
+	int i;
+
+	for (i = 0; i < src->outputs_count; i++) {
+		out = src->outputs[i];
+		if (splitout_get_state(out) != SND_PCM_STATE_RUNNING)
+			continue;
+		if (src->hw_ptr + count - out->appl_ptr > out->size) {
+			splitout_set_state(out, SND_PCM_STATE_XRUN);
+			out->overruns++;
+			splitout_wake(out);
+		}
+	}
+}
+
+static void splitsrc_notify(struct loopback_splitsrc *src)
+{
+	struct loopback_splitout *out;
+	int i;
+
+	for (i = 0; i < src->outputs_count; i++) {
+		out = src->outputs[i];
+		if (splitout_get_state(out) != SND_PCM_STATE_RUNNING)
+			continue;
+		if (splitout_fill(out) >=
+		    __atomic_load_n(&out->avail_min, __ATOMIC_RELAXED))
+			splitout_wake(out);
+	}
+}
+
+/* read everything the device has into the ring */
+static int splitsrc_read(struct loopback_splitsrc *src,
+			 snd_pcm_sframes_t avail)
+{
+	snd_pcm_uframes_t pos, count;
+	snd_pcm_sframes_t r;
+
+	pthread_mutex_lock(&src->lock);
+	while (avail > 0) {
+		pos = src->hw_ptr & (src->size - 1);
+		count = avail;
+		if (pos + count > src->size)
+			count = src->size - pos;
+		splitsrc_protect(src, count);
+		r = snd_pcm_readi(src->handle, src->buf + pos * src->frame_size,
+				  count);
+		if (r <= 0) {
+			pthread_mutex_unlock(&src->lock);
+			return r == -EAGAIN ? 0 : r;
+		}
+		__atomic_store_n(&src->hw_ptr, src->hw_ptr + r, __ATOMIC_RELEASE);
+		avail -= r;
+	}
+	splitsrc_notify(src);
+	pthread_mutex_unlock(&src->lock);
+	return 0;
+}
+
+static void *splitsrc_thread(void *_data)
+{
+	struct loopback_splitsrc *src = (struct loopback_splitsrc *) _data;
+	snd_pcm_sframes_t avail, delay;
+	unsigned short revents;
+	int err, timeout;
+
+	setScheduler(&src->sched, (src->period_size * 1000000000ULL) / src->rate);
+	/* wake up at least every two periods to notice the quit request */
+	timeout = (src->period_size * 2 * 1000) / src->rate + 1;
+	while (!__atomic_load_n(&src->quit, __ATOMIC_ACQUIRE)) {
+		snd_pcm_poll_descriptors(src->handle, src->pfds, src->pollfd_count);
+		err = poll(src->pfds, src->pollfd_count, timeout);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			logit(LOG_CRIT, "Split source %s poll failed: %s\n", src->device, strerror(errno));
+			break;
+		}
+		if (err > 0)
+			snd_pcm_poll_descriptors_revents(src->handle, src->pfds,
+							 src->pollfd_count, &revents);
+		avail = snd_pcm_avail_update(src->handle);
+		if (avail >= 0)
+			err = splitsrc_read(src, avail);
+		else
+			err = avail;
+		if (err == -EPIPE || err == -ESTRPIPE) {
+			src->xruns++;
+			if (verbose)
+				logit(LOG_DEBUG, "overrun for split source %s\n", src->device);
+			if ((err = splitsrc_restart(src)) < 0) {
+				logit(LOG_CRIT, "Split source %s restart failed: %s\n", src->device, snd_strerror(err));
+				break;
+			}
+			continue;
+		}
+		if (err < 0) {
+			logit(LOG_CRIT, "Split source %s read failed: %s\n", src->device, snd_strerror(err));
+			break;
+		}
+		if (snd_pcm_delay(src->handle, &delay) >= 0)
+			__atomic_store_n(&src->delay, delay, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void splitsrc_free(struct loopback_splitsrc *src)
+{
+	if (src->thread_running) {
+		__atomic_store_n(&src->quit, 1, __ATOMIC_RELEASE);
+		pthread_join(src->thread, NULL);
+	}
+	if (src->handle) {
+		snd_pcm_drop(src->handle);
+		snd_pcm_close(src->handle);
+	}
+	pthread_mutex_destroy(&src->lock);
+	free(src->pfds);
+	free(src->buf);
+	free(src->device);
+	free(src);
+}
+
+static int splitsrc_open(struct loopback_handle *lhandle,
+			 struct loopback_splitsrc **_src)
+{
+	struct loopback_splitsrc *src;
+	unsigned int period_time;
+	snd_pcm_uframes_t latency;
+	int err;
+
+	src = (struct loopback_splitsrc *) calloc(1, sizeof(*src));
+	if (src == NULL)
+		return -ENOMEM;
+	pthread_mutex_init(&src->lock, NULL);
+	src->sched = lhandle->loopback->sched;
+	src->device = strdup(lhandle->device);
+	if (src->device == NULL) {
+		err = -ENOMEM;
+		goto __error;
+	}
+	src->format = lhandle->format;
+	src->rate = lhandle->rate_req;
+	src->channels = lhandle->channels;
+	src->frame_size = (snd_pcm_format_physical_width(src->format) / 8) *
+				src->channels;
+	err = snd_pcm_open(&src->handle, src->device, SND_PCM_STREAM_CAPTURE,
+			   SND_PCM_NONBLOCK);
+	if (err < 0) {
+		logit(LOG_CRIT, "split source %s open error: %s\n", src->device, snd_strerror(err));
+		src->handle = NULL;
+		goto __error;
+	}
+	period_time = lhandle->loopback->latency_reqtime / 8;
+	if (period_time < 1000)
+		period_time = 1000;
+	if ((err = splitsrc_setparams(src, period_time)) < 0)
+		goto __error;
+	/* room for a whole loop latency per reader plus the device buffer */
+	latency = ((unsigned long long)lhandle->loopback->latency_reqtime *
+		   src->rate) / 1000000ULL;
+	src->size = 1;
+	while (src->size < latency * 4 || src->size < src->buffer_size * 2)
+		src->size <<= 1;
+	src->buf = (char *) calloc(1, src->size * src->frame_size);
+	err = snd_pcm_poll_descriptors_count(src->handle);
+	if (err <= 0) {
+		err = err < 0 ? err : -EIO;
+		goto __error;
+	}
+	src->pollfd_count = err;
+	src->pfds = (struct pollfd *) calloc(src->pollfd_count, sizeof(struct pollfd));
+	if (src->buf == NULL || src->pfds == NULL) {
+		err = -ENOMEM;
+		goto __error;
+	}
+	if ((err = splitsrc_restart(src)) < 0) {
+		logit(LOG_CRIT, "split source %s start error: %s\n", src->device, snd_strerror(err));
+		goto __error;
+	}
+	err = pthread_create(&src->thread, NULL, splitsrc_thread, src);
+	if (err != 0) {
+		err = -err;
+		goto __error;
+	}
+	src->thread_running = 1;
+	if (verbose)
+		logit(LOG_INFO, "Split source %s: %s, %uHz, %u channels, period %li, ring %li\n", src->device, snd_pcm_format_name(src->format), src->rate, src->channels, src->period_size, src->size);
+	*_src = src;
+	return 0;
+      __error:
+	splitsrc_free(src);
+	return err;
+}
+
+int splitsrc_attach(struct loopback_handle *lhandle)
+{
+	struct loopback_splitsrc *src;
+	struct loopback_splitout *out;
+	int err = 0;
+
+	out = (struct loopback_splitout *) calloc(1, sizeof(*out));
+	if (out == NULL)
+		return -ENOMEM;
+	out->lhandle = lhandle;
+	out->state = SND_PCM_STATE_OPEN;
+	out->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (out->event_fd < 0) {
+		free(out);
+		return -errno;
+	}
+	pthread_mutex_lock(&splitsrc_list_mutex);
+	for (src = splitsrc_list; src; src = src->next)
+		if (strcmp(src->device, lhandle->device) == 0)
+			break;
+	if (src == NULL) {
+		if ((err = splitsrc_open(lhandle, &src)) < 0)
+			goto __unlock;
+		src->next = splitsrc_list;
+		splitsrc_list = src;
+	}
+	pthread_mutex_lock(&src->lock);
+	if (src->outputs_count >= MAX_SPLITSRC_OUTPUTS) {
+		err = -EBUSY;
+	} else {
+		out->src = src;
+		src->outputs[src->outputs_count++] = out;
+	}
+	pthread_mutex_unlock(&src->lock);
+      __unlock:
+	pthread_mutex_unlock(&splitsrc_list_mutex);
+	if (err < 0) {
+		logit(LOG_CRIT, "%s: unable to attach to split source: %s\n", lhandle->id, snd_strerror(err));
+		close(out->event_fd);
+		free(out);
+		return err;
+	}
+	lhandle->splitout = out;
+	return 0;
+}
+
+void splitsrc_detach(struct loopback_handle *lhandle)
+{
+	struct loopback_splitout *out = lhandle->splitout;
+	struct loopback_splitsrc *src, **prev;
+	int i, last;
+
+	if (out == NULL)
+		return;
+	src = out->src;
+	pthread_mutex_lock(&splitsrc_list_mutex);
+	pthread_mutex_lock(&src->lock);
+	for (i = 0; i < src->outputs_count; i++) {
+		if (src->outputs[i] == out) {
+			src->outputs[i] = src->outputs[--src->outputs_count];
+			break;
+		}
+	}
+	last = src->outputs_count == 0;
+	pthread_mutex_unlock(&src->lock);
+	if (last) {
+		for (prev = &splitsrc_list; *prev; prev = &(*prev)->next) {
+			if (*prev == src) {
+				*prev = src->next;
+				break;
+			}
+		}
+		splitsrc_free(src);
+	}
+	pthread_mutex_unlock(&splitsrc_list_mutex);
+	if (verbose && out->overruns)
+		logit(LOG_INFO, "%s: %lu split source overruns, %llu frames lost\n", lhandle->id, out->overruns, out->over);
+	close(out->event_fd);
+	free(out);
+	lhandle->splitout = NULL;
+}
+
+int splitout_setup(struct loopback_splitout *out, snd_pcm_uframes_t size,
+		   snd_pcm_uframes_t avail_min)
+{
+	struct loopback_splitsrc *src = out->src;
+
+	if (size > src->size)
+		return -EINVAL;
+	pthread_mutex_lock(&src->lock);
+	splitout_set_state(out, SND_PCM_STATE_SETUP);
+	out->size = size;
+	out->avail_min = avail_min;
+	out->appl_ptr = src->hw_ptr;
+	pthread_mutex_unlock(&src->lock);
+	return 0;
+}
+
+int splitout_prepare(struct loopback_splitout *out)
+{
+	struct loopback_splitsrc *src = out->src;
+
+	pthread_mutex_lock(&src->lock);
+	if (out->size == 0) {
+		pthread_mutex_unlock(&src->lock);
+		return -EBADFD;
+	}
+	if (splitout_get_state(out) == SND_PCM_STATE_XRUN)
+		out->over += src->hw_ptr - out->appl_ptr;
+	splitout_set_state(out, SND_PCM_STATE_PREPARED);
+	out->appl_ptr = src->hw_ptr;
+	pthread_mutex_unlock(&src->lock);
+	return 0;
+}
+
+int splitout_start(struct loopback_splitout *out)
+{
+	struct loopback_splitsrc *src = out->src;
+	int err = 0;
+
+	pthread_mutex_lock(&src->lock);
+	if (splitout_get_state(out) == SND_PCM_STATE_PREPARED) {
+		/* capture starts now, older data in the ring is not ours */
+		out->appl_ptr = src->hw_ptr;
+		splitout_set_state(out, SND_PCM_STATE_RUNNING);
+	} else {
+		err = -EBADFD;
+	}
+	pthread_mutex_unlock(&src->lock);
+	return err;
+}
+
+int splitout_drop(struct loopback_splitout *out)
+{
+	pthread_mutex_lock(&out->src->lock);
+	splitout_set_state(out, SND_PCM_STATE_SETUP);
+	pthread_mutex_unlock(&out->src->lock);
+	return 0;
+}
+
+snd_pcm_state_t splitout_state(struct loopback_splitout *out)
+{
+	return (snd_pcm_state_t) splitout_get_state(out);
+}
+
+snd_pcm_sframes_t splitout_avail_update(struct loopback_splitout *out)
+{
+	switch (splitout_get_state(out)) {
+	case SND_PCM_STATE_RUNNING:
+		return splitout_fill(out);
+	case SND_PCM_STATE_XRUN:
+		return -EPIPE;
+	default:
+		return 0;
+	}
+}
+
+int splitout_delay(struct loopback_splitout *out, snd_pcm_sframes_t *delayp)
+{
+	int state = splitout_get_state(out);
+
+	if (state == SND_PCM_STATE_XRUN)
+		return -EPIPE;
+	if (state != SND_PCM_STATE_PREPARED && state != SND_PCM_STATE_RUNNING)
+		return -EBADFD;
+	*delayp = __atomic_load_n(&out->src->delay, __ATOMIC_ACQUIRE);
+	if (state == SND_PCM_STATE_RUNNING)
+		*delayp += splitout_fill(out);
+	return 0;
+}
+
+snd_pcm_sframes_t splitout_readi(struct loopback_splitout *out, void *buf,
+				 snd_pcm_uframes_t size)
+{
+	struct loopback_splitsrc *src = out->src;
+	unsigned int frame_size = src->frame_size;
+	snd_pcm_uframes_t fill, pos, count1;
+	int state = splitout_get_state(out);
+
+	if (state == SND_PCM_STATE_XRUN)
+		return -EPIPE;
+	if (state != SND_PCM_STATE_RUNNING)
+		return -EBADFD;
+	fill = splitout_fill(out);
+	if (size > fill)
+		size = fill;
+	if (size == 0)
+		return -EAGAIN;
+	pos = out->appl_ptr & (src->size - 1);
+	count1 = size;
+	if (pos + count1 > src->size)
+		count1 = src->size - pos;
+	memcpy(buf, src->buf + pos * frame_size, count1 * frame_size);
+	if (count1 < size)
+		memcpy((char *)buf + count1 * frame_size, src->buf,
+		       (size - count1) * frame_size);
+	/* the source marks us before it overwrites, so check after the copy */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (splitout_get_state(out) == SND_PCM_STATE_XRUN)
+		return -EPIPE;
+	__atomic_store_n(&out->appl_ptr, out->appl_ptr + size, __ATOMIC_RELEASE);
+	return size;
+}
+
+int splitout_poll_descriptors(struct loopback_splitout *out, struct pollfd *pfds,
+			      unsigned int space)
+{
+	if (space < 1)
+		return -EINVAL;
+	pfds[0].fd = out->event_fd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	return 1;
+}
+
+int splitout_poll_revents(struct loopback_splitout *out, struct pollfd *pfds,
+			  unsigned int nfds, unsigned short *revents)
+{
+	uint64_t val;
+
+	if (nfds < 1)
+		return -EINVAL;
+	*revents = 0;
+	if (pfds[0].revents & POLLIN) {
+		if (read(out->event_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+			return -errno;
+		*revents = POLLIN;
+	}
+	if (pfds[0].revents & (POLLERR | POLLNVAL))
+		*revents |= POLLERR;
+	return 0;
+}
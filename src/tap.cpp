@@ -0,0 +1,512 @@
+/**
+ * @file tap.cpp
+ * @author Oguzhan MUTLU (oguzhan.mutlu@daiichi.com)
+ * @brief Bir loop'un capture ya da playback tarafından geçen sesi çalışma
+ *        sırasında WAV/RF64 dosyalarına kaydeden modül. Loop thread'i
+ *        frame'leri önceden ayrılmış kilitsiz bir halkaya kopyalar, dosya
+ *        yazma işi ayrı bir thread'de yapılır.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+#include "alsaloop.h"
+
+/* ring between the loop thread and the writer, power of two */
+#define TAP_RING_DEFAULT	(4 * 1024 * 1024)
+/* the writer collects this much before a write() */
+#define TAP_WRITE_CHUNK		(1024 * 1024)
+/* writer wakeup interval, the loop thread never signals it */
+#define TAP_POLL_US		10000
+/* RIFF, JUNK/ds64, fmt and data chunk headers */
+#define TAP_HEADER_SIZE		80
+/* smallest data size of a rotated file */
+#define TAP_FILE_MIN		(64 * 1024)
+
+/* every block in the ring starts with this */
+struct tap_block {
+	uint32_t bytes;
+	uint32_t rate;
+	uint32_t channels;
+	int32_t format;
+};
+
+struct loopback_tap {
+	/* shared with the loop thread */
+	char *ring;
+	size_t size;
+	unsigned long head;		/* written bytes, loop thread */
+	unsigned long tail;		/* consumed bytes, writer thread */
+	unsigned long long ring_dropped; /* frames lost on a full ring */
+	unsigned long ring_drops;
+	int quit;
+	pthread_t thread;
+	/* writer thread */
+	char *path;
+	unsigned long long file_bytes;	/* data bytes per file, 0 = unlimited */
+	unsigned int files;		/* files in the rotation */
+	unsigned int file_index;
+	int fd;
+	unsigned long long data_bytes;	/* in the current file */
+	snd_pcm_format_t format;	/* of the current file */
+	unsigned int rate;
+	unsigned int channels;
+	char *wbuf;
+	size_t wcount;
+	unsigned int bad_format:1;	/* warned about a format */
+	struct loopback_tap_stats stats;	/* writer thread */
+	/* readers */
+	pthread_mutex_t lock;
+	struct loopback_tap_stats shown;	/* copy of stats, under lock */
+};
+
+/* start, stop and readers of lhandle->tap on the control side */
+static pthread_mutex_t tap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void put_le16(char *p, unsigned int v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_le32(char *p, unsigned long v)
+{
+	put_le16(p, v & 0xffff);
+	put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(char *p, unsigned long long v)
+{
+	put_le32(p, v & 0xffffffffUL);
+	put_le32(p + 4, v >> 32);
+}
+
+/* WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT, -1 = no plain WAV layout */
+static int wav_format_tag(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_U8:
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+	case SND_PCM_FORMAT_S32_LE:
+		return 1;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * The header keeps a JUNK chunk of the ds64 size, a file which grows
+ * past 4 GiB is turned into RF64 in place when it is closed.
+ */
+static void wav_header(struct loopback_tap *tap, char *h)
+{
+	unsigned int width = snd_pcm_format_physical_width(tap->format);
+	unsigned int align = tap->channels * width / 8;
+	unsigned long long riff = TAP_HEADER_SIZE - 8 + tap->data_bytes;
+	int rf64 = riff > 0xffffffffULL;
+
+	memset(h, 0, TAP_HEADER_SIZE);
+	memcpy(h, rf64 ? "RF64" : "RIFF", 4);
+	put_le32(h + 4, rf64 ? 0xffffffffUL : riff);
+	memcpy(h + 8, "WAVE", 4);
+	memcpy(h + 12, rf64 ? "ds64" : "JUNK", 4);
+	put_le32(h + 16, 28);
+	if (rf64) {
+		put_le64(h + 20, riff);
+		put_le64(h + 28, tap->data_bytes);
+		put_le64(h + 36, tap->data_bytes / align);
+	}
+	memcpy(h + 48, "fmt ", 4);
+	put_le32(h + 52, 16);
+	put_le16(h + 56, wav_format_tag(tap->format));
+	put_le16(h + 58, tap->channels);
+	put_le32(h + 60, tap->rate);
+	put_le32(h + 64, tap->rate * align);
+	put_le16(h + 68, align);
+	put_le16(h + 70, width);
+	memcpy(h + 72, "data", 4);
+	put_le32(h + 76, rf64 ? 0xffffffffUL : tap->data_bytes);
+}
+
+static void tap_flush(struct loopback_tap *tap)
+{
+	size_t pos = 0;
+	ssize_t r;
+
+	while (pos < tap->wcount) {
+		r = write(tap->fd, tap->wbuf + pos, tap->wcount - pos);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (tap->stats.write_errors++ == 0)
+				logit(LOG_WARNING, "Recording tap write to %s failed: %s\n", tap->path, strerror(errno));
+			break;
+		}
+		pos += r;
+	}
+	tap->wcount = 0;
+}
+
+static void tap_close_file(struct loopback_tap *tap)
+{
+	char h[TAP_HEADER_SIZE];
+
+	if (tap->fd < 0)
+		return;
+	tap_flush(tap);
+	wav_header(tap, h);
+	if (pwrite(tap->fd, h, sizeof(h), 0) != sizeof(h))
+		tap->stats.write_errors++;
+	close(tap->fd);
+	tap->fd = -1;
+}
+
+/* next file of the rotation for the parameters of blk */
+static int tap_open_file(struct loopback_tap *tap, const struct tap_block *blk)
+{
+	char name[PATH_MAX], h[TAP_HEADER_SIZE];
+
+	tap_close_file(tap);
+	tap->format = (snd_pcm_format_t) blk->format;
+	tap->rate = blk->rate;
+	tap->channels = blk->channels;
+	tap->data_bytes = 0;
+	if (wav_format_tag(tap->format) < 0) {
+		if (!tap->bad_format)
+			logit(LOG_WARNING, "Recording tap %s: %s samples cannot be stored as WAV, dropped\n", tap->path, snd_pcm_format_name(tap->format));
+		tap->bad_format = 1;
+		return -EINVAL;
+	}
+	if (tap->files > 1)
+		snprintf(name, sizeof(name), "%s.%u.wav", tap->path, tap->file_index % tap->files);
+	else
+		snprintf(name, sizeof(name), "%s.wav", tap->path);
+	tap->file_index++;
+	tap->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (tap->fd < 0) {
+		if (tap->stats.write_errors++ == 0)
+			logit(LOG_WARNING, "Unable to open recording tap file %s: %s\n", name, strerror(errno));
+		return -errno;
+	}
+	/* an empty but valid file until it is closed */
+	wav_header(tap, h);
+	if (write(tap->fd, h, sizeof(h)) != sizeof(h)) {
+		tap->stats.write_errors++;
+		close(tap->fd);
+		tap->fd = -1;
+		return -EIO;
+	}
+	tap->stats.files++;
+	return 0;
+}
+
+static void ring_put(struct loopback_tap *tap, unsigned long pos,
+		     const void *data, size_t bytes)
+{
+	size_t off = pos & (tap->size - 1), n = tap->size - off;
+
+	if (n > bytes)
+		n = bytes;
+	memcpy(tap->ring + off, data, n);
+	memcpy(tap->ring, (const char *)data + n, bytes - n);
+}
+
+static void ring_get(struct loopback_tap *tap, unsigned long pos,
+		     void *data, size_t bytes)
+{
+	size_t off = pos & (tap->size - 1), n = tap->size - off;
+
+	if (n > bytes)
+		n = bytes;
+	memcpy(data, tap->ring + off, n);
+	memcpy((char *)data + n, tap->ring, bytes - n);
+}
+
+/* copy bytes of the ring into the write buffer */
+static void tap_append(struct loopback_tap *tap, unsigned long pos, size_t bytes)
+{
+	size_t n;
+
+	while (bytes > 0) {
+		n = TAP_WRITE_CHUNK - tap->wcount;
+		if (n > bytes)
+			n = bytes;
+		ring_get(tap, pos, tap->wbuf + tap->wcount, n);
+		tap->wcount += n;
+		if (tap->wcount == TAP_WRITE_CHUNK)
+			tap_flush(tap);
+		pos += n;
+		bytes -= n;
+	}
+}
+
+/* store one block, a new file starts when the parameters change or the file is full */
+static void tap_block(struct loopback_tap *tap, const struct tap_block *blk,
+		      unsigned long pos)
+{
+	unsigned int frame = blk->channels *
+		snd_pcm_format_physical_width((snd_pcm_format_t) blk->format) / 8;
+	unsigned long long room;
+	size_t left = blk->bytes, n;
+
+	if (frame == 0)
+		return;
+	if (tap->fd < 0 || (int)tap->format != blk->format ||
+	    tap->rate != blk->rate || tap->channels != blk->channels) {
+		if (tap_open_file(tap, blk) < 0)
+			goto __drop;
+	}
+	while (left > 0) {
+		n = left;
+		if (tap->file_bytes) {
+			room = tap->file_bytes - tap->data_bytes;
+			room -= room % frame;
+			if (room == 0) {
+				if (tap_open_file(tap, blk) < 0)
+					goto __drop;
+				continue;
+			}
+			if (n > room)
+				n = room;
+		}
+		tap_append(tap, pos, n);
+		tap->data_bytes += n;
+		tap->stats.frames += n / frame;
+		tap->stats.bytes += n;
+		pos += n;
+		left -= n;
+	}
+	return;
+      __drop:
+	tap->stats.dropped += left / frame;
+}
+
+/* returns the number of blocks taken from the ring */
+static int tap_drain(struct loopback_tap *tap)
+{
+	unsigned long head = __atomic_load_n(&tap->head, __ATOMIC_ACQUIRE);
+	struct tap_block blk;
+	int count = 0;
+
+	while (tap->tail != head) {
+		ring_get(tap, tap->tail, &blk, sizeof(blk));
+		tap_block(tap, &blk, tap->tail + sizeof(blk));
+		__atomic_store_n(&tap->tail, tap->tail + sizeof(blk) + blk.bytes,
+				 __ATOMIC_RELEASE);
+		count++;
+	}
+	return count;
+}
+
+static void tap_publish(struct loopback_tap *tap)
+{
+	pthread_mutex_lock(&tap->lock);
+	tap->shown = tap->stats;
+	pthread_mutex_unlock(&tap->lock);
+}
+
+static void *tap_thread(void *arg)
+{
+	struct loopback_tap *tap = (struct loopback_tap *) arg;
+	int quit;
+
+	for (;;) {
+		quit = __atomic_load_n(&tap->quit, __ATOMIC_ACQUIRE);
+		if (tap_drain(tap) > 0) {
+			tap_publish(tap);
+			continue;
+		}
+		if (quit)
+			break;
+		/* idle, the data on disk should not lag behind much */
+		if (tap->wcount && tap->fd >= 0) {
+			tap_flush(tap);
+			tap_publish(tap);
+		}
+		usleep(TAP_POLL_US);
+	}
+	tap_close_file(tap);
+	tap_publish(tap);
+	return NULL;
+}
+
+/* writer counters plus the ones the loop thread keeps */
+static void tap_collect(struct loopback_tap *tap, struct loopback_tap_stats *stats)
+{
+	pthread_mutex_lock(&tap->lock);
+	*stats = tap->shown;
+	pthread_mutex_unlock(&tap->lock);
+	stats->dropped += __atomic_load_n(&tap->ring_dropped, __ATOMIC_RELAXED);
+	stats->drops = __atomic_load_n(&tap->ring_drops, __ATOMIC_RELAXED);
+}
+
+static void tap_free(struct loopback_tap *tap)
+{
+	free(tap->ring);
+	free(tap->wbuf);
+	free(tap->path);
+	pthread_mutex_destroy(&tap->lock);
+	free(tap);
+}
+
+/*
+ * Start recording the frames which pass lhandle into path.wav, or into
+ * path.0.wav ... path.<files - 1>.wav reused in turn when a file holds
+ * file_bytes of data. Runs on the control thread.
+ */
+int tap_start(struct loopback_handle *lhandle, const char *path,
+	      size_t ring_bytes, unsigned long long file_bytes,
+	      unsigned int files)
+{
+	struct loopback_tap *tap;
+	size_t size = TAP_RING_DEFAULT;
+	int err;
+
+	if (file_bytes && file_bytes < TAP_FILE_MIN)
+		file_bytes = TAP_FILE_MIN;
+	while (size < ring_bytes)
+		size *= 2;
+	pthread_mutex_lock(&tap_mutex);
+	if (__atomic_load_n(&lhandle->tap, __ATOMIC_ACQUIRE)) {
+		err = -EBUSY;
+		goto __unlock;
+	}
+	tap = (struct loopback_tap *) calloc(1, sizeof(*tap));
+	if (tap == NULL) {
+		err = -ENOMEM;
+		goto __unlock;
+	}
+	pthread_mutex_init(&tap->lock, NULL);
+	tap->size = size;
+	tap->fd = -1;
+	tap->file_bytes = file_bytes;
+	tap->files = files > 0 ? files : 1;
+	tap->path = strdup(path);
+	tap->ring = (char *) malloc(size);
+	if (posix_memalign((void **)&tap->wbuf, 4096, TAP_WRITE_CHUNK) != 0)
+		tap->wbuf = NULL;
+	if (tap->path == NULL || tap->ring == NULL || tap->wbuf == NULL) {
+		tap_free(tap);
+		err = -ENOMEM;
+		goto __unlock;
+	}
+	/* the loop thread must not fault the ring in */
+	memset(tap->ring, 0, size);
+	err = pthread_create(&tap->thread, NULL, tap_thread, tap);
+	if (err != 0) {
+		tap_free(tap);
+		err = -err;
+		goto __unlock;
+	}
+	__atomic_store_n(&lhandle->tap, tap, __ATOMIC_RELEASE);
+	if (verbose)
+		logit(LOG_INFO, "%s: recording into %s (ring %zu bytes)\n", lhandle->id, path, size);
+      __unlock:
+	pthread_mutex_unlock(&tap_mutex);
+	return err;
+}
+
+/*
+ * Detach the tap, wait until the loop thread has left it and let the
+ * writer store what is still queued. The counters stay with lhandle.
+ */
+int tap_stop(struct loopback_handle *lhandle)
+{
+	struct loopback_tap *tap;
+
+	pthread_mutex_lock(&tap_mutex);
+	tap = __atomic_exchange_n(&lhandle->tap, (struct loopback_tap *)NULL,
+				  __ATOMIC_SEQ_CST);
+	if (tap == NULL) {
+		pthread_mutex_unlock(&tap_mutex);
+		return -ENOENT;
+	}
+	/* the flag is in lhandle, it is still there while the loop thread checks it */
+	while (__atomic_load_n(&lhandle->tap_busy, __ATOMIC_SEQ_CST))
+		sched_yield();
+	__atomic_store_n(&tap->quit, 1, __ATOMIC_RELEASE);
+	pthread_join(tap->thread, NULL);
+	tap_collect(tap, &lhandle->tap_stats);
+	if (verbose)
+		logit(LOG_INFO, "%s: recording stopped, %llu frames, %llu dropped\n", lhandle->id, lhandle->tap_stats.frames, lhandle->tap_stats.dropped);
+	tap_free(tap);
+	pthread_mutex_unlock(&tap_mutex);
+	return 0;
+}
+
+/*
+ * Loop thread: queue frames of the ring for the writer. Nothing blocks,
+ * when the ring is full the frames are counted and lost.
+ */
+void tap_write(struct loopback_handle *lhandle, const char *buf,
+	       snd_pcm_uframes_t frames)
+{
+	struct loopback_tap *tap;
+	struct tap_block blk;
+	unsigned long head, tail;
+	size_t bytes = frames * lhandle->frame_size;
+
+	if (__atomic_load_n(&lhandle->tap, __ATOMIC_RELAXED) == NULL || frames == 0)
+		return;
+	/*
+	 * Announce the use before taking the pointer. tap_stop() detaches
+	 * first and then waits for the flag, so a tap seen here is not freed.
+	 */
+	__atomic_store_n(&lhandle->tap_busy, 1, __ATOMIC_SEQ_CST);
+	tap = __atomic_load_n(&lhandle->tap, __ATOMIC_SEQ_CST);
+	if (tap == NULL)
+		goto __out;
+	head = tap->head;
+	tail = __atomic_load_n(&tap->tail, __ATOMIC_ACQUIRE);
+	if (sizeof(blk) + bytes > tap->size - (head - tail)) {
+		__atomic_fetch_add(&tap->ring_dropped, frames, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&tap->ring_drops, 1, __ATOMIC_RELAXED);
+		goto __out;
+	}
+	blk.bytes = bytes;
+	blk.rate = lhandle->rate;
+	blk.channels = lhandle->channels;
+	blk.format = lhandle->format;
+	ring_put(tap, head, &blk, sizeof(blk));
+	ring_put(tap, head + sizeof(blk), buf, bytes);
+	__atomic_store_n(&tap->head, head + sizeof(blk) + bytes, __ATOMIC_RELEASE);
+      __out:
+	__atomic_store_n(&lhandle->tap_busy, 0, __ATOMIC_RELEASE);
+}
+
+/* counters of the running tap, of the last one when none runs */
+int tap_get_stats(struct loopback_handle *lhandle, struct loopback_tap_stats *stats)
+{
+	struct loopback_tap *tap;
+	int running = 0;
+
+	/* tap_stop() cannot free the tap while this is held */
+	pthread_mutex_lock(&tap_mutex);
+	tap = __atomic_load_n(&lhandle->tap, __ATOMIC_ACQUIRE);
+	if (tap == NULL) {
+		*stats = lhandle->tap_stats;
+	} else {
+		tap_collect(tap, stats);
+		running = 1;
+	}
+	pthread_mutex_unlock(&tap_mutex);
+	return running;
+}
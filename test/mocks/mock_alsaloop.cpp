@@ -37,10 +37,6 @@ void signalHandlerIgnore(int sig)
 {
     mock().actualCall("signalHandlerIgnore");
 }
-void AlsaLoop::sendToAll(int sig)
-{
-    mock().actualCall("sendToAll").withIntParameter("sig", sig);
-}
 int AlsaLoop::sortThreads(snd_output_t * output)
 {
     return mock().actualCall("sortThreads").returnIntValueOrDefault(1);
@@ -51,6 +47,8 @@ void AlsaLoop::threadJob(struct loopbackThread *thread)
 }
 bool AlsaLoop::initConnection(char * realDev, char * loopDev, snd_output_t *output)
 {
+    //Testler bağlantıya giden ayarları buradan okur.
+    mock().setDataObject("initConnection", "AlsaLoop", this);
     return mock().actualCall("initConnection").returnBoolValueOrDefault(true);
 }
 void AlsaLoop::setQuit()
@@ -73,6 +71,63 @@ void AlsaLoop::runThreads()
 {
     mock().actualCall("runThreads");
 }
+int AlsaLoop::postCommand(loop_cmd_type_t type, double value)
+{
+    return mock().actualCall("postCommand").withIntParameter("type", type).withDoubleParameter("value", value).returnIntValueOrDefault(0);
+}
+void AlsaLoop::openGate()
+{
+    mock().actualCall("openGate");
+}
+int AlsaLoop::waitOpened(int timeout)
+{
+    return mock().actualCall("waitOpened").returnIntValueOrDefault(0);
+}
+int AlsaLoop::waitReady(int timeout)
+{
+    return mock().actualCall("waitReady").returnIntValueOrDefault(0);
+}
+size_t AlsaLoop::memoryFootprint()
+{
+    return mock().actualCall("memoryFootprint").returnUnsignedLongIntValueOrDefault(0);
+}
+void AlsaLoop::configPool(unsigned int ttl_ms, int keep_params)
+{
+    mock().actualCall("configPool").withUnsignedIntParameter("ttl_ms", ttl_ms).withIntParameter("keep_params", keep_params);
+}
+void AlsaLoop::poolStats(struct loopback_pool_stats *stats)
+{
+    mock().actualCall("poolStats").withOutputParameter("stats", stats);
+}
+void AlsaLoop::parkStats(struct loopback_park_stats *stats)
+{
+    mock().actualCall("parkStats").withOutputParameter("stats", stats);
+}
+void AlsaLoop::busyStats(struct loopback_busy_stats *stats)
+{
+    mock().actualCall("busyStats").withOutputParameter("stats", stats);
+}
+void AlsaLoop::silenceStats(struct loopback_silence_stats *stats)
+{
+    mock().actualCall("silenceStats").withOutputParameter("stats", stats);
+}
+int AlsaLoop::startTap(snd_pcm_stream_t stream, const char *path,
+                       unsigned long long fileBytes, unsigned int files)
+{
+    return mock().actualCall("startTap").withIntParameter("stream", stream).withStringParameter("path", path).returnIntValueOrDefault(0);
+}
+int AlsaLoop::stopTap(snd_pcm_stream_t stream)
+{
+    return mock().actualCall("stopTap").withIntParameter("stream", stream).returnIntValueOrDefault(0);
+}
+bool AlsaLoop::tapStats(snd_pcm_stream_t stream, struct loopback_tap_stats *stats)
+{
+    return mock().actualCall("tapStats").withIntParameter("stream", stream).withOutputParameter("stats", stats).returnBoolValueOrDefault(false);
+}
+bool AlsaLoop::dspStats(int index, struct loopback_dsp_stats *stats)
+{
+    return mock().actualCall("dspStats").withIntParameter("index", index).withOutputParameter("stats", stats).returnBoolValueOrDefault(false);
+}
 
 int snd_output_stdio_attach(snd_output_t **outputp, FILE *fp, int _close)
 {
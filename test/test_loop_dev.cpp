@@ -15,8 +15,10 @@
 #include "CppUTest/MemoryLeakDetectorMallocMacros.h"
 
 #include "loop_dev.h"
+#include "kernels.h"
 
 #include <exception>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <vector>
@@ -80,7 +82,6 @@ TEST(loopDevTest, ConnectAndDisconnectDevice)
     mock().expectOneCall("runThreads");
 
     mock().expectOneCall("setQuit");
-    mock().expectOneCall("sendToAll").withIntParameter("sig", 12);
     mock().expectOneCall("joinFromThreads");
     mock().expectOneCall("freeThreads");
 
@@ -128,7 +129,6 @@ TEST(loopDevTest, TryConnectToAlreadyConnectedRealDev)
     mock().expectOneCall("runThreads");
 
     mock().expectOneCall("setQuit");
-    mock().expectOneCall("sendToAll").withIntParameter("sig", 12);
     mock().expectOneCall("joinFromThreads");
     mock().expectOneCall("freeThreads");
 
@@ -162,7 +162,6 @@ TEST(loopDevTest, TryConnectingAnotherRealDevFromTheSameLoopDev)
     mock().expectOneCall("runThreads");
 
     mock().expectOneCall("setQuit");
-    mock().expectOneCall("sendToAll").withIntParameter("sig", 12);
     mock().expectOneCall("joinFromThreads");
     mock().expectOneCall("freeThreads");
 
@@ -187,7 +186,6 @@ TEST(loopDevTest, GetDevNames)
     mock().expectOneCall("runThreads");
 
     mock().expectOneCall("setQuit");
-    mock().expectOneCall("sendToAll").withIntParameter("sig", 12);
     mock().expectOneCall("joinFromThreads");
     mock().expectOneCall("freeThreads");
 
@@ -265,4 +263,1100 @@ TEST(loopDevTest, TryConnectInitError)
     ret = testLoop.connect("hw:2,0");
 
     CHECK_EQUAL(-1, ret); 
-}
\ No newline at end of file
+}
+TEST(loopDevTest, ConnectTwoLoopDevicesMixed)
+{
+    int ret = 0;
+
+    mock().expectNCalls(2, "clearQuit");
+    mock().expectNCalls(2, "snd_output_stdio_attach").andReturnValue(0);
+    mock().expectNCalls(2, "initConnection").andReturnValue(true);
+    mock().expectNCalls(2, "sortThreads");
+    mock().expectNCalls(2, "runThreads");
+
+    mock().expectNCalls(2, "setQuit");
+    mock().expectNCalls(2, "joinFromThreads");
+    mock().expectNCalls(2, "freeThreads");
+
+    LoopDev testLoop;
+    LoopDev testLoop2;
+
+    ret = testLoop.connectMixed("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop2.connectMixed("hw:2,0", 0.5f);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.isRealConnected("hw:2,0");
+    CHECK_EQUAL(true, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.isRealConnected("hw:2,0");
+    CHECK_EQUAL(true, ret);
+
+    ret = testLoop2.disconnect();
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.isRealConnected("hw:2,0");
+    CHECK_EQUAL(false, ret);
+}
+
+TEST(loopDevTest, TryConnectExclusiveToMixedRealDev)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+    LoopDev testLoop2;
+
+    ret = testLoop.connectMixed("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop2.connect("hw:2,0");
+    CHECK_EQUAL(1, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, TryConnectMixedToExclusiveRealDev)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+    LoopDev testLoop2;
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop2.connectMixed("hw:2,0");
+    CHECK_EQUAL(1, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, ConnectToMultipleRealDevs)
+{
+    int ret = 0;
+    std::string tmp;
+    std::vector<std::string> devs = {"hw:2,0", "hw:3,0"};
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectNCalls(2, "initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.connect(devs);
+    CHECK_EQUAL(0, ret);
+
+    AlsaLoop *alsaLoop = (AlsaLoop *)mock().getData("initConnection").getObjectPointer();
+    CHECK_EQUAL(2, alsaLoop->arg_default_loops);
+
+    ret = testLoop.isRealConnected("hw:2,0");
+    CHECK_EQUAL(true, ret);
+
+    ret = testLoop.isRealConnected("hw:3,0");
+    CHECK_EQUAL(true, ret);
+
+    ret = testLoop.getRealDevName(tmp);
+    CHECK_EQUAL(true, ret);
+    CHECK_EQUAL("hw:2,0", tmp);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.isRealConnected("hw:2,0");
+    CHECK_EQUAL(false, ret);
+
+    ret = testLoop.isRealConnected("hw:3,0");
+    CHECK_EQUAL(false, ret);
+}
+
+TEST(loopDevTest, ConnectDuplicateRealDev)
+{
+    int ret = 0;
+    std::vector<std::string> devs = {"hw:2,0", "hw:3,0", "hw:2,0"};
+
+    LoopDev testLoop;
+
+    ret = testLoop.connect(devs);
+    CHECK_EQUAL(1, ret);
+
+    ret = testLoop.isRealConnected("hw:2,0");
+    CHECK_EQUAL(false, ret);
+}
+
+TEST(loopDevTest, TryConnectMultipleWithBusyRealDev)
+{
+    int ret = 0;
+    std::vector<std::string> devs = {"hw:3,0", "hw:2,0"};
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+    LoopDev testLoop2;
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop2.connect(devs);
+    CHECK_EQUAL(1, ret);
+
+    ret = testLoop2.isRealConnected("hw:3,0");
+    CHECK_EQUAL(false, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, TryConnectMultipleInitError)
+{
+    int ret = 0;
+    std::vector<std::string> devs = {"hw:2,0", "hw:3,0"};
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("initConnection").andReturnValue(false);
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.connect(devs);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.isLoopConnected();
+    CHECK_EQUAL(false, ret);
+}
+
+TEST(loopDevTest, SetRoutingAndConnect)
+{
+    int ret = 0;
+    std::vector<float> matrix = {1, 0,
+                                 0, 1,
+                                 1, 0,
+                                 0, 1,
+                                 0.5, 0.5,
+                                 0, 0};
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.setRouting(2, 6, matrix);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.setRouting(2, 8);
+    CHECK_EQUAL(2, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, TrySetRoutingWithInvalidMatrix)
+{
+    int ret = 0;
+    std::vector<float> matrix = {1, 0, 0, 1};
+
+    LoopDev testLoop;
+
+    ret = testLoop.setRouting(2, 6, matrix);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setRouting(0, 2);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setRouting(8, 2);
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, RouteKernelWideLayout)
+{
+    const unsigned int outs[] = {2, 16, 18, 32};
+    float in[2 * 2] = {1, 2, 3, 4};
+    float coef[32 * 2];
+    float out[2 * 32];
+    unsigned int i, o, f, n;
+
+    for (n = 0; n < sizeof(outs) / sizeof(outs[0]); n++) {
+        for (i = 0; i < 2 * outs[n]; i++)
+            coef[i] = (float)(i + 1);
+        kernel_route_t route = kernel_route_select(2, outs[n]);
+        route(out, in, 2, coef, 2, outs[n]);
+        for (f = 0; f < 2; f++)
+            for (o = 0; o < outs[n]; o++)
+                CHECK_EQUAL(in[f * 2] * coef[o * 2] + in[f * 2 + 1] * coef[o * 2 + 1],
+                            out[f * outs[n] + o]);
+    }
+
+    /* 1 to 18 used to share the 2 to 2 key */
+    for (i = 0; i < 18; i++)
+        coef[i] = (float)(i + 1);
+    kernel_route_select(1, 18)(out, in, 2, coef, 1, 18);
+    for (f = 0; f < 2; f++)
+        for (o = 0; o < 18; o++)
+            CHECK_EQUAL(in[f] * coef[o], out[f * 18 + o]);
+}
+
+TEST(loopDevTest, ConvertKernelMatchesGeneric)
+{
+    const unsigned int chans[] = {1, 2, 4, 6, 8};
+    const unsigned int frames = 13;
+    const unsigned int width[KERNEL_FORMAT_COUNT] = {2, 4, 4};
+    int16_t in16[8 * 13];
+    int32_t in32[8 * 13];
+    float inf[8 * 13];
+    const void *in[KERNEL_FORMAT_COUNT] = {in16, in32, inf};
+    int32_t out[8 * 13], ref[8 * 13];
+    unsigned int i, n;
+    int fi, fo;
+
+    for (i = 0; i < 8 * frames; i++) {
+        in16[i] = (int16_t)(i * 2731 - 32768);
+        in32[i] = (int32_t)(i * 178956970u - 2147483648u);
+        inf[i] = (float)i / (4 * frames) - 1.2f;
+    }
+    in16[0] = 32767;
+    in32[0] = 2147483647;
+
+    /* 3 channels take the generic kernel */
+    for (fi = 0; fi < KERNEL_FORMAT_COUNT; fi++) {
+        for (fo = 0; fo < KERNEL_FORMAT_COUNT; fo++) {
+            kernel_convert_t generic = kernel_convert_select(fi, fo, 3);
+            CHECK(generic != NULL);
+            for (n = 0; n < sizeof(chans) / sizeof(chans[0]); n++) {
+                kernel_convert_t cvt = kernel_convert_select(fi, fo, chans[n]);
+                CHECK(cvt != NULL);
+                memset(out, 0x55, sizeof(out));
+                memset(ref, 0x55, sizeof(ref));
+                cvt(out, in[fi], frames, chans[n]);
+                generic(ref, in[fi], frames, chans[n]);
+                MEMCMP_EQUAL(ref, out, frames * chans[n] * width[fo]);
+            }
+        }
+    }
+    CHECK(kernel_convert_select(KERNEL_FORMAT_COUNT, 0, 2) == NULL);
+}
+
+TEST(loopDevTest, StoreKernelSaturates)
+{
+    const float acc[9] = {0.0f, 100.4f, -100.6f, 32767.0f, -32768.0f,
+                          40000.0f, -40000.0f, 1e12f, -1e12f};
+    const int16_t exp16[9] = {0, 100, -101, 32767, -32768,
+                              32767, -32768, 32767, -32768};
+    int16_t out16[9];
+    int32_t out32[9];
+    unsigned int i;
+
+    kernel_store_s16(out16, acc, 9, 1.0f);
+    for (i = 0; i < 9; i++)
+        CHECK_EQUAL(exp16[i], out16[i]);
+
+    /* the scale is applied before the clamp */
+    kernel_store_s16(out16, acc, 9, 2.0f);
+    CHECK_EQUAL(201, out16[1]);
+    CHECK_EQUAL(32767, out16[3]);
+    CHECK_EQUAL(-32768, out16[4]);
+
+    kernel_store_s32(out32, acc, 9, 1.0f);
+    CHECK_EQUAL(100, out32[1]);
+    CHECK_EQUAL(-101, out32[2]);
+    CHECK_EQUAL(40000, out32[5]);
+    CHECK(out32[7] >= 2147483520);
+    CHECK_EQUAL(INT32_MIN, out32[8]);
+
+    kernel_store_s32(out32, acc, 9, 1e6f);
+    CHECK(out32[5] >= 2147483520);
+    CHECK_EQUAL(INT32_MIN, out32[6]);
+}
+
+TEST(loopDevTest, MixKernelSaturatesOnStore)
+{
+    int16_t in16[9], out16[9];
+    int32_t in32[9], out32[9];
+    float acc[9];
+    unsigned int i;
+
+    for (i = 0; i < 9; i++) {
+        in16[i] = (i & 1) ? -30000 : 30000;
+        in32[i] = (i & 1) ? -2000000000 : 2000000000;
+    }
+
+    memset(acc, 0, sizeof(acc));
+    kernel_mix_s16(acc, in16, 9, 1.0f);
+    kernel_mix_s16(acc, in16, 9, 0.5f);
+    CHECK_EQUAL(45000.0f, acc[0]);
+    kernel_store_s16(out16, acc, 9, 1.0f);
+    for (i = 0; i < 9; i++)
+        CHECK_EQUAL((i & 1) ? -32768 : 32767, out16[i]);
+
+    memset(acc, 0, sizeof(acc));
+    kernel_mix_s32(acc, in32, 9, 1.0f);
+    kernel_mix_s32(acc, in32, 9, 1.0f);
+    kernel_store_s32(out32, acc, 9, 1.0f);
+    for (i = 0; i < 9; i++) {
+        if (i & 1)
+            CHECK_EQUAL(INT32_MIN, out32[i]);
+        else
+            CHECK(out32[i] >= 2147483520);
+    }
+}
+
+TEST(loopDevTest, GainKernelSaturates)
+{
+    int16_t buf16[18];
+    int32_t buf32[9];
+    float buff[4] = {0.5f, -0.5f, 2.0f, -2.0f};
+    unsigned int i;
+
+    for (i = 0; i < 18; i++)
+        buf16[i] = (i & 1) ? -10000 : 10000;
+    kernel_gain_s16(buf16, 9, 2, 4.0f, 0.0f);
+    for (i = 0; i < 18; i++)
+        CHECK_EQUAL((i & 1) ? -32768 : 32767, buf16[i]);
+
+    /* ramp, one gain per frame */
+    for (i = 0; i < 18; i++)
+        buf16[i] = 10000;
+    kernel_gain_s16(buf16, 9, 2, 1.0f, 1.0f);
+    CHECK_EQUAL(10000, buf16[0]);
+    CHECK_EQUAL(10000, buf16[1]);
+    CHECK_EQUAL(20000, buf16[2]);
+    CHECK_EQUAL(30000, buf16[4]);
+    CHECK_EQUAL(32767, buf16[17]);
+
+    for (i = 0; i < 9; i++)
+        buf32[i] = (i & 1) ? -1500000000 : 1500000000;
+    kernel_gain_s32(buf32, 9, 1, 2.0f, 0.0f);
+    for (i = 0; i < 9; i++) {
+        if (i & 1)
+            CHECK_EQUAL(INT32_MIN, buf32[i]);
+        else
+            CHECK(buf32[i] >= 2147483520);
+    }
+
+    /* float samples are not clamped, the converter does it */
+    kernel_gain_float(buff, 2, 2, 2.0f, 0.0f);
+    CHECK_EQUAL(1.0f, buff[0]);
+    CHECK_EQUAL(-4.0f, buff[3]);
+}
+
+TEST(loopDevTest, IsZeroKernel)
+{
+    const unsigned int hits[] = {0, 7, 63, 64, 100, 128, 199};
+    uint64_t mem[26];
+    char *buf = (char *)mem + 1;
+    unsigned int n;
+
+    memset(mem, 0, sizeof(mem));
+    CHECK_EQUAL(1, kernel_is_zero(buf, 0));
+    CHECK_EQUAL(1, kernel_is_zero(buf, 200));
+    CHECK_EQUAL(1, kernel_is_zero(mem, sizeof(mem)));
+
+    /* unaligned start, every position of the block and the tail */
+    for (n = 0; n < sizeof(hits) / sizeof(hits[0]); n++) {
+        buf[hits[n]] = 1;
+        CHECK_EQUAL(0, kernel_is_zero(buf, 200));
+        CHECK_EQUAL(1, kernel_is_zero(buf + hits[n] + 1, 200 - hits[n] - 1));
+        buf[hits[n]] = 0;
+    }
+}
+
+TEST(loopDevTest, SetSchedulingAndConnect)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.setScheduling(SCHED_FIFO, 80, 0x3, true);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.setScheduling(SCHED_OTHER, 0);
+    CHECK_EQUAL(2, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, TrySetSchedulingWithInvalidPolicy)
+{
+    int ret = 0;
+
+    LoopDev testLoop;
+
+    ret = testLoop.setScheduling(42, 0);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setScheduling(SCHED_RR, 100);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setScheduling(SCHED_OTHER, 10);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setScheduling(SCHED_DEADLINE, 0, 0x3);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setScheduling(SCHED_DEADLINE, 0);
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, SetBusyPollAndGetStats)
+{
+    int ret = 0;
+    struct loopback_busy_stats stats;
+    struct loopback_busy_stats busyStats;
+
+    memset(&busyStats, 0, sizeof(busyStats));
+    busyStats.spin_time = 2000;
+    busyStats.wall_time = 100000;
+    busyStats.misses = 3;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+    mock().expectOneCall("busyStats").withOutputParameterReturning("stats", &busyStats, sizeof(busyStats));
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    CHECK_FALSE(testLoop.getBusyPollStats(stats));
+
+    ret = testLoop.setBusyPoll(100000);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setBusyPoll(300, 150);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    AlsaLoop *alsaLoop = (AlsaLoop *)mock().getData("initConnection").getObjectPointer();
+    CHECK_EQUAL(300, alsaLoop->arg_default_busy_spin);
+    CHECK_EQUAL(150, alsaLoop->arg_default_busy_lead);
+
+    ret = testLoop.setBusyPoll(0);
+    CHECK_EQUAL(2, ret);
+
+    CHECK_TRUE(testLoop.getBusyPollStats(stats));
+    CHECK_EQUAL(2000, stats.spin_time);
+    CHECK_EQUAL(3, stats.misses);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, SetTimerWakeupAndConnect)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.setTimerWakeup(true);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    AlsaLoop *alsaLoop = (AlsaLoop *)mock().getData("initConnection").getObjectPointer();
+    CHECK_EQUAL(1, alsaLoop->arg_default_wake_timer);
+
+    ret = testLoop.setTimerWakeup(false);
+    CHECK_EQUAL(2, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, SetHwParamsCacheAndConnect)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.setHwParamsCache("/tmp/alsaloop.hwcache");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    AlsaLoop *alsaLoop = (AlsaLoop *)mock().getData("initConnection").getObjectPointer();
+    STRCMP_EQUAL("/tmp/alsaloop.hwcache", alsaLoop->arg_default_hwcache);
+
+    ret = testLoop.setHwParamsCache("");
+    CHECK_EQUAL(2, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, SetDriftProfileAndConnect)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.setDriftProfile("/tmp/alsaloop.drift");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    AlsaLoop *alsaLoop = (AlsaLoop *)mock().getData("initConnection").getObjectPointer();
+    STRCMP_EQUAL("/tmp/alsaloop.drift", alsaLoop->arg_default_drift);
+
+    ret = testLoop.setDriftProfile("");
+    CHECK_EQUAL(2, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, GetMemoryFootprint)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+    mock().expectOneCall("memoryFootprint").andReturnValue((unsigned long)1048576);
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    CHECK_EQUAL(0, testLoop.getMemoryFootprint());
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    CHECK_EQUAL(1048576, testLoop.getMemoryFootprint());
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, ChangeParameterWhileConnected)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+    mock().expectOneCall("postCommand").withIntParameter("type", LOOP_CMD_LATENCY).withDoubleParameter("value", 20000);
+    mock().expectOneCall("postCommand").withIntParameter("type", LOOP_CMD_XRUN).withDoubleParameter("value", 1);
+    mock().expectOneCall("postCommand").withIntParameter("type", LOOP_CMD_SYNC).withDoubleParameter("value", SYNC_TYPE_SIMPLE).andReturnValue(-EAGAIN);
+    mock().expectOneCall("postCommand").withIntParameter("type", LOOP_CMD_GAIN).withDoubleParameter("value", 0.5);
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.changeParameter(LOOP_CMD_LATENCY, 20000);
+    CHECK_EQUAL(1, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.changeParameter(LOOP_CMD_LATENCY, 20000);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.changeParameter(LOOP_CMD_XRUN, 1);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.changeParameter(LOOP_CMD_SYNC, SYNC_TYPE_SIMPLE);
+    CHECK_EQUAL(-1, ret);
+
+    //Mixer kullanılmayan bağlantıda yazılım kazancı değişir.
+    ret = testLoop.changeParameter(LOOP_CMD_GAIN, 0.5);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.changeParameter(LOOP_CMD_GAIN, 100);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.changeParameter(LOOP_CMD_LATENCY, 0);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, DisconnectWithFadeOut)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    CHECK_EQUAL(0, testLoop.getDisconnectLatency());
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.disconnect(20);
+    CHECK_EQUAL(0, ret);
+
+    CHECK(testLoop.getDisconnectLatency() >= 0);
+    CHECK_FALSE(testLoop.isLoopConnected());
+}
+
+TEST(loopDevTest, ConnectAsyncAndWait)
+{
+    int ret = 0;
+    int callbackResult = 1;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+    mock().expectOneCall("waitReady").andReturnValue(0);
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    std::future<int> result = testLoop.connectAsync(std::vector<std::string>(1, "hw:2,0"),
+                                                    [&callbackResult](int err) { callbackResult = err; });
+    ret = result.get();
+    CHECK_EQUAL(0, ret);
+    CHECK_EQUAL(0, callbackResult);
+
+    //Bağlı loop cihazı için future hemen sonuçlanır.
+    ret = testLoop.connectAsync(std::vector<std::string>(1, "hw:3,0")).get();
+    CHECK_EQUAL(2, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, ConnectManyInParallel)
+{
+    int ret = 0;
+    long bringUpTime = -1;
+    std::vector<int> results;
+
+    mock().expectNCalls(2, "clearQuit");
+    mock().expectNCalls(2, "snd_output_stdio_attach").andReturnValue(0);
+    mock().expectNCalls(2, "initConnection").andReturnValue(true);
+    mock().expectNCalls(2, "sortThreads");
+    mock().expectNCalls(2, "runThreads");
+    mock().expectNCalls(2, "waitOpened").andReturnValue(0);
+    mock().expectNCalls(2, "openGate");
+    mock().expectNCalls(2, "waitReady").andReturnValue(0);
+
+    mock().expectNCalls(2, "setQuit");
+    mock().expectNCalls(2, "joinFromThreads");
+    mock().expectNCalls(2, "freeThreads");
+
+    LoopDev testLoop;
+    LoopDev testLoop2;
+    std::vector<LoopDev *> loops = {&testLoop, &testLoop2};
+    std::vector<std::string> realDevList = {"hw:2,0", "hw:3,0"};
+
+    ret = LoopDev::connectMany(loops, std::vector<std::string>(1, "hw:2,0"), results);
+    CHECK_EQUAL(-1, ret);
+
+    ret = LoopDev::connectMany(loops, realDevList, results, &bringUpTime);
+    CHECK_EQUAL(0, ret);
+    CHECK_EQUAL(2, results.size());
+    CHECK_EQUAL(0, results[0]);
+    CHECK_EQUAL(0, results[1]);
+    CHECK(bringUpTime >= 0);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop2.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, SetWarmPoolAndGetStats)
+{
+    int ret = 0;
+    struct loopback_pool_stats stats;
+    struct loopback_pool_stats poolStats;
+
+    memset(&poolStats, 0, sizeof(poolStats));
+    poolStats.hits = 3;
+    poolStats.misses = 1;
+    poolStats.saved_time = 45000;
+
+    mock().expectOneCall("configPool").withUnsignedIntParameter("ttl_ms", 30000).withIntParameter("keep_params", 1);
+    mock().expectOneCall("configPool").withUnsignedIntParameter("ttl_ms", 0).withIntParameter("keep_params", 0);
+    mock().expectOneCall("poolStats").withOutputParameterReturning("stats", &poolStats, sizeof(poolStats));
+
+    LoopDev testLoop;
+
+    ret = testLoop.setWarmPool(30000);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.setWarmPool(7200000);
+    CHECK_EQUAL(-1, ret);
+
+    DOUBLES_EQUAL(0.75, testLoop.getWarmPoolStats(stats), 0.0001);
+    CHECK_EQUAL(45000, stats.saved_time);
+
+    ret = testLoop.setWarmPool(0, false);
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, SetIdleParkingAndGetStats)
+{
+    int ret = 0;
+    struct loopback_park_stats stats;
+    struct loopback_park_stats parkStats;
+
+    memset(&parkStats, 0, sizeof(parkStats));
+    parkStats.parks = 2;
+    parkStats.idle_wakeups = 4;
+    parkStats.resume_latency = 1500;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+    mock().expectOneCall("parkStats").withOutputParameterReturning("stats", &parkStats, sizeof(parkStats));
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    CHECK_FALSE(testLoop.getIdleStats(stats));
+
+    ret = testLoop.setIdleParking(true, 500, 50);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.setIdleParking(false);
+    CHECK_EQUAL(2, ret);
+
+    CHECK_TRUE(testLoop.getIdleStats(stats));
+    CHECK_EQUAL(2, stats.parks);
+    CHECK_EQUAL(1500, stats.resume_latency);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, SetSoftGain)
+{
+    int ret = 0;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.setSoftGain(-1.0f);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setSoftGain(0.5f, 5000);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.setSoftGain(0.5f, 20);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.setSoftGain(1.0f);
+    CHECK_EQUAL(2, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+static void testDspProcess(void *priv, void *buf, unsigned int frames)
+{
+}
+
+TEST(loopDevTest, AddDspPluginAndGetStats)
+{
+    int ret = 0;
+    int i = 0;
+    struct loopback_dsp_ops ops;
+    struct loopback_dsp_ops noProcess;
+    struct loopback_dsp_stats stats;
+    struct loopback_dsp_stats dspStats;
+
+    memset(&ops, 0, sizeof(ops));
+    ops.name = "test";
+    ops.formats = 1U << KERNEL_FORMAT_S16;
+    ops.process = testDspProcess;
+    memset(&noProcess, 0, sizeof(noProcess));
+    memset(&dspStats, 0, sizeof(dspStats));
+    dspStats.calls = 10;
+    dspStats.frames = 480;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+    mock().expectOneCall("dspStats").withIntParameter("index", 0).withOutputParameterReturning("stats", &dspStats, sizeof(dspStats)).andReturnValue(true);
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    CHECK_FALSE(testLoop.getDspStats(0, stats));
+
+    ret = testLoop.addDspPlugin(&noProcess);
+    CHECK_EQUAL(-1, ret);
+
+    for (i = 0; i < LOOP_DSP_MAX; i++)
+    {
+        ret = testLoop.addDspPlugin(&ops);
+        CHECK_EQUAL(0, ret);
+    }
+
+    ret = testLoop.addDspPlugin(&ops);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.clearDspPlugins();
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.addDspPlugin(&ops);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.addDspPlugin(&ops);
+    CHECK_EQUAL(2, ret);
+
+    CHECK_TRUE(testLoop.getDspStats(0, stats));
+    CHECK_EQUAL(480, stats.frames);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, StartAndStopRecording)
+{
+    int ret = 0;
+    struct loopback_tap_stats stats;
+    struct loopback_tap_stats tapStats;
+
+    memset(&tapStats, 0, sizeof(tapStats));
+    tapStats.frames = 48000;
+    tapStats.dropped = 16;
+    tapStats.files = 1;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+    mock().expectOneCall("startTap").withIntParameter("stream", SND_PCM_STREAM_PLAYBACK).withStringParameter("path", "/tmp/loop").andReturnValue(0);
+    mock().expectOneCall("startTap").withIntParameter("stream", SND_PCM_STREAM_PLAYBACK).withStringParameter("path", "/tmp/loop").andReturnValue(-EBUSY);
+    mock().expectOneCall("tapStats").withIntParameter("stream", SND_PCM_STREAM_PLAYBACK).withOutputParameterReturning("stats", &tapStats, sizeof(tapStats)).andReturnValue(true);
+    mock().expectOneCall("stopTap").withIntParameter("stream", SND_PCM_STREAM_PLAYBACK).andReturnValue(0);
+    mock().expectOneCall("stopTap").withIntParameter("stream", SND_PCM_STREAM_CAPTURE).andReturnValue(-ENOENT);
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    ret = testLoop.startRecording(SND_PCM_STREAM_PLAYBACK, "/tmp/loop");
+    CHECK_EQUAL(1, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.startRecording(SND_PCM_STREAM_PLAYBACK, "");
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.startRecording(SND_PCM_STREAM_PLAYBACK, "/tmp/loop");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.startRecording(SND_PCM_STREAM_PLAYBACK, "/tmp/loop");
+    CHECK_EQUAL(-1, ret);
+
+    CHECK_TRUE(testLoop.getRecordingStats(SND_PCM_STREAM_PLAYBACK, stats));
+    CHECK_EQUAL(16, stats.dropped);
+
+    ret = testLoop.stopRecording(SND_PCM_STREAM_PLAYBACK);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.stopRecording(SND_PCM_STREAM_CAPTURE);
+    CHECK_EQUAL(-1, ret);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}
+
+TEST(loopDevTest, SetSilenceBypassAndGetStats)
+{
+    int ret = 0;
+    struct loopback_silence_stats stats;
+    struct loopback_silence_stats silenceStats;
+
+    memset(&silenceStats, 0, sizeof(silenceStats));
+    silenceStats.entries = 1;
+    silenceStats.frames = 48000;
+    silenceStats.bypass_ns = 1000000;
+    silenceStats.work_frames = 48000;
+    silenceStats.work_ns = 5000000;
+
+    mock().expectOneCall("clearQuit");
+    mock().expectOneCall("snd_output_stdio_attach").andReturnValue(0);
+    mock().expectOneCall("initConnection").andReturnValue(true);
+    mock().expectOneCall("sortThreads");
+    mock().expectOneCall("runThreads");
+    mock().expectOneCall("silenceStats").withOutputParameterReturning("stats", &silenceStats, sizeof(silenceStats));
+
+    mock().expectOneCall("setQuit");
+    mock().expectOneCall("joinFromThreads");
+    mock().expectOneCall("freeThreads");
+
+    LoopDev testLoop;
+
+    CHECK_EQUAL(0, testLoop.getSilenceStats(stats));
+
+    ret = testLoop.setSilenceBypass(100);
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.connect("hw:2,0");
+    CHECK_EQUAL(0, ret);
+
+    ret = testLoop.setSilenceBypass(0);
+    CHECK_EQUAL(2, ret);
+
+    CHECK_EQUAL(4000, testLoop.getSilenceStats(stats));
+    CHECK_EQUAL(48000, stats.frames);
+
+    ret = testLoop.disconnect();
+    CHECK_EQUAL(0, ret);
+}